@@ -92,6 +92,15 @@
 #define VSYNC_GPIO_NUM    25
 #define HREF_GPIO_NUM     23
 #define PCLK_GPIO_NUM     22
+
+// microSD スロットを SPI モードで使うときのピン。SD のピンがない機種は SD の機能を使わない
+// (ほかの基板では build_flags で SD_*_GPIO_NUM を渡す)
+#ifndef SD_SCK_GPIO_NUM
+#define SD_SCK_GPIO_NUM   14
+#define SD_MISO_GPIO_NUM   2
+#define SD_MOSI_GPIO_NUM  15
+#define SD_CS_GPIO_NUM    13
+#endif
 #elif defined(CAMERA_MODEL_TIMER_CAM)
 #define PWDN_GPIO_NUM     -1
 #define RESET_GPIO_NUM    15
@@ -0,0 +1,280 @@
+#include "AviWriter.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(ARDUINO_ARCH_ESP32)
+#include "esp_heap_caps.h"
+#endif
+
+// ヘッダーの中で close() のときに書き直す位置
+static const uint32_t RIFF_SIZE_POS = 4;
+static const uint32_t AVIH_US_PER_FRAME_POS = 32;
+static const uint32_t AVIH_MAX_BYTES_PER_SEC_POS = 36;
+static const uint32_t AVIH_TOTAL_FRAMES_POS = 48;
+static const uint32_t AVIH_SUGGESTED_BUFFER_POS = 60;
+static const uint32_t STRH_SCALE_POS = 128;
+static const uint32_t STRH_RATE_POS = 132;
+static const uint32_t STRH_LENGTH_POS = 140;
+static const uint32_t STRH_SUGGESTED_BUFFER_POS = 144;
+static const uint32_t MOVI_SIZE_POS = 216;
+static const uint32_t MOVI_FOURCC_POS = 220;
+static const uint32_t HEADER_SIZE = 224;
+
+static const uint32_t AVIF_HASINDEX = 0x10;
+static const uint32_t AVIIF_KEYFRAME = 0x10;
+
+AviWriter::AviWriter()
+{
+}
+
+AviWriter::~AviWriter()
+{
+    release();
+}
+
+void AviWriter::release()
+{
+    free(buffer);
+    free(index);
+    buffer = nullptr;
+    index = nullptr;
+    sink = nullptr;
+}
+
+bool AviWriter::begin(AviSink *out, uint16_t width, uint16_t height, uint32_t maxFrames, size_t bufferBytes)
+{
+    release();
+    if (!out || !maxFrames || bufferBytes < HEADER_SIZE)
+    {
+        return false;
+    }
+    buffer = (uint8_t *)malloc(bufferBytes);
+#if defined(ARDUINO_ARCH_ESP32)
+    index = (IndexEntry *)heap_caps_malloc(maxFrames * sizeof(IndexEntry), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+#else
+    index = (IndexEntry *)malloc(maxFrames * sizeof(IndexEntry));
+#endif
+    if (!buffer || !index)
+    {
+        release();
+        return false;
+    }
+    sink = out;
+    bufferSize = bufferBytes;
+    buffered = 0;
+    filePos = 0;
+    failed = false;
+    maxIndex = maxFrames;
+    frames = 0;
+    largestFrame = 0;
+    w = width;
+    h = height;
+
+    // 大きさ・フレーム数は 0 にしておき close() で書き直す
+    putFourcc("RIFF");
+    put32(0);
+    putFourcc("AVI ");
+
+    putFourcc("LIST");
+    put32(4 + 64 + 12 + 64 + 48);
+    putFourcc("hdrl");
+    putFourcc("avih");
+    put32(56);
+    put32(0);             // dwMicroSecPerFrame
+    put32(0);             // dwMaxBytesPerSec
+    put32(0);             // dwPaddingGranularity
+    put32(AVIF_HASINDEX); // dwFlags
+    put32(0);             // dwTotalFrames
+    put32(0);             // dwInitialFrames
+    put32(1);             // dwStreams
+    put32(0);             // dwSuggestedBufferSize
+    put32(w);
+    put32(h);
+    for (int i = 0; i < 4; i++)
+    {
+        put32(0);
+    }
+
+    putFourcc("LIST");
+    put32(4 + 64 + 48);
+    putFourcc("strl");
+    putFourcc("strh");
+    put32(56);
+    putFourcc("vids");
+    putFourcc("MJPG");
+    put32(0);          // dwFlags
+    put32(0);          // wPriority, wLanguage
+    put32(0);          // dwInitialFrames
+    put32(1);          // dwScale
+    put32(1);          // dwRate
+    put32(0);          // dwStart
+    put32(0);          // dwLength
+    put32(0);          // dwSuggestedBufferSize
+    put32(0xFFFFFFFF); // dwQuality
+    put32(0);          // dwSampleSize
+    put32(0);          // rcFrame left, top
+    put32((uint32_t)h << 16 | w);
+
+    putFourcc("strf");
+    put32(40);
+    put32(40); // biSize
+    put32(w);
+    put32(h);
+    put32(24 << 16 | 1); // biPlanes, biBitCount
+    putFourcc("MJPG");
+    put32((uint32_t)w * h * 3);
+    for (int i = 0; i < 4; i++)
+    {
+        put32(0);
+    }
+
+    putFourcc("LIST");
+    put32(0);
+    putFourcc("movi");
+    return !failed && filePos == HEADER_SIZE;
+}
+
+bool AviWriter::writeFrame(const uint8_t *jpg, size_t len, uint32_t timestampMs)
+{
+    if (!sink || failed || frames >= maxIndex)
+    {
+        return false;
+    }
+    if (!frames)
+    {
+        firstMs = timestampMs;
+    }
+    lastMs = timestampMs;
+
+    index[frames].offset = filePos - MOVI_FOURCC_POS;
+    index[frames].size = (uint32_t)len;
+    putFourcc("00dc");
+    put32((uint32_t)len);
+    put(jpg, len);
+    if (len & 1)
+    {
+        uint8_t pad = 0;
+        put(&pad, 1); // チャンクは偶数バイトに揃える
+    }
+    if (len > largestFrame)
+    {
+        largestFrame = (uint32_t)len;
+    }
+    frames++;
+    return !failed;
+}
+
+bool AviWriter::close()
+{
+    if (!sink)
+    {
+        return false;
+    }
+    uint32_t moviEnd = filePos;
+    putFourcc("idx1");
+    put32(frames * 16);
+    for (uint32_t i = 0; i < frames; i++)
+    {
+        putFourcc("00dc");
+        put32(AVIIF_KEYFRAME);
+        put32(index[i].offset);
+        put32(index[i].size);
+    }
+    flush();
+
+    // 指定がなければ実際にかかった時間からフレームレートを決める (1フレームなら 1fps とする)
+    uint32_t us = playbackUsPerFrame;
+    if (!us)
+    {
+        us = frames > 1 ? (uint32_t)((uint64_t)(lastMs - firstMs) * 1000 / (frames - 1)) : 1000000;
+    }
+    if (!us)
+    {
+        us = 1;
+    }
+    uint32_t bytesPerSec = (uint32_t)((uint64_t)(largestFrame + 8) * 1000000 / us);
+
+    patch32(RIFF_SIZE_POS, filePos - 8);
+    patch32(AVIH_US_PER_FRAME_POS, us);
+    patch32(AVIH_MAX_BYTES_PER_SEC_POS, bytesPerSec);
+    patch32(AVIH_TOTAL_FRAMES_POS, frames);
+    patch32(AVIH_SUGGESTED_BUFFER_POS, largestFrame + 8);
+    patch32(STRH_SCALE_POS, us);
+    patch32(STRH_RATE_POS, 1000000);
+    patch32(STRH_LENGTH_POS, frames);
+    patch32(STRH_SUGGESTED_BUFFER_POS, largestFrame + 8);
+    patch32(MOVI_SIZE_POS, moviEnd - MOVI_FOURCC_POS);
+    sink->seek(filePos);
+
+    bool ok = !failed;
+    release();
+    return ok;
+}
+
+bool AviWriter::put(const uint8_t *data, size_t len)
+{
+    filePos += len;
+    while (len)
+    {
+        // バッファが空で1ブロック以上あるときはコピーせず直接書く (位置はブロック境界のまま)
+        if (!buffered && len >= bufferSize)
+        {
+            size_t direct = len - len % bufferSize;
+            if (sink->write(data, direct) != direct)
+            {
+                failed = true;
+                return false;
+            }
+            data += direct;
+            len -= direct;
+            continue;
+        }
+        size_t k = bufferSize - buffered;
+        if (k > len)
+        {
+            k = len;
+        }
+        memcpy(buffer + buffered, data, k);
+        buffered += k;
+        data += k;
+        len -= k;
+        if (buffered == bufferSize && !flush())
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool AviWriter::put32(uint32_t v)
+{
+    uint8_t b[4] = {(uint8_t)v, (uint8_t)(v >> 8), (uint8_t)(v >> 16), (uint8_t)(v >> 24)};
+    return put(b, 4);
+}
+
+bool AviWriter::putFourcc(const char *cc)
+{
+    return put((const uint8_t *)cc, 4);
+}
+
+bool AviWriter::flush()
+{
+    if (buffered && sink->write(buffer, buffered) != buffered)
+    {
+        failed = true;
+    }
+    buffered = 0;
+    return !failed;
+}
+
+bool AviWriter::patch32(uint32_t pos, uint32_t v)
+{
+    uint8_t b[4] = {(uint8_t)v, (uint8_t)(v >> 8), (uint8_t)(v >> 16), (uint8_t)(v >> 24)};
+    if (!sink->seek(pos) || sink->write(b, 4) != 4)
+    {
+        failed = true;
+        return false;
+    }
+    return true;
+}
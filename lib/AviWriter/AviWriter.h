@@ -0,0 +1,85 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(ARDUINO)
+#include <FS.h>
+#endif
+
+// AVI の書き込み先。録画中は write だけ、seek は close() でヘッダーを書き直すときだけ使う
+class AviSink
+{
+public:
+    virtual ~AviSink() {}
+    virtual size_t write(const uint8_t *data, size_t len) = 0;
+    virtual bool seek(uint32_t pos) = 0;
+};
+
+#if defined(ARDUINO)
+// SD / LittleFS のファイルに書く
+class FsAviSink : public AviSink
+{
+public:
+    explicit FsAviSink(fs::File &f) : file(f) {}
+    size_t write(const uint8_t *data, size_t len) override { return file.write(data, len); }
+    bool seek(uint32_t pos) override { return file.seek(pos); }
+
+private:
+    fs::File &file;
+};
+#endif
+
+// JPEG をそのまま並べた MJPEG の AVI を、届いたフレームから順に書いていく
+// 書き込みはクラスタの倍数の大きさの固定バッファにまとめてから出すので、ファイルにはクラスタ単位でしか書かない。
+// idx1 の索引はメモリに持っておき close() で書く。クリップ全体をメモリに溜めない。Arduino 以外でも使える
+// ファイルの先取り (preallocate) はしない。fs::File には領域だけを確保する口がなく (FatFs の f_expand は出ていない)、
+// 0 で埋めて確保すると同じ量を2回書くことになる。クラスタ単位でまとめて書けば FAT の更新はクラスタごとに1回で済むので、それで代える
+class AviWriter
+{
+public:
+    uint32_t playbackUsPerFrame = 0; // 再生時の1フレームの長さ。0 なら撮った間隔のまま (タイムラプスは固定にする)
+
+    AviWriter();
+    ~AviWriter();
+
+    // bufferBytes はクラスタ (SD なら 512 の倍数、FAT のクラスタは多くが 32KB) に合わせる
+    bool begin(AviSink *sink, uint16_t width, uint16_t height, uint32_t maxFrames, size_t bufferBytes = 16384);
+    bool writeFrame(const uint8_t *jpg, size_t len, uint32_t timestampMs);
+    // 索引を書き、ヘッダーのフレーム数・フレームレート・サイズを書き直す
+    bool close();
+
+    bool isOpen() const { return sink != nullptr; }
+    uint32_t frameCount() const { return frames; }
+    uint32_t bytesWritten() const { return filePos; }
+
+private:
+    struct IndexEntry
+    {
+        uint32_t offset; // "movi" からの位置
+        uint32_t size;
+    };
+
+    bool put(const uint8_t *data, size_t len);
+    bool put32(uint32_t v);
+    bool putFourcc(const char *cc);
+    bool flush();
+    bool patch32(uint32_t pos, uint32_t v);
+    void release();
+
+    AviSink *sink = nullptr;
+    uint8_t *buffer = nullptr;
+    size_t bufferSize = 0;
+    size_t buffered = 0;
+    uint32_t filePos = 0; // 書いた (バッファ分も含む) 位置
+    bool failed = false;
+
+    IndexEntry *index = nullptr;
+    uint32_t maxIndex = 0;
+    uint32_t frames = 0;
+    uint32_t largestFrame = 0;
+    uint32_t firstMs = 0;
+    uint32_t lastMs = 0;
+    uint16_t w = 0;
+    uint16_t h = 0;
+};
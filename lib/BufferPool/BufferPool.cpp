@@ -0,0 +1,159 @@
+#include "BufferPool.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(ARDUINO_ARCH_ESP32)
+#include "esp_heap_caps.h"
+#endif
+
+BufferPool::BufferPool()
+{
+}
+
+BufferPool::~BufferPool()
+{
+    end();
+}
+
+bool BufferPool::begin(const SizeClass *sizes, size_t n)
+{
+    end();
+    if (n > MAX_CLASSES)
+    {
+        return false;
+    }
+    for (size_t i = 0; i < n; i++)
+    {
+        Class &c = classes[i];
+        c.size = (sizes[i].size + 3) & ~(size_t)3;
+        c.count = sizes[i].count < MAX_BUFFERS_PER_CLASS ? sizes[i].count : MAX_BUFFERS_PER_CLASS;
+#if defined(ARDUINO_ARCH_ESP32)
+        c.base = (uint8_t *)heap_caps_malloc(c.size * c.count, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+#else
+        c.base = (uint8_t *)malloc(c.size * c.count);
+#endif
+        if (!c.base)
+        {
+            end();
+            return false;
+        }
+        for (size_t k = 0; k < c.count; k++)
+        {
+            c.freeList[k] = (uint8_t)k;
+        }
+        c.nFree = c.count;
+        nClasses = i + 1;
+    }
+    return true;
+}
+
+void BufferPool::end()
+{
+    for (size_t i = 0; i < nClasses; i++)
+    {
+        free(classes[i].base);
+    }
+    nClasses = 0;
+    nInUse = 0;
+}
+
+void BufferPool::lock()
+{
+#if defined(ARDUINO_ARCH_ESP32)
+    portENTER_CRITICAL(&mux);
+#endif
+}
+
+void BufferPool::unlock()
+{
+#if defined(ARDUINO_ARCH_ESP32)
+    portEXIT_CRITICAL(&mux);
+#endif
+}
+
+int BufferPool::classOf(const void *buf) const
+{
+    const uint8_t *p = (const uint8_t *)buf;
+    for (size_t i = 0; i < nClasses; i++)
+    {
+        const Class &c = classes[i];
+        if (p >= c.base && p < c.base + c.size * c.count)
+        {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+void *BufferPool::acquire(size_t size)
+{
+    void *buf = nullptr;
+    lock();
+    nAcquires++;
+    for (size_t i = 0; i < nClasses; i++)
+    {
+        Class &c = classes[i];
+        if (c.size >= size && c.nFree)
+        {
+            buf = c.base + c.freeList[--c.nFree] * c.size;
+            nInUse++;
+            if (nInUse > nHighWater)
+            {
+                nHighWater = nInUse;
+            }
+            break;
+        }
+    }
+    if (!buf)
+    {
+        nHeapAllocs++;
+    }
+    unlock();
+    if (!buf)
+    {
+#if defined(ARDUINO_ARCH_ESP32)
+        buf = heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+#else
+        buf = malloc(size);
+#endif
+    }
+    return buf;
+}
+
+void BufferPool::release(void *buf)
+{
+    if (!buf)
+    {
+        return;
+    }
+    lock();
+    int i = classOf(buf);
+    if (i >= 0)
+    {
+        Class &c = classes[i];
+        c.freeList[c.nFree++] = (uint8_t)(((uint8_t *)buf - c.base) / c.size);
+        nInUse--;
+    }
+    unlock();
+    if (i < 0)
+    {
+        free(buf);
+    }
+}
+
+size_t BufferPool::capacity(const void *buf) const
+{
+    int i = classOf(buf);
+    return i >= 0 ? classes[i].size : 0;
+}
+
+size_t BufferPool::reservedBytes() const
+{
+    size_t total = 0;
+    for (size_t i = 0; i < nClasses; i++)
+    {
+        total += classes[i].size * classes[i].count;
+    }
+    return total;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(ARDUINO_ARCH_ESP32)
+#include "freertos/FreeRTOS.h"
+#endif
+
+// 大きさ別の固定バッファを最初にまとめて (PSRAM に) 確保し、使い回すプール
+// クラスごとに1つの領域を等分し、空きは添字のスタックで持つので acquire / release は O(1)。
+// 空きがないとき・どのクラスにも入らないときはヒープから確保し、その回数を数える (定常状態で 0 になるべき値)
+class BufferPool
+{
+public:
+    static const size_t MAX_CLASSES = 4;
+    static const size_t MAX_BUFFERS_PER_CLASS = 8;
+
+    struct SizeClass
+    {
+        size_t size;
+        size_t count;
+    };
+
+    BufferPool();
+    ~BufferPool();
+
+    // classes は小さい順に並べる
+    bool begin(const SizeClass *classes, size_t nClasses);
+    void end();
+
+    void *acquire(size_t size);
+    void release(void *buf);
+    // buf が入っているバッファの大きさ (ヒープから確保したものは 0)
+    size_t capacity(const void *buf) const;
+
+    uint32_t acquires() const { return nAcquires; }
+    uint32_t heapAllocations() const { return nHeapAllocs; } // プールに入らなかった回数
+    size_t inUse() const { return nInUse; }
+    size_t highWater() const { return nHighWater; }
+    size_t reservedBytes() const;
+
+private:
+    struct Class
+    {
+        uint8_t *base;
+        size_t size;
+        size_t count;
+        uint8_t freeList[MAX_BUFFERS_PER_CLASS]; // 空いているバッファの添字
+        size_t nFree;
+    };
+
+    int classOf(const void *buf) const;
+    void lock();
+    void unlock();
+
+    Class classes[MAX_CLASSES];
+    size_t nClasses = 0;
+    uint32_t nAcquires = 0;
+    uint32_t nHeapAllocs = 0;
+    size_t nInUse = 0;
+    size_t nHighWater = 0;
+#if defined(ARDUINO_ARCH_ESP32)
+    portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
+#endif
+};
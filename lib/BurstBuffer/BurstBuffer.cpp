@@ -0,0 +1,84 @@
+#include "BurstBuffer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(ARDUINO_ARCH_ESP32)
+#include "esp_heap_caps.h"
+#endif
+
+BurstBuffer::BurstBuffer()
+{
+}
+
+BurstBuffer::~BurstBuffer()
+{
+    end();
+}
+
+bool BurstBuffer::begin(size_t arenaBytes)
+{
+    end();
+#if defined(ARDUINO_ARCH_ESP32)
+    arena = (uint8_t *)heap_caps_malloc(arenaBytes, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+#else
+    arena = (uint8_t *)malloc(arenaBytes);
+#endif
+    if (!arena)
+    {
+        return false;
+    }
+    arenaSize = arenaBytes;
+    reset();
+    return true;
+}
+
+void BurstBuffer::end()
+{
+    free(arena);
+    arena = nullptr;
+    arenaSize = 0;
+    reset();
+}
+
+void BurstBuffer::reset()
+{
+    usedBytes = 0;
+    n = 0;
+}
+
+bool BurstBuffer::append(const uint8_t *jpg, size_t len, uint32_t timestampMs)
+{
+    if (!arena || n >= MAX_FRAMES || len > arenaSize - usedBytes)
+    {
+        return false;
+    }
+    memcpy(arena + usedBytes, jpg, len);
+    Frame &f = frames[n++];
+    f.offset = (uint32_t)usedBytes;
+    f.len = (uint32_t)len;
+    f.timestampMs = timestampMs;
+    usedBytes += len;
+    return true;
+}
+
+size_t BurstBuffer::formatLengths(char *out, size_t outSize) const
+{
+    size_t pos = 0;
+    if (outSize)
+    {
+        out[0] = '\0';
+    }
+    for (size_t i = 0; i < n; i++)
+    {
+        int k = snprintf(out + pos, outSize - pos, i ? ",%u" : "%u", (unsigned)frames[i].len);
+        if (k < 0 || (size_t)k >= outSize - pos)
+        {
+            out[pos] = '\0'; // 途中で切れた数字は残さない
+            break;
+        }
+        pos += k;
+    }
+    return pos;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// 連写した JPEG を、最初に確保した1つの領域 (PSRAM) に隙間なく詰めていく
+// フレームごとの malloc をしないので、連写中に確保に失敗したり断片化したりしない。
+// 詰めた領域はそのまま1回の POST の本文にできる
+class BurstBuffer
+{
+public:
+    static const size_t MAX_FRAMES = 64;
+
+    struct Frame
+    {
+        uint32_t offset;
+        uint32_t len;
+        uint32_t timestampMs;
+    };
+
+    BurstBuffer();
+    ~BurstBuffer();
+
+    bool begin(size_t arenaBytes);
+    void end();
+
+    void reset();
+    // 入りきらなければ false (そのフレームは落とす)
+    bool append(const uint8_t *jpg, size_t len, uint32_t timestampMs);
+
+    size_t frameCount() const { return n; }
+    const Frame &frame(size_t i) const { return frames[i]; }
+    const uint8_t *data() const { return arena; }
+    size_t used() const { return usedBytes; }
+    size_t capacity() const { return arenaSize; }
+
+    // "len,len,..." を書く (POST のヘッダー用)。書いた長さを返す
+    size_t formatLengths(char *out, size_t outSize) const;
+
+private:
+    uint8_t *arena = nullptr;
+    size_t arenaSize = 0;
+    size_t usedBytes = 0;
+    Frame frames[MAX_FRAMES];
+    size_t n = 0;
+};
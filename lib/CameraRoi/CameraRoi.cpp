@@ -0,0 +1,144 @@
+#include "CameraRoi.h"
+
+#include <Preferences.h>
+#include "sensor.h"
+
+#if defined(ARDUINO_ARCH_ESP32) && defined(CONFIG_ARDUHAL_ESP_LOG)
+#include "esp32-hal-log.h"
+#endif
+
+static const char *ROI_NAMESPACE = "camera";
+static const char *ROI_KEY = "roi";
+static CameraRoi currentRoi = {0, 0, 1000, 1000};
+
+// センサーのフル解像度モードの窓 (esp32-camera の ratio_table の 4:3 の行)
+struct SensorWindow
+{
+    uint16_t width;
+    uint16_t height;
+    uint16_t endMarginX; // ex - sx - width
+    uint16_t endMarginY;
+    uint16_t offsetX;
+    uint16_t offsetY;
+    uint16_t totalX;
+    uint16_t totalY;
+};
+
+static const SensorWindow OV3660_FULL = {2048, 1536, 31, 11, 16, 6, 2300, 1564};
+static const SensorWindow OV5640_FULL = {2560, 1920, 63, 31, 32, 16, 2844, 1968};
+
+static uint16_t alignDown(uint32_t v, uint16_t a)
+{
+    return (uint16_t)(v / a * a);
+}
+
+bool cameraRoiLoad(CameraRoi *roi)
+{
+    Preferences prefs;
+    if (!prefs.begin(ROI_NAMESPACE, true))
+    {
+        return false;
+    }
+    CameraRoi r;
+    bool ok = prefs.getBytes(ROI_KEY, &r, sizeof(r)) == sizeof(r) && r.valid();
+    prefs.end();
+    if (ok)
+    {
+        *roi = r;
+        currentRoi = r;
+    }
+    return ok;
+}
+
+bool cameraRoiSave(const CameraRoi &roi)
+{
+    if (!roi.valid())
+    {
+        return false;
+    }
+    Preferences prefs;
+    if (!prefs.begin(ROI_NAMESPACE, false))
+    {
+        return false;
+    }
+    bool ok = prefs.putBytes(ROI_KEY, &roi, sizeof(roi)) == sizeof(roi);
+    prefs.end();
+    if (ok)
+    {
+        currentRoi = roi;
+    }
+    return ok;
+}
+
+void cameraRoiClear()
+{
+    Preferences prefs;
+    if (prefs.begin(ROI_NAMESPACE, false))
+    {
+        prefs.remove(ROI_KEY);
+        prefs.end();
+    }
+    currentRoi = {0, 0, 1000, 1000};
+}
+
+const CameraRoi &cameraRoiCurrent()
+{
+    return currentRoi;
+}
+
+int cameraRoiApply(sensor_t *s, const CameraRoi &roi)
+{
+    if (!s || !roi.valid())
+    {
+        return -1;
+    }
+    framesize_t fs = s->status.framesize;
+    if (roi.full())
+    {
+        return s->set_framesize(s, fs); // 窓を標準に戻す
+    }
+
+    // 出力サイズは今の解像度を ROI の割合で縮めたもの (JPEG の MCU 16x8 に揃える)
+    uint16_t outW = alignDown((uint32_t)resolution[fs].width * roi.w / 1000, 16);
+    uint16_t outH = alignDown((uint32_t)resolution[fs].height * roi.h / 1000, 8);
+    if (outW < 16 || outH < 8)
+    {
+        return -1;
+    }
+
+    int res;
+    if (s->id.PID == OV2640_PID)
+    {
+        // OV2640 は startX がセンサーモード (0 = UXGA)、offset/total が切り出し窓
+        uint16_t wx = alignDown((uint32_t)1600 * roi.x / 1000, 4);
+        uint16_t wy = alignDown((uint32_t)1200 * roi.y / 1000, 4);
+        uint16_t ww = alignDown((uint32_t)1600 * roi.w / 1000, 4);
+        uint16_t wh = alignDown((uint32_t)1200 * roi.h / 1000, 4);
+        if (outW > ww)
+        {
+            outW = alignDown(ww, 16);
+        }
+        if (outH > wh)
+        {
+            outH = alignDown(wh, 8);
+        }
+        res = s->set_res_raw(s, 0, 0, 0, 0, wx, wy, ww, wh, outW, outH, false, false);
+    }
+    else if (s->id.PID == OV3660_PID || s->id.PID == OV5640_PID)
+    {
+        const SensorWindow &win = s->id.PID == OV3660_PID ? OV3660_FULL : OV5640_FULL;
+        uint16_t sx = alignDown((uint32_t)win.width * roi.x / 1000, 2);
+        uint16_t sy = alignDown((uint32_t)win.height * roi.y / 1000, 2);
+        uint16_t ww = alignDown((uint32_t)win.width * roi.w / 1000, 2);
+        uint16_t wh = alignDown((uint32_t)win.height * roi.h / 1000, 2);
+        res = s->set_res_raw(s, sx, sy, sx + ww + win.endMarginX, sy + wh + win.endMarginY, win.offsetX, win.offsetY, win.totalX, win.totalY, outW, outH,
+                             outW != ww || outH != wh, false);
+    }
+    else
+    {
+        log_e("ROI is not supported on this sensor (PID 0x%x)", s->id.PID);
+        return -1;
+    }
+    log_i("ROI %u,%u %ux%u -> output %ux%u", roi.x, roi.y, roi.w, roi.h, outW, outH);
+    return res;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stdint.h>
+#include "esp_camera.h"
+
+// 撮影範囲 (水槽の部分だけを撮る)。センサー全体に対する千分率で持つので、解像度を変えても同じ範囲になる
+struct CameraRoi
+{
+    uint16_t x;
+    uint16_t y;
+    uint16_t w;
+    uint16_t h;
+
+    bool valid() const { return w > 0 && h > 0 && x + w <= 1000 && y + h <= 1000; }
+    bool full() const { return x == 0 && y == 0 && w == 1000 && h == 1000; }
+};
+
+// NVS に保存・読み出しする
+bool cameraRoiLoad(CameraRoi *roi);
+bool cameraRoiSave(const CameraRoi &roi);
+void cameraRoiClear();
+
+// 今の framesize を基準に、ROI だけを出力するようにセンサーの窓を設定する
+// set_framesize で窓が戻るので、解像度を変えたら呼び直す。0 なら成功
+int cameraRoiApply(sensor_t *s, const CameraRoi &roi);
+
+// 現在有効な ROI (未設定なら全体)
+const CameraRoi &cameraRoiCurrent();
@@ -0,0 +1,334 @@
+#include "CameraService.h"
+
+#if defined(ARDUINO_ARCH_ESP32) && defined(CONFIG_ARDUHAL_ESP_LOG)
+#include "esp32-hal-log.h"
+#endif
+
+static uint32_t nowMs()
+{
+    return (uint32_t)(xTaskGetTickCount() * portTICK_PERIOD_MS);
+}
+
+static const uint32_t IDLE_WAIT_MS = 1000;
+
+int CameraService::chooseFramesize(const Pending *pending, size_t n, int current)
+{
+    // 一番長く待っている受け手に合わせる。それが今の解像度で足りるなら切り替えない
+    const Pending *oldest = nullptr;
+    for (size_t i = 0; i < n; i++)
+    {
+        if (!oldest || (int32_t)(pending[i].waitingSince - oldest->waitingSince) < 0)
+        {
+            oldest = &pending[i];
+        }
+    }
+    if (!oldest || oldest->framesize == ANY_FRAMESIZE || oldest->framesize == current)
+    {
+        return current;
+    }
+    return oldest->framesize;
+}
+
+bool CameraService::begin(UBaseType_t priority, int core, uint32_t stackBytes)
+{
+    mutex = xSemaphoreCreateMutex();
+    configLock = xSemaphoreCreateMutex();
+    configDone = xSemaphoreCreateBinary();
+    if (!mutex || !configLock || !configDone)
+    {
+        return false;
+    }
+    sensor_t *s = esp_camera_sensor_get();
+    current = s ? (int)s->status.framesize : ANY_FRAMESIZE;
+    return xTaskCreatePinnedToCore(taskEntry, "camera", stackBytes, this, priority, &task, core) == pdPASS;
+}
+
+int CameraService::addConsumer(const char *name, int framesize, uint32_t minIntervalMs)
+{
+    SemaphoreHandle_t ready = xSemaphoreCreateBinary();
+    if (!ready)
+    {
+        return -1;
+    }
+    lock();
+    if (nConsumers >= MAX_CONSUMERS)
+    {
+        unlock();
+        vSemaphoreDelete(ready);
+        return -1;
+    }
+    int id = (int)nConsumers++;
+    Consumer &c = consumers[id];
+    c.name = name;
+    c.framesize = framesize;
+    c.minIntervalMs = minIntervalMs;
+    c.waitingSince = 0;
+    c.lastServed = 0;
+    c.waiting = false;
+    c.served = false;
+    c.holding = false;
+    c.frame = nullptr;
+    c.ready = ready;
+    unlock();
+    return id;
+}
+
+void CameraService::setFramesize(int id, int framesize)
+{
+    lock();
+    consumers[id].framesize = framesize;
+    unlock();
+}
+
+void CameraService::setInterval(int id, uint32_t minIntervalMs)
+{
+    lock();
+    consumers[id].minIntervalMs = minIntervalMs;
+    unlock();
+}
+
+void CameraService::wake()
+{
+    xTaskNotifyGive(task);
+}
+
+camera_fb_t *CameraService::acquire(int id, uint32_t timeoutMs)
+{
+    if (!task)
+    {
+        return nullptr;
+    }
+    release(id);
+    Consumer &c = consumers[id];
+    lock();
+    c.waiting = true;
+    c.waitingSince = nowMs();
+    unlock();
+    wake();
+
+    bool got = xSemaphoreTake(c.ready, pdMS_TO_TICKS(timeoutMs)) == pdTRUE;
+    lock();
+    if (!got && c.waiting)
+    {
+        c.waiting = false; // 諦める。まだ配られていないので取り消すだけ
+        unlock();
+        return nullptr;
+    }
+    unlock();
+    if (!got)
+    {
+        // 待ち切った直後に配られていた。合図を読み捨てて受け取る
+        xSemaphoreTake(c.ready, 0);
+    }
+    return c.frame;
+}
+
+void CameraService::release(int id)
+{
+    Consumer &c = consumers[id];
+    lock();
+    bool released = c.holding;
+    if (released)
+    {
+        c.holding = false;
+        c.frame = nullptr;
+        outstandingRefs--;
+    }
+    unlock();
+    if (released)
+    {
+        wake();
+    }
+}
+
+esp_err_t CameraService::configure(ConfigureFn fn, void *arg, int *result, uint32_t timeoutMs)
+{
+    int res = 0;
+    esp_err_t err = ESP_OK;
+    if (!task)
+    {
+        sensor_t *s = esp_camera_sensor_get();
+        if (!s)
+        {
+            return ESP_FAIL;
+        }
+        res = fn(s, arg);
+    }
+    else
+    {
+        TickType_t start = xTaskGetTickCount();
+        TickType_t timeout = pdMS_TO_TICKS(timeoutMs);
+        if (xSemaphoreTake(configLock, timeout) != pdTRUE)
+        {
+            return ESP_ERR_TIMEOUT;
+        }
+        lock();
+        configFn = fn;
+        configArg = arg;
+        unlock();
+        wake();
+        TickType_t elapsed = xTaskGetTickCount() - start;
+        if (xSemaphoreTake(configDone, elapsed < timeout ? timeout - elapsed : 0) != pdTRUE)
+        {
+            lock();
+            bool started = !configFn;
+            configFn = nullptr;
+            unlock();
+            if (!started)
+            {
+                // まだ取りかかっていないので取り消す
+                xSemaphoreGive(configLock);
+                return ESP_ERR_TIMEOUT;
+            }
+            xSemaphoreTake(configDone, portMAX_DELAY);
+        }
+        res = configResult;
+        err = configStatus;
+        xSemaphoreGive(configLock);
+    }
+    if (result && err == ESP_OK)
+    {
+        *result = res;
+    }
+    return err;
+}
+
+bool CameraService::eligible(const Consumer &c, uint32_t now, uint32_t *waitMs) const
+{
+    if (!c.waiting)
+    {
+        return false;
+    }
+    uint32_t elapsed = now - c.lastServed;
+    if (!c.served || elapsed >= c.minIntervalMs)
+    {
+        return true;
+    }
+    uint32_t remaining = c.minIntervalMs - elapsed;
+    if (remaining < *waitMs)
+    {
+        *waitMs = remaining;
+    }
+    return false;
+}
+
+void CameraService::taskEntry(void *arg)
+{
+    ((CameraService *)arg)->run();
+}
+
+void CameraService::run()
+{
+    for (;;)
+    {
+        lock();
+        if (outstanding && !outstandingRefs)
+        {
+            esp_camera_fb_return(outstanding);
+            outstanding = nullptr;
+        }
+        if (outstanding)
+        {
+            // 配ったフレームが全部返るまでは撮れない (fb_count = 1) し、センサーも触らない
+            unlock();
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            continue;
+        }
+        if (configFn)
+        {
+            ConfigureFn fn = configFn;
+            configFn = nullptr;
+            unlock();
+            sensor_t *s = esp_camera_sensor_get();
+            configStatus = s ? ESP_OK : ESP_FAIL;
+            if (s)
+            {
+                configResult = fn(s, configArg);
+                current = (int)s->status.framesize;
+                nConfigurations++;
+            }
+            xSemaphoreGive(configDone);
+            continue;
+        }
+
+        uint32_t now = nowMs();
+        uint32_t waitMs = IDLE_WAIT_MS;
+        Pending pending[MAX_CONSUMERS];
+        size_t n = 0;
+        for (size_t i = 0; i < nConsumers; i++)
+        {
+            if (eligible(consumers[i], now, &waitMs))
+            {
+                pending[n].framesize = consumers[i].framesize;
+                pending[n].waitingSince = consumers[i].waitingSince;
+                n++;
+            }
+        }
+        unlock();
+        if (!n)
+        {
+            ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(waitMs));
+            continue;
+        }
+
+        sensor_t *s = esp_camera_sensor_get();
+        int framesize = chooseFramesize(pending, n, (int)s->status.framesize);
+        if (framesize != (int)s->status.framesize)
+        {
+            s->set_framesize(s, (framesize_t)framesize);
+            if (onFramesizeChanged)
+            {
+                onFramesizeChanged(s);
+            }
+            nReconfigurations++;
+            for (uint32_t i = 0; i < settleFrames; i++)
+            {
+                camera_fb_t *fb = esp_camera_fb_get();
+                if (fb)
+                {
+                    esp_camera_fb_return(fb);
+                }
+            }
+        }
+        current = framesize;
+        camera_fb_t *fb = esp_camera_fb_get();
+        if (!fb)
+        {
+            log_e("Camera capture failed");
+            nFailures++;
+        }
+
+        // 撮っている間に来た受け手も、解像度が合えば同じフレームを受け取る。撮れなかったときは NULL を配る
+        lock();
+        now = nowMs();
+        uint32_t delivered = 0;
+        for (size_t i = 0; i < nConsumers; i++)
+        {
+            Consumer &c = consumers[i];
+            uint32_t unused = IDLE_WAIT_MS;
+            if (!eligible(c, now, &unused) || (c.framesize != ANY_FRAMESIZE && c.framesize != framesize))
+            {
+                continue;
+            }
+            c.waiting = false;
+            c.frame = fb;
+            c.holding = fb != nullptr;
+            c.served = true;
+            c.lastServed = now;
+            delivered++;
+            xSemaphoreGive(c.ready);
+        }
+        if (fb && delivered)
+        {
+            outstanding = fb;
+            outstandingRefs = delivered;
+            nFrames++;
+            nShared += delivered - 1;
+        }
+        else if (fb)
+        {
+            esp_camera_fb_return(fb); // 待っていた受け手が諦めた
+        }
+        unlock();
+    }
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_camera.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+// カメラのドライバを持つ唯一の窓口。esp_camera_fb_get とセンサーの設定はこのクラスのタスクだけが呼ぶ
+// 受け手 (consumer) は名前・欲しい解像度・最短の間隔を登録し、acquire() でフレームを待つ。
+// 待っている受け手のうち一番長く待っているものの解像度で撮り、同じ解像度 (か「どれでもよい」) で待っている受け手には
+// 同じフレームを配る (読み取り専用、全員が release() したらドライバに返す)。今の解像度で足りるなら切り替えないので、
+// 解像度を変えるのは違う解像度の受け手が先頭に来たときだけになる
+// センサーの設定は configure() に関数を渡し、フレームを誰も持っていない間にこのタスクの中で実行する
+class CameraService
+{
+public:
+    static const size_t MAX_CONSUMERS = 8;
+    static const int ANY_FRAMESIZE = -1;
+    // 配ったフレームが返るまでセンサーは触れないので、ストリームが1枚を長く持つと待たされる
+    static const uint32_t CONFIGURE_TIMEOUT_MS = 3000;
+
+    typedef int (*ConfigureFn)(sensor_t *s, void *arg);
+
+    // 解像度を変えた直後に捨てるフレームの数 (切り替え前の設定で撮れているものと、露出が落ち着く前のもの)
+    uint32_t settleFrames = 1;
+    // 解像度を変えたあとに呼ぶ (set_framesize で戻る窓を掛け直すなど)
+    void (*onFramesizeChanged)(sensor_t *s) = nullptr;
+
+    // esp_camera_init の後で呼ぶ。これより前のセンサーの設定は呼んだ側が直接してよい
+    bool begin(UBaseType_t priority, int core, uint32_t stackBytes = 4096);
+
+    // 登録して ID を返す。いっぱいなら -1
+    int addConsumer(const char *name, int framesize = ANY_FRAMESIZE, uint32_t minIntervalMs = 0);
+    void setFramesize(int id, int framesize);
+    void setInterval(int id, uint32_t minIntervalMs);
+
+    // 次のフレームを待つ。撮れなかったとき・timeoutMs を過ぎたときは NULL。
+    // どちらだったかは captureFailures() が増えたかでわかる
+    // 前に受け取ったフレームをまだ持っていたら先に返す (受け手ごとに持てるのは1枚)
+    camera_fb_t *acquire(int id, uint32_t timeoutMs);
+    void release(int id);
+
+    // fn(sensor, arg) をカメラのタスクで実行し、終わるまで待つ。fn の戻り値は result に入れる (NULL なら捨てる)。
+    // センサーがなければ ESP_FAIL、timeoutMs までに始まらなければ ESP_ERR_TIMEOUT を返し、どちらも fn は呼ばない。
+    // 始まったあとは終わるまで待つ (arg は呼んだ側のスタックにあることが多い)
+    esp_err_t configure(ConfigureFn fn, void *arg, int *result = nullptr, uint32_t timeoutMs = CONFIGURE_TIMEOUT_MS);
+
+    // 最後に撮った解像度
+    int currentFramesize() const { return current; }
+    uint32_t frames() const { return nFrames; }
+    uint32_t reconfigurations() const { return nReconfigurations; }
+    uint32_t sharedDeliveries() const { return nShared; } // 2人目以降に同じフレームを配った回数
+    uint32_t configurations() const { return nConfigurations; }
+    uint32_t captureFailures() const { return nFailures; } // esp_camera_fb_get が NULL を返した回数
+
+    // 待っている受け手から次に撮る解像度を選ぶ (テスト用に公開)
+    struct Pending
+    {
+        int framesize;
+        uint32_t waitingSince;
+    };
+    static int chooseFramesize(const Pending *pending, size_t n, int current);
+
+private:
+    struct Consumer
+    {
+        const char *name;
+        int framesize;
+        uint32_t minIntervalMs;
+        uint32_t waitingSince;
+        uint32_t lastServed;
+        bool waiting;
+        bool served;
+        bool holding;
+        camera_fb_t *frame;
+        SemaphoreHandle_t ready;
+    };
+
+    static void taskEntry(void *arg);
+    void run();
+    bool eligible(const Consumer &c, uint32_t now, uint32_t *waitMs) const;
+    void lock() { xSemaphoreTake(mutex, portMAX_DELAY); }
+    void unlock() { xSemaphoreGive(mutex); }
+    void wake();
+
+    Consumer consumers[MAX_CONSUMERS];
+    size_t nConsumers = 0;
+    SemaphoreHandle_t mutex = nullptr;
+    TaskHandle_t task = nullptr;
+
+    camera_fb_t *outstanding = nullptr; // 配ったフレーム
+    uint32_t outstandingRefs = 0;
+
+    SemaphoreHandle_t configLock = nullptr; // configure() を呼ぶ側を1人ずつにする
+    SemaphoreHandle_t configDone = nullptr;
+    ConfigureFn configFn = nullptr;
+    void *configArg = nullptr;
+    int configResult = 0;
+    esp_err_t configStatus = ESP_OK;
+
+    volatile int current = ANY_FRAMESIZE;
+    uint32_t nFrames = 0;
+    uint32_t nReconfigurations = 0;
+    uint32_t nShared = 0;
+    uint32_t nConfigurations = 0;
+    volatile uint32_t nFailures = 0;
+};
@@ -0,0 +1,179 @@
+#include "CaptureCache.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(ARDUINO_ARCH_ESP32)
+#include "esp_heap_caps.h"
+#endif
+
+CaptureCache::CaptureCache()
+{
+}
+
+CaptureCache::~CaptureCache()
+{
+    end();
+}
+
+bool CaptureCache::begin(size_t arenaBytes)
+{
+    end();
+#if defined(ARDUINO_ARCH_ESP32)
+    arena = (uint8_t *)heap_caps_malloc(arenaBytes, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    mutex = xSemaphoreCreateMutex();
+    if (!mutex)
+    {
+        end();
+        return false;
+    }
+#else
+    arena = (uint8_t *)malloc(arenaBytes);
+#endif
+    if (!arena)
+    {
+        end();
+        return false;
+    }
+    arenaSize = arenaBytes;
+    head = 0;
+    first = 0;
+    n = 0;
+    return true;
+}
+
+void CaptureCache::end()
+{
+    free(arena);
+    arena = nullptr;
+    arenaSize = 0;
+    n = 0;
+#if defined(ARDUINO_ARCH_ESP32)
+    if (mutex)
+    {
+        vSemaphoreDelete(mutex);
+        mutex = nullptr;
+    }
+#endif
+}
+
+void CaptureCache::lock()
+{
+#if defined(ARDUINO_ARCH_ESP32)
+    // begin() に失敗したあとも latestId / info は呼ばれる (空のキャッシュとして答える)
+    if (mutex)
+    {
+        xSemaphoreTake(mutex, portMAX_DELAY);
+    }
+#endif
+}
+
+void CaptureCache::unlock()
+{
+#if defined(ARDUINO_ARCH_ESP32)
+    if (mutex)
+    {
+        xSemaphoreGive(mutex);
+    }
+#endif
+}
+
+const CaptureCache::Entry *CaptureCache::find(uint32_t id) const
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        const Entry &e = entries[(first + i) % MAX_ENTRIES];
+        if (e.id == id)
+        {
+            return &e;
+        }
+    }
+    return nullptr;
+}
+
+void CaptureCache::evictOldest()
+{
+    first = (first + 1) % MAX_ENTRIES;
+    n--;
+    evicted++;
+}
+
+uint32_t CaptureCache::put(const uint8_t *jpg, size_t len, uint32_t timestamp)
+{
+    if (!arena || !len || len > arenaSize)
+    {
+        return 0;
+    }
+    lock();
+    size_t pos = head;
+    bool wrapped = false;
+    if (pos + len > arenaSize)
+    {
+        pos = 0; // 末尾に入らなければ先頭に戻る (末尾の余りは使わない)
+        wrapped = true;
+    }
+    // 書き込む範囲に重なるものを古い順に追い出す。先頭に戻ったときは、head より後ろにある前の周回の分が一番古い
+    while (n)
+    {
+        const Entry &oldest = entries[first];
+        bool overlaps = oldest.offset < pos + len && pos < oldest.offset + oldest.len;
+        bool stale = wrapped && oldest.offset >= head;
+        if (!overlaps && !stale && n < MAX_ENTRIES)
+        {
+            break;
+        }
+        evictOldest();
+    }
+    memcpy(arena + pos, jpg, len);
+    Entry &e = entries[(first + n) % MAX_ENTRIES];
+    e.id = nextId++;
+    e.timestamp = timestamp;
+    e.offset = pos;
+    e.len = len;
+    n++;
+    head = pos + len;
+    uint32_t id = e.id;
+    unlock();
+    return id;
+}
+
+bool CaptureCache::read(uint32_t id, size_t offset, uint8_t *buf, size_t maxLen, size_t *got)
+{
+    lock();
+    const Entry *e = find(id);
+    bool ok = e && offset <= e->len;
+    if (ok)
+    {
+        size_t k = e->len - offset;
+        if (k > maxLen)
+        {
+            k = maxLen;
+        }
+        memcpy(buf, arena + e->offset + offset, k);
+        *got = k;
+    }
+    unlock();
+    return ok;
+}
+
+bool CaptureCache::info(uint32_t id, size_t *len, uint32_t *timestamp)
+{
+    lock();
+    const Entry *e = find(id);
+    if (e)
+    {
+        *len = e->len;
+        *timestamp = e->timestamp;
+    }
+    unlock();
+    return e != nullptr;
+}
+
+uint32_t CaptureCache::latestId()
+{
+    // nextId は put が書き換えるので、ほかのタスクからもロックの中で読む
+    lock();
+    uint32_t id = nextId - 1;
+    unlock();
+    return id;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(ARDUINO_ARCH_ESP32)
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#endif
+
+// 撮影したフル解像度の JPEG を撮影 ID で取っておくキャッシュ
+// 最初に確保した1つの領域 (PSRAM) をリングとして使い、古いものから上書きする。撮影ごとの malloc はしない
+// put はフレームを処理するタスク (processing) からだけ呼ぶ。read / info / latestId は HTTP サーバーや control など別のタスクから呼んでよい
+class CaptureCache
+{
+public:
+    static const size_t MAX_ENTRIES = 16;
+
+    CaptureCache();
+    ~CaptureCache();
+
+    bool begin(size_t arenaBytes);
+    void end();
+
+    // 保存して撮影 ID を返す。入りきらないときは 0
+    uint32_t put(const uint8_t *jpg, size_t len, uint32_t timestamp);
+
+    // 別タスク用。offset から最大 maxLen バイトをコピーする。追い出されていたら false
+    bool read(uint32_t id, size_t offset, uint8_t *buf, size_t maxLen, size_t *got);
+    bool info(uint32_t id, size_t *len, uint32_t *timestamp);
+
+    uint32_t latestId(); // まだ何も入れていなければ 0
+    size_t count() const { return n; }
+    size_t capacity() const { return arenaSize; }
+    uint32_t evictions() const { return evicted; }
+
+private:
+    struct Entry
+    {
+        uint32_t id;
+        uint32_t timestamp;
+        size_t offset;
+        size_t len;
+    };
+
+    const Entry *find(uint32_t id) const;
+    void evictOldest();
+    void lock();
+    void unlock();
+
+    uint8_t *arena = nullptr;
+    size_t arenaSize = 0;
+    size_t head = 0; // 次に書く位置
+    Entry entries[MAX_ENTRIES];
+    size_t first = 0; // 一番古いエントリ
+    size_t n = 0;
+    uint32_t nextId = 1;
+    uint32_t evicted = 0;
+#if defined(ARDUINO_ARCH_ESP32)
+    SemaphoreHandle_t mutex = nullptr;
+#endif
+};
@@ -0,0 +1,100 @@
+#include "CaptureScheduler.h"
+
+#include <stdio.h>
+
+void SchedulerStats::setName(uint8_t cls, const char *name)
+{
+    if (cls < MAX_CLASSES)
+    {
+        classes[cls].name = name;
+    }
+}
+
+void SchedulerStats::served(uint8_t cls, uint32_t latencyMs, bool missed)
+{
+    Class &c = at(cls);
+    c.served++;
+    if (missed)
+    {
+        c.missed++;
+    }
+    if (latencyMs > c.maxMs)
+    {
+        c.maxMs = latencyMs;
+    }
+    // 区間 0 は 0 ms、区間 i は [2^(i-1), 2^i) ms
+    size_t b = 0;
+    while (b + 1 < BUCKETS && (latencyMs >> b))
+    {
+        b++;
+    }
+    c.histogram[b]++;
+}
+
+uint32_t SchedulerStats::percentileMs(uint8_t cls, uint32_t p) const
+{
+    const Class &c = at(cls);
+    uint32_t total = 0;
+    for (size_t b = 0; b < BUCKETS; b++)
+    {
+        total += c.histogram[b];
+    }
+    if (!total)
+    {
+        return 0;
+    }
+    uint64_t want = ((uint64_t)total * p + 99) / 100;
+    uint32_t seen = 0;
+    for (size_t b = 0; b < BUCKETS; b++)
+    {
+        seen += c.histogram[b];
+        if (seen >= want && c.histogram[b])
+        {
+            // 区間の上端。最大値を超えては答えない。最後の区間は上端がないので最大値
+            if (b + 1 == BUCKETS)
+            {
+                return c.maxMs;
+            }
+            uint32_t upper = b ? ((1UL << b) - 1) : 0;
+            return upper < c.maxMs ? upper : c.maxMs;
+        }
+    }
+    return c.maxMs;
+}
+
+size_t SchedulerStats::formatJson(char *out, size_t size) const
+{
+    size_t pos = 0;
+    int k = snprintf(out, size, "{\"scheduler\":[");
+    if (k < 0 || (size_t)k >= size)
+    {
+        return 0;
+    }
+    pos = k;
+    bool first = true;
+    for (size_t i = 0; i < MAX_CLASSES; i++)
+    {
+        const Class &c = classes[i];
+        if (!c.name)
+        {
+            continue;
+        }
+        k = snprintf(out + pos, size - pos,
+                     "%s{\"class\":\"%s\",\"requested\":%u,\"served\":%u,\"coalesced\":%u,\"dropped\":%u,\"missed\":%u,\"p50_ms\":%u,\"p95_ms\":%u,"
+                     "\"p99_ms\":%u,\"max_ms\":%u}",
+                     first ? "" : ",", c.name, (unsigned)c.requested, (unsigned)c.served, (unsigned)c.coalesced, (unsigned)c.dropped, (unsigned)c.missed,
+                     (unsigned)percentileMs(i, 50), (unsigned)percentileMs(i, 95), (unsigned)percentileMs(i, 99), (unsigned)c.maxMs);
+        if (k < 0 || (size_t)k >= size - pos)
+        {
+            return 0;
+        }
+        pos += k;
+        first = false;
+    }
+    k = snprintf(out + pos, size - pos, "]}");
+    if (k < 0 || (size_t)k >= size - pos)
+    {
+        return 0;
+    }
+    return pos + k;
+}
@@ -0,0 +1,251 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// 撮影の種類 (クラス) ごとの待ち時間と締め切りの記録。待ち時間は 2 のべき乗 ms の区間の度数で持ち、
+// 百分位はその区間の上端で答える (固定長、確保なし)。書くのはスケジューラを持つタスクだけで、読む側は目安として読む
+class SchedulerStats
+{
+public:
+    static const size_t MAX_CLASSES = 4;
+    static const size_t BUCKETS = 18; // 最後の区間は 2^16 ms (約 65 s) 以上
+
+    void setName(uint8_t cls, const char *name);
+
+    void requested(uint8_t cls) { at(cls).requested++; }
+    void coalesced(uint8_t cls) { at(cls).coalesced++; }
+    void dropped(uint8_t cls) { at(cls).dropped++; }
+    // 取り出したときに呼ぶ。締め切りを過ぎていたら missed
+    void served(uint8_t cls, uint32_t latencyMs, bool missed);
+
+    // p は 0-100。まだ1つも取り出していなければ 0
+    uint32_t percentileMs(uint8_t cls, uint32_t p) const;
+    uint32_t maxMs(uint8_t cls) const { return at(cls).maxMs; }
+    uint32_t servedCount(uint8_t cls) const { return at(cls).served; }
+    uint32_t missedCount(uint8_t cls) const { return at(cls).missed; }
+    uint32_t coalescedCount(uint8_t cls) const { return at(cls).coalesced; }
+    uint32_t droppedCount(uint8_t cls) const { return at(cls).dropped; }
+
+    // 名前をつけたクラスだけを JSON の配列にする。入りきらなければ 0
+    size_t formatJson(char *out, size_t size) const;
+
+private:
+    struct Class
+    {
+        const char *name;
+        uint32_t requested;
+        uint32_t coalesced;
+        uint32_t dropped;
+        uint32_t served;
+        uint32_t missed;
+        uint32_t maxMs;
+        uint32_t histogram[BUCKETS];
+    };
+
+    Class &at(uint8_t cls) { return classes[cls < MAX_CLASSES ? cls : MAX_CLASSES - 1]; }
+    const Class &at(uint8_t cls) const { return classes[cls < MAX_CLASSES ? cls : MAX_CLASSES - 1]; }
+
+    Class classes[MAX_CLASSES] = {};
+};
+
+// 撮影の予定表。優先度の高いもの → 締め切りの早いもの → 来た順に取り出す二分ヒープ (N 個まで、確保なし)
+// key が 0 でない予定は、同じ key の予定がまだ待っていればそれにまとめる (優先度は高い方、締め切りは早い方、
+// 待ち時間は先に来た方から数え、merged を1つ増やす)。いっぱいのときは一番優先度の低い予定を追い出して入れる
+// 時刻は折り返す 32 ビットの ms。Arduino に依存しない (ヘッダだけ)
+template <typename T, size_t N>
+class CaptureScheduler
+{
+public:
+    struct Entry
+    {
+        T job;
+        uint32_t key;        // まとめてよい予定の印 (0 ならまとめない)
+        uint8_t cls;         // SchedulerStats のクラス
+        uint8_t priority;    // 大きいほど先
+        int16_t framesize;   // -1 ならどれでもよい
+        int16_t quality;     // -1 なら今のまま
+        uint32_t deadlineMs; // この時刻までに撮り始めたい
+        uint32_t enqueuedMs;
+        uint16_t merged;     // まとめた予定の数
+        uint32_t seq;
+    };
+
+    enum Result
+    {
+        QUEUED,
+        COALESCED,
+        REPLACED, // いっぱいだったので優先度の低い予定を追い出した
+        REJECTED, // いっぱいで、追い出せる予定もない
+    };
+
+    SchedulerStats stats;
+
+    Result push(const T &job, uint8_t cls, uint8_t priority, uint32_t deadlineMs, uint32_t nowMs, uint32_t key = 0, int16_t framesize = -1,
+                int16_t quality = -1)
+    {
+        stats.requested(cls);
+        if (key)
+        {
+            for (size_t i = 0; i < n; i++)
+            {
+                Entry &e = heap[i];
+                if (e.key == key)
+                {
+                    if (priority > e.priority)
+                    {
+                        e.priority = priority;
+                    }
+                    if ((int32_t)(deadlineMs - e.deadlineMs) < 0)
+                    {
+                        e.deadlineMs = deadlineMs;
+                    }
+                    e.merged++;
+                    siftUp(i);
+                    stats.coalesced(cls);
+                    return COALESCED;
+                }
+            }
+        }
+        Result result = QUEUED;
+        if (n == N)
+        {
+            size_t victim = lowest();
+            if (!before(priority, deadlineMs, nextSeq, heap[victim]))
+            {
+                stats.dropped(cls);
+                return REJECTED;
+            }
+            stats.dropped(heap[victim].cls);
+            removeAt(victim);
+            result = REPLACED;
+        }
+        Entry &e = heap[n];
+        e.job = job;
+        e.key = key;
+        e.cls = cls;
+        e.priority = priority;
+        e.framesize = framesize;
+        e.quality = quality;
+        e.deadlineMs = deadlineMs;
+        e.enqueuedMs = nowMs;
+        e.merged = 0;
+        e.seq = nextSeq++;
+        siftUp(n++);
+        return result;
+    }
+
+    // 一番先の予定を取り出し、待ち時間と締め切りを記録する
+    bool pop(Entry &out, uint32_t nowMs)
+    {
+        if (!n)
+        {
+            return false;
+        }
+        out = heap[0];
+        removeAt(0);
+        stats.served(out.cls, nowMs - out.enqueuedMs, (int32_t)(nowMs - out.deadlineMs) > 0);
+        return true;
+    }
+
+    const Entry *peek() const { return n ? &heap[0] : nullptr; }
+    bool contains(uint32_t key) const
+    {
+        for (size_t i = 0; i < n; i++)
+        {
+            if (heap[i].key == key)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+    size_t size() const { return n; }
+    bool empty() const { return n == 0; }
+    static constexpr size_t capacity() { return N; }
+
+private:
+    static bool before(uint8_t priority, uint32_t deadlineMs, uint32_t seq, const Entry &b)
+    {
+        if (priority != b.priority)
+        {
+            return priority > b.priority;
+        }
+        int32_t d = (int32_t)(deadlineMs - b.deadlineMs);
+        if (d)
+        {
+            return d < 0;
+        }
+        return (int32_t)(seq - b.seq) < 0;
+    }
+    static bool before(const Entry &a, const Entry &b) { return before(a.priority, a.deadlineMs, a.seq, b); }
+
+    // 一番後に取り出される予定 (葉のどれか)
+    size_t lowest() const
+    {
+        size_t worst = n / 2;
+        for (size_t i = n / 2 + 1; i < n; i++)
+        {
+            if (before(heap[worst], heap[i]))
+            {
+                worst = i;
+            }
+        }
+        return worst;
+    }
+
+    void swap(size_t a, size_t b)
+    {
+        Entry t = heap[a];
+        heap[a] = heap[b];
+        heap[b] = t;
+    }
+
+    void siftUp(size_t i)
+    {
+        while (i && before(heap[i], heap[(i - 1) / 2]))
+        {
+            swap(i, (i - 1) / 2);
+            i = (i - 1) / 2;
+        }
+    }
+
+    void siftDown(size_t i)
+    {
+        for (;;)
+        {
+            size_t best = i;
+            size_t l = 2 * i + 1, r = l + 1;
+            if (l < n && before(heap[l], heap[best]))
+            {
+                best = l;
+            }
+            if (r < n && before(heap[r], heap[best]))
+            {
+                best = r;
+            }
+            if (best == i)
+            {
+                return;
+            }
+            swap(i, best);
+            i = best;
+        }
+    }
+
+    void removeAt(size_t i)
+    {
+        n--;
+        if (i == n)
+        {
+            return;
+        }
+        heap[i] = heap[n];
+        siftDown(i);
+        siftUp(i);
+    }
+
+    Entry heap[N];
+    size_t n = 0;
+    uint32_t nextSeq = 0;
+};
@@ -0,0 +1,476 @@
+#include "FirebaseLink.h"
+
+#include <Arduino.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+static const char *FIRESTORE_HOST = "firestore.googleapis.com";
+static const char *STORAGE_HOST = "firebasestorage.googleapis.com";
+static const size_t ALIGN = 8;
+
+// JsonArena
+
+JsonArena::JsonArena(void *buf, size_t size) : base((uint8_t *)buf), size(size)
+{
+}
+
+void *JsonArena::allocate(size_t n)
+{
+    size_t need = ALIGN + ((n + ALIGN - 1) & ~(ALIGN - 1));
+    if (size - top < need)
+    {
+        nFailures++;
+        return nullptr;
+    }
+    *(size_t *)(base + top) = n;
+    last = top;
+    top += need;
+    if (top > nHighWater)
+    {
+        nHighWater = top;
+    }
+    return base + last + ALIGN;
+}
+
+void JsonArena::deallocate(void *ptr)
+{
+    // 最後のブロックだけ戻す。それ以外は reset() でまとめて戻る
+    if (ptr && last != NONE && (uint8_t *)ptr == base + last + ALIGN)
+    {
+        top = last;
+        last = NONE;
+    }
+}
+
+void *JsonArena::reallocate(void *ptr, size_t n)
+{
+    if (!ptr)
+    {
+        return allocate(n);
+    }
+    uint8_t *p = (uint8_t *)ptr;
+    if (last != NONE && p == base + last + ALIGN)
+    {
+        // 最後のブロックはその場で伸縮する (deserializeJson の最後の shrinkToFit もここに来る)
+        size_t need = ALIGN + ((n + ALIGN - 1) & ~(ALIGN - 1));
+        if (size - last < need)
+        {
+            nFailures++;
+            return nullptr;
+        }
+        *(size_t *)(base + last) = n;
+        top = last + need;
+        if (top > nHighWater)
+        {
+            nHighWater = top;
+        }
+        return ptr;
+    }
+    size_t old = *(size_t *)(p - ALIGN);
+    if (n <= old)
+    {
+        // 途中のブロックの縮小はその場で済ませる (v7 の shrinkToFit は後ろに文字列を確保したあとで変数のプールを縮める)
+        *(size_t *)(p - ALIGN) = n;
+        return ptr;
+    }
+    void *q = allocate(n);
+    if (q)
+    {
+        memcpy(q, ptr, old < n ? old : n);
+    }
+    return q;
+}
+
+// FirebaseLink
+
+FirebaseLink::FirebaseLink(Client &firestore, Client &storage, void *arenaBuf, size_t arenaBytes)
+    : firestore(firestore), storage(storage), arena(arenaBuf, arenaBytes), doc(&arena), body(*this)
+{
+}
+
+void FirebaseLink::begin(const char *project, const char *bucketId, TokenFn tokenFn)
+{
+    projectId = project;
+    bucket = bucketId;
+    token = tokenFn;
+}
+
+bool FirebaseLink::formatName(char *out, size_t size, const char *prefix, uint32_t number, const char *suffix)
+{
+    int n = snprintf(out, size, "%s%lu%s", prefix, (unsigned long)number, suffix);
+    return n > 0 && (size_t)n < size;
+}
+
+bool FirebaseLink::connect(Client &c, const char *host)
+{
+    if (c.connected())
+    {
+        return true;
+    }
+    c.stop();
+    nReconnects++;
+    return c.connect(host, 443) == 1;
+}
+
+bool FirebaseLink::sendHead(Client &c, const char *method, const char *host, const char *path, const char *authScheme,
+                            const char *contentType, size_t contentLength)
+{
+    const char *t = token ? token() : nullptr;
+    if (!t || !*t)
+    {
+        return false;
+    }
+    // トークンは 1KB 近くあるので line には入れず、そのまま書く
+    int n = snprintf(line, sizeof(line), "%s %s HTTP/1.1\r\nHost: %s\r\nAuthorization: %s ", method, path, host, authScheme);
+    if (n <= 0 || (size_t)n >= sizeof(line))
+    {
+        return false;
+    }
+    size_t tokenLen = strlen(t);
+    if (c.write((const uint8_t *)line, n) != (size_t)n || c.write((const uint8_t *)t, tokenLen) != tokenLen)
+    {
+        return false;
+    }
+    if (contentType)
+    {
+        n = snprintf(line, sizeof(line), "\r\nContent-Type: %s\r\nContent-Length: %u\r\n\r\n", contentType, (unsigned)contentLength);
+    }
+    else
+    {
+        n = snprintf(line, sizeof(line), "\r\n\r\n");
+    }
+    nRequests++;
+    return c.write((const uint8_t *)line, n) == (size_t)n;
+}
+
+int FirebaseLink::readByte(Client &c)
+{
+    uint32_t start = millis();
+    while (!c.available())
+    {
+        if (!c.connected() || millis() - start > timeoutMs)
+        {
+            return -1;
+        }
+        delay(1);
+    }
+    return c.read();
+}
+
+bool FirebaseLink::readLine(Client &c, char *out, size_t size)
+{
+    size_t n = 0;
+    for (;;)
+    {
+        int ch = readByte(c);
+        if (ch < 0)
+        {
+            return false;
+        }
+        if (ch == '\n')
+        {
+            break;
+        }
+        if (ch != '\r' && n + 1 < size)
+        {
+            out[n++] = (char)ch; // 長すぎる行は切り詰める (読み捨てる)
+        }
+    }
+    out[n] = '\0';
+    return true;
+}
+
+bool FirebaseLink::readHead(Client &c)
+{
+    status = 0;
+    closeAfter = false;
+    if (!readLine(c, line, sizeof(line)) || strncmp(line, "HTTP/1.", 7) != 0)
+    {
+        return false;
+    }
+    status = atoi(line + 9);
+    bool chunked = false;
+    bool hasLength = false;
+    size_t length = 0;
+    for (;;)
+    {
+        if (!readLine(c, line, sizeof(line)))
+        {
+            return false;
+        }
+        if (!line[0])
+        {
+            break;
+        }
+        if (strncasecmp(line, "content-length:", 15) == 0)
+        {
+            hasLength = true;
+            length = strtoul(line + 15, nullptr, 10);
+        }
+        else if (strncasecmp(line, "transfer-encoding:", 18) == 0)
+        {
+            chunked = strstr(line + 18, "chunked") != nullptr;
+        }
+        else if (strncasecmp(line, "connection:", 11) == 0)
+        {
+            closeAfter = strstr(line + 11, "close") != nullptr;
+        }
+    }
+    if (!chunked && !hasLength)
+    {
+        // 長さがわからないときは切断までが本文
+        closeAfter = true;
+        length = (status == 204 || status == 304) ? 0 : (size_t)-1;
+    }
+    body.start(&c, chunked, length);
+    return true;
+}
+
+bool FirebaseLink::finish(Client &c, bool ok)
+{
+    body.drain();
+    if (!ok || closeAfter || !body.done())
+    {
+        c.stop(); // 次の要求は繋ぎ直す (応答の途中から読まないように)
+    }
+    return ok;
+}
+
+bool FirebaseLink::get(const char *path, const char *mask, const JsonDocument *filter)
+{
+    doc.clear();
+    arena.reset();
+    int n = snprintf(url, sizeof(url), "/v1/projects/%s/databases/(default)/documents/%s", projectId, path);
+    if (n <= 0 || (size_t)n >= sizeof(url))
+    {
+        return false;
+    }
+    // mask=a,b → ?mask.fieldPaths=a&mask.fieldPaths=b
+    size_t pos = n;
+    char sep = '?';
+    for (const char *p = mask; p && *p;)
+    {
+        const char *end = strchr(p, ',');
+        size_t len = end ? (size_t)(end - p) : strlen(p);
+        n = snprintf(url + pos, sizeof(url) - pos, "%cmask.fieldPaths=%.*s", sep, (int)len, p);
+        sep = '&';
+        if (n <= 0 || (size_t)n >= sizeof(url) - pos)
+        {
+            return false;
+        }
+        pos += n;
+        p = end ? end + 1 : p + len;
+    }
+    if (!connect(firestore, FIRESTORE_HOST) || !sendHead(firestore, "GET", FIRESTORE_HOST, url, "Bearer", nullptr, 0))
+    {
+        firestore.stop();
+        return false;
+    }
+    if (!readHead(firestore))
+    {
+        firestore.stop();
+        return false;
+    }
+    if (status != 200)
+    {
+        return finish(firestore, false);
+    }
+    uint32_t start = micros();
+    DeserializationError err = filter ? deserializeJson(doc, body, DeserializationOption::Filter(*filter)) : deserializeJson(doc, body);
+    parseUs = micros() - start;
+    return finish(firestore, !err);
+}
+
+bool FirebaseLink::patchBool(const char *path, const char *field, bool value)
+{
+    int n = snprintf(url, sizeof(url), "/v1/projects/%s/databases/(default)/documents/%s", projectId, path);
+    int m = snprintf(text, sizeof(text), "{\"fields\":{\"%s\":{\"booleanValue\":%s}}}", field, value ? "true" : "false");
+    if (n <= 0 || (size_t)n >= sizeof(url) || m <= 0 || (size_t)m >= sizeof(text))
+    {
+        return false;
+    }
+    if (!connect(firestore, FIRESTORE_HOST) || !sendHead(firestore, "PATCH", FIRESTORE_HOST, url, "Bearer", "application/json", m) ||
+        firestore.write((const uint8_t *)text, m) != (size_t)m)
+    {
+        firestore.stop();
+        return false;
+    }
+    if (!readHead(firestore))
+    {
+        firestore.stop();
+        return false;
+    }
+    return finish(firestore, status == 200);
+}
+
+bool FirebaseLink::upload(const char *name, const uint8_t *data, size_t len, const char *contentType)
+{
+    // name はクエリに入るので / なども %xx にする
+    int n = snprintf(url, sizeof(url), "/v0/b/%s/o?uploadType=media&name=", bucket);
+    if (n <= 0 || (size_t)n >= sizeof(url))
+    {
+        return false;
+    }
+    size_t pos = n;
+    if (*name == '/')
+    {
+        name++;
+    }
+    for (const char *p = name; *p; p++)
+    {
+        char ch = *p;
+        bool plain = (ch >= 'A' && ch <= 'Z') || (ch >= 'a' && ch <= 'z') || (ch >= '0' && ch <= '9') || ch == '-' || ch == '_' || ch == '.' || ch == '~';
+        if (pos + (plain ? 1 : 3) >= sizeof(url))
+        {
+            return false;
+        }
+        if (plain)
+        {
+            url[pos++] = ch;
+        }
+        else
+        {
+            pos += snprintf(url + pos, sizeof(url) - pos, "%%%02X", (uint8_t)ch);
+        }
+    }
+    url[pos] = '\0';
+
+    if (!connect(storage, STORAGE_HOST) || !sendHead(storage, "POST", STORAGE_HOST, url, "Firebase", contentType, len))
+    {
+        storage.stop();
+        return false;
+    }
+    size_t sent = 0;
+    while (sent < len)
+    {
+        size_t w = storage.write(data + sent, len - sent);
+        if (!w)
+        {
+            storage.stop();
+            return false;
+        }
+        sent += w;
+    }
+    if (!readHead(storage))
+    {
+        storage.stop();
+        return false;
+    }
+    return finish(storage, status == 200);
+}
+
+// FirebaseLink::Body
+
+void FirebaseLink::Body::start(Client *c, bool isChunked, size_t length)
+{
+    client = c;
+    chunked = isChunked;
+    remaining = chunked ? 0 : length;
+    count = 0;
+    finished = !chunked && length == 0;
+    peeked = -1;
+}
+
+bool FirebaseLink::Body::nextChunk()
+{
+    // チャンクの大きさの行。前のチャンクの後ろの空行は読み飛ばす
+    char size[16];
+    do
+    {
+        if (!link.readLine(*client, size, sizeof(size)))
+        {
+            client = nullptr; // 途中で切れた
+            return false;
+        }
+    } while (!size[0]);
+    remaining = strtoul(size, nullptr, 16);
+    if (remaining == 0)
+    {
+        // 最後のチャンク。トレーラーを空行まで読み捨てる
+        while (link.readLine(*client, size, sizeof(size)) && size[0])
+        {
+        }
+        finished = true;
+        return false;
+    }
+    return true;
+}
+
+int FirebaseLink::Body::read()
+{
+    if (peeked >= 0)
+    {
+        int ch = peeked;
+        peeked = -1;
+        return ch;
+    }
+    if (finished || !client)
+    {
+        return -1;
+    }
+    if (remaining == 0 && (!chunked || !nextChunk()))
+    {
+        return -1;
+    }
+    int ch = link.readByte(*client);
+    if (ch < 0)
+    {
+        // 長さ不明の本文は切断で終わる。それ以外は途中で切れた
+        if (remaining == (size_t)-1)
+        {
+            finished = true;
+        }
+        else
+        {
+            client = nullptr;
+        }
+        return -1;
+    }
+    count++;
+    if (remaining != (size_t)-1)
+    {
+        remaining--;
+        if (remaining == 0 && !chunked)
+        {
+            finished = true;
+        }
+    }
+    return ch;
+}
+
+int FirebaseLink::Body::peek()
+{
+    if (peeked < 0)
+    {
+        peeked = read();
+    }
+    return peeked;
+}
+
+int FirebaseLink::Body::available()
+{
+    if (peeked >= 0)
+    {
+        return 1;
+    }
+    if (finished || !client)
+    {
+        return 0;
+    }
+    int n = client->available();
+    if (!chunked && remaining != (size_t)-1 && (size_t)n > remaining)
+    {
+        n = (int)remaining;
+    }
+    return n;
+}
+
+void FirebaseLink::Body::drain()
+{
+    peeked = -1;
+    while (read() >= 0)
+    {
+    }
+}
@@ -0,0 +1,134 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <Client.h>
+#include <ArduinoJson.h>
+
+// ArduinoJson の確保先を固定の領域にする。パースの前に reset() するだけで使い回せる (ヒープを使わない)
+// 各ブロックの前に大きさを置くので、最後のブロックの解放・伸縮と、どのブロックの縮小もその場でできる
+class JsonArena : public ArduinoJson::Allocator
+{
+public:
+    JsonArena(void *buf, size_t size);
+
+    void *allocate(size_t size) override;
+    void deallocate(void *ptr) override;
+    void *reallocate(void *ptr, size_t newSize) override;
+
+    void reset() { top = 0; last = NONE; }
+    size_t used() const { return top; }
+    size_t capacity() const { return size; }
+    size_t highWater() const { return nHighWater; }
+    uint32_t failures() const { return nFailures; } // 領域が足りなかった回数
+
+private:
+    static const size_t NONE = (size_t)-1;
+
+    uint8_t *base;
+    size_t size;
+    size_t top = 0;
+    size_t last = NONE; // 最後に確保したブロックの先頭 (大きさの位置)
+    size_t nHighWater = 0;
+    uint32_t nFailures = 0;
+};
+
+// Firestore と Storage の REST API を、TLS の接続を張ったまま (keep-alive) 固定のバッファだけで叩く
+// Firebase_ESP_Client は認証 (トークンの取得・更新) にだけ使い、トークンは関数で受け取る。
+// パス・URL・リクエストヘッダ・送信する JSON はメンバの char 配列に snprintf で組み立て、
+// レスポンスは接続から直接 JsonArena の上にパースするので、定常状態の問い合わせ・アップロードでヒープを確保しない
+// (確保が起きるのは再接続の TLS ハンドシェイクとトークンの更新だけ)
+class FirebaseLink
+{
+public:
+    typedef const char *(*TokenFn)();
+
+    static const size_t PATH_SIZE = 128;
+    static const size_t URL_SIZE = 384;
+    static const size_t BODY_SIZE = 256;
+    static const size_t LINE_SIZE = 256;
+
+    uint32_t timeoutMs = 10000;
+
+    // firestore / storage は別のホストにつなぐので接続を分ける (どちらも WiFiClientSecure を想定)
+    FirebaseLink(Client &firestore, Client &storage, void *arena, size_t arenaBytes);
+
+    void begin(const char *projectId, const char *bucket, TokenFn token);
+
+    // Firestore: documents/ 以下のパス (コレクションなら一覧) を取得して document() にパースする
+    // mask にフィールドのパス (カンマ区切りで複数) を渡すと、そのフィールドだけを返させる (mask.fieldPaths)。
+    // filter を渡すと、それに載っている要素だけを arena に残し、ほかは読み捨てながらパースする
+    bool get(const char *path, const char *mask = nullptr, const JsonDocument *filter = nullptr);
+    JsonDocument &document() { return doc; }
+    // フィールド1つの bool でドキュメントを置き換える
+    bool patchBool(const char *path, const char *field, bool value);
+
+    // Storage: name (先頭の / は無視) にデータを置く
+    bool upload(const char *name, const uint8_t *data, size_t len, const char *contentType);
+
+    // name に "<prefix><番号><suffix>" を固定のバッファで組み立てる。String の連結の代わり
+    static bool formatName(char *out, size_t size, const char *prefix, uint32_t number, const char *suffix);
+
+    int lastStatus() const { return status; }
+    size_t lastBodyBytes() const { return body.bytesRead(); } // 直近のレスポンスの本文の大きさ
+    uint32_t lastParseUs() const { return parseUs; }          // 直近の get の本文の受信とパースにかかった時間
+    uint32_t requests() const { return nRequests; }
+    uint32_t reconnects() const { return nReconnects; }
+    const JsonArena &parseArena() const { return arena; }
+
+private:
+    // レスポンスの本文を読むストリーム (Content-Length と chunked の両方を扱う)
+    class Body : public Stream
+    {
+    public:
+        Body(FirebaseLink &link) : link(link) {}
+        void start(Client *c, bool chunked, size_t length);
+        bool done() const { return finished; }
+        size_t bytesRead() const { return count; }
+        void drain();
+
+        int available() override;
+        int read() override;
+        int peek() override;
+        size_t write(uint8_t) override { return 0; }
+
+    private:
+        bool nextChunk();
+
+        FirebaseLink &link;
+        Client *client = nullptr;
+        bool chunked = false;
+        bool finished = true;
+        size_t remaining = 0;
+        size_t count = 0;
+        int peeked = -1;
+    };
+
+    bool connect(Client &c, const char *host);
+    bool sendHead(Client &c, const char *method, const char *host, const char *url, const char *authScheme, const char *contentType,
+                  size_t contentLength);
+    bool readHead(Client &c);
+    int readByte(Client &c);
+    bool readLine(Client &c, char *out, size_t size);
+    bool finish(Client &c, bool ok);
+
+    Client &firestore;
+    Client &storage;
+    JsonArena arena;
+    JsonDocument doc;
+    Body body;
+
+    const char *projectId = "";
+    const char *bucket = "";
+    TokenFn token = nullptr;
+
+    char url[URL_SIZE];
+    char text[BODY_SIZE];
+    char line[LINE_SIZE];
+
+    int status = 0;
+    bool closeAfter = false;
+    uint32_t parseUs = 0;
+    uint32_t nRequests = 0;
+    uint32_t nReconnects = 0;
+};
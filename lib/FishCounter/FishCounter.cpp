@@ -0,0 +1,303 @@
+#include "FishCounter.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+FishCounter::FishCounter()
+{
+}
+
+FishCounter::~FishCounter()
+{
+    end();
+}
+
+bool FishCounter::begin(uint16_t width, uint16_t height)
+{
+    end();
+    if (width < 3 || height < 3)
+    {
+        return false;
+    }
+    w = width;
+    h = height;
+    size_t n = (size_t)w * h;
+    size_t maxRuns = w / 2 + 1;
+
+    bg = (uint16_t *)malloc(n * sizeof(uint16_t));
+    maskBuf = (uint8_t *)malloc(n);
+    tmpBuf = (uint8_t *)malloc(n);
+    prevRuns = (Run *)malloc(maxRuns * sizeof(Run));
+    curRuns = (Run *)malloc(maxRuns * sizeof(Run));
+    if (!bg || !maskBuf || !tmpBuf || !prevRuns || !curRuns)
+    {
+        end();
+        return false;
+    }
+    bgReady = false;
+    return true;
+}
+
+void FishCounter::end()
+{
+    free(bg);
+    free(maskBuf);
+    free(tmpBuf);
+    free(prevRuns);
+    free(curRuns);
+    bg = nullptr;
+    maskBuf = nullptr;
+    tmpBuf = nullptr;
+    prevRuns = nullptr;
+    curRuns = nullptr;
+    w = h = 0;
+    nBlobs = 0;
+}
+
+int FishCounter::process(const uint8_t *gray)
+{
+    if (!bg)
+    {
+        return -1;
+    }
+    size_t n = (size_t)w * h;
+    if (!bgReady)
+    {
+        for (size_t i = 0; i < n; i++)
+        {
+            bg[i] = (uint16_t)gray[i] << 8;
+        }
+        bgReady = true;
+        nBlobs = 0;
+        return 0;
+    }
+    subtract(gray);
+    open3x3();
+    label();
+    return (int)nBlobs;
+}
+
+void FishCounter::subtract(const uint8_t *gray)
+{
+    size_t n = (size_t)w * h;
+    for (size_t i = 0; i < n; i++)
+    {
+        int b = bg[i] >> 8;
+        int d = (int)gray[i] - b;
+        if (d < 0)
+        {
+            d = -d;
+        }
+        bool fg = d > threshold;
+        maskBuf[i] = fg ? 255 : 0;
+
+        // 前景は取り込みを遅くして、止まっている魚がすぐ背景に溶けないようにする
+        int shift = fg ? learnShift + 3 : learnShift;
+        int32_t diff = ((int32_t)gray[i] << 8) - bg[i];
+        bg[i] = (uint16_t)(bg[i] + (diff >> shift));
+    }
+}
+
+// 3x3 のオープニング (収縮→膨張) を縦横に分離して行う
+void FishCounter::open3x3()
+{
+    // 横方向の収縮
+    for (uint16_t y = 0; y < h; y++)
+    {
+        const uint8_t *src = maskBuf + (size_t)y * w;
+        uint8_t *dst = tmpBuf + (size_t)y * w;
+        dst[0] = src[0] & src[1];
+        for (uint16_t x = 1; x < w - 1; x++)
+        {
+            dst[x] = src[x - 1] & src[x] & src[x + 1];
+        }
+        dst[w - 1] = src[w - 2] & src[w - 1];
+    }
+    // 縦方向の収縮
+    for (uint16_t y = 0; y < h; y++)
+    {
+        const uint8_t *up = tmpBuf + (size_t)(y ? y - 1 : y) * w;
+        const uint8_t *mid = tmpBuf + (size_t)y * w;
+        const uint8_t *down = tmpBuf + (size_t)(y + 1 < h ? y + 1 : y) * w;
+        uint8_t *dst = maskBuf + (size_t)y * w;
+        for (uint16_t x = 0; x < w; x++)
+        {
+            dst[x] = up[x] & mid[x] & down[x];
+        }
+    }
+    // 横方向の膨張
+    for (uint16_t y = 0; y < h; y++)
+    {
+        const uint8_t *src = maskBuf + (size_t)y * w;
+        uint8_t *dst = tmpBuf + (size_t)y * w;
+        dst[0] = src[0] | src[1];
+        for (uint16_t x = 1; x < w - 1; x++)
+        {
+            dst[x] = src[x - 1] | src[x] | src[x + 1];
+        }
+        dst[w - 1] = src[w - 2] | src[w - 1];
+    }
+    // 縦方向の膨張
+    for (uint16_t y = 0; y < h; y++)
+    {
+        const uint8_t *up = tmpBuf + (size_t)(y ? y - 1 : y) * w;
+        const uint8_t *mid = tmpBuf + (size_t)y * w;
+        const uint8_t *down = tmpBuf + (size_t)(y + 1 < h ? y + 1 : y) * w;
+        uint8_t *dst = maskBuf + (size_t)y * w;
+        for (uint16_t x = 0; x < w; x++)
+        {
+            dst[x] = up[x] | mid[x] | down[x];
+        }
+    }
+}
+
+uint16_t FishCounter::newLabel()
+{
+    if (nLabels >= MAX_LABELS)
+    {
+        labelOverflow = true;
+        return MAX_LABELS;
+    }
+    uint16_t l = nLabels++;
+    parent[l] = l;
+    LabelStat &s = stats[l];
+    s.area = 0;
+    s.sumX = 0;
+    s.sumY = 0;
+    s.minX = s.minY = 0xFFFF;
+    s.maxX = s.maxY = 0;
+    return l;
+}
+
+uint16_t FishCounter::findRoot(uint16_t l)
+{
+    while (parent[l] != l)
+    {
+        parent[l] = parent[parent[l]];
+        l = parent[l];
+    }
+    return l;
+}
+
+void FishCounter::unite(uint16_t a, uint16_t b)
+{
+    a = findRoot(a);
+    b = findRoot(b);
+    if (a == b)
+    {
+        return;
+    }
+    if (b < a)
+    {
+        uint16_t t = a;
+        a = b;
+        b = t;
+    }
+    // 若いラベルを根にして統計を集約する
+    parent[b] = a;
+    LabelStat &sa = stats[a];
+    const LabelStat &sb = stats[b];
+    sa.area += sb.area;
+    sa.sumX += sb.sumX;
+    sa.sumY += sb.sumY;
+    if (sb.minX < sa.minX) sa.minX = sb.minX;
+    if (sb.minY < sa.minY) sa.minY = sb.minY;
+    if (sb.maxX > sa.maxX) sa.maxX = sb.maxX;
+    if (sb.maxY > sa.maxY) sa.maxY = sb.maxY;
+}
+
+// 1行ずつランを取り出し、直前の行のランとだけ比較する1パスのラベリング (8近傍)
+void FishCounter::label()
+{
+    nLabels = 0;
+    labelOverflow = false;
+    nBlobs = 0;
+    size_t nPrev = 0;
+
+    for (uint16_t y = 0; y < h; y++)
+    {
+        const uint8_t *row = maskBuf + (size_t)y * w;
+        size_t nCur = 0;
+        size_t p = 0;
+        uint16_t x = 0;
+        while (x < w)
+        {
+            if (!row[x])
+            {
+                x++;
+                continue;
+            }
+            Run r;
+            r.x0 = x;
+            while (x < w && row[x])
+            {
+                x++;
+            }
+            r.x1 = x - 1;
+            r.label = MAX_LABELS;
+
+            // 前の行で接しているラン (斜めも含む) を統合する
+            while (p < nPrev && prevRuns[p].x1 + 1 < r.x0)
+            {
+                p++;
+            }
+            for (size_t q = p; q < nPrev && prevRuns[q].x0 <= r.x1 + 1; q++)
+            {
+                if (prevRuns[q].label == MAX_LABELS)
+                {
+                    continue;
+                }
+                if (r.label == MAX_LABELS)
+                {
+                    r.label = findRoot(prevRuns[q].label);
+                }
+                else
+                {
+                    unite(r.label, prevRuns[q].label);
+                }
+            }
+            if (r.label == MAX_LABELS)
+            {
+                r.label = newLabel();
+            }
+            if (r.label != MAX_LABELS)
+            {
+                LabelStat &s = stats[findRoot(r.label)];
+                uint32_t len = (uint32_t)r.x1 - r.x0 + 1;
+                s.area += len;
+                s.sumX += ((uint32_t)r.x0 + r.x1) * len / 2;
+                s.sumY += (uint32_t)y * len;
+                if (r.x0 < s.minX) s.minX = r.x0;
+                if (r.x1 > s.maxX) s.maxX = r.x1;
+                if (y < s.minY) s.minY = y;
+                if (y > s.maxY) s.maxY = y;
+            }
+            curRuns[nCur++] = r;
+        }
+        Run *t = prevRuns;
+        prevRuns = curRuns;
+        curRuns = t;
+        nPrev = nCur;
+    }
+
+    for (uint16_t l = 0; l < nLabels && nBlobs < MAX_BLOBS; l++)
+    {
+        if (parent[l] != l)
+        {
+            continue;
+        }
+        const LabelStat &s = stats[l];
+        if (s.area < minArea || s.area > maxArea)
+        {
+            continue;
+        }
+        FishBlob &b = blobs[nBlobs++];
+        b.area = s.area;
+        b.cx = (uint16_t)(s.sumX / s.area);
+        b.cy = (uint16_t)(s.sumY / s.area);
+        b.minX = s.minX;
+        b.minY = s.minY;
+        b.maxX = s.maxX;
+        b.maxY = s.maxY;
+    }
+}
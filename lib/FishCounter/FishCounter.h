@@ -0,0 +1,89 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// 魚カウント用の1ブロブ分の統計
+struct FishBlob
+{
+    uint32_t area;   // 画素数
+    uint16_t cx;     // 重心 X
+    uint16_t cy;     // 重心 Y
+    uint16_t minX;
+    uint16_t minY;
+    uint16_t maxX;
+    uint16_t maxY;
+};
+
+// 背景差分 → 二値化 → モルフォロジー(オープニング) → 行ストリーミングのラベリング
+// 入力は縮小済みのグレースケール画像 (1画素1バイト)。Arduino に依存しないのでホストでもビルドできる。
+class FishCounter
+{
+public:
+    static const size_t MAX_LABELS = 512; // 1フレーム内の仮ラベル上限
+    static const size_t MAX_BLOBS = 64;   // 結果として保持するブロブ数
+
+    FishCounter();
+    ~FishCounter();
+
+    bool begin(uint16_t width, uint16_t height);
+    void end();
+
+    // 1フレーム処理して検出した魚の数を返す。最初のフレームは背景の初期化のみ (0 を返す)
+    int process(const uint8_t *gray);
+
+    void resetBackground() { bgReady = false; }
+
+    uint8_t threshold = 24;      // 背景との差分のしきい値
+    uint8_t learnShift = 5;      // 背景更新率 = 1 / 2^learnShift
+    uint32_t minArea = 6;        // これより小さいブロブはノイズとして捨てる
+    uint32_t maxArea = 4000;     // これより大きいブロブは照明変化などとして捨てる
+
+    uint16_t width() const { return w; }
+    uint16_t height() const { return h; }
+    size_t blobCount() const { return nBlobs; }
+    const FishBlob &blob(size_t i) const { return blobs[i]; }
+    const uint8_t *mask() const { return maskBuf; }
+
+private:
+    struct Run
+    {
+        uint16_t x0;
+        uint16_t x1; // 終端 (含む)
+        uint16_t label;
+    };
+
+    struct LabelStat
+    {
+        uint32_t area;
+        uint32_t sumX;
+        uint32_t sumY;
+        uint16_t minX, minY, maxX, maxY;
+    };
+
+    void subtract(const uint8_t *gray);
+    void open3x3();
+    void label();
+
+    uint16_t newLabel();
+    uint16_t findRoot(uint16_t l);
+    void unite(uint16_t a, uint16_t b);
+
+    uint16_t w = 0;
+    uint16_t h = 0;
+    bool bgReady = false;
+
+    uint16_t *bg = nullptr;  // 背景 (8.8 固定小数)
+    uint8_t *maskBuf = nullptr;
+    uint8_t *tmpBuf = nullptr;
+    Run *prevRuns = nullptr;
+    Run *curRuns = nullptr;
+
+    uint16_t parent[MAX_LABELS];
+    LabelStat stats[MAX_LABELS];
+    uint16_t nLabels = 0;
+    bool labelOverflow = false;
+
+    FishBlob blobs[MAX_BLOBS];
+    size_t nBlobs = 0;
+};
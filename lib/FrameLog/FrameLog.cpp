@@ -0,0 +1,619 @@
+#include "FrameLog.h"
+
+#include <Arduino.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const uint8_t SEGMENT_MAGIC[4] = {'F', 'L', 'S', '1'};
+static const uint8_t RECORD_MAGIC[4] = {'F', 'R', 'E', 'C'};
+static const uint8_t INDEX_MAGIC[4] = {'F', 'L', 'I', '1'};
+static const uint32_t SEGMENT_HEADER_SIZE = 8;
+static const uint32_t RECORD_HEADER_SIZE = 20;
+static const uint32_t INDEX_HEADER_SIZE = 24;
+static const uint32_t INDEX_ENTRY_SIZE = 12;
+
+static void put32(uint8_t *p, uint32_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+static void put64(uint8_t *p, uint64_t v)
+{
+    put32(p, (uint32_t)v);
+    put32(p + 4, (uint32_t)(v >> 32));
+}
+
+static uint32_t get32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint64_t get64(const uint8_t *p)
+{
+    return (uint64_t)get32(p) | (uint64_t)get32(p + 4) << 32;
+}
+
+static uint32_t padded(uint32_t len)
+{
+    return (len + 3) & ~3u;
+}
+
+// レコードのヘッダーを読む。壊れていれば false
+static bool readRecordHeader(File &f, uint32_t pos, uint32_t limit, uint64_t *ts, uint32_t *len, uint32_t *crc)
+{
+    uint8_t h[RECORD_HEADER_SIZE];
+    if (pos + RECORD_HEADER_SIZE > limit || !f.seek(pos) || f.read(h, sizeof(h)) != sizeof(h) || memcmp(h, RECORD_MAGIC, 4) != 0)
+    {
+        return false;
+    }
+    *ts = get64(h + 4);
+    *len = get32(h + 12);
+    *crc = get32(h + 16);
+    return *len > 0 && pos + RECORD_HEADER_SIZE + *len <= limit;
+}
+
+uint32_t FrameLog::crc32(const uint8_t *data, size_t len, uint32_t crc)
+{
+    static uint32_t table[256];
+    static bool ready = false;
+    if (!ready)
+    {
+        for (uint32_t i = 0; i < 256; i++)
+        {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++)
+            {
+                c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            }
+            table[i] = c;
+        }
+        ready = true;
+    }
+    crc = ~crc;
+    while (len--)
+    {
+        crc = table[(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+FrameLog::FrameLog()
+{
+}
+
+FrameLog::~FrameLog()
+{
+    end();
+}
+
+void FrameLog::lock()
+{
+#if defined(ARDUINO_ARCH_ESP32)
+    xSemaphoreTake(mutex, portMAX_DELAY);
+#endif
+}
+
+void FrameLog::unlock()
+{
+#if defined(ARDUINO_ARCH_ESP32)
+    xSemaphoreGive(mutex);
+#endif
+}
+
+void FrameLog::segmentPath(char *out, size_t size, uint32_t number, const char *ext) const
+{
+    snprintf(out, size, "%s/%08lu.%s", dir, (unsigned long)number, ext);
+}
+
+bool FrameLog::begin(fs::FS &filesystem, const char *directory)
+{
+    end();
+#if defined(ARDUINO_ARCH_ESP32)
+    mutex = xSemaphoreCreateMutex();
+    if (!mutex)
+    {
+        return false;
+    }
+#endif
+    fs = &filesystem;
+    snprintf(dir, sizeof(dir), "%s", directory);
+    fs->mkdir(dir);
+
+    // セグメントの番号を集めて古い順に並べる (多すぎる分は古いほうを捨てる)
+    uint32_t numbers[MAX_SEGMENTS];
+    size_t count = 0;
+    File d = fs->open(dir);
+    for (File f = d.openNextFile(); f; f = d.openNextFile())
+    {
+        const char *name = strrchr(f.name(), '/');
+        name = name ? name + 1 : f.name();
+        const char *ext = strrchr(name, '.');
+        if (!ext || strcmp(ext, ".seg") != 0)
+        {
+            continue;
+        }
+        uint32_t n = strtoul(name, NULL, 10);
+        if (count == MAX_SEGMENTS)
+        {
+            if (n < numbers[0])
+            {
+                continue;
+            }
+            memmove(numbers, numbers + 1, (MAX_SEGMENTS - 1) * sizeof(uint32_t));
+            count--;
+        }
+        size_t i = count++;
+        while (i > 0 && numbers[i - 1] > n)
+        {
+            numbers[i] = numbers[i - 1];
+            i--;
+        }
+        numbers[i] = n;
+    }
+    d.close();
+
+    // 閉じたセグメントは索引の見出しから時刻の範囲だけを読む
+    char path[48];
+    nSegments = 0;
+    for (size_t i = 0; i + 1 < count; i++)
+    {
+        Segment &seg = segments[nSegments];
+        seg.number = numbers[i];
+        seg.firstMs = seg.lastMs = 0;
+        segmentPath(path, sizeof(path), seg.number, "idx");
+        File idx = fs->open(path, "r");
+        uint8_t h[INDEX_HEADER_SIZE];
+        if (idx && idx.read(h, sizeof(h)) == sizeof(h) && memcmp(h, INDEX_MAGIC, 4) == 0 &&
+            idx.size() == INDEX_HEADER_SIZE + get32(h + 4) * INDEX_ENTRY_SIZE)
+        {
+            seg.firstMs = get64(h + 8);
+            seg.lastMs = get64(h + 16);
+        }
+        else
+        {
+            // 索引が壊れていればレコードの見出しをたどる (CRC は見ない)
+            segmentPath(path, sizeof(path), seg.number, "seg");
+            File f = fs->open(path, "r");
+            uint32_t limit = f ? f.size() : 0;
+            uint32_t pos = SEGMENT_HEADER_SIZE;
+            uint64_t ts;
+            uint32_t len, crc;
+            while (readRecordHeader(f, pos, limit, &ts, &len, &crc))
+            {
+                if (!seg.firstMs)
+                {
+                    seg.firstMs = ts;
+                }
+                seg.lastMs = ts;
+                pos += RECORD_HEADER_SIZE + padded(len);
+            }
+        }
+        if (seg.lastMs)
+        {
+            nSegments++;
+        }
+    }
+
+    if (!count)
+    {
+        return openSegment(0);
+    }
+    segments[nSegments].number = numbers[count - 1];
+    segments[nSegments].firstMs = segments[nSegments].lastMs = 0;
+    nSegments++;
+    return recoverTail();
+}
+
+// 最後のセグメントを先頭から CRC を確かめながら読み、壊れていない所までを有効にする
+bool FrameLog::recoverTail()
+{
+    unsigned long start = millis();
+    Segment &seg = segments[nSegments - 1];
+    char path[48];
+    segmentPath(path, sizeof(path), seg.number, "idx");
+    fs->remove(path); // 閉じるときに書き直す
+    segmentPath(path, sizeof(path), seg.number, "seg");
+    tail = fs->open(path, "r+");
+    if (!tail)
+    {
+        return false;
+    }
+
+    uint8_t *buf = (uint8_t *)malloc(4096);
+    if (!buf)
+    {
+        tail.close();
+        return false;
+    }
+    uint32_t limit = tail.size();
+    uint32_t pos = SEGMENT_HEADER_SIZE;
+    uint64_t ts;
+    uint32_t len, crc;
+    nTailIndex = 0;
+    while (readRecordHeader(tail, pos, limit, &ts, &len, &crc))
+    {
+        uint32_t c = 0;
+        for (uint32_t done = 0; done < len;)
+        {
+            size_t k = len - done < 4096 ? len - done : 4096;
+            if (tail.read(buf, k) != k)
+            {
+                break;
+            }
+            c = crc32(buf, k, c);
+            done += k;
+        }
+        if (c != crc)
+        {
+            break;
+        }
+        if (!seg.firstMs)
+        {
+            seg.firstMs = ts;
+        }
+        seg.lastMs = ts;
+        if (nTailIndex < MAX_TAIL_INDEX && (!nTailIndex || ts - tailIndex[nTailIndex - 1].timestampMs >= indexIntervalMs))
+        {
+            tailIndex[nTailIndex].timestampMs = ts;
+            tailIndex[nTailIndex].offset = pos;
+            nTailIndex++;
+        }
+        pos += RECORD_HEADER_SIZE + padded(len);
+    }
+    free(buf);
+
+    if (limit < SEGMENT_HEADER_SIZE)
+    {
+        // 見出しも書けていなかった
+        uint8_t h[SEGMENT_HEADER_SIZE];
+        memcpy(h, SEGMENT_MAGIC, 4);
+        put32(h + 4, seg.number);
+        tail.seek(0);
+        tail.write(h, sizeof(h));
+        limit = SEGMENT_HEADER_SIZE;
+    }
+    discarded = limit > pos ? limit - pos : 0;
+    tailPos = pos;
+    tail.seek(tailPos); // 後ろの書きかけは次のレコードで上書きする
+    recoveryTime = millis() - start;
+    return true;
+}
+
+bool FrameLog::openSegment(uint32_t number)
+{
+    char path[48];
+    segmentPath(path, sizeof(path), number, "seg");
+    tail = fs->open(path, "w");
+    if (!tail)
+    {
+        return false;
+    }
+    uint8_t h[SEGMENT_HEADER_SIZE];
+    memcpy(h, SEGMENT_MAGIC, 4);
+    put32(h + 4, number);
+    if (tail.write(h, sizeof(h)) != sizeof(h))
+    {
+        tail.close();
+        return false;
+    }
+    tail.flush();
+    tailPos = SEGMENT_HEADER_SIZE;
+    nTailIndex = 0;
+
+    // maxSegments が 0 でも書いている1つは残す
+    size_t keep = maxSegments < 1 ? 1 : maxSegments < MAX_SEGMENTS ? maxSegments : MAX_SEGMENTS;
+    lock();
+    while (nSegments >= keep)
+    {
+        dropOldest();
+    }
+    segments[nSegments].number = number;
+    segments[nSegments].firstMs = segments[nSegments].lastMs = 0;
+    nSegments++;
+    unlock();
+    return true;
+}
+
+bool FrameLog::closeSegment()
+{
+    const Segment &seg = segments[nSegments - 1];
+    tail.close();
+
+    char path[48];
+    segmentPath(path, sizeof(path), seg.number, "idx");
+    File idx = fs->open(path, "w");
+    if (!idx)
+    {
+        return false;
+    }
+    uint8_t h[INDEX_HEADER_SIZE];
+    memcpy(h, INDEX_MAGIC, 4);
+    put32(h + 4, nTailIndex);
+    put64(h + 8, seg.firstMs);
+    put64(h + 16, seg.lastMs);
+    bool ok = idx.write(h, sizeof(h)) == sizeof(h);
+    for (size_t i = 0; ok && i < nTailIndex; i++)
+    {
+        uint8_t e[INDEX_ENTRY_SIZE];
+        put64(e, tailIndex[i].timestampMs);
+        put32(e + 8, tailIndex[i].offset);
+        ok = idx.write(e, sizeof(e)) == sizeof(e);
+    }
+    idx.close();
+    return ok;
+}
+
+void FrameLog::dropOldest()
+{
+    if (!nSegments)
+    {
+        return;
+    }
+    char path[48];
+    segmentPath(path, sizeof(path), segments[0].number, "seg");
+    fs->remove(path);
+    segmentPath(path, sizeof(path), segments[0].number, "idx");
+    fs->remove(path);
+    memmove(segments, segments + 1, (nSegments - 1) * sizeof(Segment));
+    nSegments--;
+}
+
+void FrameLog::end()
+{
+    if (tail)
+    {
+        tail.close();
+    }
+    nSegments = 0;
+    nTailIndex = 0;
+    fs = nullptr;
+#if defined(ARDUINO_ARCH_ESP32)
+    if (mutex)
+    {
+        vSemaphoreDelete(mutex);
+        mutex = nullptr;
+    }
+#endif
+}
+
+bool FrameLog::append(const uint8_t *jpg, size_t len, uint64_t timestampMs)
+{
+    if (!fs || !tail || !len)
+    {
+        return false;
+    }
+    uint32_t recordSize = RECORD_HEADER_SIZE + padded((uint32_t)len);
+    if (tailPos + recordSize > segmentBytes && tailPos > SEGMENT_HEADER_SIZE)
+    {
+        uint32_t next = segments[nSegments - 1].number + 1;
+        closeSegment();
+        if (!openSegment(next))
+        {
+            return false;
+        }
+    }
+
+    uint8_t h[RECORD_HEADER_SIZE];
+    memcpy(h, RECORD_MAGIC, 4);
+    put64(h + 4, timestampMs);
+    put32(h + 12, (uint32_t)len);
+    put32(h + 16, crc32(jpg, len));
+    static const uint8_t pad[4] = {0, 0, 0, 0};
+    size_t padLen = padded((uint32_t)len) - len;
+    if (tail.write(h, sizeof(h)) != sizeof(h) || tail.write(jpg, len) != len || (padLen && tail.write(pad, padLen) != padLen))
+    {
+        // 書きかけのレコードは CRC で弾かれるので、次は同じ位置から書き直す
+        tail.seek(tailPos);
+        return false;
+    }
+    tail.flush();
+
+    lock();
+    Segment &seg = segments[nSegments - 1];
+    if (!seg.firstMs)
+    {
+        seg.firstMs = timestampMs;
+    }
+    seg.lastMs = timestampMs;
+    if (nTailIndex < MAX_TAIL_INDEX && (!nTailIndex || timestampMs - tailIndex[nTailIndex - 1].timestampMs >= indexIntervalMs))
+    {
+        tailIndex[nTailIndex].timestampMs = timestampMs;
+        tailIndex[nTailIndex].offset = tailPos;
+        nTailIndex++;
+    }
+    tailPos += recordSize;
+    unlock();
+    return true;
+}
+
+// 索引から fromMs より前で一番近いレコードの位置を探す
+bool FrameLog::seekHint(const Segment &seg, uint64_t fromMs, uint32_t *offset)
+{
+    *offset = SEGMENT_HEADER_SIZE;
+    lock();
+    bool isTail = nSegments && segments[nSegments - 1].number == seg.number;
+    if (isTail)
+    {
+        for (size_t i = 0; i < nTailIndex && tailIndex[i].timestampMs <= fromMs; i++)
+        {
+            *offset = tailIndex[i].offset;
+        }
+    }
+    unlock();
+    if (isTail)
+    {
+        return true;
+    }
+
+    char path[48];
+    segmentPath(path, sizeof(path), seg.number, "idx");
+    File idx = fs->open(path, "r");
+    uint8_t h[INDEX_HEADER_SIZE];
+    if (!idx || idx.read(h, sizeof(h)) != sizeof(h) || memcmp(h, INDEX_MAGIC, 4) != 0)
+    {
+        return false;
+    }
+    uint32_t count = get32(h + 4);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        uint8_t e[INDEX_ENTRY_SIZE];
+        if (idx.read(e, sizeof(e)) != sizeof(e) || get64(e) > fromMs)
+        {
+            break;
+        }
+        *offset = get32(e + 8);
+    }
+    return true;
+}
+
+bool FrameLog::scan(uint64_t fromMs, uint64_t toMs, RecordVisitor visit, void *ctx)
+{
+    if (!fs)
+    {
+        return false;
+    }
+    bool first = true;
+    uint32_t previous = 0;
+    while (true)
+    {
+        // 時刻の範囲が重なる次のセグメント (ロックは表を見る間だけ)
+        // 書いているセグメントは tailPos まで (後ろには起動時に捨てた書きかけが残っていることがある)
+        Segment seg;
+        bool found = false;
+        uint32_t end = UINT32_MAX;
+        lock();
+        for (size_t i = 0; i < nSegments; i++)
+        {
+            if ((first || segments[i].number > previous) && segments[i].lastMs && segments[i].lastMs >= fromMs)
+            {
+                seg = segments[i];
+                found = true;
+                if (i + 1 == nSegments)
+                {
+                    end = tailPos;
+                }
+                break;
+            }
+        }
+        unlock();
+        if (!found || seg.firstMs > toMs)
+        {
+            return true;
+        }
+        first = false;
+        previous = seg.number;
+
+        uint32_t pos;
+        seekHint(seg, fromMs, &pos);
+        char path[48];
+        segmentPath(path, sizeof(path), seg.number, "seg");
+        File f = fs->open(path, "r");
+        uint32_t limit = f ? f.size() : 0;
+        if (limit > end)
+        {
+            limit = end;
+        }
+        uint64_t ts;
+        uint32_t len, crc;
+        while (readRecordHeader(f, pos, limit, &ts, &len, &crc))
+        {
+            if (ts > toMs)
+            {
+                return true;
+            }
+            if (ts >= fromMs)
+            {
+                FrameLogRecord rec = {ts, seg.number, pos + RECORD_HEADER_SIZE, len};
+                if (!visit(ctx, rec))
+                {
+                    return true;
+                }
+            }
+            pos += RECORD_HEADER_SIZE + padded(len);
+        }
+    }
+}
+
+static bool takeFirst(void *ctx, const FrameLogRecord &rec)
+{
+    *(FrameLogRecord *)ctx = rec;
+    return false;
+}
+
+bool FrameLog::findAt(uint64_t timestampMs, FrameLogRecord *rec)
+{
+    rec->length = 0;
+    scan(timestampMs, UINT64_MAX, takeFirst, rec);
+    return rec->length != 0;
+}
+
+struct ListContext
+{
+    FrameLogRecord *out;
+    size_t max;
+    size_t n;
+};
+
+static bool collect(void *arg, const FrameLogRecord &rec)
+{
+    ListContext *ctx = (ListContext *)arg;
+    ctx->out[ctx->n++] = rec;
+    return ctx->n < ctx->max;
+}
+
+size_t FrameLog::list(uint64_t fromMs, uint64_t toMs, FrameLogRecord *out, size_t max)
+{
+    if (!max)
+    {
+        return 0;
+    }
+    ListContext ctx = {out, max, 0};
+    scan(fromMs, toMs, collect, &ctx);
+    return ctx.n;
+}
+
+File FrameLog::open(const FrameLogRecord &rec)
+{
+    if (!fs)
+    {
+        return File();
+    }
+    char path[48];
+    segmentPath(path, sizeof(path), rec.segment, "seg");
+    File f = fs->open(path, "r");
+    if (f && !f.seek(rec.offset))
+    {
+        f.close();
+    }
+    return f;
+}
+
+bool FrameLog::verify(const FrameLogRecord &rec)
+{
+    char path[48];
+    segmentPath(path, sizeof(path), rec.segment, "seg");
+    File f = fs ? fs->open(path, "r") : File();
+    uint64_t ts;
+    uint32_t len, crc;
+    if (!f || !readRecordHeader(f, rec.offset - RECORD_HEADER_SIZE, f.size(), &ts, &len, &crc) || len != rec.length)
+    {
+        return false;
+    }
+    uint8_t buf[256];
+    uint32_t c = 0;
+    for (uint32_t done = 0; done < len;)
+    {
+        size_t k = len - done < sizeof(buf) ? len - done : sizeof(buf);
+        if (f.read(buf, k) != k)
+        {
+            return false;
+        }
+        c = crc32(buf, k, c);
+        done += k;
+    }
+    return c == crc;
+}
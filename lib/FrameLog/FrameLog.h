@@ -0,0 +1,101 @@
+#pragma once
+
+#include <FS.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(ARDUINO_ARCH_ESP32)
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#endif
+
+// SD / LittleFS に JPEG を追記していくだけのフレームログ
+//
+//   <dir>/<n>.seg  セグメント (segmentBytes まで)。"FLS1" のあとにレコードが並ぶ
+//                  レコード = "FREC" + 時刻 (ms, 8) + 長さ (4) + CRC32 (4) + JPEG (4 バイト境界まで詰める)
+//   <dir>/<n>.idx  閉じたセグメントの疎な索引。indexIntervalMs ごとに (時刻, 位置) を1つ
+//
+// 電源が落ちても壊れるのは書きかけの最後のレコードだけなので、起動時は最後のセグメントだけを読み直して
+// CRC の合う所までを有効とし、その後ろから書き続ける。古いセグメントから消していく
+struct FrameLogRecord
+{
+    uint64_t timestampMs;
+    uint32_t segment;
+    uint32_t offset; // JPEG の先頭の位置
+    uint32_t length;
+};
+
+class FrameLog
+{
+public:
+    static const size_t MAX_SEGMENTS = 64;
+    static const size_t MAX_TAIL_INDEX = 512;
+
+    uint32_t segmentBytes = 4 * 1024 * 1024;
+    uint32_t maxSegments = MAX_SEGMENTS; // これを超えたら一番古いセグメントを消す (0 でも書いている1つは残す)
+    uint32_t indexIntervalMs = 10000;
+
+    FrameLog();
+    ~FrameLog();
+
+    bool begin(fs::FS &fs, const char *dir);
+    void end();
+
+    bool append(const uint8_t *jpg, size_t len, uint64_t timestampMs);
+
+    // timestampMs 以降で最初のフレーム
+    bool findAt(uint64_t timestampMs, FrameLogRecord *rec);
+    // from から to までのフレームを古い順に最大 max 個
+    size_t list(uint64_t fromMs, uint64_t toMs, FrameLogRecord *out, size_t max);
+    // JPEG の先頭に位置を合わせたファイルを開く (HTTP で小分けに送る用)。セグメントが消されていたら開けない
+    File open(const FrameLogRecord &rec);
+    // 読んだ JPEG が書いたときのものと同じか
+    bool verify(const FrameLogRecord &rec);
+
+    size_t segmentCount() const { return nSegments; }
+    uint64_t firstTimestamp() const { return nSegments ? segments[0].firstMs : 0; }
+    uint64_t lastTimestamp() const { return nSegments ? segments[nSegments - 1].lastMs : 0; }
+    uint32_t recoveredBytes() const { return discarded; } // 起動時に捨てた書きかけのバイト数
+    uint32_t recoveryMs() const { return recoveryTime; }
+
+    static uint32_t crc32(const uint8_t *data, size_t len, uint32_t crc = 0);
+
+private:
+    struct Segment
+    {
+        uint32_t number;
+        uint64_t firstMs;
+        uint64_t lastMs;
+    };
+    struct IndexEntry
+    {
+        uint64_t timestampMs;
+        uint32_t offset; // レコードの先頭
+    };
+
+    typedef bool (*RecordVisitor)(void *ctx, const FrameLogRecord &rec);
+
+    void segmentPath(char *out, size_t size, uint32_t number, const char *ext) const;
+    bool recoverTail();
+    bool openSegment(uint32_t number);
+    bool closeSegment();
+    void dropOldest();
+    bool seekHint(const Segment &seg, uint64_t fromMs, uint32_t *offset);
+    bool scan(uint64_t fromMs, uint64_t toMs, RecordVisitor visit, void *ctx);
+    void lock();
+    void unlock();
+
+    fs::FS *fs = nullptr;
+    char dir[24] = "";
+    File tail;
+    uint32_t tailPos = 0;
+    Segment segments[MAX_SEGMENTS];
+    size_t nSegments = 0;
+    IndexEntry tailIndex[MAX_TAIL_INDEX];
+    size_t nTailIndex = 0;
+    uint32_t discarded = 0;
+    uint32_t recoveryTime = 0;
+#if defined(ARDUINO_ARCH_ESP32)
+    SemaphoreHandle_t mutex = nullptr;
+#endif
+};
@@ -0,0 +1,55 @@
+#include "FrameQuality.h"
+
+FrameQualityScore FrameQuality::score(const uint8_t *gray, uint16_t width, uint16_t height, const FrameQualityConfig &config)
+{
+    FrameQualityScore s = {};
+    size_t n = (size_t)width * height;
+    if (!gray || width < 3 || height < 3)
+    {
+        return s;
+    }
+
+    // 露出: 平均とクリップした画素数
+    uint32_t sum = 0;
+    uint32_t dark = 0;
+    uint32_t bright = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+        uint8_t v = gray[i];
+        sum += v;
+        if (v <= config.clipLow)
+        {
+            dark++;
+        }
+        else if (v >= config.clipHigh)
+        {
+            bright++;
+        }
+    }
+    s.mean = (uint8_t)(sum / n);
+    s.darkPercent = (uint8_t)(dark * 100 / n);
+    s.brightPercent = (uint8_t)(bright * 100 / n);
+    s.exposureOk = s.mean >= config.minMean && s.mean <= config.maxMean && s.darkPercent + s.brightPercent <= config.maxClipPercent;
+
+    // 鮮鋭度: 4近傍ラプラシアンの分散
+    int64_t lapSum = 0;
+    uint64_t lapSq = 0;
+    for (uint16_t y = 1; y < height - 1; y++)
+    {
+        const uint8_t *up = gray + (size_t)(y - 1) * width;
+        const uint8_t *row = gray + (size_t)y * width;
+        const uint8_t *down = gray + (size_t)(y + 1) * width;
+        for (uint16_t x = 1; x < width - 1; x++)
+        {
+            int32_t lap = (int32_t)up[x] + down[x] + row[x - 1] + row[x + 1] - 4 * (int32_t)row[x];
+            lapSum += lap;
+            lapSq += (uint64_t)(lap * lap);
+        }
+    }
+    uint32_t m = (uint32_t)(width - 2) * (height - 2);
+    int64_t meanLap = lapSum / m;
+    int64_t var = (int64_t)(lapSq / m) - meanLap * meanLap;
+    s.sharpness = var > 0 ? (uint32_t)var : 0;
+    s.sharpOk = s.sharpness >= config.minSharpness;
+    return s;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// 画質判定のしきい値
+struct FrameQualityConfig
+{
+    uint32_t minSharpness = 40; // ラプラシアンの分散の下限 (ぼけ・濁り)
+    uint8_t minMean = 35;       // 平均輝度の下限 (暗すぎ)
+    uint8_t maxMean = 215;      // 平均輝度の上限 (明るすぎ)
+    uint8_t clipLow = 8;        // これ以下を黒つぶれとみなす
+    uint8_t clipHigh = 247;     // これ以上を白とびとみなす
+    uint8_t maxClipPercent = 20; // 黒つぶれ・白とびの画素の割合の上限 (%)
+};
+
+struct FrameQualityScore
+{
+    uint32_t sharpness;  // ラプラシアンの分散
+    uint8_t mean;        // 平均輝度
+    uint8_t darkPercent; // 黒つぶれの割合 (%)
+    uint8_t brightPercent; // 白とびの割合 (%)
+    bool sharpOk;
+    bool exposureOk;
+
+    bool ok() const { return sharpOk && exposureOk; }
+};
+
+// 縮小した輝度画像からぼけ・露出不良を判定する。整数演算のみでホストでもビルドできる
+class FrameQuality
+{
+public:
+    static FrameQualityScore score(const uint8_t *gray, uint16_t width, uint16_t height, const FrameQualityConfig &config);
+};
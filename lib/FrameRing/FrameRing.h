@@ -0,0 +1,114 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+
+// タスク間でフレームを渡すときの記述子。中身はコピーせず、持ち主 (handle、camera_fb_t など) を一緒に渡す
+// 複数の受け手に配るときは refs に共有のカウンタを指させ、配る数だけ frameRetain() し、最後に frameRelease() した側が返す
+struct FrameDescriptor
+{
+    const uint8_t *data;
+    uint32_t len;
+    uint32_t seq;
+    uint64_t timestampMs;
+    void *handle;                 // 返すときに使う持ち主 (camera_fb_t * など)
+    std::atomic<uint32_t> *refs;  // NULL なら受け手は1つ
+};
+
+inline void frameRetain(const FrameDescriptor &f, uint32_t n = 1)
+{
+    if (f.refs)
+    {
+        f.refs->fetch_add(n, std::memory_order_relaxed);
+    }
+}
+
+// 最後の参照を手放したら true (呼んだ側が handle を返す)
+inline bool frameRelease(const FrameDescriptor &f)
+{
+    if (!f.refs)
+    {
+        return true;
+    }
+    return f.refs->fetch_sub(1, std::memory_order_acq_rel) == 1;
+}
+
+// 書き手1つ・読み手1つのロックのないリング (ヘッダだけ)。N は 2 のべき
+// 添字は折り返す 32 ビットのカウンタで、書き手は head、読み手は tail だけを書く。
+// push は要素を書いてから head を release で進め、pop は head を acquire で読んでから要素を読むので、
+// 別のコアから見ても要素が書き終わる前に読まれることはない。相手の添字は手元に覚えておき、
+// 足りなくなったときだけ読み直す (コア間の読み合いを減らす)。head と tail は別のキャッシュラインに置く
+template <typename T, size_t N>
+class SpscRing
+{
+    static_assert(N >= 2 && (N & (N - 1)) == 0, "SpscRing size must be a power of two");
+
+public:
+    static const size_t LINE = 64;
+
+    static constexpr size_t capacity() { return N; }
+
+    // 書き手だけが呼ぶ。いっぱいなら false
+    bool push(const T &v)
+    {
+        uint32_t h = head.load(std::memory_order_relaxed);
+        if (h - tailCache == N)
+        {
+            tailCache = tail.load(std::memory_order_acquire);
+            if (h - tailCache == N)
+            {
+                return false;
+            }
+        }
+        slots[h & (N - 1)] = v;
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    // 読み手だけが呼ぶ。空なら false
+    bool pop(T &out)
+    {
+        const T *f = front();
+        if (!f)
+        {
+            return false;
+        }
+        out = *f;
+        popFront();
+        return true;
+    }
+
+    // 読み手だけが呼ぶ。先頭をコピーせずに見る (popFront() までは書き手に上書きされない)
+    const T *front()
+    {
+        uint32_t t = tail.load(std::memory_order_relaxed);
+        if (t == headCache)
+        {
+            headCache = head.load(std::memory_order_acquire);
+            if (t == headCache)
+            {
+                return nullptr;
+            }
+        }
+        return &slots[t & (N - 1)];
+    }
+
+    void popFront()
+    {
+        tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    // どちらからでも呼べるが、相手が動いている間は目安
+    size_t size() const { return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire); }
+    bool empty() const { return size() == 0; }
+
+private:
+    // 書き手の欄
+    alignas(LINE) std::atomic<uint32_t> head{0};
+    uint32_t tailCache = 0;
+    // 読み手の欄
+    alignas(LINE) std::atomic<uint32_t> tail{0};
+    uint32_t headCache = 0;
+    alignas(LINE) T slots[N];
+};
@@ -0,0 +1,587 @@
+#include "JpegDc.h"
+
+#include <string.h>
+
+// JPEG 規格 Annex K の標準ハフマンテーブル (DHT を省略した JPEG 用)
+static const uint8_t STD_DC_LUMA_BITS[16] = {0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0};
+static const uint8_t STD_DC_CHROMA_BITS[16] = {0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0};
+static const uint8_t STD_DC_VALS[12] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11};
+static const uint8_t STD_AC_LUMA_BITS[16] = {0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d};
+static const uint8_t STD_AC_LUMA_VALS[162] = {
+    0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+    0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08, 0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0,
+    0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+    0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+    0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+    0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+    0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
+    0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5,
+    0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+    0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+    0xf9, 0xfa};
+static const uint8_t STD_AC_CHROMA_BITS[16] = {0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77};
+static const uint8_t STD_AC_CHROMA_VALS[162] = {
+    0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
+    0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91, 0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0,
+    0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
+    0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+    0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+    0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+    0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5,
+    0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3,
+    0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+    0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+    0xf9, 0xfa};
+
+static inline uint16_t readU16(const uint8_t *p)
+{
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static inline uint8_t clamp8(int v)
+{
+    return v < 0 ? 0 : (v > 255 ? 255 : (uint8_t)v);
+}
+
+JpegDcDecoder::JpegDcDecoder()
+{
+    memset(dcTables, 0, sizeof(dcTables));
+    memset(acTables, 0, sizeof(acTables));
+}
+
+bool JpegDcDecoder::buildHuffman(Huffman &t, const uint8_t *bits, const uint8_t *vals)
+{
+    int total = 0;
+    for (int i = 0; i < 16; i++)
+    {
+        total += bits[i];
+    }
+    if (total > 256)
+    {
+        return false;
+    }
+    memcpy(t.values, vals, total);
+    memset(t.fast, 0, sizeof(t.fast));
+    memset(t.skip, 0, sizeof(t.skip));
+
+    int code = 0;
+    int k = 0;
+    for (int len = 1; len <= 16; len++)
+    {
+        t.valOffset[len] = k - code;
+        for (int i = 0; i < bits[len - 1]; i++, k++, code++)
+        {
+            if (len <= FAST_BITS)
+            {
+                // AC の付加ビットは値を見ずに読み飛ばすので、シンボルから飛ばす長さが決まる
+                int r = t.values[k] >> 4;
+                int s = t.values[k] & 0x0F;
+                uint16_t skip = (uint16_t)(0x8000 | ((s ? r + 1 : (r == 15 ? 16 : 0)) << 5) | (len + s));
+                int shift = FAST_BITS - len;
+                for (int j = 0; j < (1 << shift); j++)
+                {
+                    t.fast[(code << shift) | j] = (uint16_t)((len << 8) | t.values[k]);
+                    t.skip[(code << shift) | j] = skip;
+                }
+            }
+        }
+        t.maxCode[len] = bits[len - 1] ? code - 1 : -1;
+        code <<= 1;
+    }
+    t.maxCode[17] = 0x7FFFFFFF;
+    t.defined = true;
+    return true;
+}
+
+void JpegDcDecoder::loadDefaultHuffman()
+{
+    if (!dcTables[0].defined)
+    {
+        buildHuffman(dcTables[0], STD_DC_LUMA_BITS, STD_DC_VALS);
+    }
+    if (!dcTables[1].defined)
+    {
+        buildHuffman(dcTables[1], STD_DC_CHROMA_BITS, STD_DC_VALS);
+    }
+    if (!acTables[0].defined)
+    {
+        buildHuffman(acTables[0], STD_AC_LUMA_BITS, STD_AC_LUMA_VALS);
+    }
+    if (!acTables[1].defined)
+    {
+        buildHuffman(acTables[1], STD_AC_CHROMA_BITS, STD_AC_CHROMA_VALS);
+    }
+}
+
+// SOI からスキャン開始までのマーカーを読む。stopAtFrame なら SOF を読んだ時点で終わる
+bool JpegDcDecoder::parseHeaders(const uint8_t *jpg, size_t len, bool stopAtFrame)
+{
+    if (len < 4 || jpg[0] != 0xFF || jpg[1] != 0xD8)
+    {
+        return false;
+    }
+    for (int i = 0; i < 4; i++)
+    {
+        dcTables[i].defined = false;
+        acTables[i].defined = false;
+        dcQuant[i] = 1;
+    }
+    restartInterval = 0;
+    width = height = 0;
+    nComp = 0;
+    scanData = nullptr;
+
+    const uint8_t *p = jpg + 2;
+    const uint8_t *e = jpg + len;
+    while (p + 4 <= e)
+    {
+        if (p[0] != 0xFF)
+        {
+            return false;
+        }
+        uint8_t marker = p[1];
+        if (marker == 0xFF)
+        {
+            p++;
+            continue;
+        }
+        uint16_t segLen = readU16(p + 2);
+        const uint8_t *seg = p + 4;
+        const uint8_t *segEnd = p + 2 + segLen;
+        if (segLen < 2 || segEnd > e)
+        {
+            return false;
+        }
+
+        switch (marker)
+        {
+        case 0xC0: // SOF0
+        case 0xC1: // SOF1
+        {
+            if (segLen < 8)
+            {
+                return false;
+            }
+            height = readU16(seg + 1);
+            width = readU16(seg + 3);
+            nComp = seg[5];
+            if (nComp != 1 && nComp != 3)
+            {
+                return false;
+            }
+            if (segLen < 8 + 3 * nComp)
+            {
+                return false;
+            }
+            hMax = vMax = 1;
+            for (int i = 0; i < nComp; i++)
+            {
+                comp[i].id = seg[6 + i * 3];
+                comp[i].h = seg[7 + i * 3] >> 4;
+                comp[i].v = seg[7 + i * 3] & 0x0F;
+                comp[i].tq = seg[8 + i * 3] & 0x03;
+                if (comp[i].h == 0 || comp[i].v == 0 || comp[i].h > 2 || comp[i].v > 2)
+                {
+                    return false;
+                }
+                if (comp[i].h > hMax)
+                {
+                    hMax = comp[i].h;
+                }
+                if (comp[i].v > vMax)
+                {
+                    vMax = comp[i].v;
+                }
+            }
+            if (stopAtFrame)
+            {
+                return width && height;
+            }
+            break;
+        }
+        case 0xC2: // プログレッシブなどは対象外
+        case 0xC3:
+        case 0xC5:
+        case 0xC6:
+        case 0xC7:
+        case 0xC9:
+        case 0xCA:
+        case 0xCB:
+        case 0xCD:
+        case 0xCE:
+        case 0xCF:
+            return false;
+        case 0xC4: // DHT
+        {
+            const uint8_t *q = seg;
+            while (q + 17 <= segEnd)
+            {
+                uint8_t tc = q[0] >> 4;
+                uint8_t th = q[0] & 0x03;
+                const uint8_t *bits = q + 1;
+                int total = 0;
+                for (int i = 0; i < 16; i++)
+                {
+                    total += bits[i];
+                }
+                if (q + 17 + total > segEnd)
+                {
+                    return false;
+                }
+                Huffman &t = tc ? acTables[th] : dcTables[th];
+                if (!buildHuffman(t, bits, q + 17))
+                {
+                    return false;
+                }
+                q += 17 + total;
+            }
+            break;
+        }
+        case 0xDB: // DQT (DC 係数 = ジグザグ順の先頭だけ使う)
+        {
+            const uint8_t *q = seg;
+            while (q < segEnd)
+            {
+                uint8_t pq = q[0] >> 4;
+                uint8_t tq = q[0] & 0x03;
+                size_t size = pq ? 129 : 65;
+                if (q + size > segEnd)
+                {
+                    return false;
+                }
+                dcQuant[tq] = pq ? readU16(q + 1) : q[1];
+                q += size;
+            }
+            break;
+        }
+        case 0xDD: // DRI
+            restartInterval = readU16(seg);
+            break;
+        case 0xDA: // SOS
+        {
+            if (!nComp)
+            {
+                return false;
+            }
+            nScanComp = seg[0];
+            if (nScanComp != nComp)
+            {
+                return false; // 非インターリーブの複数スキャンは非対応
+            }
+            for (int i = 0; i < nScanComp; i++)
+            {
+                uint8_t id = seg[1 + i * 2];
+                int idx = -1;
+                for (int j = 0; j < nComp; j++)
+                {
+                    if (comp[j].id == id)
+                    {
+                        idx = j;
+                    }
+                }
+                if (idx < 0)
+                {
+                    return false;
+                }
+                scanOrder[i] = (uint8_t)idx;
+                comp[idx].td = seg[2 + i * 2] >> 4 & 0x03;
+                comp[idx].ta = seg[2 + i * 2] & 0x03;
+            }
+            scanData = segEnd;
+            return true;
+        }
+        case 0xD9: // EOI
+            return false;
+        default: // APPn, COM など
+            break;
+        }
+        p = segEnd;
+    }
+    return false;
+}
+
+bool JpegDcDecoder::getSize(const uint8_t *jpg, size_t len, uint16_t *outW, uint16_t *outH)
+{
+    if (!parseHeaders(jpg, len, true))
+    {
+        return false;
+    }
+    *outW = outWidth();
+    *outH = outHeight();
+    return true;
+}
+
+void JpegDcDecoder::fillBits()
+{
+    while (bitCount <= 24)
+    {
+        uint32_t byte = 0;
+        if (!hitMarker && data < end)
+        {
+            byte = *data++;
+            if (byte == 0xFF)
+            {
+                uint8_t next = data < end ? *data : 0xD9;
+                if (next == 0x00)
+                {
+                    data++;
+                }
+                else
+                {
+                    // RSTn や EOI。以降は 0 を詰める
+                    data--;
+                    hitMarker = true;
+                    byte = 0;
+                }
+            }
+        }
+        bitBuf |= byte << (24 - bitCount);
+        bitCount += 8;
+    }
+}
+
+int JpegDcDecoder::decodeHuffman(const Huffman &t)
+{
+    fillBits();
+    uint16_t f = t.fast[bitBuf >> (32 - FAST_BITS)];
+    if (f)
+    {
+        int len = f >> 8;
+        bitBuf <<= len;
+        bitCount -= len;
+        return f & 0xFF;
+    }
+    for (int len = FAST_BITS + 1; len <= 16; len++)
+    {
+        int32_t code = (int32_t)(bitBuf >> (32 - len));
+        if (code <= t.maxCode[len])
+        {
+            bitBuf <<= len;
+            bitCount -= len;
+            return t.values[code + t.valOffset[len]];
+        }
+    }
+    return -1;
+}
+
+int JpegDcDecoder::receiveExtend(int s)
+{
+    if (s == 0)
+    {
+        return 0;
+    }
+    fillBits();
+    int v = (int)(bitBuf >> (32 - s));
+    bitBuf <<= s;
+    bitCount -= s;
+    if (v < (1 << (s - 1)))
+    {
+        v -= (1 << s) - 1;
+    }
+    return v;
+}
+
+void JpegDcDecoder::skipBits(int n)
+{
+    fillBits();
+    bitBuf <<= n;
+    bitCount -= n;
+}
+
+// リスタートマーカーを読み飛ばして DC の予測値をリセットする
+bool JpegDcDecoder::restart()
+{
+    bitBuf = 0;
+    bitCount = 0;
+    hitMarker = false;
+    while (data + 1 < end && !(data[0] == 0xFF && data[1] >= 0xD0 && data[1] <= 0xD7))
+    {
+        data++;
+    }
+    if (data + 1 >= end)
+    {
+        return false;
+    }
+    data += 2;
+    for (int i = 0; i < nComp; i++)
+    {
+        comp[i].pred = 0;
+    }
+    return true;
+}
+
+bool JpegDcDecoder::decode(const uint8_t *jpg, size_t len, uint8_t *luma, size_t lumaSize, uint8_t *cb, uint8_t *cr)
+{
+    if (!parseHeaders(jpg, len, false))
+    {
+        return false;
+    }
+    uint16_t ow = outWidth();
+    uint16_t oh = outHeight();
+    if (!luma || lumaSize < (size_t)ow * oh)
+    {
+        return false;
+    }
+    loadDefaultHuffman();
+
+    data = scanData;
+    end = jpg + len;
+    bitBuf = 0;
+    bitCount = 0;
+    hitMarker = false;
+    for (int i = 0; i < nComp; i++)
+    {
+        comp[i].pred = 0;
+        if (!dcTables[comp[i].td].defined || !acTables[comp[i].ta].defined)
+        {
+            return false;
+        }
+    }
+
+    // グレースケールは1ブロック = 1MCU
+    uint8_t mh = nComp == 1 ? 1 : hMax;
+    uint8_t mv = nComp == 1 ? 1 : vMax;
+    uint16_t mcusX = (width + 8 * mh - 1) / (8 * mh);
+    uint16_t mcusY = (height + 8 * mv - 1) / (8 * mv);
+    uint32_t mcuCount = 0;
+
+    for (uint16_t my = 0; my < mcusY; my++)
+    {
+        for (uint16_t mx = 0; mx < mcusX; mx++)
+        {
+            if (restartInterval && mcuCount && mcuCount % restartInterval == 0)
+            {
+                if (!restart())
+                {
+                    return false;
+                }
+            }
+            mcuCount++;
+
+            for (int si = 0; si < nScanComp; si++)
+            {
+                Component &c = comp[scanOrder[si]];
+                int ch = nComp == 1 ? 1 : c.h;
+                int cv = nComp == 1 ? 1 : c.v;
+                const Huffman &dc = dcTables[c.td];
+                const Huffman &ac = acTables[c.ta];
+                // この成分の1ブロックが輝度の 1/8 格子で何マス分に当たるか
+                int sx = mh / ch;
+                int sy = mv / cv;
+
+                for (int by = 0; by < cv; by++)
+                {
+                    for (int bx = 0; bx < ch; bx++)
+                    {
+                        int s = decodeHuffman(dc);
+                        if (s < 0 || s > 11)
+                        {
+                            return false;
+                        }
+                        c.pred += receiveExtend(s);
+
+                        // AC 係数は符号だけ読んで捨てる
+                        for (int k = 1; k < 64;)
+                        {
+                            fillBits();
+                            uint16_t fs = ac.skip[bitBuf >> (32 - FAST_BITS)];
+                            if (fs)
+                            {
+                                int n = fs & 0x1F;
+                                int adv = (fs >> 5) & 0x1F;
+                                bitBuf <<= n;
+                                bitCount -= n;
+                                if (!adv)
+                                {
+                                    break;
+                                }
+                                k += adv;
+                                continue;
+                            }
+                            int rs = decodeHuffman(ac);
+                            if (rs < 0)
+                            {
+                                return false;
+                            }
+                            int r = rs >> 4;
+                            int sz = rs & 0x0F;
+                            if (sz == 0)
+                            {
+                                if (r != 15)
+                                {
+                                    break;
+                                }
+                                k += 16;
+                                continue;
+                            }
+                            skipBits(sz);
+                            k += r + 1;
+                        }
+
+                        // DC 係数 = 8 * (ブロック平均 - 128)
+                        uint8_t value = clamp8(((c.pred * dcQuant[c.tq]) >> 3) + 128);
+                        uint8_t *plane;
+                        if (scanOrder[si] == 0)
+                        {
+                            plane = luma;
+                        }
+                        else
+                        {
+                            plane = scanOrder[si] == 1 ? cb : cr;
+                        }
+                        if (!plane)
+                        {
+                            continue;
+                        }
+                        int ox = (mx * ch + bx) * sx;
+                        int oy = (my * cv + by) * sy;
+                        for (int yy = 0; yy < sy; yy++)
+                        {
+                            if (oy + yy >= oh)
+                            {
+                                break;
+                            }
+                            uint8_t *row = plane + (size_t)(oy + yy) * ow;
+                            for (int xx = 0; xx < sx; xx++)
+                            {
+                                if (ox + xx < ow)
+                                {
+                                    row[ox + xx] = value;
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    if (nComp == 1)
+    {
+        size_t n = (size_t)ow * oh;
+        if (cb)
+        {
+            memset(cb, 128, n);
+        }
+        if (cr)
+        {
+            memset(cr, 128, n);
+        }
+    }
+    return true;
+}
+
+void JpegDcDecoder::toRgb888(const uint8_t *y, const uint8_t *cb, const uint8_t *cr, size_t n, uint8_t *rgb, bool bgr)
+{
+    int ri = bgr ? 2 : 0;
+    int bi = bgr ? 0 : 2;
+    for (size_t i = 0; i < n; i++, rgb += 3)
+    {
+        int yy = y[i];
+        int u = cb ? cb[i] - 128 : 0;
+        int v = cr ? cr[i] - 128 : 0;
+        rgb[ri] = clamp8(yy + ((91881 * v) >> 16));
+        rgb[1] = clamp8(yy - ((22554 * u + 46802 * v) >> 16));
+        rgb[bi] = clamp8(yy + ((116130 * u) >> 16));
+    }
+}
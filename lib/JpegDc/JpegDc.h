@@ -0,0 +1,84 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// DC 係数だけをエントロピー復号して 1/8 スケールの画像を作る JPEG デコーダ
+// IDCT を行わないので、フル解像度のデコードよりずっと速い。
+// ベースライン (SOF0/SOF1) のハフマン符号化 JPEG のみ対応。Arduino に依存しない。
+class JpegDcDecoder
+{
+public:
+    JpegDcDecoder();
+
+    // ヘッダだけを読んで 1/8 スケールの出力サイズを返す
+    bool getSize(const uint8_t *jpg, size_t len, uint16_t *outWidth, uint16_t *outHeight);
+
+    // luma には outWidth * outHeight バイトが必要。
+    // cb, cr を渡すと色差も同じ格子 (輝度の 1/8) に展開して書き出す。グレースケールの JPEG では 128 で埋める
+    bool decode(const uint8_t *jpg, size_t len, uint8_t *luma, size_t lumaSize, uint8_t *cb = nullptr, uint8_t *cr = nullptr);
+
+    uint16_t imageWidth() const { return width; }   // 元画像の幅
+    uint16_t imageHeight() const { return height; } // 元画像の高さ
+    uint16_t outWidth() const { return (width + 7) / 8; }
+    uint16_t outHeight() const { return (height + 7) / 8; }
+
+    // YCbCr (1/8 スケール) → RGB888 変換。サムネイルのエンコード用
+    // esp32-camera の fmt2jpg に渡すときは bgr = true (B, G, R の順で書く)
+    static void toRgb888(const uint8_t *y, const uint8_t *cb, const uint8_t *cr, size_t n, uint8_t *rgb, bool bgr = false);
+
+private:
+    static const int FAST_BITS = 9;
+
+    struct Huffman
+    {
+        bool defined;
+        uint16_t fast[1 << FAST_BITS]; // 下位8bit: シンボル, 上位8bit: 符号長 (0 は未登録)
+        uint16_t skip[1 << FAST_BITS]; // AC 用: 下位5bit: 符号長+付加ビット長, 上位: 進む係数の数 (0 は EOB)
+        int32_t maxCode[18];
+        int32_t valOffset[17];
+        uint8_t values[256];
+    };
+
+    struct Component
+    {
+        uint8_t id;
+        uint8_t h;
+        uint8_t v;
+        uint8_t tq;
+        uint8_t td;
+        uint8_t ta;
+        int pred;
+    };
+
+    bool parseHeaders(const uint8_t *jpg, size_t len, bool stopAtFrame);
+    bool buildHuffman(Huffman &t, const uint8_t *bits, const uint8_t *vals);
+    void loadDefaultHuffman();
+
+    // ビット読み出し
+    void fillBits();
+    int decodeHuffman(const Huffman &t);
+    int receiveExtend(int s);
+    void skipBits(int n);
+    bool restart();
+
+    const uint8_t *data = nullptr;
+    const uint8_t *end = nullptr;
+    uint32_t bitBuf = 0;
+    int bitCount = 0;
+    bool hitMarker = false;
+
+    uint16_t width = 0;
+    uint16_t height = 0;
+    uint8_t nComp = 0;
+    uint8_t nScanComp = 0;
+    uint8_t scanOrder[3];
+    Component comp[3];
+    uint8_t hMax = 1;
+    uint8_t vMax = 1;
+    uint16_t restartInterval = 0;
+    uint16_t dcQuant[4];
+    Huffman dcTables[4];
+    Huffman acTables[4];
+    const uint8_t *scanData = nullptr;
+};
@@ -0,0 +1,154 @@
+#include "JpegQualityController.h"
+
+#include <math.h>
+
+static const uint32_t HOUR_MS = 3600000UL;
+
+void JpegQualityController::begin(int quality, int frameSize, const int *frameLadder, size_t ladderLength)
+{
+    q = quality;
+    fixedFrameSize = frameSize;
+    ladder = ladderLength ? frameLadder : nullptr;
+    ladderLen = ladderLength;
+    step = 0;
+    for (size_t i = 0; ladder && i < ladderLen; i++)
+    {
+        if (ladder[i] <= frameSize)
+        {
+            step = i;
+        }
+    }
+    hasAvg = false;
+    hold = 0;
+}
+
+void JpegQualityController::setTargetBytes(uint32_t bytesPerFrame)
+{
+    target = bytesPerFrame;
+    hourlyBudget = 0;
+}
+
+void JpegQualityController::setHourlyBudget(uint32_t bytesPerHour, uint32_t framesPerHour)
+{
+    hourlyBudget = bytesPerHour;
+    hourlyFrames = framesPerHour ? framesPerHour : 1;
+    target = hourlyBudget / hourlyFrames;
+    spentThisHour = 0;
+    framesThisHour = 0;
+    hourStartMs = 0;
+}
+
+void JpegQualityController::updateHourlyTarget(uint32_t nowMs)
+{
+    if (!hourlyBudget)
+    {
+        return;
+    }
+    if (!hourStartMs || nowMs - hourStartMs >= HOUR_MS)
+    {
+        hourStartMs = nowMs ? nowMs : 1;
+        spentThisHour = 0;
+        framesThisHour = 0;
+    }
+    uint32_t remainingFrames = hourlyFrames > framesThisHour ? hourlyFrames - framesThisHour : 1;
+    uint32_t remainingBytes = hourlyBudget > spentThisHour ? hourlyBudget - spentThisHour : 0;
+    target = remainingBytes / remainingFrames;
+}
+
+bool JpegQualityController::observe(size_t frameBytes, uint32_t nowMs)
+{
+    updateHourlyTarget(nowMs);
+    if (hourlyBudget)
+    {
+        spentThisHour += frameBytes;
+        framesThisHour++;
+    }
+
+    if (hold)
+    {
+        hold--;
+        return false;
+    }
+
+    if (!hasAvg)
+    {
+        avg = (float)frameBytes;
+        hasAvg = true;
+    }
+    else
+    {
+        avg += smoothing * ((float)frameBytes - avg);
+    }
+
+    if (!target)
+    {
+        return false;
+    }
+
+    float ratio = avg / (float)target;
+    float band = hysteresisPercent / 100.0f;
+    if (ratio <= 1.0f + band && ratio >= 1.0f - band)
+    {
+        return false;
+    }
+
+    // JPEG のサイズは品質の目盛りにおおよそ反比例するので、比の対数に比例して動かす
+    int delta = (int)lroundf(logf(ratio) * 8.0f);
+    if (delta == 0)
+    {
+        delta = ratio > 1.0f ? 1 : -1;
+    }
+    if (delta > 8)
+    {
+        delta = 8;
+    }
+    if (delta < -8)
+    {
+        delta = -8;
+    }
+
+    int next = q + delta;
+    bool changed = false;
+    if (next > maxQuality)
+    {
+        // 品質を下げきっても大きすぎるなら解像度を1段下げる
+        if (ladder && step > 0)
+        {
+            step--;
+            q = (minQuality + maxQuality) / 2;
+            changed = true;
+        }
+        else if (q != maxQuality)
+        {
+            q = maxQuality;
+            changed = true;
+        }
+    }
+    else if (next < minQuality)
+    {
+        // 最高画質でも余裕があるなら解像度を1段上げる (余裕が十分なときだけ)
+        if (ladder && step + 1 < ladderLen && ratio < 0.5f)
+        {
+            step++;
+            q = maxQuality;
+            changed = true;
+        }
+        else if (q != minQuality)
+        {
+            q = minQuality;
+            changed = true;
+        }
+    }
+    else
+    {
+        q = next;
+        changed = true;
+    }
+
+    if (changed)
+    {
+        hold = holdFrames;
+        hasAvg = false; // 設定が変わったので平均を取り直す
+    }
+    return changed;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// 直近のフレームサイズ (fb->len) を見て JPEG 品質と解像度を調整し、1フレームあたりの目標バイト数に近づける
+// 品質はセンサーの set_quality と同じ目盛り (小さいほど高画質)。Arduino に依存しない
+class JpegQualityController
+{
+public:
+    int minQuality = 6;            // 最高画質側の限界
+    int maxQuality = 40;           // 最低画質側の限界
+    uint8_t hysteresisPercent = 15; // 目標の ±この範囲なら何もしない
+    uint8_t holdFrames = 1;        // 設定を変えたあと、この枚数は観測だけする (変更直後のフレームは古い設定のことがある)
+    float smoothing = 0.5f;        // 平均サイズの EWMA 係数
+
+    // ladder: 使ってよい解像度 (framesize_t) を小さい順に並べたもの。nullptr なら解像度は変えない
+    void begin(int quality, int frameSize, const int *ladder = nullptr, size_t ladderLength = 0);
+
+    void setTargetBytes(uint32_t bytesPerFrame);
+    // 1時間あたりの予算。残り予算 / 残りフレーム数を目標にする
+    void setHourlyBudget(uint32_t bytesPerHour, uint32_t framesPerHour);
+
+    // フレームを1枚観測する。品質か解像度を変えるべきなら true
+    bool observe(size_t frameBytes, uint32_t nowMs);
+
+    int quality() const { return q; }
+    int frameSize() const { return ladder ? ladder[step] : fixedFrameSize; }
+    uint32_t targetBytes() const { return target; }
+    uint32_t averageBytes() const { return (uint32_t)avg; }
+    uint32_t hourBytes() const { return spentThisHour; }
+
+private:
+    void updateHourlyTarget(uint32_t nowMs);
+
+    int q = 10;
+    int fixedFrameSize = 0;
+    const int *ladder = nullptr;
+    size_t ladderLen = 0;
+    size_t step = 0;
+
+    uint32_t target = 0;
+    float avg = 0;
+    bool hasAvg = false;
+    uint8_t hold = 0;
+
+    uint32_t hourlyBudget = 0;
+    uint32_t hourlyFrames = 0;
+    uint32_t hourStartMs = 0;
+    uint32_t spentThisHour = 0;
+    uint32_t framesThisHour = 0;
+};
@@ -0,0 +1,138 @@
+#include "MemoryTelemetry.h"
+
+#include <stdio.h>
+#include "esp_heap_caps.h"
+
+void MemoryTelemetry::sample(uint32_t uptimeMs)
+{
+    MemorySample &s = ring[(first + n) % RING_SIZE];
+    if (n < RING_SIZE)
+    {
+        n++;
+    }
+    else
+    {
+        first = (first + 1) % RING_SIZE;
+    }
+    s.uptimeS = uptimeMs / 1000;
+    s.internalFree = heap_caps_get_free_size(MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    s.internalLargest = heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    s.internalMinFree = heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    s.psramFree = heap_caps_get_free_size(MALLOC_CAP_SPIRAM);
+    s.psramLargest = heap_caps_get_largest_free_block(MALLOC_CAP_SPIRAM);
+    s.psramMinFree = heap_caps_get_minimum_free_size(MALLOC_CAP_SPIRAM);
+}
+
+uint32_t MemoryTelemetry::worstInternalLargest() const
+{
+    uint32_t worst = UINT32_MAX;
+    for (size_t i = 0; i < n; i++)
+    {
+        if (at(i).internalLargest < worst)
+        {
+            worst = at(i).internalLargest;
+        }
+    }
+    return n ? worst : 0;
+}
+
+uint32_t MemoryTelemetry::worstPsramLargest() const
+{
+    uint32_t worst = UINT32_MAX;
+    for (size_t i = 0; i < n; i++)
+    {
+        if (at(i).psramLargest < worst)
+        {
+            worst = at(i).psramLargest;
+        }
+    }
+    return n ? worst : 0;
+}
+
+size_t MemoryTelemetry::formatJson(char *out, size_t size) const
+{
+    if (!n)
+    {
+        return snprintf(out, size, "{}");
+    }
+    const MemorySample &s = latest();
+    const MemorySample &oldest = at(0);
+    int len = snprintf(out, size,
+                       "{\"uptime\":%u,\"heap_free\":%u,\"heap_largest\":%u,\"heap_min\":%u,\"heap_frag\":%u,\"psram_free\":%u,\"psram_largest\":%u,\"psram_frag\":%u,"
+                       "\"heap_largest_worst\":%u,\"psram_largest_worst\":%u,\"heap_largest_delta\":%d,\"window_s\":%u",
+                       (unsigned)s.uptimeS, (unsigned)s.internalFree, (unsigned)s.internalLargest, (unsigned)s.internalMinFree, s.internalFragmentation(),
+                       (unsigned)s.psramFree, (unsigned)s.psramLargest, s.psramFragmentation(), (unsigned)worstInternalLargest(), (unsigned)worstPsramLargest(),
+                       (int)(s.internalLargest - oldest.internalLargest), (unsigned)(s.uptimeS - oldest.uptimeS));
+    if (len < 0 || (size_t)len >= size)
+    {
+        return 0;
+    }
+
+    AllocationSite sites[5];
+    size_t k = topSites(sites, 5);
+    if (k)
+    {
+        len += snprintf(out + len, size - len, ",\"top_sites\":[");
+        for (size_t i = 0; i < k && (size_t)len < size; i++)
+        {
+            len += snprintf(out + len, size - len, "%s{\"pc\":\"0x%08x\",\"bytes\":%u,\"count\":%u}", i ? "," : "", (unsigned)sites[i].site, (unsigned)sites[i].bytes,
+                            (unsigned)sites[i].count);
+        }
+        if ((size_t)len < size)
+        {
+            len += snprintf(out + len, size - len, "]");
+        }
+    }
+    if ((size_t)len + 1 >= size)
+    {
+        return 0;
+    }
+    len += snprintf(out + len, size - len, "}");
+    return len;
+}
+
+size_t MemoryTelemetry::formatMetrics(char *out, size_t size) const
+{
+    if (!n)
+    {
+        return 0;
+    }
+    const MemorySample &s = latest();
+    int len = snprintf(out, size,
+                       "# TYPE heap_free_bytes gauge\n"
+                       "heap_free_bytes{region=\"internal\"} %u\n"
+                       "heap_free_bytes{region=\"psram\"} %u\n"
+                       "# TYPE heap_largest_free_block_bytes gauge\n"
+                       "heap_largest_free_block_bytes{region=\"internal\"} %u\n"
+                       "heap_largest_free_block_bytes{region=\"psram\"} %u\n"
+                       "# TYPE heap_minimum_free_bytes gauge\n"
+                       "heap_minimum_free_bytes{region=\"internal\"} %u\n"
+                       "heap_minimum_free_bytes{region=\"psram\"} %u\n"
+                       "# TYPE heap_fragmentation_percent gauge\n"
+                       "heap_fragmentation_percent{region=\"internal\"} %u\n"
+                       "heap_fragmentation_percent{region=\"psram\"} %u\n"
+                       "# TYPE heap_largest_free_block_worst_bytes gauge\n"
+                       "heap_largest_free_block_worst_bytes{region=\"internal\"} %u\n"
+                       "heap_largest_free_block_worst_bytes{region=\"psram\"} %u\n"
+                       "# TYPE uptime_seconds counter\n"
+                       "uptime_seconds %u\n",
+                       (unsigned)s.internalFree, (unsigned)s.psramFree, (unsigned)s.internalLargest, (unsigned)s.psramLargest, (unsigned)s.internalMinFree,
+                       (unsigned)s.psramMinFree, s.internalFragmentation(), s.psramFragmentation(), (unsigned)worstInternalLargest(), (unsigned)worstPsramLargest(),
+                       (unsigned)s.uptimeS);
+    if (len < 0 || (size_t)len >= size)
+    {
+        return 0;
+    }
+
+    AllocationSite sites[10];
+    size_t k = topSites(sites, 10);
+    if (k)
+    {
+        len += snprintf(out + len, size - len, "# TYPE heap_live_bytes_by_site gauge\n");
+    }
+    for (size_t i = 0; i < k && (size_t)len < size; i++)
+    {
+        len += snprintf(out + len, size - len, "heap_live_bytes_by_site{pc=\"0x%08x\"} %u\n", (unsigned)sites[i].site, (unsigned)sites[i].bytes);
+    }
+    return (size_t)len < size ? len : 0;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// 内部 RAM と PSRAM の空き・最大の連続空き・最小空きを定期的に記録する
+// 空きがあるのに最大の連続空きが減っていくのが断片化。リングに直近 RING_SIZE 回分を持つ
+struct MemorySample
+{
+    uint32_t uptimeS;
+    uint32_t internalFree;
+    uint32_t internalLargest;
+    uint32_t internalMinFree; // 起動してからの最小
+    uint32_t psramFree;
+    uint32_t psramLargest;
+    uint32_t psramMinFree;
+
+    // 0 - 100。空きのうち最大の塊に入らない割合
+    uint8_t internalFragmentation() const { return internalFree ? 100 - (uint8_t)((uint64_t)internalLargest * 100 / internalFree) : 0; }
+    uint8_t psramFragmentation() const { return psramFree ? 100 - (uint8_t)((uint64_t)psramLargest * 100 / psramFree) : 0; }
+};
+
+// 確保した場所 (呼び出し元のアドレス) ごとの、まだ解放されていないバイト数
+// MEMORY_TRACKING を付けたビルド (-Wl,--wrap=malloc など) でだけ集計される。アドレスは addr2line で関数に直す
+struct AllocationSite
+{
+    uintptr_t site;
+    uint32_t bytes;
+    uint32_t count;
+};
+
+class MemoryTelemetry
+{
+public:
+    static const size_t RING_SIZE = 60;
+
+    void sample(uint32_t uptimeMs);
+
+    size_t sampleCount() const { return n; }
+    // 0 が一番古い
+    const MemorySample &at(size_t i) const { return ring[(first + i) % RING_SIZE]; }
+    const MemorySample &latest() const { return at(n - 1); }
+    // リングの中での最大連続空きの最小値 (断片化の一番ひどかった時)
+    uint32_t worstInternalLargest() const;
+    uint32_t worstPsramLargest() const;
+
+    // 多い順に最大 max 個。追跡していないビルドでは 0
+    static size_t topSites(AllocationSite *out, size_t max);
+    static bool trackingEnabled();
+
+    // MQTT 用の JSON と /metrics 用の Prometheus テキスト。書いた長さを返す
+    size_t formatJson(char *out, size_t size) const;
+    size_t formatMetrics(char *out, size_t size) const;
+
+private:
+    MemorySample ring[RING_SIZE];
+    size_t first = 0;
+    size_t n = 0;
+};
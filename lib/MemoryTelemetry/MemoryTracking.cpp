@@ -0,0 +1,262 @@
+#include "MemoryTelemetry.h"
+
+#if defined(MEMORY_TRACKING)
+
+// -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc,--wrap=free,--wrap=heap_caps_malloc,--wrap=heap_caps_free
+// と operator new (--wrap=_Znwj,--wrap=_Znaj と nothrow 版) でリンクする。
+// 生きている確保を固定長のハッシュ表で持ち、呼び出し元のアドレスごとにバイト数を足し引きする。ここでは確保しない
+// 場所は呼び出し元1段だけ (__builtin_return_address(0)) なので、malloc を包む関数の中の確保はその関数にまとまる。
+// new は包んで new を呼んだ側に付け直すが、String (WString の changeBuffer の realloc) や std::vector のアロケータ、
+// ライブラリの中の確保 (lwIP・mbedTLS など) はそれぞれの中の1か所に見える
+#include <new>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+
+extern "C"
+{
+    void *__real_malloc(size_t size);
+    void *__real_calloc(size_t n, size_t size);
+    void *__real_realloc(void *ptr, size_t size);
+    void __real_free(void *ptr);
+    void *__real_heap_caps_malloc(size_t size, uint32_t caps);
+    void __real_heap_caps_free(void *ptr);
+    // ESP32 (size_t が unsigned int) の operator new / new[]
+    void *__real__Znwj(size_t size);
+    void *__real__Znaj(size_t size);
+    void *__real__ZnwjRKSt9nothrow_t(size_t size, const std::nothrow_t &tag);
+    void *__real__ZnajRKSt9nothrow_t(size_t size, const std::nothrow_t &tag);
+}
+
+static const size_t MAX_LIVE = 2048; // 2 の累乗
+static const size_t MAX_SITES = 64;
+
+struct LiveAllocation
+{
+    void *ptr;
+    uint32_t size;
+    uint16_t site;
+};
+
+static LiveAllocation live[MAX_LIVE];
+static AllocationSite sites[MAX_SITES];
+static size_t nSites = 0;
+static portMUX_TYPE trackingMux = portMUX_INITIALIZER_UNLOCKED;
+
+static size_t slotOf(const void *ptr)
+{
+    return ((uintptr_t)ptr >> 3) * 2654435761u & (MAX_LIVE - 1);
+}
+
+static void track(void *ptr, size_t size, void *pc)
+{
+    if (!ptr)
+    {
+        return;
+    }
+    portENTER_CRITICAL(&trackingMux);
+    size_t s = 0;
+    while (s < nSites && sites[s].site != (uintptr_t)pc)
+    {
+        s++;
+    }
+    if (s == nSites && nSites < MAX_SITES)
+    {
+        sites[nSites++] = {(uintptr_t)pc, 0, 0};
+    }
+    if (s < nSites)
+    {
+        // 表が一杯なら数えない (空きを探すのは表の 1/4 まで)
+        size_t i = slotOf(ptr);
+        for (size_t probe = 0; probe < MAX_LIVE / 4; probe++, i = (i + 1) & (MAX_LIVE - 1))
+        {
+            if (!live[i].ptr)
+            {
+                live[i] = {ptr, (uint32_t)size, (uint16_t)s};
+                sites[s].bytes += size;
+                sites[s].count++;
+                break;
+            }
+        }
+    }
+    portEXIT_CRITICAL(&trackingMux);
+}
+
+static void untrack(void *ptr)
+{
+    if (!ptr)
+    {
+        return;
+    }
+    portENTER_CRITICAL(&trackingMux);
+    size_t i = slotOf(ptr);
+    for (size_t probe = 0; probe < MAX_LIVE / 4 && live[i].ptr; probe++, i = (i + 1) & (MAX_LIVE - 1))
+    {
+        if (live[i].ptr != ptr)
+        {
+            continue;
+        }
+        AllocationSite &site = sites[live[i].site];
+        site.bytes -= live[i].size;
+        site.count--;
+        // 線形探索の表なので、後ろに続く要素を詰めて穴をふさぐ
+        size_t j = i;
+        while (true)
+        {
+            j = (j + 1) & (MAX_LIVE - 1);
+            if (!live[j].ptr)
+            {
+                break;
+            }
+            size_t k = slotOf(live[j].ptr);
+            bool movable = i <= j ? (k <= i || k > j) : (k <= i && k > j);
+            if (movable)
+            {
+                live[i] = live[j];
+                i = j;
+            }
+        }
+        live[i].ptr = nullptr;
+        break;
+    }
+    portEXIT_CRITICAL(&trackingMux);
+}
+
+// operator new の中の malloc で付いた場所を、new を呼んだ側に付け直す (delete は free で外れる)
+static void retrack(void *ptr, size_t size, void *pc)
+{
+    if (!ptr)
+    {
+        return;
+    }
+    untrack(ptr);
+    track(ptr, size, pc);
+}
+
+extern "C"
+{
+    void *__wrap_malloc(size_t size)
+    {
+        void *p = __real_malloc(size);
+        track(p, size, __builtin_return_address(0));
+        return p;
+    }
+
+    void *__wrap_calloc(size_t n, size_t size)
+    {
+        void *p = __real_calloc(n, size);
+        track(p, n * size, __builtin_return_address(0));
+        return p;
+    }
+
+    void *__wrap_realloc(void *ptr, size_t size)
+    {
+        if (ptr && size == 0)
+        {
+            // realloc(p, 0) は解放になる (ESP-IDF は NULL を返す)。free と同じく解放する前に外す
+            untrack(ptr);
+            return __real_realloc(ptr, 0);
+        }
+        void *p = __real_realloc(ptr, size);
+        if (p)
+        {
+            untrack(ptr); // 失敗したときは元の確保がそのまま生きている
+            track(p, size, __builtin_return_address(0));
+        }
+        return p;
+    }
+
+    void __wrap_free(void *ptr)
+    {
+        untrack(ptr);
+        __real_free(ptr);
+    }
+
+    void *__wrap_heap_caps_malloc(size_t size, uint32_t caps)
+    {
+        void *p = __real_heap_caps_malloc(size, caps);
+        track(p, size, __builtin_return_address(0));
+        return p;
+    }
+
+    void __wrap_heap_caps_free(void *ptr)
+    {
+        untrack(ptr);
+        __real_heap_caps_free(ptr);
+    }
+
+    void *__wrap__Znwj(size_t size)
+    {
+        void *p = __real__Znwj(size);
+        retrack(p, size, __builtin_return_address(0));
+        return p;
+    }
+
+    void *__wrap__Znaj(size_t size)
+    {
+        void *p = __real__Znaj(size);
+        retrack(p, size, __builtin_return_address(0));
+        return p;
+    }
+
+    void *__wrap__ZnwjRKSt9nothrow_t(size_t size, const std::nothrow_t &tag)
+    {
+        void *p = __real__ZnwjRKSt9nothrow_t(size, tag);
+        retrack(p, size, __builtin_return_address(0));
+        return p;
+    }
+
+    void *__wrap__ZnajRKSt9nothrow_t(size_t size, const std::nothrow_t &tag)
+    {
+        void *p = __real__ZnajRKSt9nothrow_t(size, tag);
+        retrack(p, size, __builtin_return_address(0));
+        return p;
+    }
+}
+
+bool MemoryTelemetry::trackingEnabled()
+{
+    return true;
+}
+
+size_t MemoryTelemetry::topSites(AllocationSite *out, size_t max)
+{
+    size_t k = 0;
+    portENTER_CRITICAL(&trackingMux);
+    for (size_t s = 0; s < nSites; s++)
+    {
+        if (!sites[s].bytes)
+        {
+            continue;
+        }
+        // 挿入ソートで大きい順に max 個
+        size_t i = k < max ? k++ : max;
+        while (i > 0 && out[i - 1].bytes < sites[s].bytes)
+        {
+            if (i < max)
+            {
+                out[i] = out[i - 1];
+            }
+            i--;
+        }
+        if (i < max)
+        {
+            out[i] = sites[s];
+        }
+    }
+    portEXIT_CRITICAL(&trackingMux);
+    return k;
+}
+
+#else
+
+bool MemoryTelemetry::trackingEnabled()
+{
+    return false;
+}
+
+size_t MemoryTelemetry::topSites(AllocationSite *, size_t)
+{
+    return 0;
+}
+
+#endif
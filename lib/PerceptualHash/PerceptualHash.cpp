@@ -0,0 +1,70 @@
+#include "PerceptualHash.h"
+
+uint64_t PerceptualHash::dHash(const uint8_t *gray, uint16_t width, uint16_t height)
+{
+    const int HW = 9;
+    const int HH = 8;
+    uint32_t cells[HH][HW];
+
+    if (!gray || width < HW || height < HH)
+    {
+        return 0;
+    }
+
+    // 各セルの平均 (セル境界は整数で割り振る)
+    for (int cy = 0; cy < HH; cy++)
+    {
+        uint16_t y0 = (uint16_t)((uint32_t)cy * height / HH);
+        uint16_t y1 = (uint16_t)((uint32_t)(cy + 1) * height / HH);
+        for (int cx = 0; cx < HW; cx++)
+        {
+            uint16_t x0 = (uint16_t)((uint32_t)cx * width / HW);
+            uint16_t x1 = (uint16_t)((uint32_t)(cx + 1) * width / HW);
+            uint32_t sum = 0;
+            for (uint16_t y = y0; y < y1; y++)
+            {
+                const uint8_t *row = gray + (size_t)y * width;
+                for (uint16_t x = x0; x < x1; x++)
+                {
+                    sum += row[x];
+                }
+            }
+            cells[cy][cx] = sum / ((uint32_t)(y1 - y0) * (x1 - x0));
+        }
+    }
+
+    uint64_t hash = 0;
+    for (int cy = 0; cy < HH; cy++)
+    {
+        for (int cx = 0; cx < HW - 1; cx++)
+        {
+            hash = (hash << 1) | (cells[cy][cx] < cells[cy][cx + 1] ? 1 : 0);
+        }
+    }
+    return hash;
+}
+
+bool FrameDeduplicator::shouldUpload(uint64_t hash, size_t frameBytes)
+{
+    if (!hasReference)
+    {
+        lastDist = -1;
+        return true;
+    }
+    lastDist = PerceptualHash::distance(hash, reference);
+    if (lastDist > threshold || sinceUpload + 1 >= heartbeatEvery)
+    {
+        return true;
+    }
+    sinceUpload++;
+    skipped++;
+    saved += frameBytes;
+    return false;
+}
+
+void FrameDeduplicator::markUploaded(uint64_t hash)
+{
+    hasReference = true;
+    reference = hash;
+    sinceUpload = 0;
+}
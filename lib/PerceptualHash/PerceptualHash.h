@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// 縮小した輝度画像の差分ハッシュ (dHash)。
+// 9x8 に平均縮小し、横に隣り合う画素の大小を 64bit に詰める。Arduino に依存しない
+class PerceptualHash
+{
+public:
+    static uint64_t dHash(const uint8_t *gray, uint16_t width, uint16_t height);
+
+    static int distance(uint64_t a, uint64_t b)
+    {
+        uint64_t x = a ^ b;
+        int n = 0;
+        while (x)
+        {
+            x &= x - 1;
+            n++;
+        }
+        return n;
+    }
+};
+
+// 前回アップロードしたフレームとのハッシュ距離で、送るかどうかを決める
+class FrameDeduplicator
+{
+public:
+    int threshold = 4;          // この距離以下なら同じ画像とみなす
+    uint32_t heartbeatEvery = 30; // 変化がなくても N フレームに1回は送る
+
+    // true なら送る。送った場合は必ず markUploaded() を呼ぶ
+    bool shouldUpload(uint64_t hash, size_t frameBytes);
+    void markUploaded(uint64_t hash);
+
+    int lastDistance() const { return lastDist; }
+    uint32_t skippedFrames() const { return skipped; }
+    uint64_t bytesSaved() const { return saved; }
+
+private:
+    bool hasReference = false;
+    uint64_t reference = 0;
+    uint32_t sinceUpload = 0;
+    int lastDist = -1;
+    uint32_t skipped = 0;
+    uint64_t saved = 0;
+};
@@ -0,0 +1,164 @@
+#include "PreTriggerBuffer.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(ARDUINO_ARCH_ESP32)
+#include "esp_heap_caps.h"
+#endif
+
+PreTriggerBuffer::PreTriggerBuffer()
+{
+}
+
+PreTriggerBuffer::~PreTriggerBuffer()
+{
+    end();
+}
+
+bool PreTriggerBuffer::begin(size_t arenaBytes)
+{
+    end();
+#if defined(ARDUINO_ARCH_ESP32)
+    arena = (uint8_t *)heap_caps_malloc(arenaBytes, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+#else
+    arena = (uint8_t *)malloc(arenaBytes);
+#endif
+    if (!arena)
+    {
+        return false;
+    }
+    arenaSize = arenaBytes;
+    return true;
+}
+
+void PreTriggerBuffer::end()
+{
+    free(arena);
+    arena = nullptr;
+    arenaSize = 0;
+    head = 0;
+    live = 0;
+    first = 0;
+    n = 0;
+    triggered = false;
+}
+
+void PreTriggerBuffer::evictOldest()
+{
+    live -= frames[first].len;
+    first = (first + 1) % MAX_FRAMES;
+    n--;
+}
+
+bool PreTriggerBuffer::push(const uint8_t *jpg, size_t len, uint32_t timestampMs)
+{
+    if (!arena || !len || len > arenaSize)
+    {
+        droppedFrames++;
+        return false;
+    }
+    // 古くなったものを先に捨てる
+    while (n && evictable(at(0)) && timestampMs - at(0).timestampMs > maxAgeMs)
+    {
+        evictOldest();
+    }
+
+    size_t pos = head;
+    bool wrapped = false;
+    if (pos + len > arenaSize)
+    {
+        pos = 0; // 末尾の余りは使わない
+        wrapped = true;
+    }
+    // 書き込む範囲に重なるもの (先頭に戻ったときは前の周回の末尾側も) を古い順に捨てる
+    while (n)
+    {
+        const Frame &oldest = at(0);
+        bool overlaps = oldest.offset < pos + len && pos < oldest.offset + oldest.len;
+        bool stale = wrapped && oldest.offset >= head;
+        if (!overlaps && !stale && n < MAX_FRAMES)
+        {
+            break;
+        }
+        if (!evictable(oldest))
+        {
+            droppedFrames++; // クリップを守るため新しいほうを落とす
+            return false;
+        }
+        evictOldest();
+    }
+
+    memcpy(arena + pos, jpg, len);
+    Frame &f = frames[(first + n) % MAX_FRAMES];
+    f.seq = nextSeq++;
+    f.offset = (uint32_t)pos;
+    f.len = (uint32_t)len;
+    f.timestampMs = timestampMs;
+    n++;
+    live += len;
+    head = pos + len;
+    return true;
+}
+
+void PreTriggerBuffer::trigger(uint32_t nowMs, uint32_t preMs, uint32_t postMs)
+{
+    if (triggered)
+    {
+        // クリップの途中でもう一度トリガーされたら後ろに延ばす
+        if ((int32_t)(nowMs + postMs - clipEndMs) > 0)
+        {
+            clipEndMs = nowMs + postMs;
+        }
+        return;
+    }
+    triggered = true;
+    clipStartMs = nowMs - preMs;
+    clipEndMs = nowMs + postMs;
+    clipFirstSeq = nextSeq;
+    for (size_t i = 0; i < n; i++)
+    {
+        if ((int32_t)(at(i).timestampMs - clipStartMs) >= 0)
+        {
+            clipFirstSeq = at(i).seq;
+            break;
+        }
+    }
+}
+
+size_t PreTriggerBuffer::clipFirstIndex() const
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        if ((int32_t)(at(i).seq - clipFirstSeq) >= 0)
+        {
+            return i;
+        }
+    }
+    return n;
+}
+
+size_t PreTriggerBuffer::clipFrameCount() const
+{
+    if (!triggered)
+    {
+        return 0;
+    }
+    size_t count = 0;
+    for (size_t i = clipFirstIndex(); i < n && (int32_t)(at(i).timestampMs - clipEndMs) <= 0; i++)
+    {
+        count++;
+    }
+    return count;
+}
+
+size_t PreTriggerBuffer::clipBytes() const
+{
+    size_t bytes = 0;
+    size_t count = clipFrameCount();
+    for (size_t i = 0; i < count; i++)
+    {
+        bytes += clipFrame(i).len;
+    }
+    return bytes;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// 直近 maxAgeMs ぶんの JPEG を PSRAM のリングに詰めて持っておく (トリガーより前のフレームも残すため)
+// フレームは領域に隙間なく詰め、索引 (位置・長さ・時刻) は別の固定長のリングに持つ。
+// trigger() すると、その前 preMs と後 postMs のフレームをクリップとして release() まで上書きしない。Arduino に依存しない
+class PreTriggerBuffer
+{
+public:
+    static const size_t MAX_FRAMES = 128;
+
+    struct Frame
+    {
+        uint32_t seq;
+        uint32_t offset;
+        uint32_t len;
+        uint32_t timestampMs;
+    };
+
+    uint32_t maxAgeMs = 10000; // これより古いフレームは捨てる
+
+    PreTriggerBuffer();
+    ~PreTriggerBuffer();
+
+    bool begin(size_t arenaBytes);
+    void end();
+
+    // 入らなければ false (クリップのフレームで領域が埋まっているとき、1フレームが領域より大きいとき)
+    bool push(const uint8_t *jpg, size_t len, uint32_t timestampMs);
+
+    void trigger(uint32_t nowMs, uint32_t preMs, uint32_t postMs);
+    bool clipPending() const { return triggered; }
+    // postMs が過ぎたら true。そのあとクリップのフレームを読み出して release() する
+    bool clipComplete(uint32_t nowMs) const { return triggered && (int32_t)(nowMs - clipEndMs) >= 0; }
+    size_t clipFrameCount() const;
+    const Frame &clipFrame(size_t i) const { return at(clipFirstIndex() + i); }
+    size_t clipBytes() const;
+    void release() { triggered = false; }
+
+    const uint8_t *frameData(const Frame &f) const { return arena + f.offset; }
+
+    size_t frameCount() const { return n; }
+    size_t liveBytes() const { return live; }
+    size_t capacity() const { return arenaSize; }
+    uint32_t spanMs() const { return n ? at(n - 1).timestampMs - at(0).timestampMs : 0; }
+    uint32_t dropped() const { return droppedFrames; }
+
+private:
+    const Frame &at(size_t i) const { return frames[(first + i) % MAX_FRAMES]; }
+    size_t clipFirstIndex() const;
+    bool evictable(const Frame &f) const { return !triggered || (int32_t)(f.seq - clipFirstSeq) < 0; }
+    void evictOldest();
+
+    uint8_t *arena = nullptr;
+    size_t arenaSize = 0;
+    size_t head = 0;
+    size_t live = 0;
+    Frame frames[MAX_FRAMES];
+    size_t first = 0;
+    size_t n = 0;
+    uint32_t nextSeq = 0;
+    uint32_t droppedFrames = 0;
+
+    bool triggered = false;
+    uint32_t clipFirstSeq = 0;
+    uint32_t clipStartMs = 0;
+    uint32_t clipEndMs = 0;
+};
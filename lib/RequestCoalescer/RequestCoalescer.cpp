@@ -0,0 +1,69 @@
+#include "RequestCoalescer.h"
+
+void RequestCoalescer::lock()
+{
+#if defined(ARDUINO_ARCH_ESP32)
+    portENTER_CRITICAL(&mux);
+#endif
+}
+
+void RequestCoalescer::unlock()
+{
+#if defined(ARDUINO_ARCH_ESP32)
+    portEXIT_CRITICAL(&mux);
+#endif
+}
+
+bool RequestCoalescer::request()
+{
+    lock();
+    nRequests++;
+    bool start = false;
+    if (!busy)
+    {
+        busy = true;
+        committed = false;
+        current = 1;
+        start = true;
+    }
+    else if (!committed)
+    {
+        current++;
+        nMerged++;
+    }
+    else
+    {
+        next++;
+        nFollowUps++;
+    }
+    unlock();
+    return start;
+}
+
+void RequestCoalescer::commit()
+{
+    lock();
+    committed = true;
+    unlock();
+}
+
+uint16_t RequestCoalescer::finish(bool *startNext)
+{
+    lock();
+    uint16_t served = current;
+    nBatches++;
+    *startNext = next > 0;
+    if (next)
+    {
+        current = next;
+        next = 0;
+        committed = false;
+    }
+    else
+    {
+        busy = false;
+        current = 0;
+    }
+    unlock();
+    return served;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(ARDUINO_ARCH_ESP32)
+#include "freertos/FreeRTOS.h"
+#endif
+
+// 同じ頼み (photo など) を、処理中の1件と後続の1件にまとめる
+// 頼みを受けてから結果を返し終わるまでを1件とし、その間に来た頼みは
+//   まだ結果の元 (フレーム) を決めていなければ今の件に、決めたあとなら次の1件にまとめる (次の件は多くても1つ)
+// ので、頼みが何回続いても待つのは今の件と次の件の2件分まで。結果は件ごとに1回だけ返し、何人分かを添える
+// 別々のタスク (受ける側・処理する側・返す側) から呼んでよい。Arduino に依存しない
+class RequestCoalescer
+{
+public:
+    // 頼みを受ける。true なら新しい件を始めたので、呼んだ側が処理を頼む
+    bool request();
+    // 今の件の結果の元が決まった (これより後の頼みは次の件になる)
+    void commit();
+    // 今の件の結果を返し終わった。まとめた頼みの数を返す。次の件があれば *startNext を true にして、
+    // 呼んだ側が処理を頼む
+    uint16_t finish(bool *startNext);
+
+    bool active() const { return busy; }
+    uint32_t requests() const { return nRequests; }
+    uint32_t merged() const { return nMerged; }   // 今の件にまとめた数
+    uint32_t followUps() const { return nFollowUps; } // 次の件にまとめた数 (次の件を始めた頼みを含む)
+    uint32_t batches() const { return nBatches; } // 結果を返した件の数
+
+private:
+    void lock();
+    void unlock();
+
+    bool busy = false;
+    bool committed = false;
+    uint16_t current = 0; // 今の件の頼みの数
+    uint16_t next = 0;    // 次の件の頼みの数
+    uint32_t nRequests = 0;
+    uint32_t nMerged = 0;
+    uint32_t nFollowUps = 0;
+    uint32_t nBatches = 0;
+#if defined(ARDUINO_ARCH_ESP32)
+    portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
+#endif
+};
@@ -0,0 +1,107 @@
+#include "TaskStats.h"
+
+#include <stdio.h>
+
+int TaskStats::add(const char *name, int core, int priority)
+{
+    if (n >= MAX_TASKS)
+    {
+        return -1;
+    }
+    Entry &e = entries[n];
+    e.name = name;
+    e.core = core;
+    e.priority = priority;
+    e.busyUs = 0;
+    e.enteredUs = 0;
+    e.busy = false;
+    e.stackFree = 0;
+    e.lastBusyUs = 0;
+    e.permille = 0;
+    return (int)n++;
+}
+
+void TaskStats::enter(int id, uint32_t nowUs)
+{
+    if (id < 0)
+    {
+        return;
+    }
+    Entry &e = entries[id];
+    e.enteredUs = nowUs;
+    e.busy = true;
+}
+
+void TaskStats::leave(int id, uint32_t nowUs)
+{
+    if (id < 0)
+    {
+        return;
+    }
+    Entry &e = entries[id];
+    if (e.busy)
+    {
+        e.busyUs += nowUs - e.enteredUs;
+        e.busy = false;
+    }
+}
+
+void TaskStats::setStackFree(int id, uint32_t bytes)
+{
+    if (id >= 0)
+    {
+        entries[id].stackFree = bytes;
+    }
+}
+
+uint32_t TaskStats::totalBusy(const Entry &e, uint32_t nowUs) const
+{
+    // 区間の途中なら、そこまでを足しておく (あとで leave したときの合計と辻褄が合う)
+    uint32_t total = e.busyUs;
+    if (e.busy)
+    {
+        total += nowUs - e.enteredUs;
+    }
+    return total;
+}
+
+size_t TaskStats::formatJson(char *out, size_t size, uint32_t nowUs)
+{
+    uint32_t window = nowUs - lastUs;
+    lastUs = nowUs;
+    uint32_t corePermille[2] = {0, 0};
+
+    int pos = snprintf(out, size, "{\"window_ms\":%u,\"tasks\":[", (unsigned)(window / 1000));
+    for (size_t i = 0; i < n && pos > 0 && (size_t)pos < size; i++)
+    {
+        Entry &e = entries[i];
+        uint32_t total = totalBusy(e, nowUs);
+        uint32_t busy = total - e.lastBusyUs;
+        e.lastBusyUs = total;
+        if (busy > window)
+        {
+            busy = window; // 書き込みの途中を読んだとき
+        }
+        e.permille = window ? (uint32_t)((uint64_t)busy * 1000 / window) : 0;
+        if (e.core == 0 || e.core == 1)
+        {
+            corePermille[e.core] += e.permille;
+        }
+        pos += snprintf(out + pos, size - pos, "%s{\"name\":\"%s\",\"core\":%d,\"prio\":%d,\"busy\":%u.%u,\"stack_free\":%u}", i ? "," : "", e.name, e.core,
+                        e.priority, (unsigned)(e.permille / 10), (unsigned)(e.permille % 10), (unsigned)e.stackFree);
+    }
+    if (pos > 0 && (size_t)pos < size)
+    {
+        pos += snprintf(out + pos, size - pos, "],\"core0\":%u.%u,\"core1\":%u.%u}", (unsigned)(corePermille[0] / 10), (unsigned)(corePermille[0] % 10),
+                        (unsigned)(corePermille[1] / 10), (unsigned)(corePermille[1] % 10));
+    }
+    if (pos <= 0 || (size_t)pos >= size)
+    {
+        if (size)
+        {
+            out[0] = '\0';
+        }
+        return 0;
+    }
+    return (size_t)pos;
+}
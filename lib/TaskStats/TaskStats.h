@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// タスクごとの忙しさ (キューやカメラを待っていない時間) とスタックの残りを集める
+// 各タスクは自分の欄だけを書き、読む側は前回との差で割合を出すのでロックはいらない。Arduino に依存しない
+class TaskStats
+{
+public:
+    static const size_t MAX_TASKS = 8;
+
+    // 登録した順の番号を返す (いっぱいなら -1)。name は固定の文字列
+    int add(const char *name, int core, int priority);
+
+    // 待ちから戻ったら enter、待つ前に leave を呼ぶ
+    void enter(int id, uint32_t nowUs);
+    void leave(int id, uint32_t nowUs);
+    void setStackFree(int id, uint32_t bytes);
+
+    // 前回の呼び出しからの忙しさの割合 (タスクごと・コアごと) を JSON にする。入りきらなければ 0
+    size_t formatJson(char *out, size_t size, uint32_t nowUs);
+
+    size_t count() const { return n; }
+    const char *name(int id) const { return entries[id].name; }
+    // 直近の formatJson での割合 (0.1% 単位)
+    uint32_t busyPermille(int id) const { return entries[id].permille; }
+
+private:
+    struct Entry
+    {
+        const char *name;
+        int core;
+        int priority;
+        volatile uint32_t busyUs;    // 終わった区間の合計 (折り返してよい)
+        volatile uint32_t enteredUs; // 今の区間の開始
+        volatile bool busy;
+        volatile uint32_t stackFree;
+        uint32_t lastBusyUs; // 前回の formatJson の時点の合計
+        uint32_t permille;
+    };
+
+    uint32_t totalBusy(const Entry &e, uint32_t nowUs) const;
+
+    Entry entries[MAX_TASKS];
+    size_t n = 0;
+    uint32_t lastUs = 0;
+};
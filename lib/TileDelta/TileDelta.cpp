@@ -0,0 +1,215 @@
+#include "TileDelta.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+TileChangeMap::TileChangeMap()
+{
+}
+
+TileChangeMap::~TileChangeMap()
+{
+    end();
+}
+
+bool TileChangeMap::begin(uint16_t thumbWidth, uint16_t thumbHeight, uint8_t tileCells)
+{
+    end();
+    if (!tileCells || !thumbWidth || !thumbHeight)
+    {
+        return false;
+    }
+    uint16_t nx = (thumbWidth + tileCells - 1) / tileCells;
+    uint16_t ny = (thumbHeight + tileCells - 1) / tileCells;
+    if ((size_t)nx * ny > MAX_TILES)
+    {
+        return false;
+    }
+    reference = (uint8_t *)malloc((size_t)thumbWidth * thumbHeight);
+    if (!reference)
+    {
+        return false;
+    }
+    w = thumbWidth;
+    h = thumbHeight;
+    cells = tileCells;
+    tx = nx;
+    ty = ny;
+    hasReference = false;
+    sinceKeyframe = 0;
+    nChanged = 0;
+    return true;
+}
+
+void TileChangeMap::end()
+{
+    free(reference);
+    reference = nullptr;
+    hasReference = false;
+    w = h = 0;
+    tx = ty = 0;
+}
+
+size_t TileChangeMap::detect(const uint8_t *thumb)
+{
+    nChanged = 0;
+    if (!reference || !hasReference)
+    {
+        return 0;
+    }
+    for (uint16_t ty0 = 0; ty0 < ty; ty0++)
+    {
+        uint16_t y0 = ty0 * cells;
+        uint16_t y1 = y0 + cells < h ? y0 + cells : h;
+        for (uint16_t tx0 = 0; tx0 < tx; tx0++)
+        {
+            uint16_t x0 = tx0 * cells;
+            uint16_t x1 = x0 + cells < w ? x0 + cells : w;
+            uint32_t sum = 0;
+            uint32_t hot = 0;
+            for (uint16_t y = y0; y < y1; y++)
+            {
+                const uint8_t *a = thumb + (size_t)y * w;
+                const uint8_t *b = reference + (size_t)y * w;
+                for (uint16_t x = x0; x < x1; x++)
+                {
+                    int d = (int)a[x] - b[x];
+                    if (d < 0)
+                    {
+                        d = -d;
+                    }
+                    sum += d;
+                    if (d > cellThreshold)
+                    {
+                        hot++;
+                    }
+                }
+            }
+            uint32_t n = (uint32_t)(y1 - y0) * (x1 - x0);
+            if (hot >= minChangedCells || sum > meanThreshold * n)
+            {
+                changed[nChanged++] = ty0 * tx + tx0;
+            }
+        }
+    }
+    return nChanged;
+}
+
+bool TileChangeMap::keyframeDue() const
+{
+    if (!hasReference || sinceKeyframe + 1 >= keyframeEvery)
+    {
+        return true;
+    }
+    return nChanged * 100 > (size_t)tx * ty * maxDeltaPercent;
+}
+
+void TileChangeMap::commitKeyframe(const uint8_t *thumb)
+{
+    memcpy(reference, thumb, (size_t)w * h);
+    hasReference = true;
+    sinceKeyframe = 0;
+}
+
+void TileChangeMap::commitDelta(const uint8_t *thumb)
+{
+    for (size_t i = 0; i < nChanged; i++)
+    {
+        uint16_t x0 = (changed[i] % tx) * cells;
+        uint16_t y0 = (changed[i] / tx) * cells;
+        uint16_t x1 = x0 + cells < w ? x0 + cells : w;
+        uint16_t y1 = y0 + cells < h ? y0 + cells : h;
+        for (uint16_t y = y0; y < y1; y++)
+        {
+            memcpy(reference + (size_t)y * w + x0, thumb + (size_t)y * w + x0, x1 - x0);
+        }
+    }
+    sinceKeyframe++;
+}
+
+static void putU16(uint8_t *p, uint16_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+static void putU32(uint8_t *p, uint32_t v)
+{
+    putU16(p, (uint16_t)v);
+    putU16(p + 2, (uint16_t)(v >> 16));
+}
+
+static uint16_t getU16(const uint8_t *p)
+{
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t getU32(const uint8_t *p)
+{
+    return getU16(p) | ((uint32_t)getU16(p + 2) << 16);
+}
+
+void writeTilePacketManifest(uint8_t *out, const TilePacketHeader &header, const TileEntry *entries)
+{
+    memcpy(out, "TDL1", 4);
+    out[4] = header.type;
+    out[5] = 0;
+    putU16(out + 6, header.tileSize);
+    putU32(out + 8, header.seq);
+    putU32(out + 12, header.keySeq);
+    putU16(out + 16, header.width);
+    putU16(out + 18, header.height);
+    putU16(out + 20, header.count);
+    putU16(out + 22, 0);
+    uint8_t *p = out + TILE_PACKET_HEADER_SIZE;
+    for (uint16_t i = 0; i < header.count; i++, p += TILE_ENTRY_SIZE)
+    {
+        putU16(p, entries[i].tileX);
+        putU16(p + 2, entries[i].tileY);
+        putU32(p + 4, entries[i].length);
+    }
+}
+
+bool readTilePacketHeader(const uint8_t *buf, size_t len, TilePacketHeader *header)
+{
+    if (len < TILE_PACKET_HEADER_SIZE || memcmp(buf, "TDL1", 4) != 0)
+    {
+        return false;
+    }
+    header->type = buf[4];
+    header->tileSize = getU16(buf + 6);
+    header->seq = getU32(buf + 8);
+    header->keySeq = getU32(buf + 12);
+    header->width = getU16(buf + 16);
+    header->height = getU16(buf + 18);
+    header->count = getU16(buf + 20);
+    if (header->type != TILE_PACKET_KEYFRAME && header->type != TILE_PACKET_DELTA)
+    {
+        return false;
+    }
+    return len >= tilePacketManifestSize(header->count);
+}
+
+bool readTilePacketEntries(const uint8_t *buf, size_t len, const TilePacketHeader &header, TileEntry *entries, const uint8_t **payload)
+{
+    size_t offset = tilePacketManifestSize(header.count);
+    if (len < offset)
+    {
+        return false;
+    }
+    uint64_t total = 0; // 32 ビットの size_t では length の合計が折り返すことがある
+    const uint8_t *p = buf + TILE_PACKET_HEADER_SIZE;
+    for (uint16_t i = 0; i < header.count; i++, p += TILE_ENTRY_SIZE)
+    {
+        entries[i].tileX = getU16(p);
+        entries[i].tileY = getU16(p + 2);
+        entries[i].length = getU32(p + 4);
+        total += entries[i].length;
+    }
+    if (len < offset + total)
+    {
+        return false;
+    }
+    *payload = buf + offset;
+    return true;
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// フレームをタイルに分け、基準フレームから変化したタイルだけを送るための部品
+// 変化の判定は 1/8 の輝度画像 (JpegDc の出力) で行う。Arduino に依存しない
+
+class TileChangeMap
+{
+public:
+    static const size_t MAX_TILES = 1024;
+
+    uint8_t cellThreshold = 14;  // 1/8 画像の1画素あたりの差分のしきい値
+    uint8_t minChangedCells = 2; // タイル内でこれ以上の画素が変化したら「変化あり」
+    uint8_t meanThreshold = 6;   // タイル全体の平均差分のしきい値
+    uint32_t keyframeEvery = 30; // N パケットに1回はキーフレームを送る
+    uint8_t maxDeltaPercent = 50; // 変化タイルがこれを超えたらキーフレームにする
+
+    TileChangeMap();
+    ~TileChangeMap();
+
+    // tileCells: 1タイルが 1/8 画像の何画素か (フル解像度のタイルは tileCells * 8 px)
+    bool begin(uint16_t thumbWidth, uint16_t thumbHeight, uint8_t tileCells);
+    void end();
+
+    // 基準フレームと比べて変化したタイル数を返す
+    size_t detect(const uint8_t *thumb);
+
+    bool keyframeDue() const;
+    size_t changedCount() const { return nChanged; }
+    uint16_t changedTile(size_t i) const { return changed[i]; } // tileY * tilesX + tileX
+
+    // 受信側が持っている画像に合わせて基準を更新する
+    void commitKeyframe(const uint8_t *thumb);
+    void commitDelta(const uint8_t *thumb);
+
+    uint16_t tilesX() const { return tx; }
+    uint16_t tilesY() const { return ty; }
+    uint16_t tileSize() const { return (uint16_t)cells * 8; }
+
+private:
+    uint16_t w = 0;
+    uint16_t h = 0;
+    uint8_t cells = 0;
+    uint16_t tx = 0;
+    uint16_t ty = 0;
+    uint8_t *reference = nullptr;
+    bool hasReference = false;
+    uint32_t sinceKeyframe = 0;
+    uint16_t changed[MAX_TILES];
+    size_t nChanged = 0;
+};
+
+// 送信パケット: ヘッダ + タイル表 (マニフェスト) + JPEG の連結。数値はリトルエンディアン
+//   "TDL1" type(1) reserved(1) tileSize(2) seq(4) keySeq(4) width(2) height(2) count(2) reserved(2)
+//   count 個の { tileX(2) tileY(2) length(4) }
+// キーフレームは tileX = tileY = 0xFFFF の1エントリでフレーム全体の JPEG を持つ
+enum TilePacketType : uint8_t
+{
+    TILE_PACKET_KEYFRAME = 'K',
+    TILE_PACKET_DELTA = 'D',
+};
+
+struct TilePacketHeader
+{
+    uint8_t type;
+    uint16_t tileSize;
+    uint32_t seq;
+    uint32_t keySeq; // このパケットが基にするキーフレームの seq
+    uint16_t width;
+    uint16_t height;
+    uint16_t count;
+};
+
+struct TileEntry
+{
+    uint16_t tileX;
+    uint16_t tileY;
+    uint32_t length;
+};
+
+static const uint16_t TILE_FULL_FRAME = 0xFFFF;
+static const size_t TILE_PACKET_HEADER_SIZE = 24;
+static const size_t TILE_ENTRY_SIZE = 8;
+
+inline size_t tilePacketManifestSize(uint16_t count)
+{
+    return TILE_PACKET_HEADER_SIZE + (size_t)count * TILE_ENTRY_SIZE;
+}
+
+// out には tilePacketManifestSize(header.count) バイトが必要
+void writeTilePacketManifest(uint8_t *out, const TilePacketHeader &header, const TileEntry *entries);
+
+bool readTilePacketHeader(const uint8_t *buf, size_t len, TilePacketHeader *header);
+
+// entries には header.count 個分が必要。成功すると *payload に最初の JPEG の先頭を返す
+bool readTilePacketEntries(const uint8_t *buf, size_t len, const TilePacketHeader &header, TileEntry *entries, const uint8_t **payload);
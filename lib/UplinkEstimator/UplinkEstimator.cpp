@@ -0,0 +1,77 @@
+#include "UplinkEstimator.h"
+
+UplinkEstimator::UplinkEstimator(uint32_t initialBytesPerSecond, uint32_t initialLatencyMs)
+    : throughput((float)initialBytesPerSecond), latency((float)initialLatencyMs)
+{
+}
+
+void UplinkEstimator::recordUpload(size_t bytes, uint32_t elapsedMs)
+{
+    if (!elapsedMs)
+    {
+        elapsedMs = 1;
+    }
+    consecutiveFailures = 0;
+    if (bytes < smallUploadBytes)
+    {
+        // 小さい送信はほぼ遅延だけで決まる。スループットは、遅延を 0 とみなした下限より低ければそこまで戻すだけ
+        // (罰で下げたあと、サムネイルしか送らない間も回線が戻ったことがわかる)
+        latency += smoothing * ((float)elapsedMs - latency);
+        float atLeast = (float)bytes * 1000.0f / elapsedMs;
+        if (atLeast > throughput)
+        {
+            throughput += smoothing * (atLeast - throughput);
+        }
+        return;
+    }
+    float transferMs = (float)elapsedMs - latency;
+    if (transferMs < elapsedMs * 0.2f)
+    {
+        transferMs = elapsedMs * 0.2f; // 遅延を多めに見積もっていても極端な値にしない
+    }
+    float measured = (float)bytes * 1000.0f / transferMs;
+    throughput += smoothing * (measured - throughput);
+}
+
+void UplinkEstimator::recordFailure(uint32_t elapsedMs)
+{
+    // 大きさによらず、その時間では何も届かなかった。待った時間は遅延の下限として、スループットは罰で下げる
+    nFailures++;
+    if (consecutiveFailures < 0xFF)
+    {
+        consecutiveFailures++;
+    }
+    latency += smoothing * ((float)elapsedMs - latency);
+    throughput *= failurePenalty;
+    if (throughput < minBytesPerSecond)
+    {
+        throughput = (float)minBytesPerSecond;
+    }
+}
+
+uint32_t UplinkEstimator::expectedMs(size_t bytes) const
+{
+    return (uint32_t)(latency + (float)bytes * 1000.0f / throughput);
+}
+
+uint32_t UplinkEstimator::byteBudget(uint32_t deadlineMs) const
+{
+    if (deadlineMs <= latency)
+    {
+        return 0;
+    }
+    return (uint32_t)(((float)deadlineMs - latency) * throughput / 1000.0f);
+}
+
+bool UplinkEstimator::linkPoor(uint32_t deadlineMs) const
+{
+    if (lastRssi != 0 && lastRssi < poorRssi)
+    {
+        return true;
+    }
+    if (consecutiveFailures >= poorAfterFailures)
+    {
+        return true;
+    }
+    return byteBudget(deadlineMs) < minFullFrameBytes;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// アップロードの実測から回線の速さを推定する
+// 送信時間 = 固定の遅延 (WireGuard + HTTP の往復) + バイト数 / スループット、として EWMA で追いかける。
+// 送れなかった (タイムアウト・接続できない) 送信は罰として推定を下げるので、切れた回線はすぐ悪く見える。Arduino に依存しない
+class UplinkEstimator
+{
+public:
+    float smoothing = 0.3f;          // EWMA 係数
+    uint32_t smallUploadBytes = 8192; // これより小さい送信は遅延の推定に使う
+    int poorRssi = -85;              // これより弱い電波は回線不良とみなす
+    uint32_t minFullFrameBytes = 40000; // 締め切り内にこれだけ送れないならサムネイルに切り替える
+    float failurePenalty = 0.5f;     // 送れなかったらスループットにこれを掛ける
+    uint8_t poorAfterFailures = 2;   // 続けてこの回数送れなければ、推定によらず回線不良とみなす
+    uint32_t minBytesPerSecond = 100; // 罰で下げる下限 (回線が戻ったら小さい送信でも戻れるように 0 にしない)
+
+    UplinkEstimator(uint32_t initialBytesPerSecond = 50000, uint32_t initialLatencyMs = 300);
+
+    void recordUpload(size_t bytes, uint32_t elapsedMs);
+    // 送れなかった送信。elapsedMs は諦めるまでにかかった時間
+    void recordFailure(uint32_t elapsedMs);
+    void recordRssi(int rssi) { lastRssi = rssi; }
+
+    uint32_t bytesPerSecond() const { return (uint32_t)throughput; }
+    uint32_t latencyMs() const { return (uint32_t)latency; }
+    int rssi() const { return lastRssi; }
+    uint32_t failures() const { return nFailures; }
+
+    uint32_t expectedMs(size_t bytes) const;
+    // deadlineMs 以内に送れるバイト数
+    uint32_t byteBudget(uint32_t deadlineMs) const;
+    bool linkPoor(uint32_t deadlineMs) const;
+
+private:
+    float throughput;
+    float latency;
+    int lastRssi = 0;
+    uint32_t nFailures = 0;
+    uint8_t consecutiveFailures = 0;
+};
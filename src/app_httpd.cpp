@@ -20,6 +20,13 @@
 #include "esp32-hal-ledc.h"
 #include "sdkconfig.h"
 #include "camera_index.h"
+#include "CameraRoi.h"
+#include "CameraService.h"
+#include "CaptureCache.h"
+#include "FrameLog.h"
+#include "BufferPool.h"
+#include "MemoryTelemetry.h"
+#include <SD.h>
 
 #if defined(ARDUINO_ARCH_ESP32) && defined(CONFIG_ARDUHAL_ESP_LOG)
 #include "esp32-hal-log.h"
@@ -64,6 +71,52 @@ typedef struct
 
 static ra_filter_t ra_filter;
 
+// 変換やクエリ文字列のバッファはリクエストごとに malloc せず、ここから借りる
+// JPEG: 非 JPEG モードのストリームの変換先、BMP: VGA の 24bit まで
+static const BufferPool::SizeClass buffer_pool_classes[] = {
+    {512, 4},                  // クエリ文字列
+    {128 * 1024, 2},           // JPEG
+    {54 + 640 * 480 * 3, 1},   // BMP
+};
+static BufferPool buffer_pool;
+
+typedef struct
+{
+  uint8_t *buf;
+  size_t capacity;
+  size_t len;
+} jpg_pool_buf_t;
+
+// frame2jpg_cb の出力をプールのバッファに書く。入りきらなければ 0 を返して変換をやめる
+static size_t jpg_encode_pool(void *arg, size_t index, const void *data, size_t len)
+{
+  jpg_pool_buf_t *j = (jpg_pool_buf_t *)arg;
+  if (!index)
+  {
+    j->len = 0;
+  }
+  if (j->len + len > j->capacity)
+  {
+    return 0;
+  }
+  memcpy(j->buf + j->len, data, len);
+  j->len += len;
+  return len;
+}
+
+extern CaptureCache captureCache; // main.cpp が撮影のたびにフル解像度を入れる
+extern FrameLog frameLog;         // main.cpp が SD に残しているフレーム
+extern bool sdReady;              // SD カードを使える機種で、起動時にマウントできたとき true
+extern MemoryTelemetry memoryTelemetry;
+extern CameraService camera;      // main.cpp が持つカメラの窓口。ドライバとセンサーはここを通してだけ触る
+
+// /capture と /bmp (サーバーのタスクは1つ) と、別のサーバーで動く /stream は別の受け手として登録する
+static int still_consumer = -1;
+static int stream_consumer = -1;
+static const uint32_t acquire_timeout_ms = 5000;
+
+static uint8_t send_chunk[4096]; // キャッシュやファイルから小分けに送るときの作業領域 (サーバーのタスクは1つ)
+
 static ra_filter_t *ra_filter_init(ra_filter_t *filter, size_t sample_size)
 {
   memset(filter, 0, sizeof(ra_filter_t));
@@ -114,6 +167,32 @@ void enable_led(bool en)
 }
 #endif
 
+#define BMP_HEADER_LEN 54
+
+static void put_le32(uint8_t *p, uint32_t v)
+{
+  p[0] = v;
+  p[1] = v >> 8;
+  p[2] = v >> 16;
+  p[3] = v >> 24;
+}
+
+static void write_bmp_header(uint8_t *p, uint16_t width, uint16_t height)
+{
+  uint32_t image_size = (uint32_t)width * height * 3;
+  memset(p, 0, BMP_HEADER_LEN);
+  p[0] = 'B';
+  p[1] = 'M';
+  put_le32(p + 2, BMP_HEADER_LEN + image_size);
+  put_le32(p + 10, BMP_HEADER_LEN);
+  put_le32(p + 14, 40);
+  put_le32(p + 18, width);
+  put_le32(p + 22, (uint32_t)(-(int32_t)height)); // 上から下
+  p[26] = 1;                                     // planes
+  p[28] = 24;                                    // bits per pixel
+  put_le32(p + 34, image_size);
+}
+
 static esp_err_t bmp_handler(httpd_req_t *req)
 {
   camera_fb_t *fb = NULL;
@@ -121,7 +200,7 @@ static esp_err_t bmp_handler(httpd_req_t *req)
 #if ARDUHAL_LOG_LEVEL >= ARDUHAL_LOG_LEVEL_INFO
   uint64_t fr_start = esp_timer_get_time();
 #endif
-  fb = esp_camera_fb_get();
+  fb = camera.acquire(still_consumer, acquire_timeout_ms);
   if (!fb)
   {
     log_e("Camera capture failed");
@@ -137,18 +216,26 @@ static esp_err_t bmp_handler(httpd_req_t *req)
   snprintf(ts, 32, "%lld.%06ld", fb->timestamp.tv_sec, fb->timestamp.tv_usec);
   httpd_resp_set_hdr(req, "X-Timestamp", (const char *)ts);
 
-  uint8_t *buf = NULL;
-  size_t buf_len = 0;
-  bool converted = frame2bmp(fb, &buf, &buf_len);
-  esp_camera_fb_return(fb);
+  // frame2bmp と同じ形 (上から下への 24bit) をプールのバッファに作る
+  size_t pix_count = fb->width * fb->height;
+  size_t buf_len = BMP_HEADER_LEN + pix_count * 3;
+  uint8_t *buf = (uint8_t *)buffer_pool.acquire(buf_len);
+  bool converted = buf != NULL;
+  if (converted)
+  {
+    write_bmp_header(buf, fb->width, fb->height);
+    converted = fmt2rgb888(fb->buf, fb->len, fb->format, buf + BMP_HEADER_LEN);
+  }
+  camera.release(still_consumer);
   if (!converted)
   {
+    buffer_pool.release(buf);
     log_e("BMP Conversion failed");
     httpd_resp_send_500(req);
     return ESP_FAIL;
   }
   res = httpd_resp_send(req, (const char *)buf, buf_len);
-  free(buf);
+  buffer_pool.release(buf);
 #if ARDUHAL_LOG_LEVEL >= ARDUHAL_LOG_LEVEL_INFO
   uint64_t fr_end = esp_timer_get_time();
 #endif
@@ -181,11 +268,11 @@ static esp_err_t capture_handler(httpd_req_t *req)
 
 #if CONFIG_LED_ILLUMINATOR_ENABLED
   enable_led(true);
-  vTaskDelay(150 / portTICK_PERIOD_MS); // The LED needs to be turned on ~150ms before the call to esp_camera_fb_get()
-  fb = esp_camera_fb_get();             // or it won't be visible in the frame. A better way to do this is needed.
+  vTaskDelay(150 / portTICK_PERIOD_MS);                  // The LED needs to be turned on ~150ms before the call to esp_camera_fb_get()
+  fb = camera.acquire(still_consumer, acquire_timeout_ms); // or it won't be visible in the frame. A better way to do this is needed.
   enable_led(false);
 #else
-  fb = esp_camera_fb_get();
+  fb = camera.acquire(still_consumer, acquire_timeout_ms);
 #endif
 
   if (!fb)
@@ -222,7 +309,7 @@ static esp_err_t capture_handler(httpd_req_t *req)
     fb_len = jchunk.len;
 #endif
   }
-  esp_camera_fb_return(fb);
+  camera.release(still_consumer);
 #if ARDUHAL_LOG_LEVEL >= ARDUHAL_LOG_LEVEL_INFO
   int64_t fr_end = esp_timer_get_time();
 #endif
@@ -238,6 +325,7 @@ static esp_err_t stream_handler(httpd_req_t *req)
   size_t _jpg_buf_len = 0;
   uint8_t *_jpg_buf = NULL;
   char *part_buf[128];
+  jpg_pool_buf_t jpg_out = {NULL, 0, 0};
 
   static int64_t last_frame = 0;
   if (!last_frame)
@@ -261,7 +349,7 @@ static esp_err_t stream_handler(httpd_req_t *req)
 
   while (true)
   {
-    fb = esp_camera_fb_get();
+    fb = camera.acquire(stream_consumer, acquire_timeout_ms);
     if (!fb)
     {
       log_e("Camera capture failed");
@@ -273,8 +361,23 @@ static esp_err_t stream_handler(httpd_req_t *req)
       _timestamp.tv_usec = fb->timestamp.tv_usec;
       if (fb->format != PIXFORMAT_JPEG)
       {
-        bool jpeg_converted = frame2jpg(fb, 80, &_jpg_buf, &_jpg_buf_len);
-        esp_camera_fb_return(fb);
+        // 変換先は接続の間ずっと同じプールのバッファを使う。入りきらないフレームだけ従来どおり malloc する
+        if (!jpg_out.buf)
+        {
+          jpg_out.buf = (uint8_t *)buffer_pool.acquire(buffer_pool_classes[1].size);
+          jpg_out.capacity = jpg_out.buf ? buffer_pool_classes[1].size : 0;
+        }
+        bool jpeg_converted = jpg_out.capacity && frame2jpg_cb(fb, 80, jpg_encode_pool, &jpg_out);
+        if (jpeg_converted)
+        {
+          _jpg_buf = jpg_out.buf;
+          _jpg_buf_len = jpg_out.len;
+        }
+        else
+        {
+          jpeg_converted = frame2jpg(fb, 80, &_jpg_buf, &_jpg_buf_len);
+        }
+        camera.release(stream_consumer);
         fb = NULL;
         if (!jpeg_converted)
         {
@@ -303,13 +406,16 @@ static esp_err_t stream_handler(httpd_req_t *req)
     }
     if (fb)
     {
-      esp_camera_fb_return(fb);
+      camera.release(stream_consumer);
       fb = NULL;
       _jpg_buf = NULL;
     }
     else if (_jpg_buf)
     {
-      free(_jpg_buf);
+      if (_jpg_buf != jpg_out.buf)
+      {
+        free(_jpg_buf);
+      }
       _jpg_buf = NULL;
     }
     if (res != ESP_OK)
@@ -329,6 +435,8 @@ static esp_err_t stream_handler(httpd_req_t *req)
         1000.0 / avg_frame_time);
   }
 
+  buffer_pool.release(jpg_out.buf);
+
 #if CONFIG_LED_ILLUMINATOR_ENABLED
   isStreaming = false;
   enable_led(false);
@@ -345,7 +453,7 @@ static esp_err_t parse_get(httpd_req_t *req, char **obuf)
   buf_len = httpd_req_get_url_query_len(req) + 1;
   if (buf_len > 1)
   {
-    buf = (char *)malloc(buf_len);
+    buf = (char *)buffer_pool.acquire(buf_len);
     if (!buf)
     {
       httpd_resp_send_500(req);
@@ -356,43 +464,27 @@ static esp_err_t parse_get(httpd_req_t *req, char **obuf)
       *obuf = buf;
       return ESP_OK;
     }
-    free(buf);
+    buffer_pool.release(buf);
   }
   httpd_resp_send_404(req);
   return ESP_FAIL;
 }
 
-static esp_err_t cmd_handler(httpd_req_t *req)
+typedef struct
 {
-  char *buf = NULL;
-  char variable[32];
-  char value[32];
-
-  if (parse_get(req, &buf) != ESP_OK)
-  {
-    return ESP_FAIL;
-  }
-  if (httpd_query_key_value(buf, "var", variable, sizeof(variable)) != ESP_OK || httpd_query_key_value(buf, "val", value, sizeof(value)) != ESP_OK)
-  {
-    free(buf);
-    httpd_resp_send_404(req);
-    return ESP_FAIL;
-  }
-  free(buf);
+  const char *variable;
+  int val;
+} control_t;
 
-  int val = atoi(value);
-  log_i("%s = %d", variable, val);
-  sensor_t *s = esp_camera_sensor_get();
+// /control のセンサーの設定。camera のタスクで、フレームを誰も持っていない間に実行される
+static int apply_control(sensor_t *s, void *arg)
+{
+  const control_t *c = (const control_t *)arg;
+  const char *variable = c->variable;
+  int val = c->val;
   int res = 0;
 
-  if (!strcmp(variable, "framesize"))
-  {
-    if (s->pixformat == PIXFORMAT_JPEG)
-    {
-      res = s->set_framesize(s, (framesize_t)val);
-    }
-  }
-  else if (!strcmp(variable, "quality"))
+  if (!strcmp(variable, "quality"))
   {
     res = s->set_quality(s, val);
   }
@@ -484,6 +576,42 @@ static esp_err_t cmd_handler(httpd_req_t *req)
   {
     res = s->set_ae_level(s, val);
   }
+  else
+  {
+    log_i("Unknown command: %s", variable);
+    res = -1;
+  }
+  return res;
+}
+
+static esp_err_t cmd_handler(httpd_req_t *req)
+{
+  char *buf = NULL;
+  char variable[32];
+  char value[32];
+
+  if (parse_get(req, &buf) != ESP_OK)
+  {
+    return ESP_FAIL;
+  }
+  if (httpd_query_key_value(buf, "var", variable, sizeof(variable)) != ESP_OK || httpd_query_key_value(buf, "val", value, sizeof(value)) != ESP_OK)
+  {
+    buffer_pool.release(buf);
+    httpd_resp_send_404(req);
+    return ESP_FAIL;
+  }
+  buffer_pool.release(buf);
+
+  int val = atoi(value);
+  log_i("%s = %d", variable, val);
+  int res = 0;
+
+  if (!strcmp(variable, "framesize"))
+  {
+    // センサーには直接掛けず、Web の受け手の解像度にする。切り替えは camera が撮るときにする (窓も掛け直す)
+    camera.setFramesize(still_consumer, val);
+    camera.setFramesize(stream_consumer, val);
+  }
 #if CONFIG_LED_ILLUMINATOR_ENABLED
   else if (!strcmp(variable, "led_intensity"))
   {
@@ -496,8 +624,11 @@ static esp_err_t cmd_handler(httpd_req_t *req)
 #endif
   else
   {
-    log_i("Unknown command: %s", variable);
-    res = -1;
+    control_t control = {variable, val};
+    if (camera.configure(apply_control, &control, &res) != ESP_OK)
+    {
+      return httpd_resp_send_500(req);
+    }
   }
 
   if (res < 0)
@@ -514,13 +645,11 @@ static int print_reg(char *p, sensor_t *s, uint16_t reg, uint32_t mask)
   return sprintf(p, "\"0x%x\":%u,", reg, s->get_reg(s, reg, mask));
 }
 
-static esp_err_t status_handler(httpd_req_t *req)
+// センサーのレジスタと設定を p に書き、書いた長さを返す。camera のタスクで実行する
+static int write_sensor_status(sensor_t *s, void *arg)
 {
-  static char json_response[1024];
-
-  sensor_t *s = esp_camera_sensor_get();
-  char *p = json_response;
-  *p++ = '{';
+  char *start = (char *)arg;
+  char *p = start;
 
   if (s->id.PID == OV5640_PID || s->id.PID == OV3660_PID)
   {
@@ -584,11 +713,31 @@ static esp_err_t status_handler(httpd_req_t *req)
   p += sprintf(p, "\"hmirror\":%u,", s->status.hmirror);
   p += sprintf(p, "\"dcw\":%u,", s->status.dcw);
   p += sprintf(p, "\"colorbar\":%u", s->status.colorbar);
+  return p - start;
+}
+
+static esp_err_t status_handler(httpd_req_t *req)
+{
+  static char json_response[1024];
+
+  char *p = json_response;
+  *p++ = '{';
+  int len = 0;
+  if (camera.configure(write_sensor_status, p, &len) != ESP_OK)
+  {
+    log_e("Camera sensor busy or not found");
+    return httpd_resp_send_500(req);
+  }
+  p += len;
 #if CONFIG_LED_ILLUMINATOR_ENABLED
   p += sprintf(p, ",\"led_intensity\":%u", led_duty);
 #else
   p += sprintf(p, ",\"led_intensity\":%d", -1);
 #endif
+  p += sprintf(p, ",\"pool_acquires\":%u,\"pool_heap_allocs\":%u,\"pool_high_water\":%u", (unsigned)buffer_pool.acquires(), (unsigned)buffer_pool.heapAllocations(),
+               (unsigned)buffer_pool.highWater());
+  p += sprintf(p, ",\"camera_frames\":%u,\"camera_reconfigs\":%u,\"camera_shared\":%u", (unsigned)camera.frames(), (unsigned)camera.reconfigurations(),
+               (unsigned)camera.sharedDeliveries());
   *p++ = '}';
   *p++ = 0;
   httpd_resp_set_type(req, "application/json");
@@ -596,6 +745,12 @@ static esp_err_t status_handler(httpd_req_t *req)
   return httpd_resp_send(req, json_response, strlen(json_response));
 }
 
+// 以下の set_* / get_reg は camera のタスクで実行する。arg はハンドラが解析した値
+static int set_xclk(sensor_t *s, void *arg)
+{
+  return s->set_xclk(s, LEDC_TIMER_0, *(int *)arg);
+}
+
 static esp_err_t xclk_handler(httpd_req_t *req)
 {
   char *buf = NULL;
@@ -607,18 +762,17 @@ static esp_err_t xclk_handler(httpd_req_t *req)
   }
   if (httpd_query_key_value(buf, "xclk", _xclk, sizeof(_xclk)) != ESP_OK)
   {
-    free(buf);
+    buffer_pool.release(buf);
     httpd_resp_send_404(req);
     return ESP_FAIL;
   }
-  free(buf);
+  buffer_pool.release(buf);
 
   int xclk = atoi(_xclk);
   log_i("Set XCLK: %d MHz", xclk);
 
-  sensor_t *s = esp_camera_sensor_get();
-  int res = s->set_xclk(s, LEDC_TIMER_0, xclk);
-  if (res)
+  int res = -1;
+  if (camera.configure(set_xclk, &xclk, &res) != ESP_OK || res)
   {
     return httpd_resp_send_500(req);
   }
@@ -627,6 +781,12 @@ static esp_err_t xclk_handler(httpd_req_t *req)
   return httpd_resp_send(req, NULL, 0);
 }
 
+static int set_reg(sensor_t *s, void *arg)
+{
+  const int *v = (const int *)arg; // reg, mask, val
+  return s->set_reg(s, v[0], v[1], v[2]);
+}
+
 static esp_err_t reg_handler(httpd_req_t *req)
 {
   char *buf = NULL;
@@ -640,20 +800,20 @@ static esp_err_t reg_handler(httpd_req_t *req)
   }
   if (httpd_query_key_value(buf, "reg", _reg, sizeof(_reg)) != ESP_OK || httpd_query_key_value(buf, "mask", _mask, sizeof(_mask)) != ESP_OK || httpd_query_key_value(buf, "val", _val, sizeof(_val)) != ESP_OK)
   {
-    free(buf);
+    buffer_pool.release(buf);
     httpd_resp_send_404(req);
     return ESP_FAIL;
   }
-  free(buf);
+  buffer_pool.release(buf);
 
   int reg = atoi(_reg);
   int mask = atoi(_mask);
   int val = atoi(_val);
   log_i("Set Register: reg: 0x%02x, mask: 0x%02x, value: 0x%02x", reg, mask, val);
 
-  sensor_t *s = esp_camera_sensor_get();
-  int res = s->set_reg(s, reg, mask, val);
-  if (res)
+  int args[3] = {reg, mask, val};
+  int res = -1;
+  if (camera.configure(set_reg, args, &res) != ESP_OK || res)
   {
     return httpd_resp_send_500(req);
   }
@@ -662,6 +822,12 @@ static esp_err_t reg_handler(httpd_req_t *req)
   return httpd_resp_send(req, NULL, 0);
 }
 
+static int get_reg(sensor_t *s, void *arg)
+{
+  const int *v = (const int *)arg; // reg, mask
+  return s->get_reg(s, v[0], v[1]);
+}
+
 static esp_err_t greg_handler(httpd_req_t *req)
 {
   char *buf = NULL;
@@ -674,17 +840,17 @@ static esp_err_t greg_handler(httpd_req_t *req)
   }
   if (httpd_query_key_value(buf, "reg", _reg, sizeof(_reg)) != ESP_OK || httpd_query_key_value(buf, "mask", _mask, sizeof(_mask)) != ESP_OK)
   {
-    free(buf);
+    buffer_pool.release(buf);
     httpd_resp_send_404(req);
     return ESP_FAIL;
   }
-  free(buf);
+  buffer_pool.release(buf);
 
   int reg = atoi(_reg);
   int mask = atoi(_mask);
-  sensor_t *s = esp_camera_sensor_get();
-  int res = s->get_reg(s, reg, mask);
-  if (res < 0)
+  int args[2] = {reg, mask};
+  int res = -1;
+  if (camera.configure(get_reg, args, &res) != ESP_OK || res < 0)
   {
     return httpd_resp_send_500(req);
   }
@@ -706,6 +872,12 @@ static int parse_get_var(char *buf, const char *key, int def)
   return atoi(_int);
 }
 
+static int set_pll(sensor_t *s, void *arg)
+{
+  const int *v = (const int *)arg; // bypass, mul, sys, root, pre, seld5, pclken, pclk
+  return s->set_pll(s, v[0], v[1], v[2], v[3], v[4], v[5], v[6], v[7]);
+}
+
 static esp_err_t pll_handler(httpd_req_t *req)
 {
   char *buf = NULL;
@@ -723,12 +895,12 @@ static esp_err_t pll_handler(httpd_req_t *req)
   int seld5 = parse_get_var(buf, "seld5", 0);
   int pclken = parse_get_var(buf, "pclken", 0);
   int pclk = parse_get_var(buf, "pclk", 0);
-  free(buf);
+  buffer_pool.release(buf);
 
   log_i("Set Pll: bypass: %d, mul: %d, sys: %d, root: %d, pre: %d, seld5: %d, pclken: %d, pclk: %d", bypass, mul, sys, root, pre, seld5, pclken, pclk);
-  sensor_t *s = esp_camera_sensor_get();
-  int res = s->set_pll(s, bypass, mul, sys, root, pre, seld5, pclken, pclk);
-  if (res)
+  int args[8] = {bypass, mul, sys, root, pre, seld5, pclken, pclk};
+  int res = -1;
+  if (camera.configure(set_pll, args, &res) != ESP_OK || res)
   {
     return httpd_resp_send_500(req);
   }
@@ -737,6 +909,12 @@ static esp_err_t pll_handler(httpd_req_t *req)
   return httpd_resp_send(req, NULL, 0);
 }
 
+static int set_res_raw(sensor_t *s, void *arg)
+{
+  const int *v = (const int *)arg; // sx, sy, ex, ey, offx, offy, tx, ty, ox, oy, scale, binning
+  return s->set_res_raw(s, v[0], v[1], v[2], v[3], v[4], v[5], v[6], v[7], v[8], v[9], v[10] != 0, v[11] != 0);
+}
+
 static esp_err_t win_handler(httpd_req_t *req)
 {
   char *buf = NULL;
@@ -758,15 +936,15 @@ static esp_err_t win_handler(httpd_req_t *req)
   int outputY = parse_get_var(buf, "oy", 0);
   bool scale = parse_get_var(buf, "scale", 0) == 1;
   bool binning = parse_get_var(buf, "binning", 0) == 1;
-  free(buf);
+  buffer_pool.release(buf);
 
   log_i(
       "Set Window: Start: %d %d, End: %d %d, Offset: %d %d, Total: %d %d, Output: %d %d, Scale: %u, Binning: %u", startX, startY, endX, endY, offsetX, offsetY,
       totalX, totalY, outputX, outputY, scale, binning // codespell:ignore totaly
   );
-  sensor_t *s = esp_camera_sensor_get();
-  int res = s->set_res_raw(s, startX, startY, endX, endY, offsetX, offsetY, totalX, totalY, outputX, outputY, scale, binning); // codespell:ignore totaly
-  if (res)
+  int args[12] = {startX, startY, endX, endY, offsetX, offsetY, totalX, totalY, outputX, outputY, scale, binning}; // codespell:ignore totaly
+  int res = -1;
+  if (camera.configure(set_res_raw, args, &res) != ESP_OK || res)
   {
     return httpd_resp_send_500(req);
   }
@@ -775,18 +953,443 @@ static esp_err_t win_handler(httpd_req_t *req)
   return httpd_resp_send(req, NULL, 0);
 }
 
+// roi が NULL なら解除する
+static int set_roi(sensor_t *s, void *arg)
+{
+  const CameraRoi *roi = (const CameraRoi *)arg;
+  if (!roi)
+  {
+    cameraRoiClear();
+    return cameraRoiApply(s, cameraRoiCurrent());
+  }
+  return cameraRoiSave(*roi) ? cameraRoiApply(s, *roi) : -1;
+}
+
+static esp_err_t roi_handler(httpd_req_t *req)
+{
+  size_t query_len = httpd_req_get_url_query_len(req);
+  if (query_len > 0)
+  {
+    char *buf = NULL;
+    if (parse_get(req, &buf) != ESP_OK)
+    {
+      return ESP_FAIL;
+    }
+    bool clear = parse_get_var(buf, "clear", 0) == 1;
+    CameraRoi roi;
+    roi.x = parse_get_var(buf, "x", 0);
+    roi.y = parse_get_var(buf, "y", 0);
+    roi.w = parse_get_var(buf, "w", 1000);
+    roi.h = parse_get_var(buf, "h", 1000);
+    buffer_pool.release(buf);
+
+    if (!clear)
+    {
+      log_i("Set ROI: %u,%u %ux%u", roi.x, roi.y, roi.w, roi.h);
+    }
+    int res = -1;
+    if (camera.configure(set_roi, clear ? NULL : &roi, &res) != ESP_OK || res)
+    {
+      return httpd_resp_send_500(req);
+    }
+  }
+
+  char json_response[96];
+  const CameraRoi &roi = cameraRoiCurrent();
+  snprintf(json_response, sizeof(json_response), "{\"x\":%u,\"y\":%u,\"w\":%u,\"h\":%u}", roi.x, roi.y, roi.w, roi.h);
+  httpd_resp_set_type(req, "application/json");
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+  return httpd_resp_send(req, json_response, strlen(json_response));
+}
+
+static esp_err_t full_handler(httpd_req_t *req)
+{
+  uint32_t id = captureCache.latestId();
+  if (httpd_req_get_url_query_len(req) > 0)
+  {
+    char *buf = NULL;
+    if (parse_get(req, &buf) != ESP_OK)
+    {
+      return ESP_FAIL;
+    }
+    id = parse_get_var(buf, "id", id);
+    buffer_pool.release(buf);
+  }
+
+  size_t len = 0;
+  uint32_t timestamp = 0;
+  if (!captureCache.info(id, &len, &timestamp))
+  {
+    return httpd_resp_send_404(req);
+  }
+
+  char id_str[16];
+  char ts[16];
+  snprintf(id_str, sizeof(id_str), "%u", (unsigned)id);
+  snprintf(ts, sizeof(ts), "%u", (unsigned)timestamp);
+  httpd_resp_set_type(req, "image/jpeg");
+  httpd_resp_set_hdr(req, "Content-Disposition", "inline; filename=full.jpg");
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+  httpd_resp_set_hdr(req, "X-Capture-Id", id_str);
+  httpd_resp_set_hdr(req, "X-Timestamp", ts);
+
+  // キャッシュはロックを取ってコピーするので、送信中に撮影を止めないよう小分けにする
+  size_t offset = 0;
+  while (offset < len)
+  {
+    size_t got = 0;
+    if (!captureCache.read(id, offset, send_chunk, sizeof(send_chunk), &got) || !got)
+    {
+      log_e("Capture %u was evicted while sending", id);
+      break;
+    }
+    if (httpd_resp_send_chunk(req, (const char *)send_chunk, got) != ESP_OK)
+    {
+      return ESP_FAIL;
+    }
+    offset += got;
+  }
+  log_i("Full capture %u: %uB", id, (uint32_t)offset);
+  return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+// /frame?t=<unix 秒> その時刻以降で最初のフレーム
+static esp_err_t frame_handler(httpd_req_t *req)
+{
+  char *buf = NULL;
+  if (parse_get(req, &buf) != ESP_OK)
+  {
+    return ESP_FAIL;
+  }
+  uint32_t t = (uint32_t)parse_get_var(buf, "t", 0);
+  buffer_pool.release(buf);
+
+  FrameLogRecord rec;
+  if (!frameLog.findAt((uint64_t)t * 1000, &rec))
+  {
+    return httpd_resp_send_404(req);
+  }
+  File f = frameLog.open(rec);
+  if (!f)
+  {
+    return httpd_resp_send_404(req);
+  }
+
+  char ts[24];
+  snprintf(ts, sizeof(ts), "%u.%03u", (unsigned)(rec.timestampMs / 1000), (unsigned)(rec.timestampMs % 1000));
+  httpd_resp_set_type(req, "image/jpeg");
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+  httpd_resp_set_hdr(req, "X-Timestamp", ts);
+
+  uint32_t remaining = rec.length;
+  while (remaining)
+  {
+    size_t k = remaining < sizeof(send_chunk) ? remaining : sizeof(send_chunk);
+    if (f.read(send_chunk, k) != k || httpd_resp_send_chunk(req, (const char *)send_chunk, k) != ESP_OK)
+    {
+      log_e("Frame log read failed");
+      return ESP_FAIL;
+    }
+    remaining -= k;
+  }
+  return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+// /frames?from=<unix 秒>&to=<unix 秒> その範囲のフレームの時刻と大きさ (最大 100 個)
+static esp_err_t frames_handler(httpd_req_t *req)
+{
+  char *buf = NULL;
+  if (parse_get(req, &buf) != ESP_OK)
+  {
+    return ESP_FAIL;
+  }
+  uint32_t from = (uint32_t)parse_get_var(buf, "from", 0);
+  uint32_t to = (uint32_t)parse_get_var(buf, "to", from + 3600);
+  buffer_pool.release(buf);
+
+  static FrameLogRecord records[100];
+  size_t n = frameLog.list((uint64_t)from * 1000, (uint64_t)to * 1000 + 999, records, sizeof(records) / sizeof(records[0]));
+
+  httpd_resp_set_type(req, "application/json");
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+  char item[64];
+  httpd_resp_send_chunk(req, "[", 1);
+  for (size_t i = 0; i < n; i++)
+  {
+    int len = snprintf(item, sizeof(item), "%s{\"t\":%u.%03u,\"len\":%u}", i ? "," : "", (unsigned)(records[i].timestampMs / 1000),
+                       (unsigned)(records[i].timestampMs % 1000), (unsigned)records[i].length);
+    if (httpd_resp_send_chunk(req, item, len) != ESP_OK)
+    {
+      return ESP_FAIL;
+    }
+  }
+  httpd_resp_send_chunk(req, "]", 1);
+  return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+// SD から読む単位。SD の DMA が使えるよう内部 RAM に置き、クラスタに揃える
+static uint8_t file_buf[16384];
+
+// /recordings で出すディレクトリ (main.cpp の録画とフレームログ)
+static const char *recording_dirs[] = {"rec", "framelog"};
+
+static bool recording_name_ok(const char *name)
+{
+  if (strstr(name, "..") || strchr(name, '\\'))
+  {
+    return false;
+  }
+  for (size_t i = 0; i < sizeof(recording_dirs) / sizeof(recording_dirs[0]); i++)
+  {
+    size_t n = strlen(recording_dirs[i]);
+    if (!strncmp(name, recording_dirs[i], n) && name[n] == '/' && name[n + 1])
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+enum range_result
+{
+  RANGE_IGNORE,        // 読めない・対応しない Range。無視して全体を返す
+  RANGE_OK,            // [start, end] を返す
+  RANGE_UNSATISFIABLE, // 形は正しいが、始まりがファイルの外
+};
+
+// 10 進の数字を1つ以上読む。数字がなければ false
+static bool parse_digits(const char **p, size_t *value)
+{
+  if (**p < '0' || **p > '9')
+  {
+    return false;
+  }
+  char *next;
+  *value = strtoul(*p, &next, 10);
+  *p = next;
+  return true;
+}
+
+// "bytes=a-b" / "bytes=a-" / "bytes=-n" を [start, end] にする。
+// RFC 7233 に合わせて、bytes 以外の単位・数字でないもの・a > b などの読めない Range は無視し (RANGE_IGNORE)、
+// 416 にするのは形の正しい範囲の始まりが size 以上のときだけ。複数の範囲は呼ぶ側で無視する
+static range_result parse_range(const char *value, size_t size, size_t *start, size_t *end)
+{
+  if (strncmp(value, "bytes=", 6))
+  {
+    return RANGE_IGNORE;
+  }
+  const char *p = value + 6;
+  if (*p == '-')
+  {
+    p++;
+    size_t suffix;
+    if (!parse_digits(&p, &suffix) || *p || !suffix)
+    {
+      return RANGE_IGNORE;
+    }
+    if (!size)
+    {
+      return RANGE_UNSATISFIABLE;
+    }
+    *start = suffix < size ? size - suffix : 0;
+    *end = size - 1;
+    return RANGE_OK;
+  }
+  size_t first, last = 0;
+  if (!parse_digits(&p, &first) || *p++ != '-')
+  {
+    return RANGE_IGNORE;
+  }
+  bool open = !*p;
+  if (!open && (!parse_digits(&p, &last) || *p || last < first))
+  {
+    return RANGE_IGNORE;
+  }
+  if (first >= size)
+  {
+    return RANGE_UNSATISFIABLE;
+  }
+  *start = first;
+  *end = open || last >= size ? size - 1 : last;
+  return RANGE_OK;
+}
+
+static esp_err_t send_all(httpd_req_t *req, const char *buf, size_t len)
+{
+  while (len)
+  {
+    int sent = httpd_send(req, buf, len);
+    if (sent <= 0)
+    {
+      return ESP_FAIL;
+    }
+    buf += sent;
+    len -= sent;
+  }
+  return ESP_OK;
+}
+
+static esp_err_t recordings_list(httpd_req_t *req)
+{
+  httpd_resp_set_type(req, "application/json");
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+  httpd_resp_send_chunk(req, "[", 1);
+  bool first = true;
+  char item[96];
+  char path[16];
+  for (size_t i = 0; i < sizeof(recording_dirs) / sizeof(recording_dirs[0]); i++)
+  {
+    snprintf(path, sizeof(path), "/%s", recording_dirs[i]);
+    File dir = SD.open(path);
+    if (!dir || !dir.isDirectory())
+    {
+      continue;
+    }
+    for (File f = dir.openNextFile(); f; f = dir.openNextFile())
+    {
+      const char *name = strrchr(f.name(), '/');
+      name = name ? name + 1 : f.name();
+      int len = snprintf(item, sizeof(item), "%s{\"name\":\"%s/%s\",\"size\":%u}", first ? "" : ",", recording_dirs[i], name, (unsigned)f.size());
+      first = false;
+      if (httpd_resp_send_chunk(req, item, len) != ESP_OK)
+      {
+        return ESP_FAIL;
+      }
+    }
+  }
+  httpd_resp_send_chunk(req, "]", 1);
+  return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+// /recordings 一覧 (JSON)
+// /recordings?name=rec/xxx.avi  ファイルを送る。Range に対応するので、切れたダウンロードは続きから取り直せる
+static esp_err_t recordings_handler(httpd_req_t *req)
+{
+  char name[64] = "";
+  size_t query_len = httpd_req_get_url_query_len(req);
+  if (query_len > 0)
+  {
+    char *buf = NULL;
+    if (parse_get(req, &buf) != ESP_OK)
+    {
+      return ESP_FAIL;
+    }
+    httpd_query_key_value(buf, "name", name, sizeof(name));
+    buffer_pool.release(buf);
+  }
+  if (!name[0])
+  {
+    return recordings_list(req);
+  }
+  if (!recording_name_ok(name))
+  {
+    return httpd_resp_send_404(req);
+  }
+
+  char path[72];
+  snprintf(path, sizeof(path), "/%s", name);
+  File f = SD.open(path, "r");
+  if (!f || f.isDirectory())
+  {
+    return httpd_resp_send_404(req);
+  }
+  size_t size = f.size();
+  size_t start = 0;
+  size_t end = size ? size - 1 : 0;
+  bool partial = false;
+
+  // 複数の範囲 (multipart/byteranges) には対応しないので、Range を無視して 200 で全体を返す。
+  // 長すぎる・読めない Range も同じ
+  char range[48];
+  if (httpd_req_get_hdr_value_str(req, "Range", range, sizeof(range)) == ESP_OK && !strchr(range, ','))
+  {
+    range_result r = parse_range(range, size, &start, &end);
+    if (r == RANGE_UNSATISFIABLE)
+    {
+      char content_range[32];
+      snprintf(content_range, sizeof(content_range), "bytes */%u", (unsigned)size);
+      httpd_resp_set_status(req, "416 Range Not Satisfiable");
+      httpd_resp_set_hdr(req, "Content-Range", content_range);
+      return httpd_resp_send(req, NULL, 0);
+    }
+    partial = r == RANGE_OK;
+  }
+  size_t length = size ? end - start + 1 : 0;
+
+  // チャンク形式では Content-Length を付けられないので、見出しは自分で書いてから本文をそのまま流す
+  const char *type = strstr(name, ".avi") ? "video/x-msvideo" : "application/octet-stream";
+  char header[320];
+  int header_len;
+  if (partial)
+  {
+    header_len = snprintf(header, sizeof(header),
+                          "HTTP/1.1 206 Partial Content\r\nContent-Type: %s\r\nContent-Length: %u\r\nContent-Range: bytes %u-%u/%u\r\nAccept-Ranges: bytes\r\n"
+                          "Access-Control-Allow-Origin: *\r\n\r\n",
+                          type, (unsigned)length, (unsigned)start, (unsigned)end, (unsigned)size);
+  }
+  else
+  {
+    header_len = snprintf(header, sizeof(header),
+                          "HTTP/1.1 200 OK\r\nContent-Type: %s\r\nContent-Length: %u\r\nAccept-Ranges: bytes\r\nAccess-Control-Allow-Origin: *\r\n\r\n", type,
+                          (unsigned)length);
+  }
+  if (send_all(req, header, header_len) != ESP_OK || (start && !f.seek(start)))
+  {
+    return ESP_FAIL;
+  }
+
+#if ARDUHAL_LOG_LEVEL >= ARDUHAL_LOG_LEVEL_INFO
+  int64_t fr_start = esp_timer_get_time();
+#endif
+  size_t remaining = length;
+  while (remaining)
+  {
+    size_t k = remaining < sizeof(file_buf) ? remaining : sizeof(file_buf);
+    if (f.read(file_buf, k) != k || send_all(req, (const char *)file_buf, k) != ESP_OK)
+    {
+      log_e("Recording transfer aborted at %u", (unsigned)(length - remaining));
+      return ESP_FAIL;
+    }
+    remaining -= k;
+  }
+#if ARDUHAL_LOG_LEVEL >= ARDUHAL_LOG_LEVEL_INFO
+  int64_t fr_end = esp_timer_get_time();
+  log_i("Recording %s: %uB in %ums", name, (unsigned)length, (uint32_t)((fr_end - fr_start) / 1000));
+#endif
+  return ESP_OK;
+}
+
+// Prometheus 形式のメモリの状況 (main.cpp が記録した最新の値)
+static esp_err_t metrics_handler(httpd_req_t *req)
+{
+  static char metrics[2048];
+  size_t len = memoryTelemetry.formatMetrics(metrics, sizeof(metrics));
+  if (!len)
+  {
+    return httpd_resp_send_500(req);
+  }
+  httpd_resp_set_type(req, "text/plain; version=0.0.4");
+  return httpd_resp_send(req, metrics, len);
+}
+
+static int get_pid(sensor_t *s, void *arg)
+{
+  return s->id.PID;
+}
+
 static esp_err_t index_handler(httpd_req_t *req)
 {
   httpd_resp_set_type(req, "text/html");
   httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
-  sensor_t *s = esp_camera_sensor_get();
-  if (s != NULL)
+  int pid = -1;
+  if (camera.configure(get_pid, NULL, &pid) == ESP_OK && pid >= 0)
   {
-    if (s->id.PID == OV3660_PID)
+    if (pid == OV3660_PID)
     {
       return httpd_resp_send(req, (const char *)index_ov3660_html_gz, index_ov3660_html_gz_len);
     }
-    else if (s->id.PID == OV5640_PID)
+    else if (pid == OV5640_PID)
     {
       return httpd_resp_send(req, (const char *)index_ov5640_html_gz, index_ov5640_html_gz_len);
     }
@@ -805,7 +1408,8 @@ static esp_err_t index_handler(httpd_req_t *req)
 void startCameraServer()
 {
   httpd_config_t config = HTTPD_DEFAULT_CONFIG();
-  config.max_uri_handlers = 16;
+  config.max_uri_handlers = 24; // camera_httpd に 16 個。足しても登録に失敗しないよう余裕を持たせる
+  config.stack_size = 8192;     // 既定の 4096 では JSON・SD のファイル・範囲の解析をするハンドラには足りない
 
   httpd_uri_t index_uri = {
       .uri = "/",
@@ -950,7 +1554,92 @@ void startCameraServer()
 #endif
   };
 
+  httpd_uri_t roi_uri = {
+      .uri = "/roi",
+      .method = HTTP_GET,
+      .handler = roi_handler,
+      .user_ctx = NULL
+#ifdef CONFIG_HTTPD_WS_SUPPORT
+      ,
+      .is_websocket = true,
+      .handle_ws_control_frames = false,
+      .supported_subprotocol = NULL
+#endif
+  };
+
+  httpd_uri_t full_uri = {
+      .uri = "/full",
+      .method = HTTP_GET,
+      .handler = full_handler,
+      .user_ctx = NULL
+#ifdef CONFIG_HTTPD_WS_SUPPORT
+      ,
+      .is_websocket = true,
+      .handle_ws_control_frames = false,
+      .supported_subprotocol = NULL
+#endif
+  };
+
+  httpd_uri_t frame_uri = {
+      .uri = "/frame",
+      .method = HTTP_GET,
+      .handler = frame_handler,
+      .user_ctx = NULL
+#ifdef CONFIG_HTTPD_WS_SUPPORT
+      ,
+      .is_websocket = true,
+      .handle_ws_control_frames = false,
+      .supported_subprotocol = NULL
+#endif
+  };
+
+  httpd_uri_t frames_uri = {
+      .uri = "/frames",
+      .method = HTTP_GET,
+      .handler = frames_handler,
+      .user_ctx = NULL
+#ifdef CONFIG_HTTPD_WS_SUPPORT
+      ,
+      .is_websocket = true,
+      .handle_ws_control_frames = false,
+      .supported_subprotocol = NULL
+#endif
+  };
+
+  httpd_uri_t recordings_uri = {
+      .uri = "/recordings",
+      .method = HTTP_GET,
+      .handler = recordings_handler,
+      .user_ctx = NULL
+#ifdef CONFIG_HTTPD_WS_SUPPORT
+      ,
+      .is_websocket = true,
+      .handle_ws_control_frames = false,
+      .supported_subprotocol = NULL
+#endif
+  };
+
+  httpd_uri_t metrics_uri = {
+      .uri = "/metrics",
+      .method = HTTP_GET,
+      .handler = metrics_handler,
+      .user_ctx = NULL
+#ifdef CONFIG_HTTPD_WS_SUPPORT
+      ,
+      .is_websocket = true,
+      .handle_ws_control_frames = false,
+      .supported_subprotocol = NULL
+#endif
+  };
+
   ra_filter_init(&ra_filter, 20);
+  // 解像度は /control の framesize で決まるまで今のセンサーのまま
+  still_consumer = camera.addConsumer("http");
+  stream_consumer = camera.addConsumer("stream");
+  if (!buffer_pool.begin(buffer_pool_classes, sizeof(buffer_pool_classes) / sizeof(buffer_pool_classes[0])))
+  {
+    log_e("Buffer pool allocation failed, falling back to malloc");
+  }
 
   log_i("Starting web server on port: '%d'", config.server_port);
   if (httpd_start(&camera_httpd, &config) == ESP_OK)
@@ -966,6 +1655,15 @@ void startCameraServer()
     httpd_register_uri_handler(camera_httpd, &greg_uri);
     httpd_register_uri_handler(camera_httpd, &pll_uri);
     httpd_register_uri_handler(camera_httpd, &win_uri);
+    httpd_register_uri_handler(camera_httpd, &roi_uri);
+    httpd_register_uri_handler(camera_httpd, &full_uri);
+    httpd_register_uri_handler(camera_httpd, &metrics_uri);
+    if (sdReady)
+    {
+      httpd_register_uri_handler(camera_httpd, &frame_uri);
+      httpd_register_uri_handler(camera_httpd, &frames_uri);
+      httpd_register_uri_handler(camera_httpd, &recordings_uri);
+    }
   }
 
   config.server_port += 1;
@@ -7,14 +7,51 @@
 #include <ArduinoJson.h>
 #include <LittleFS.h>
 #include <SD.h>
+#include <SPI.h>
 #include <Update.h>
 #include "soc/soc.h"
 #include "soc/rtc_cntl_reg.h"
+#include "esp_heap_caps.h"
+#include <FishCounter.h>
+#include <JpegDc.h>
+#include <FrameQuality.h>
+#include <JpegQualityController.h>
+#include <UplinkEstimator.h>
+#include <CameraRoi.h>
+#include <CaptureCache.h>
+#include <BurstBuffer.h>
+#include <PreTriggerBuffer.h>
+#include <AviWriter.h>
+#include <FrameLog.h>
+#include <MemoryTelemetry.h>
+#include <TaskStats.h>
+#include <FrameRing.h>
+#include <CameraService.h>
+#include <CaptureScheduler.h>
+#include <RequestCoalescer.h>
+#include "img_converters.h"
 
 // Select camera model
 #define CAMERA_MODEL_M5STACK_PSRAM
 #include "camera_pins.h"
 
+// SD カードは camera_pins.h がピンを決めている機種だけで使う。既定の VSPI (5, 18, 19, 23) は
+// M5STACK_PSRAM ではカメラのデータ線と SCCB に使われているので、SD.begin() を既定のピンでは呼ばない
+#if defined(SD_SCK_GPIO_NUM)
+constexpr bool cameraUsesPin(int pin)
+{
+    return pin == PWDN_GPIO_NUM || pin == RESET_GPIO_NUM || pin == XCLK_GPIO_NUM || pin == SIOD_GPIO_NUM || pin == SIOC_GPIO_NUM || pin == Y9_GPIO_NUM ||
+           pin == Y8_GPIO_NUM || pin == Y7_GPIO_NUM || pin == Y6_GPIO_NUM || pin == Y5_GPIO_NUM || pin == Y4_GPIO_NUM || pin == Y3_GPIO_NUM ||
+           pin == Y2_GPIO_NUM || pin == VSYNC_GPIO_NUM || pin == HREF_GPIO_NUM || pin == PCLK_GPIO_NUM;
+}
+static_assert(!cameraUsesPin(SD_SCK_GPIO_NUM) && !cameraUsesPin(SD_MISO_GPIO_NUM) && !cameraUsesPin(SD_MOSI_GPIO_NUM) && !cameraUsesPin(SD_CS_GPIO_NUM),
+              "SD pins collide with the camera pins");
+SPIClass sdSpi(HSPI);
+#endif
+
+// app_httpd.cpp の Web サーバー (静止画・ストリーム・設定・SD のフレームと録画)
+void startCameraServer();
+
 //WIFI 情報
 const char *ssid = "YOUR_WIFI_SSID";
 const char *password = "YOUT_WIFI_PASSWORD";
@@ -26,7 +63,8 @@ const char *serverUrl = "SORACOM_HTTP";
 const char *mqtt_server = "*******";
 const int mqtt_port = 9999;
 const char *mqtt_topic = "******";
-const char *mqqt_client_ID = "CPSMonitoring" //MqqtのクライアントID 自由に名前を設定していいけど、他のデバイスと被っちゃダメ
+const char *mqtt_telemetry_topic = "******"; // 魚カウントなどのテレメトリ送信先
+const char *mqqt_client_ID = "CPSMonitoring"; //MqqtのクライアントID 自由に名前を設定していいけど、他のデバイスと被っちゃダメ
 
 // SORACOM ArcのWireGuard情報
 const char *private_key = "***********";
@@ -40,6 +78,214 @@ PubSubClient client(espClient);
 
 WireGuard wg;
 
+// フレームの 1/8 輝度画像 (解析用の共有バッファ)
+JpegDcDecoder jpegDc; // DC 係数だけで 1/8 の輝度画像を作る
+uint8_t *thumbGray = NULL;
+size_t thumbGraySize = 0;
+uint16_t thumbWidth = 0;
+uint16_t thumbHeight = 0;
+
+// 魚カウント (1/8 に縮小したフレームで背景差分)
+const unsigned long fish_count_interval = 5000; // 送信間隔 (ms)
+// 背景は縮小画像の画素ごとに覚えるので、解像度が変わると覚え直し (その間は 0 を送る) になる。
+// ほかの撮影の解像度に引きずられないよう、魚カウントは決まった解像度で撮る (VGA なら 80x60)
+const int fish_framesize = FRAMESIZE_VGA;
+FishCounter fishCounter;
+
+// 画質判定 (ぼけ・露出不良のフレームは送らない)
+const unsigned long capture_deadline = 3000; // 良いフレームを待つ最大時間 (ms)
+const unsigned long capture_retry_delay = 100;
+FrameQualityConfig qualityConfig;
+
+// 送信サイズの目標に合わせて JPEG 品質と解像度を調整する
+const uint32_t jpeg_target_bytes = 120000; // 1フレームあたりの目標 (bytes)
+const int jpeg_frame_ladder[] = {FRAMESIZE_VGA, FRAMESIZE_SVGA, FRAMESIZE_XGA, FRAMESIZE_UXGA, FRAMESIZE_QXGA};
+JpegQualityController jpegController;
+
+// 回線の実測に合わせて送るものを選ぶ (遅い回線ではサムネイルを先に送り、フル解像度は後回し)
+const uint32_t upload_deadline = 8000;             // 1枚の送信にかけてよい時間 (ms)
+const unsigned long deferred_retry_interval = 60000; // 後回しにした画像を試しに送る間隔 (ms)
+const int thumbnail_jpeg_quality = 80;
+UplinkEstimator uplink;
+uint8_t *thumbCb = NULL;
+uint8_t *thumbCr = NULL;
+uint8_t *thumbRgb = NULL;
+size_t thumbCbSize = 0;
+size_t thumbCrSize = 0;
+size_t thumbRgbSize = 0;
+uint32_t deferredCaptureId = 0;
+
+// 撮影のたびにサムネイルだけをすぐ送り、フル解像度は撮影 ID で PSRAM に取っておく ("full" コマンド か /full?id= で取り出す)
+const size_t capture_cache_bytes = 1024 * 1024;
+const bool send_full_on_capture = false; // true なら回線が良いときはフル解像度も続けて送る
+CaptureCache captureCache;
+
+// 給餌のときの連写。PSRAM の領域に詰めて、まとめて1回で送る
+const size_t burst_arena_bytes = 1536 * 1024; // VGA なら 30 枚ほど
+const int burst_max_count = 30;
+BurstBuffer burst;
+volatile bool burstUploading = false; // 送信タスクが領域を使っている間は次の連写をしない
+struct BurstStats
+{
+    uint32_t requested;
+    uint32_t captured;
+    uint32_t dropped;
+    uint32_t elapsedMs;
+    uint32_t bytes;
+} burstStats;
+
+// トリガーより前のフレームも残す録画。有効にしている間だけ PSRAM を確保する
+// 4 MB の PSRAM は起動時にフレームバッファ (QXGA の JPEG で約 630 KB)・キャッシュ (1 MB)・連写 (1.5 MB) で
+// 3 MB ほど埋まる。残りから録画の索引やサムネイル・Web サーバーのバッファの分 (pretrigger_reserve_bytes) を除いた範囲で確保する
+const size_t pretrigger_bytes = 1024 * 1024;         // 領域の上限 (bytes)
+const size_t pretrigger_min_bytes = 256 * 1024;      // これより小さくしか取れないなら有効にしない
+const size_t pretrigger_reserve_bytes = 256 * 1024;  // PSRAM に残しておく分
+const uint32_t pretrigger_seconds = 8;               // 持っておく長さ (s)
+const unsigned long pretrigger_interval = 1000;      // 録画の間隔 (ms)
+const uint32_t clip_default_pre = 5, clip_default_post = 5; // "clip" コマンドの既定 (s)
+PreTriggerBuffer pretrigger;
+volatile bool pretriggerEnabled = false;
+volatile bool clipUploading = false; // network がクリップを読んでいる間はリングに詰めない
+uint32_t pretriggerPushCount = 0;
+uint64_t pretriggerPushUsTotal = 0; // 1フレームを詰めるのにかかった時間 (書き込みのコスト)
+uint32_t pretriggerPushUsMax = 0;
+
+// 給餌の様子を SD カードに MJPEG の AVI で録画する
+const uint32_t record_max_frames = 3000;    // 1ファイルの上限 (索引を PSRAM に持つ)
+const size_t record_buffer_bytes = 32768;   // SD への書き込み単位 (FAT のクラスタに合わせる)
+const uint32_t record_default_seconds = 60;
+const int record_name_retries = 99;        // 同じ秒の名前に付ける番号の上限
+bool sdReady = false;
+File recordFile;
+FsAviSink recordSink(recordFile);
+AviWriter recordWriter;
+volatile bool recording = false;
+unsigned long recordStart = 0;
+unsigned long recordUntil = 0;
+
+// SD に時刻つきでフレームを残し続ける (/frame?t= で「14:05 ごろ」の画像を取り出す)
+const unsigned long framelog_interval = 5000; // 記録の間隔 (ms)
+FrameLog frameLog;
+volatile bool frameLogEnabled = false;
+
+// メモリの空きと断片化 (最大の連続空き) の推移
+const unsigned long memory_sample_interval = 10000;  // 記録の間隔 (ms)
+const unsigned long memory_publish_interval = 60000; // MQTT に送る間隔 (ms)
+MemoryTelemetry memoryTelemetry;
+
+// 直近に採用したフレームの撮影時間 (ROI の効果の確認用)
+unsigned long lastCaptureMs = 0;
+
+// タスクの構成。WiFi / lwIP がコア0で動くので HTTP と MQTT はコア0、カメラと画像処理はコア1に置く
+//   camera     : ドライバ (esp_camera_fb_get とセンサーの設定) を触る唯一のタスク (CameraService)。HTTP のハンドラも受け手として使う
+//   capture    : 撮影の予定を立て、camera から受け取ったフレームを frameRing で processing に渡す
+//   processing : 画質判定・魚カウント・サムネイル・キャッシュ・SD への記録。送るものは uploadQueue で network に渡す
+//   network    : HTTP の送信と、後回しにしたフル解像度の再送
+//   control    : MQTT の接続・コマンド・テレメトリ
+// capture → processing はロックのないリング (フレームの記述子) とタスク通知で渡し、ほかはキューで渡す
+// camera_fb_t は渡した先が持ち主になり、持ち主が releaseFrame() で返すまで capture は次を頼まない (fb_count = 1)
+// スタックは余裕を持たせた値。テレメトリの stack_free (high water) を見て詰める
+const int camera_core = 1, capture_core = 1, processing_core = 1, network_core = 0, control_core = 0;
+const UBaseType_t camera_priority = 4, capture_priority = 3, processing_priority = 2, network_priority = 2, control_priority = 3;
+const uint32_t camera_stack = 4096, capture_stack = 4096, processing_stack = 8192, network_stack = 8192, control_stack = 8192;
+const uint32_t camera_acquire_timeout = 5000; // camera にフレームを頼んで待つ上限 (ms)
+const unsigned long control_poll_interval = 10;   // MQTT を見に行く間隔 (ms)
+const unsigned long mqtt_retry_interval = 5000;   // MQTT の再接続の間隔 (ms)
+const unsigned long task_trace_interval = 60000;  // タスクごとの忙しさを送る間隔 (ms)
+const TickType_t mqtt_publish_wait = pdMS_TO_TICKS(200); // control 以外から送るとき MQTT の空きを待つ時間
+
+// capture の予定表 (CaptureScheduler)。頼まれた撮影 (command) は録画・定期の撮影より先に撮り、
+// 録画と定期の撮影は同じ優先度で締め切りの早い順に撮る (録画中も定期の撮影が遅れすぎない)
+// 同じ種類の定期の撮影・録画・新しい photo は、前の分がまだ待っていれば1つにまとめる
+enum CaptureClass : uint8_t
+{
+    CLASS_COMMAND,
+    CLASS_RECORD,
+    CLASS_PERIODIC,
+};
+const uint8_t command_priority = 2, record_priority = 1, periodic_priority = 1;
+const unsigned long command_deadline = 1000;  // photo 以外のコマンドを撮り始めるまで (ms)。photo は capture_deadline
+const unsigned long record_deadline = 500;    // 録画の次のコマ (ms)
+const unsigned long periodic_deadline = 500;  // 定期の撮影の時刻から (ms)
+
+enum JobKind : uint8_t
+{
+    // capture に頼む撮影。フレームは processing に渡る
+    JOB_PHOTO,      // 画質判定つき (MQTT の photo)
+    JOB_FISH,       // 魚カウント
+    JOB_PRETRIGGER, // トリガー前録画のリング
+    JOB_RECORD,     // SD への録画
+    JOB_FRAMELOG,   // フレームログ
+    JOB_BURST,      // 連写 (capture の中で領域に詰めて、そのまま network に渡す)。arg: count, interval, framesize
+    // capture が掛けるセンサーの設定
+    JOB_SET_ROI, // arg: x, y, w, h (千分率)。w = 0 なら解除
+    // processing の状態を変えるコマンド (フレームなし)
+    JOB_PRETRIGGER_ENABLE, // arg: 有効なら 1
+    JOB_CLIP,              // arg: pre, post (s)
+    JOB_RECORD_START,      // arg: 秒
+    JOB_FRAMELOG_ENABLE,   // arg: 有効なら 1
+};
+
+struct Job
+{
+    uint8_t kind;
+    uint16_t attempts;     // JOB_PHOTO: 画質判定で撮り直した回数
+    unsigned long startMs; // 撮影を始めた時刻 (JOB_PHOTO は最初の撮影。締め切りの基準)
+    int32_t arg[4];
+};
+
+// capture → processing。frame.handle が camera_fb_t で、受け取った側が releaseFrame() するか、UploadJob に載せて network に渡す
+// frame.timestampMs は撮った時刻 (UNIX 時間、ms)
+struct FrameMessage
+{
+    FrameDescriptor frame;
+    Job job;
+};
+
+enum UploadKind : uint8_t
+{
+    UPLOAD_PHOTO,  // サムネイル (作れなかったときはフレームそのもの) と撮影のテレメトリ
+    UPLOAD_CACHED, // キャッシュにあるフル解像度 ("full" コマンド)
+    UPLOAD_BURST,
+    UPLOAD_CLIP,
+};
+
+// processing / capture / control → network。fb は network が返し、thumb は network が free する
+struct UploadJob
+{
+    uint8_t kind;
+    camera_fb_t *fb;
+    uint8_t *thumb;
+    size_t thumbLen;
+    uint32_t captureId;
+    size_t frameBytes;
+    unsigned long startMs;
+    bool poorLink;
+};
+
+QueueHandle_t captureQueue;   // Job
+SpscRing<FrameMessage, 4> frameRing; // 書くのは capture、読むのは processing だけ
+QueueHandle_t commandQueue;   // Job (processing へのコマンド。書き手が複数なのでキュー)
+TaskHandle_t processingHandle = NULL;
+QueueHandle_t uploadQueue;    // UploadJob
+SemaphoreHandle_t frameSlots; // 持ち出せるフレームの数 (fb_count)
+SemaphoreHandle_t mqttMutex;  // PubSubClient はスレッドセーフでないので、使う間は取る (再帰可: コールバックの中からも送る)
+TaskStats taskStats;
+CameraService camera;
+int captureConsumer = -1;                                    // capture が camera から受け取る受け手
+volatile int photoFramesize = CameraService::ANY_FRAMESIZE;  // JpegQualityController が選んだ解像度と画質 (JOB_PHOTO)
+volatile int photoQuality = -1;
+typedef CaptureScheduler<Job, 16> JobScheduler;
+JobScheduler captureSchedule; // capture だけが使う (統計は control が読む)
+int appliedQuality = -1;      // capture が最後に掛けた画質
+// "photo" の頼み。撮影から送信までの間に来た頼みは、フレームを決める前なら今の撮影に、決めたあとなら次の1回にまとめる
+RequestCoalescer photoRequests;
+int recordFramesize = CameraService::ANY_FRAMESIZE;          // 録画の間は最初のフレームの解像度に固定する
+int captureTaskId = -1;
+int processingTaskId = -1;
+int networkTaskId = -1;
+int controlTaskId = -1;
+
 void setup_wifi()
 {
     delay(10);
@@ -75,31 +321,124 @@ void connectToWireGuard()
     Serial.println("Connected to SORACOM Arc");
 }
 
-void sendImageToSoracomFunk()
+// PSRAM のバッファを必要な大きさまで広げる
+bool ensureBuffer(uint8_t **buf, size_t *capacity, size_t size)
+{
+    if (size <= *capacity)
+    {
+        return true;
+    }
+    free(*buf);
+    *buf = (uint8_t *)ps_malloc(size);
+    *capacity = *buf ? size : 0;
+    return *buf != NULL;
+}
+
+// JPEG フレームを thumbGray に 1/8 の輝度画像として展開する
+bool decodeThumbnail(camera_fb_t *fb)
 {
-    camera_fb_t *fb = NULL;
-    fb = esp_camera_fb_get();
-    esp_camera_fb_return(fb);
-    delay(200);
-    fb = NULL;
-    fb = esp_camera_fb_get();
+    uint16_t w, h;
+    if (!jpegDc.getSize(fb->buf, fb->len, &w, &h))
+    {
+        Serial.println("Unsupported JPEG");
+        return false;
+    }
+    if (!ensureBuffer(&thumbGray, &thumbGraySize, (size_t)w * h))
+    {
+        Serial.println("Thumbnail allocation failed");
+        return false;
+    }
+    thumbWidth = w;
+    thumbHeight = h;
+    if (!jpegDc.decode(fb->buf, fb->len, thumbGray, thumbGraySize))
+    {
+        Serial.println("JPEG decode failed");
+        return false;
+    }
+    return true;
+}
 
-    if (!fb)
+// 1/8 のカラーサムネイルを JPEG にする。*out は呼び出し側で free する
+bool encodeThumbnailJpeg(camera_fb_t *fb, uint8_t **out, size_t *outLen)
+{
+    uint16_t w, h;
+    if (!jpegDc.getSize(fb->buf, fb->len, &w, &h))
     {
-        Serial.println("Camera capture failed");
-        ESP.restart();
-        return;
+        return false;
+    }
+    size_t n = (size_t)w * h;
+    if (!ensureBuffer(&thumbGray, &thumbGraySize, n) || !ensureBuffer(&thumbCb, &thumbCbSize, n) || !ensureBuffer(&thumbCr, &thumbCrSize, n) ||
+        !ensureBuffer(&thumbRgb, &thumbRgbSize, n * 3))
+    {
+        Serial.println("Thumbnail allocation failed");
+        return false;
+    }
+    if (!jpegDc.decode(fb->buf, fb->len, thumbGray, thumbGraySize, thumbCb, thumbCr))
+    {
+        return false;
+    }
+    thumbWidth = w;
+    thumbHeight = h;
+    JpegDcDecoder::toRgb888(thumbGray, thumbCb, thumbCr, n, thumbRgb, true);
+    return fmt2jpg(thumbRgb, n * 3, w, h, PIXFORMAT_RGB888, thumbnail_jpeg_quality, out, outLen);
+}
+
+Job makeJob(uint8_t kind, int32_t a0 = 0, int32_t a1 = 0, int32_t a2 = 0, int32_t a3 = 0)
+{
+    Job job = {kind, 0, 0, {a0, a1, a2, a3}};
+    return job;
+}
+
+// MQTT で送る。control 以外のタスクからも呼べる (control が繋ぎ直している間などは諦める)
+bool publishTelemetry(const char *msg)
+{
+    if (xSemaphoreTakeRecursive(mqttMutex, mqtt_publish_wait) != pdTRUE)
+    {
+        return false;
+    }
+    bool ok = client.publish(mqtt_telemetry_topic, msg);
+    xSemaphoreGiveRecursive(mqttMutex);
+    return ok;
+}
+
+// 持ち主が capture の受け取ったフレームを camera に返す。これで capture が次を頼める
+void releaseFrame()
+{
+    camera.release(captureConsumer);
+    xSemaphoreGive(frameSlots);
+}
+
+// 送信の結果を回線の推定に入れる。送れた時間は実測として、送れなかった (タイムアウトなど) ときは罰として推定を下げる
+// 連写・クリップ・フル解像度の大きい送信がスループットの実測になる
+void recordUplink(int httpResponseCode, size_t bytes, unsigned long elapsedMs)
+{
+    if (httpResponseCode > 0)
+    {
+        uplink.recordUpload(bytes, elapsedMs);
+    }
+    else
+    {
+        uplink.recordFailure(elapsedMs);
     }
+}
 
+// 画像を SORACOM Funk に POST し、かかった時間を回線の推定に反映する。本文は buf か、なければ stream から読む
+int postImageBody(const uint8_t *buf, Stream *stream, size_t len, const char *kind, uint32_t captureId)
+{
     HTTPClient http;
     http.begin(serverUrl);
     http.addHeader("Content-Type", "application/octet-stream");
+    http.addHeader("X-Image-Kind", kind);
+    http.addHeader("X-Capture-Id", String(captureId));
 
-    int httpResponseCode = http.POST(fb->buf, fb->len);
+    unsigned long start = millis();
+    int httpResponseCode = buf ? http.POST((uint8_t *)buf, len) : http.sendRequest("POST", stream, len);
+    unsigned long elapsed = millis() - start;
+    recordUplink(httpResponseCode, len, elapsed);
 
     if (httpResponseCode > 0)
     {
-        Serial.printf("HTTP Response code: %d\n", httpResponseCode);
+        Serial.printf("HTTP Response code: %d (%s, %u bytes, %lu ms)\n", httpResponseCode, kind, (unsigned)len, elapsed);
     }
     else
     {
@@ -107,9 +446,1046 @@ void sendImageToSoracomFunk()
     }
 
     http.end();
-    esp_camera_fb_return(fb);
+    return httpResponseCode;
+}
+
+int postImage(const uint8_t *buf, size_t len, const char *kind, uint32_t captureId)
+{
+    return postImageBody(buf, NULL, len, kind, captureId);
+}
+
+// キャッシュのフレームを POST の本文として小分けに読む。capture はこの間もキャッシュに書くので、
+// ポインタは持たず、読むたびに read() でロックを取ってコピーする。途中で追い出されたら available() が -1 になり送信は失敗する
+class CachedFrameStream : public Stream
+{
+public:
+    CachedFrameStream(CaptureCache &cache, uint32_t id, size_t len) : cache(cache), id(id), remaining(len) {}
+
+    int available() override { return evicted ? -1 : (int)remaining; }
+    size_t readBytes(char *out, size_t length) override
+    {
+        size_t got = 0;
+        if (length > remaining)
+        {
+            length = remaining;
+        }
+        if (!length || !cache.read(id, offset, (uint8_t *)out, length, &got))
+        {
+            evicted = length != 0;
+            return 0;
+        }
+        offset += got;
+        remaining -= got;
+        return got;
+    }
+    int read() override
+    {
+        char c;
+        return readBytes(&c, 1) ? (uint8_t)c : -1;
+    }
+    int peek() override
+    {
+        uint8_t c;
+        size_t got = 0;
+        return remaining && cache.read(id, offset, &c, 1, &got) && got ? c : -1;
+    }
+    size_t write(uint8_t) override { return 0; }
+
+private:
+    CaptureCache &cache;
+    uint32_t id;
+    size_t remaining;
+    size_t offset = 0;
+    bool evicted = false;
+};
+
+// キャッシュにあるフル解像度を送る。追い出されていたら false
+bool sendCachedFrame(uint32_t captureId, const char *kind)
+{
+    size_t len;
+    uint32_t timestamp;
+    if (!captureCache.info(captureId, &len, &timestamp))
+    {
+        Serial.printf("Capture %u is no longer cached\n", (unsigned)captureId);
+        return false;
+    }
+    CachedFrameStream body(captureCache, captureId, len);
+    return postImageBody(NULL, &body, len, kind, captureId) > 0;
+}
+
+// 回線が悪くて送れなかったフル解像度を、回線が戻ったら送る
+void uploadDeferredFrame()
+{
+    static unsigned long lastAttempt = 0;
+    if (!deferredCaptureId)
+    {
+        return;
+    }
+    uplink.recordRssi(WiFi.RSSI());
+    // 回線が悪いままでも、たまに送ってみて推定を更新する
+    if (uplink.linkPoor(upload_deadline) && millis() - lastAttempt < deferred_retry_interval)
+    {
+        return;
+    }
+    lastAttempt = millis();
+    size_t len;
+    uint32_t timestamp;
+    if (!captureCache.info(deferredCaptureId, &len, &timestamp) || sendCachedFrame(deferredCaptureId, "deferred"))
+    {
+        deferredCaptureId = 0;
+    }
+}
+
+// メモリの状況を MQTT で送る
+void publishMemoryTelemetry()
+{
+    static char msg[768];
+    memoryTelemetry.sample(millis());
+    if (memoryTelemetry.formatJson(msg, sizeof(msg)))
+    {
+        publishTelemetry(msg);
+    }
+}
+
+void sampleMemory()
+{
+    static unsigned long lastSample = 0;
+    static unsigned long lastPublish = 0;
+    if (millis() - lastSample >= memory_sample_interval)
+    {
+        lastSample = millis();
+        memoryTelemetry.sample(lastSample);
+    }
+    if (millis() - lastPublish >= memory_publish_interval)
+    {
+        lastPublish = millis();
+        publishMemoryTelemetry();
+    }
+}
+
+// タスクごとの忙しさ (コアごとの合計つき) とスタックの残りを MQTT とシリアルに出す
+void publishTaskTrace()
+{
+    static char msg[768];
+    if (taskStats.formatJson(msg, sizeof(msg), micros()))
+    {
+        Serial.println(msg);
+        publishTelemetry(msg);
+    }
+    // 解像度の切り替えが多いと撮影が遅れるので、受け手の頼み方を見直す目安にする
+    char cam[224];
+    snprintf(cam, sizeof(cam),
+             "{\"camera_frames\":%u,\"camera_reconfigs\":%u,\"camera_shared\":%u,\"camera_configs\":%u,\"photo_requests\":%u,\"photo_merged\":%u,"
+             "\"photo_followups\":%u,\"photo_batches\":%u}",
+             (unsigned)camera.frames(), (unsigned)camera.reconfigurations(), (unsigned)camera.sharedDeliveries(), (unsigned)camera.configurations(),
+             (unsigned)photoRequests.requests(), (unsigned)photoRequests.merged(), (unsigned)photoRequests.followUps(), (unsigned)photoRequests.batches());
+    publishTelemetry(cam);
+    static char sched[512];
+    if (captureSchedule.stats.formatJson(sched, sizeof(sched)))
+    {
+        publishTelemetry(sched);
+    }
+}
+
+// ---- capture タスク ----
+
+// camera が解像度を変えたら窓を掛け直す (set_framesize で窓が戻る)
+void reapplyRoi(sensor_t *s)
+{
+    if (!cameraRoiCurrent().full())
+    {
+        cameraRoiApply(s, cameraRoiCurrent());
+    }
+}
+
+// 撮影の種類ごとに camera に頼む解像度。フレームログは今の解像度のままでよい
+int jobFramesize(const Job &job)
+{
+    switch (job.kind)
+    {
+    case JOB_PHOTO:
+    case JOB_PRETRIGGER: // クリップは JPEG をつないで X-Clip-Lengths と POST するだけなので大きさは問わない。写真と同じにしてセンサーの切り替えを減らす
+        return photoFramesize;
+    case JOB_RECORD:
+        if (recordFramesize == CameraService::ANY_FRAMESIZE)
+        {
+            recordFramesize = camera.currentFramesize();
+        }
+        return recordFramesize;
+    case JOB_FISH:
+        return fish_framesize;
+    default:
+        return CameraService::ANY_FRAMESIZE;
+    }
+}
+
+int setQuality(sensor_t *s, void *arg)
+{
+    return s->set_quality(s, *(int *)arg);
+}
+
+// 予定の解像度・画質でフレームを1枚撮って processing に渡す。撮れなければ false
+bool captureFrame(const JobScheduler::Entry &e)
+{
+    Job job = e.job;
+    int quality = e.quality;
+    int res = -1;
+    if (quality >= 0 && quality != appliedQuality && camera.configure(setQuality, &quality, &res) == ESP_OK && res == 0)
+    {
+        appliedQuality = quality;
+    }
+    // 前のフレームが返るまで・camera がフレームを出すまでは待っている時間なので、忙しさに数えない
+    taskStats.leave(captureTaskId, micros());
+    xSemaphoreTake(frameSlots, portMAX_DELAY);
+    camera.setFramesize(captureConsumer, e.framesize);
+    unsigned long captureStart = millis();
+    camera_fb_t *fb = camera.acquire(captureConsumer, camera_acquire_timeout);
+    taskStats.enter(captureTaskId, micros());
+    if (!fb)
+    {
+        xSemaphoreGive(frameSlots);
+        return false;
+    }
+    lastCaptureMs = millis() - captureStart;
+    if (!job.attempts)
+    {
+        job.startMs = captureStart;
+    }
+
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    static uint32_t seq = 0;
+    FrameMessage m = {{fb->buf, (uint32_t)fb->len, seq++, (uint64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000, fb, NULL}, job};
+    // 持ち出せるフレームは fb_count 枚までなので、リングがいっぱいになることはない
+    if (!frameRing.push(m))
+    {
+        releaseFrame();
+        return false;
+    }
+    xTaskNotifyGive(processingHandle);
+    return true;
+}
+
+// count 枚を interval ms ごとに撮る (0 ならセンサーが出せるだけ速く)。
+// 予定の時刻を逃したコマと、領域に入りきらなかったコマは落としたものとして数える
+bool captureBurst(int count, unsigned long interval, int framesize)
+{
+    if (burstUploading)
+    {
+        Serial.println("Burst upload still in progress");
+        return false;
+    }
+    if (count < 1 || count > burst_max_count)
+    {
+        return false;
+    }
+
+    // 連写の間はフレームを capture の中だけで使うので、持ち出せる枠をまとめて押さえる
+    taskStats.leave(captureTaskId, micros());
+    xSemaphoreTake(frameSlots, portMAX_DELAY);
+    taskStats.enter(captureTaskId, micros());
+    // 解像度の切り替えと、切り替えた直後のフレームを捨てるのは camera がする
+    camera.setFramesize(captureConsumer, framesize >= 0 ? framesize : CameraService::ANY_FRAMESIZE);
+
+    burst.reset();
+    memset(&burstStats, 0, sizeof(burstStats));
+    burstStats.requested = count;
+    unsigned long start = millis();
+    int slot = 0;
+    while (slot < count)
+    {
+        camera_fb_t *fb = camera.acquire(captureConsumer, camera_acquire_timeout);
+        if (!fb)
+        {
+            burstStats.dropped++;
+            slot++;
+            continue;
+        }
+        unsigned long now = millis();
+        if (burst.append(fb->buf, fb->len, now - start))
+        {
+            burstStats.captured++;
+        }
+        else
+        {
+            burstStats.dropped++;
+        }
+        camera.release(captureConsumer);
+        slot++;
+
+        if (interval && slot < count)
+        {
+            unsigned long next = start + slot * interval;
+            now = millis();
+            // 撮影とコピーが間隔より長くかかったら、逃したコマを飛ばす
+            while (slot < count && (long)(now - next) > (long)interval / 2)
+            {
+                burstStats.dropped++;
+                slot++;
+                next += interval;
+            }
+            if ((long)(next - now) > 0)
+            {
+                delay(next - now);
+            }
+        }
+    }
+    burstStats.elapsedMs = millis() - start;
+    burstStats.bytes = burst.used();
+    xSemaphoreGive(frameSlots);
+
+    if (!burst.frameCount())
+    {
+        return false;
+    }
+    burstUploading = true;
+    UploadJob up = {UPLOAD_BURST};
+    xQueueSend(uploadQueue, &up, portMAX_DELAY);
+    return true;
+}
+
+// camera のタスクで実行する。arg は JOB_SET_ROI の Job
+int setRoi(sensor_t *s, void *arg)
+{
+    const Job &job = *(const Job *)arg;
+    if (!job.arg[2])
+    {
+        cameraRoiClear();
+        cameraRoiApply(s, cameraRoiCurrent());
+        return 0;
+    }
+    CameraRoi roi;
+    roi.x = job.arg[0];
+    roi.y = job.arg[1];
+    roi.w = job.arg[2];
+    roi.h = job.arg[3];
+    return cameraRoiSave(roi) ? cameraRoiApply(s, roi) : -1;
+}
+
+void applyRoi(const Job &job)
+{
+    int res = 0;
+    esp_err_t err = camera.configure(setRoi, (void *)&job, &res);
+    if (err != ESP_OK)
+    {
+        Serial.printf("ROI not applied: camera configure error 0x%x\n", err);
+    }
+    else if (res != 0)
+    {
+        Serial.println("Invalid ROI");
+    }
+}
+
+// 撮れなかった photo の件を閉じる。まとめていた頼みには失敗を1回だけ返し、後から来た頼みがあれば次の1回を撮る
+// 次の1回を頼めなかったときは、その件の頼みにも queue_full を返す (黙って捨てない)
+void failPhoto(const char *reason)
+{
+    for (;;)
+    {
+        bool again = false;
+        uint16_t requests = photoRequests.finish(&again);
+        char msg[96];
+        snprintf(msg, sizeof(msg), "{\"photo_error\":\"%s\",\"requests\":%u}", reason, (unsigned)requests);
+        publishTelemetry(msg);
+        if (!again)
+        {
+            return;
+        }
+        // capture (captureQueue を読むタスク) と control から呼ぶので、いっぱいでも待たない
+        Job next = makeJob(JOB_PHOTO);
+        if (xQueueSend(captureQueue, &next, 0) == pdTRUE)
+        {
+            return;
+        }
+        reason = "queue_full";
+    }
+}
+
+void runCaptureJob(const JobScheduler::Entry &e)
+{
+    const Job &job = e.job;
+    switch (job.kind)
+    {
+    case JOB_PHOTO:
+    {
+        uint32_t failures = camera.captureFailures();
+        if (captureFrame(e))
+        {
+            break;
+        }
+        if (camera.captureFailures() != failures)
+        {
+            // ドライバが撮れなかった。直らないので再起動する
+            Serial.println("Camera capture failed");
+            publishMemoryTelemetry(); // 再起動の直前の状態を残す
+            delay(100);
+            ESP.restart();
+        }
+        // 前のフレームが返らない・他の受け手の解像度で撮っているなどで待ち切っただけなので、この件は失敗として返す
+        Serial.println("Camera acquire timed out");
+        failPhoto("timeout");
+        break;
+    }
+    case JOB_BURST:
+        if (!captureBurst(job.arg[0], job.arg[1], job.arg[2]))
+        {
+            Serial.println("Burst capture failed");
+        }
+        break;
+    case JOB_SET_ROI:
+        applyRoi(job);
+        break;
+    default:
+        if (!captureFrame(e))
+        {
+            Serial.println("Camera capture failed");
+        }
+        break;
+    }
+}
+
+// 同じ種類をまとめるときの key (0 はまとめない印なので 1 から)
+uint32_t jobKey(uint8_t kind)
+{
+    return kind + 1;
+}
+
+// 予定表に入れる。種類ごとにクラス・優先度・締め切り・解像度を決め、まとめてよいものには key を付ける
+void scheduleJob(const Job &job, unsigned long now)
+{
+    uint32_t key = jobKey(job.kind);
+    int quality = -1;
+    switch (job.kind)
+    {
+    case JOB_PHOTO:
+        // 画質判定の撮り直しは最初の撮影から数えた締め切りのまま、ほかとはまとめない
+        quality = photoQuality;
+        captureSchedule.push(job, CLASS_COMMAND, command_priority, (job.attempts ? job.startMs : now) + capture_deadline, now, job.attempts ? 0 : key,
+                             jobFramesize(job), quality);
+        break;
+    case JOB_BURST:
+        captureSchedule.push(job, CLASS_COMMAND, command_priority, now + command_deadline, now, 0, job.arg[2]);
+        break;
+    case JOB_SET_ROI:
+        captureSchedule.push(job, CLASS_COMMAND, command_priority, now + command_deadline, now);
+        break;
+    case JOB_RECORD:
+        captureSchedule.push(job, CLASS_RECORD, record_priority, now + record_deadline, now, key, jobFramesize(job));
+        break;
+    default:
+        captureSchedule.push(job, CLASS_PERIODIC, periodic_priority, now + periodic_deadline, now, key, jobFramesize(job));
+        break;
+    }
+}
+
+// 次の定期撮影まで何 ms あるか
+unsigned long untilDue(unsigned long last, unsigned long interval, unsigned long now)
+{
+    unsigned long elapsed = now - last;
+    return elapsed >= interval ? 0 : interval - elapsed;
+}
+
+// 定期の撮影 (魚カウント・トリガー前録画・フレームログ・録画) を時刻が来たら予定表に入れ、
+// 頼まれた撮影と一緒に予定表の順に撮る。頼まれた撮影は定期の撮影の次のコマより先になる
+void captureTask(void *arg)
+{
+    unsigned long lastFish = 0;
+    unsigned long lastPretrigger = 0;
+    unsigned long lastFrameLog = 0;
+    Job job;
+    JobScheduler::Entry next;
+    for (;;)
+    {
+        unsigned long now = millis();
+        if (!untilDue(lastFish, fish_count_interval, now))
+        {
+            lastFish = now;
+            scheduleJob(makeJob(JOB_FISH), now);
+        }
+        if (pretriggerEnabled && !untilDue(lastPretrigger, pretrigger_interval, now))
+        {
+            lastPretrigger = now;
+            scheduleJob(makeJob(JOB_PRETRIGGER), now);
+        }
+        if (frameLogEnabled && !untilDue(lastFrameLog, framelog_interval, now))
+        {
+            lastFrameLog = now;
+            if (time(NULL) >= 1700000000) // NTP で時刻が合うまでは残さない
+            {
+                scheduleJob(makeJob(JOB_FRAMELOG), now);
+            }
+        }
+        if (recording)
+        {
+            if (!captureSchedule.contains(jobKey(JOB_RECORD)))
+            {
+                scheduleJob(makeJob(JOB_RECORD), now);
+            }
+        }
+        else
+        {
+            recordFramesize = CameraService::ANY_FRAMESIZE; // 次の録画は始めたときの解像度で撮る
+        }
+
+        unsigned long wait = 0;
+        if (captureSchedule.empty())
+        {
+            wait = untilDue(lastFish, fish_count_interval, now);
+            if (pretriggerEnabled)
+            {
+                wait = min(wait, untilDue(lastPretrigger, pretrigger_interval, now));
+            }
+            if (frameLogEnabled)
+            {
+                wait = min(wait, untilDue(lastFrameLog, framelog_interval, now));
+            }
+            wait = min(wait, 1000UL); // 有効にされた録画に気づくまでの上限
+        }
+
+        taskStats.setStackFree(captureTaskId, uxTaskGetStackHighWaterMark(NULL));
+        taskStats.leave(captureTaskId, micros());
+        bool received = xQueueReceive(captureQueue, &job, pdMS_TO_TICKS(wait)) == pdTRUE;
+        taskStats.enter(captureTaskId, micros());
+        // 届いている頼みはすべて予定表に移してから、一番先の予定を撮る
+        while (received)
+        {
+            scheduleJob(job, millis());
+            received = xQueueReceive(captureQueue, &job, 0) == pdTRUE;
+        }
+        if (captureSchedule.pop(next, millis()))
+        {
+            runCaptureJob(next);
+        }
+    }
+}
+
+// ---- processing タスク ----
+
+// 画質判定を通ったフレームをキャッシュに入れ、サムネイルと一緒に network に渡す。
+// 通らなければ締め切りまで撮り直しを頼み、過ぎたらそのフレームを使う
+void processPhoto(camera_fb_t *fb, Job &job)
+{
+    bool accepted = false;
+    if (decodeThumbnail(fb))
+    {
+        FrameQualityScore q = FrameQuality::score(thumbGray, thumbWidth, thumbHeight, qualityConfig);
+        accepted = q.ok();
+        if (accepted)
+        {
+            Serial.printf("Frame accepted after %d attempts (sharpness %u, mean %u)\n", job.attempts + 1, q.sharpness, q.mean);
+        }
+        else
+        {
+            Serial.printf("Frame rejected: sharpness %u, mean %u, dark %u%%, bright %u%%\n", q.sharpness, q.mean, q.darkPercent, q.brightPercent);
+        }
+    }
+    if (!accepted)
+    {
+        if (millis() - job.startMs <= capture_deadline)
+        {
+            releaseFrame();
+            vTaskDelay(pdMS_TO_TICKS(capture_retry_delay));
+            job.attempts++;
+            xQueueSendToFront(captureQueue, &job, portMAX_DELAY);
+            return;
+        }
+        Serial.println("Quality deadline expired, using last frame");
+    }
+    photoRequests.commit(); // これより後の photo は次の撮影になる
+
+    uplink.recordRssi(WiFi.RSSI());
+    UploadJob up = {UPLOAD_PHOTO};
+    up.poorLink = uplink.linkPoor(upload_deadline);
+    if (!up.poorLink)
+    {
+        // 締め切り内に送れる量を超えないように目標サイズを絞る (次の撮影から効く)
+        jpegController.setTargetBytes(min(jpeg_target_bytes, uplink.byteBudget(upload_deadline)));
+    }
+    up.frameBytes = fb->len;
+    up.startMs = job.startMs;
+    up.captureId = captureCache.put(fb->buf, fb->len, (uint32_t)time(NULL));
+    if (!encodeThumbnailJpeg(fb, &up.thumb, &up.thumbLen))
+    {
+        up.thumb = NULL;
+        up.thumbLen = 0;
+    }
+    if (!up.captureId || !up.thumb)
+    {
+        // キャッシュに入らない・サムネイルが作れないときは従来どおりフル解像度を送る。フレームごと network に渡す
+        up.fb = fb;
+    }
+    else
+    {
+        releaseFrame();
+    }
+
+    if (jpegController.observe(up.frameBytes, millis()))
+    {
+        // 次の photo から camera がこの解像度で撮り、capture がこの画質を掛ける
+        photoFramesize = jpegController.frameSize();
+        photoQuality = jpegController.quality();
+    }
+    xQueueSend(uploadQueue, &up, portMAX_DELAY);
+}
+
+// フレームを 1/8 の輝度画像に変換して魚を数え、数だけを MQTT で送る
+void processFish(camera_fb_t *fb, const Job &job)
+{
+    bool decoded = decodeThumbnail(fb);
+    releaseFrame();
+    if (!decoded)
+    {
+        return;
+    }
+    // 解像度は fish_framesize に固定しているので、大きさが変わるのは ROI を変えたときだけ
+    if (fishCounter.width() != thumbWidth || fishCounter.height() != thumbHeight)
+    {
+        if (!fishCounter.begin(thumbWidth, thumbHeight))
+        {
+            Serial.println("FishCounter allocation failed");
+            return;
+        }
+    }
+    int count = fishCounter.process(thumbGray);
+
+    char msg[96];
+    snprintf(msg, sizeof(msg), "{\"fish\":%d,\"time\":%ld,\"elapsed_ms\":%lu}", count, (long)time(NULL), millis() - job.startMs);
+    publishTelemetry(msg);
+}
+
+void setPretrigger(bool enable)
+{
+    if (enable == pretriggerEnabled)
+    {
+        return;
+    }
+    if (clipUploading)
+    {
+        Serial.println("Clip upload in progress");
+        return;
+    }
+    if (enable)
+    {
+        size_t largest = heap_caps_get_largest_free_block(MALLOC_CAP_SPIRAM);
+        size_t bytes = largest > pretrigger_reserve_bytes ? min(pretrigger_bytes, largest - pretrigger_reserve_bytes) : 0;
+        if (bytes < pretrigger_min_bytes || !pretrigger.begin(bytes))
+        {
+            Serial.printf("Pre-trigger buffer allocation failed (%u bytes free)\n", (unsigned)largest);
+            return;
+        }
+    }
+    if (!enable)
+    {
+        pretrigger.end();
+    }
+    pretrigger.maxAgeMs = pretrigger_seconds * 1000;
+    pretriggerEnabled = enable;
+    pretriggerPushCount = 0;
+    pretriggerPushUsTotal = 0;
+    pretriggerPushUsMax = 0;
+}
+
+void triggerClip(uint32_t pre, uint32_t post)
+{
+    // 前の分は録画を有効にしている間だけ残っている
+    if (!pretriggerEnabled)
+    {
+        Serial.println("Pre-trigger recording is disabled");
+        return;
+    }
+    if (clipUploading)
+    {
+        Serial.println("Clip upload in progress");
+        return;
+    }
+    pretrigger.trigger(millis(), pre * 1000, post * 1000);
+}
+
+// フレームをリングに詰め、トリガー後の時間が過ぎたクリップを network に渡す
+void pushPretrigger(camera_fb_t *fb, const Job &job)
+{
+    if (pretriggerEnabled && !clipUploading)
+    {
+        unsigned long start = micros();
+        pretrigger.push(fb->buf, fb->len, job.startMs);
+        uint32_t us = micros() - start;
+        pretriggerPushCount++;
+        pretriggerPushUsTotal += us;
+        pretriggerPushUsMax = max(pretriggerPushUsMax, us);
+    }
+    releaseFrame();
+
+    if (pretriggerEnabled && !clipUploading && pretrigger.clipComplete(millis()))
+    {
+        clipUploading = true;
+        UploadJob up = {UPLOAD_CLIP};
+        xQueueSend(uploadQueue, &up, portMAX_DELAY);
+    }
+}
+
+bool startRecording(uint32_t seconds)
+{
+    if (!sdReady || recording)
+    {
+        return false;
+    }
+    char path[32];
+    SD.mkdir("/rec");
+    // NTP で時刻が合う前の time() は起動からの秒数なので、同じ名前がすでにあれば番号を付けて前の録画を上書きしない
+    long t = (long)time(NULL);
+    snprintf(path, sizeof(path), "/rec/%ld.avi", t);
+    for (int n = 1; SD.exists(path); n++)
+    {
+        if (n > record_name_retries)
+        {
+            Serial.printf("No free name for /rec/%ld\n", t);
+            return false;
+        }
+        snprintf(path, sizeof(path), "/rec/%ld-%d.avi", t, n);
+    }
+    recordFile = SD.open(path, FILE_WRITE);
+    if (!recordFile)
+    {
+        Serial.printf("Failed to open %s\n", path);
+        return false;
+    }
+    Serial.printf("Recording to %s\n", path);
+    recordStart = millis();
+    recordUntil = recordStart + seconds * 1000;
+    recording = true;
+    return true;
+}
+
+void stopRecording()
+{
+    bool ok = recordWriter.isOpen() && recordWriter.close();
+    uint32_t frames = recordWriter.frameCount();
+    uint32_t bytes = recordWriter.bytesWritten();
+    recordFile.close();
+    recording = false;
+
+    unsigned long elapsed = millis() - recordStart;
+    unsigned fps10 = elapsed ? frames * 10000 / elapsed : 0;
+    char msg[160];
+    snprintf(msg, sizeof(msg), "{\"record_frames\":%u,\"record_bytes\":%u,\"record_ms\":%lu,\"record_fps\":%u.%u,\"ok\":%s}", (unsigned)frames, (unsigned)bytes,
+             elapsed, fps10 / 10, fps10 % 10, ok ? "true" : "false");
+    publishTelemetry(msg);
+}
+
+// 録画中はフレームが来るたびにそのまま追記する (止めたあとに届いたフレームは返すだけ)
+void recordFrame(camera_fb_t *fb)
+{
+    if (!recording)
+    {
+        releaseFrame();
+        return;
+    }
+    bool ok = true;
+    if (!recordWriter.isOpen())
+    {
+        // 大きさは最初のフレームで決める (ROI を掛けていると framesize の表と違う)
+        ok = recordWriter.begin(&recordSink, fb->width, fb->height, record_max_frames, record_buffer_bytes);
+    }
+    ok = ok && recordWriter.writeFrame(fb->buf, fb->len, millis());
+    releaseFrame();
+    if (!ok)
+    {
+        Serial.println("Recording stopped: write failed or index full");
+        stopRecording();
+        return;
+    }
+    if ((long)(millis() - recordUntil) >= 0)
+    {
+        stopRecording();
+    }
+}
+
+// 撮った時刻でフレームログに追記する
+void appendFrameLog(camera_fb_t *fb, uint64_t timestampMs)
+{
+    if (frameLogEnabled && !frameLog.append(fb->buf, fb->len, timestampMs))
+    {
+        Serial.println("Frame log append failed");
+    }
+    releaseFrame();
+}
+
+void runProcessingCommand(const Job &job)
+{
+    switch (job.kind)
+    {
+    case JOB_PRETRIGGER_ENABLE:
+        setPretrigger(job.arg[0] != 0);
+        break;
+    case JOB_CLIP:
+        triggerClip(job.arg[0], job.arg[1]);
+        break;
+    case JOB_RECORD_START:
+        if (!startRecording(job.arg[0]))
+        {
+            Serial.println("Recording could not start");
+        }
+        break;
+    case JOB_FRAMELOG_ENABLE:
+        frameLogEnabled = sdReady && job.arg[0];
+        break;
+    }
+}
+
+void processFrame(FrameMessage &m)
+{
+    camera_fb_t *fb = (camera_fb_t *)m.frame.handle;
+    switch (m.job.kind)
+    {
+    case JOB_PHOTO:
+        processPhoto(fb, m.job);
+        break;
+    case JOB_FISH:
+        processFish(fb, m.job);
+        break;
+    case JOB_PRETRIGGER:
+        pushPretrigger(fb, m.job);
+        break;
+    case JOB_RECORD:
+        recordFrame(fb);
+        break;
+    case JOB_FRAMELOG:
+        appendFrameLog(fb, m.frame.timestampMs);
+        break;
+    default:
+        releaseFrame();
+        break;
+    }
+}
+
+// capture と control からの通知で起き、コマンドを先に、それからリングのフレームを片付ける
+void processingTask(void *arg)
+{
+    Job job;
+    FrameMessage m;
+    for (;;)
+    {
+        taskStats.setStackFree(processingTaskId, uxTaskGetStackHighWaterMark(NULL));
+        taskStats.leave(processingTaskId, micros());
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        taskStats.enter(processingTaskId, micros());
+
+        while (xQueueReceive(commandQueue, &job, 0) == pdTRUE)
+        {
+            runProcessingCommand(job);
+        }
+        while (frameRing.pop(m))
+        {
+            processFrame(m);
+        }
+    }
+}
+
+// ---- network タスク ----
+
+// サムネイル (とフル解像度) を送り、撮影のテレメトリを出す
+void uploadPhoto(const UploadJob &job)
+{
+    if (job.fb)
+    {
+        postImage(job.fb->buf, job.fb->len, "full", job.captureId);
+        releaseFrame();
+    }
+    bool thumbnail = job.thumb != NULL;
+    if (thumbnail)
+    {
+        postImage(job.thumb, job.thumbLen, "thumbnail", job.captureId);
+        free(job.thumb);
+    }
+    unsigned long firstImageMs = millis() - job.startMs; // 撮影から最初の画像が届くまで
+
+    if (job.captureId && thumbnail && send_full_on_capture)
+    {
+        if (job.poorLink)
+        {
+            deferredCaptureId = job.captureId;
+        }
+        else
+        {
+            sendCachedFrame(job.captureId, "full");
+        }
+    }
+
+    // 応答はまとめた頼みの分まで1回だけ出す。撮影の後に来た頼みがあれば次の1回を撮る
+    bool again = false;
+    uint16_t requests = photoRequests.finish(&again);
+    char msg[352];
+    snprintf(msg, sizeof(msg),
+             "{\"capture_id\":%u,\"requests\":%u,\"jpeg_bytes\":%u,\"thumb_bytes\":%u,\"first_image_ms\":%lu,\"jpeg_target\":%u,\"jpeg_avg\":%u,\"quality\":%d,"
+             "\"framesize\":%d,\"uplink_bps\":%u,\"latency_ms\":%u,\"rssi\":%d,\"capture_ms\":%lu,\"roi\":%s}",
+             (unsigned)job.captureId, (unsigned)requests, (unsigned)job.frameBytes, (unsigned)job.thumbLen, firstImageMs, (unsigned)jpegController.targetBytes(),
+             (unsigned)jpegController.averageBytes(), jpegController.quality(), jpegController.frameSize(), (unsigned)uplink.bytesPerSecond(),
+             (unsigned)uplink.latencyMs(), uplink.rssi(), lastCaptureMs, cameraRoiCurrent().full() ? "false" : "true");
+    publishTelemetry(msg);
+    if (again)
+    {
+        Job next = makeJob(JOB_PHOTO);
+        xQueueSend(captureQueue, &next, portMAX_DELAY);
+    }
+}
+
+// 連写した領域をまとめて1回で POST する。フレームの区切りは X-Burst-Lengths で渡す
+void uploadBurst()
+{
+    char lengths[BurstBuffer::MAX_FRAMES * 8];
+    burst.formatLengths(lengths, sizeof(lengths));
+
+    HTTPClient http;
+    http.begin(serverUrl);
+    http.addHeader("Content-Type", "application/octet-stream");
+    http.addHeader("X-Image-Kind", "burst");
+    http.addHeader("X-Burst-Lengths", lengths);
+    unsigned long start = millis();
+    int httpResponseCode = http.POST((uint8_t *)burst.data(), burst.used());
+    recordUplink(httpResponseCode, burst.used(), millis() - start);
+    http.end();
+
+    unsigned fps10 = burstStats.elapsedMs ? burstStats.captured * 10000 / burstStats.elapsedMs : 0;
+    char msg[192];
+    snprintf(msg, sizeof(msg), "{\"burst_requested\":%u,\"burst_captured\":%u,\"burst_dropped\":%u,\"burst_ms\":%u,\"burst_fps\":%u.%u,\"burst_bytes\":%u,\"http\":%d}",
+             (unsigned)burstStats.requested, (unsigned)burstStats.captured, (unsigned)burstStats.dropped, (unsigned)burstStats.elapsedMs, fps10 / 10, fps10 % 10,
+             (unsigned)burstStats.bytes, httpResponseCode);
+    burstUploading = false;
+    publishTelemetry(msg);
+}
+
+// クリップのフレームをリングから直接 POST の本文として読み出す (コピーしない)
+class ClipStream : public Stream
+{
+public:
+    ClipStream(const PreTriggerBuffer &buffer) : buf(buffer), count(buffer.clipFrameCount()), remaining(buffer.clipBytes()) {}
+
+    // HTTPClient は読むたびに呼ぶので、フレームを数え直さず残りを持っておく
+    int available() override { return (int)remaining; }
+    size_t readBytes(char *out, size_t length) override
+    {
+        size_t done = 0;
+        while (done < length && frame < count)
+        {
+            const PreTriggerBuffer::Frame &f = buf.clipFrame(frame);
+            size_t k = min(length - done, (size_t)(f.len - offset));
+            memcpy(out + done, buf.frameData(f) + offset, k);
+            done += k;
+            offset += k;
+            remaining -= k;
+            if (offset == f.len)
+            {
+                frame++;
+                offset = 0;
+            }
+        }
+        return done;
+    }
+    int read() override
+    {
+        char c;
+        return readBytes(&c, 1) ? (uint8_t)c : -1;
+    }
+    int peek() override
+    {
+        return frame < count ? buf.frameData(buf.clipFrame(frame))[offset] : -1;
+    }
+    size_t write(uint8_t) override { return 0; }
+
+private:
+    const PreTriggerBuffer &buf;
+    size_t count;
+    size_t remaining;
+    size_t frame = 0;
+    size_t offset = 0;
+};
+
+// クリップを1回で送る。フレームの区切りは X-Clip-Lengths で渡す。送っている間 processing はリングに詰めない
+void uploadClip()
+{
+    size_t count = pretrigger.clipFrameCount();
+    size_t bytes = pretrigger.clipBytes();
+    int httpResponseCode = 0;
+    if (count)
+    {
+        static char lengths[PreTriggerBuffer::MAX_FRAMES * 8];
+        size_t pos = 0;
+        lengths[0] = '\0';
+        for (size_t i = 0; i < count && pos < sizeof(lengths) - 8; i++)
+        {
+            pos += snprintf(lengths + pos, sizeof(lengths) - pos, i ? ",%u" : "%u", (unsigned)pretrigger.clipFrame(i).len);
+        }
+
+        ClipStream body(pretrigger);
+        HTTPClient http;
+        http.begin(serverUrl);
+        http.addHeader("Content-Type", "application/octet-stream");
+        http.addHeader("X-Image-Kind", "clip");
+        http.addHeader("X-Clip-Lengths", lengths);
+        unsigned long start = millis();
+        httpResponseCode = http.sendRequest("POST", &body, bytes);
+        recordUplink(httpResponseCode, bytes, millis() - start);
+        http.end();
+    }
+    uint32_t spanMs = count ? pretrigger.clipFrame(count - 1).timestampMs - pretrigger.clipFrame(0).timestampMs : 0;
+    pretrigger.release();
+
+    char msg[256];
+    snprintf(msg, sizeof(msg),
+             "{\"clip_frames\":%u,\"clip_bytes\":%u,\"clip_span_ms\":%u,\"http\":%d,\"pretrigger_bytes\":%u,\"pretrigger_dropped\":%u,\"push_us_avg\":%u,"
+             "\"push_us_max\":%u}",
+             (unsigned)count, (unsigned)bytes, (unsigned)spanMs, httpResponseCode, (unsigned)pretrigger.capacity(), (unsigned)pretrigger.dropped(),
+             (unsigned)(pretriggerPushCount ? pretriggerPushUsTotal / pretriggerPushCount : 0), (unsigned)pretriggerPushUsMax);
+    clipUploading = false;
+    publishTelemetry(msg);
+}
+
+void networkTask(void *arg)
+{
+    UploadJob job;
+    for (;;)
+    {
+        // 送信中の時間は応答待ちも含めて忙しさに数える
+        taskStats.setStackFree(networkTaskId, uxTaskGetStackHighWaterMark(NULL));
+        taskStats.leave(networkTaskId, micros());
+        bool received = xQueueReceive(uploadQueue, &job, pdMS_TO_TICKS(1000)) == pdTRUE;
+        taskStats.enter(networkTaskId, micros());
+
+        if (received)
+        {
+            switch (job.kind)
+            {
+            case UPLOAD_PHOTO:
+                uploadPhoto(job);
+                break;
+            case UPLOAD_CACHED:
+                sendCachedFrame(job.captureId, "full");
+                break;
+            case UPLOAD_BURST:
+                uploadBurst();
+                break;
+            case UPLOAD_CLIP:
+                uploadClip();
+                break;
+            }
+        }
+        uploadDeferredFrame();
+    }
+}
+
+// ---- control タスク ----
+
+bool sendToProcessing(const Job &job)
+{
+    if (xQueueSend(commandQueue, &job, 0) != pdTRUE)
+    {
+        return false;
+    }
+    xTaskNotifyGive(processingHandle);
+    return true;
 }
 
+// 受け取ったコマンドは該当するタスクのキューに積むだけにして、MQTT を止めない
 void callback(char *topic, byte *payload, unsigned int length)
 {
     StaticJsonDocument<200> slackMessage;
@@ -123,9 +1499,131 @@ void callback(char *topic, byte *payload, unsigned int length)
     }
 
     const char *message = slackMessage["message"];
+    if (message == NULL)
+    {
+        return;
+    }
+    bool queued = true;
     if (strcmp(message, "photo") == 0)
     {
-        sendImageToSoracomFunk();
+        // 撮影中・送信中ならまとめる (応答は撮り終えた1回にまとめて出る)
+        if (photoRequests.request())
+        {
+            Job job = makeJob(JOB_PHOTO);
+            queued = xQueueSend(captureQueue, &job, 0) == pdTRUE;
+            if (!queued)
+            {
+                failPhoto("queue_full");
+            }
+        }
+    }
+    else if (strcmp(message, "full") == 0)
+    {
+        // {"message":"full","id":..}。id を省くと直近の撮影
+        UploadJob up = {UPLOAD_CACHED};
+        up.captureId = slackMessage["id"] | captureCache.latestId();
+        queued = xQueueSend(uploadQueue, &up, 0) == pdTRUE;
+    }
+    else if (strcmp(message, "pretrigger") == 0)
+    {
+        // {"message":"pretrigger","enable":true}
+        queued = sendToProcessing(makeJob(JOB_PRETRIGGER_ENABLE, slackMessage["enable"] | false));
+    }
+    else if (strcmp(message, "clip") == 0)
+    {
+        // {"message":"clip","pre":秒,"post":秒}
+        queued = sendToProcessing(makeJob(JOB_CLIP, slackMessage["pre"] | clip_default_pre, slackMessage["post"] | clip_default_post));
+    }
+    else if (strcmp(message, "record") == 0)
+    {
+        // {"message":"record","seconds":..}
+        queued = sendToProcessing(makeJob(JOB_RECORD_START, slackMessage["seconds"] | record_default_seconds));
+    }
+    else if (strcmp(message, "framelog") == 0)
+    {
+        // {"message":"framelog","enable":true}
+        queued = sendToProcessing(makeJob(JOB_FRAMELOG_ENABLE, slackMessage["enable"] | false));
+    }
+    else if (strcmp(message, "burst") == 0)
+    {
+        // {"message":"burst","count":..,"interval":..,"framesize":..}。framesize を省くと今の解像度
+        Job job = makeJob(JOB_BURST, slackMessage["count"] | 10, slackMessage["interval"] | 0, slackMessage["framesize"] | -1);
+        queued = xQueueSend(captureQueue, &job, 0) == pdTRUE;
+    }
+    else if (strcmp(message, "roi") == 0)
+    {
+        // {"message":"roi","x":..,"y":..,"w":..,"h":..} (千分率)。"clear":true で解除
+        Job job = makeJob(JOB_SET_ROI, slackMessage["x"] | 0, slackMessage["y"] | 0, slackMessage["w"] | 1000, slackMessage["h"] | 1000);
+        if (slackMessage["clear"] | false)
+        {
+            job.arg[2] = 0;
+        }
+        queued = xQueueSend(captureQueue, &job, 0) == pdTRUE;
+    }
+    else if (strcmp(message, "tasks") == 0)
+    {
+        publishTaskTrace();
+    }
+    if (!queued)
+    {
+        Serial.printf("Command \"%s\" dropped: queue full\n", message);
+    }
+}
+
+// 1回だけ接続を試す。失敗したら control が mqtt_retry_interval あとにまた呼ぶ
+bool reconnect()
+{
+    Serial.print("Attempting MQTT connection...");
+    if (client.connect(mqqt_client_ID))
+    {
+        Serial.println("connected");
+        client.subscribe(mqtt_topic);
+        return true;
+    }
+    Serial.print("failed, rc=");
+    Serial.print(client.state());
+    Serial.println(" try again in 5 seconds");
+    return false;
+}
+
+void controlTask(void *arg)
+{
+    unsigned long lastReconnect = 0;
+    unsigned long lastTrace = millis();
+    for (;;)
+    {
+        taskStats.enter(controlTaskId, micros());
+        xSemaphoreTakeRecursive(mqttMutex, portMAX_DELAY);
+        if (!client.connected() && (!lastReconnect || millis() - lastReconnect >= mqtt_retry_interval))
+        {
+            lastReconnect = millis();
+            if (reconnect())
+            {
+                lastReconnect = 0;
+            }
+        }
+        client.loop();
+        xSemaphoreGiveRecursive(mqttMutex);
+
+        sampleMemory();
+        if (millis() - lastTrace >= task_trace_interval)
+        {
+            lastTrace = millis();
+            publishTaskTrace();
+        }
+        taskStats.setStackFree(controlTaskId, uxTaskGetStackHighWaterMark(NULL));
+        taskStats.leave(controlTaskId, micros());
+        vTaskDelay(pdMS_TO_TICKS(control_poll_interval));
+    }
+}
+
+// 登録してからタスクを作る (作った直後から taskStats に書くため)
+void startTask(TaskFunction_t fn, const char *name, uint32_t stack, UBaseType_t priority, int core, int *id, TaskHandle_t *handle = NULL)
+{
+    *id = taskStats.add(name, core, priority);
+    if (xTaskCreatePinnedToCore(fn, name, stack, NULL, priority, handle, core) != pdPASS)
+    {
+        Serial.printf("Failed to start %s task\n", name);
     }
 }
 
@@ -197,38 +1695,81 @@ void setup()
     s->set_contrast(s, 1);    // コントラスト -2 - 2
     s->set_saturation(s, 2);  // 彩度 -2 - 2
     s->set_denoise(s, 1);     // ノイズ除去
+
+    // 保存してある撮影範囲を掛ける
+    CameraRoi roi;
+    if (cameraRoiLoad(&roi))
+    {
+        cameraRoiApply(s, roi);
+    }
+
+    if (!captureCache.begin(capture_cache_bytes))
+    {
+        Serial.println("Capture cache allocation failed");
+    }
+
+#if defined(SD_SCK_GPIO_NUM)
+    sdSpi.begin(SD_SCK_GPIO_NUM, SD_MISO_GPIO_NUM, SD_MOSI_GPIO_NUM, SD_CS_GPIO_NUM);
+    sdReady = SD.begin(SD_CS_GPIO_NUM, sdSpi);
+#endif
+    if (!sdReady)
+    {
+        Serial.println("SD card not available");
+    }
+    else if (!frameLog.begin(SD, "/framelog"))
+    {
+        Serial.println("Frame log recovery failed");
+    }
+    else
+    {
+        Serial.printf("Frame log: %u segments, %u bytes discarded in %u ms\n", (unsigned)frameLog.segmentCount(), (unsigned)frameLog.recoveredBytes(),
+                      (unsigned)frameLog.recoveryMs());
+    }
+
+    if (!burst.begin(burst_arena_bytes))
+    {
+        Serial.println("Burst arena allocation failed");
+    }
+
+    jpegController.begin(config.jpeg_quality, config.frame_size, jpeg_frame_ladder, sizeof(jpeg_frame_ladder) / sizeof(jpeg_frame_ladder[0]));
+    jpegController.setTargetBytes(jpeg_target_bytes);
     setup_wifi();
     connectToWireGuard();
 
     client.setServer(mqtt_server, mqtt_port);
+    client.setBufferSize(1024); // テレメトリの JSON が既定の 256 バイトを超えるため
     client.setCallback(callback);
-}
 
-void reconnect()
-{
-    while (!client.connected())
+    captureQueue = xQueueCreate(8, sizeof(Job));
+    commandQueue = xQueueCreate(4, sizeof(Job));
+    uploadQueue = xQueueCreate(4, sizeof(UploadJob));
+    frameSlots = xSemaphoreCreateCounting(config.fb_count, config.fb_count);
+    mqttMutex = xSemaphoreCreateRecursiveMutex();
+    // ここから先はセンサーを camera のタスクだけが触る
+    camera.settleFrames = 2; // 解像度を変えた直後の数フレームは露出が落ち着いていないので捨てる
+    camera.onFramesizeChanged = reapplyRoi;
+    if (!camera.begin(camera_priority, camera_core, camera_stack))
     {
-        Serial.print("Attempting MQTT connection...");
-        if (client.connect(mqqt_client_ID))
-        {
-            Serial.println("connected");
-            client.subscribe(mqtt_topic);
-        }
-        else
-        {
-            Serial.print("failed, rc=");
-            Serial.print(client.state());
-            Serial.println(" try again in 5 seconds");
-            delay(5000);
-        }
+        Serial.println("Failed to start camera task");
     }
+    captureConsumer = camera.addConsumer("capture");
+    photoFramesize = jpegController.frameSize();
+    photoQuality = jpegController.quality();
+    appliedQuality = config.jpeg_quality;
+    captureSchedule.stats.setName(CLASS_COMMAND, "command");
+    captureSchedule.stats.setName(CLASS_RECORD, "record");
+    captureSchedule.stats.setName(CLASS_PERIODIC, "periodic");
+    // Web サーバーは camera のタスクに頼むので、WiFi と camera のタスクが動いてから始める
+    startCameraServer();
+    // capture が通知する先なので processing を先に作る
+    startTask(processingTask, "processing", processing_stack, processing_priority, processing_core, &processingTaskId, &processingHandle);
+    startTask(captureTask, "capture", capture_stack, capture_priority, capture_core, &captureTaskId);
+    startTask(networkTask, "network", network_stack, network_priority, network_core, &networkTaskId);
+    startTask(controlTask, "control", control_stack, control_priority, control_core, &controlTaskId);
 }
 
 void loop()
 {
-    if (!client.connected())
-    {
-        reconnect();
-    }
-    client.loop();
+    // 仕事はすべて setup() で作ったタスクで行う
+    vTaskDelete(NULL);
 }
@@ -4,6 +4,13 @@
 #include <addons/TokenHelper.h>
 #include <esp_heap_caps.h>
 #include <esp_system.h>
+#include <JpegDc.h>
+#include <PerceptualHash.h>
+#include <TileDelta.h>
+#include <AviWriter.h>
+#include <SD.h>
+#include "img_converters.h"
+#include "esp_jpg_decode.h"
 
 // Select camera model
 #define CAMERA_MODEL_M5STACK_PSRAM // M5Stack with PSRAM
@@ -15,6 +22,7 @@ const char *ssid = "*******";     // Replace with your Wi-Fi SSID
 const char *password = "*******"; // Replace with your Wi-Fi password
 
 // Firebase project credentials
+#define FIREBASE_PROJECT_ID "secret"         // プロジェクトID
 #define STORAGE_BUCKET_ID "********" // Replace with your Storage Bucket ID
 #define API_KEY "*******"            // Replace with your Firebase API Key
 #define USER_EMAIL "********"        // Optional user email for authentication
@@ -26,6 +34,55 @@ FirebaseConfig firebaseConfig;
 
 int counter =0; 
 
+// 変化のないフレームは送らない (知覚ハッシュで比較)
+JpegDcDecoder jpegDc;
+uint8_t *thumbGray = NULL;
+size_t thumbGraySize = 0;
+uint16_t thumbWidth = 0;
+uint16_t thumbHeight = 0;
+FrameDeduplicator dedup;
+
+// 変化したタイルだけを送る (定期的にキーフレーム)
+const uint8_t tile_cells = 8;         // 1/8 画像で 8 画素 = 64px のタイル
+const size_t max_delta_tiles = 96;    // これを超える変化はキーフレームにする
+const int tile_jpeg_quality = 85;
+TileChangeMap tileMap;
+uint8_t *tileRgb = NULL;              // 変化タイルの BGR888 (max_delta_tiles 枚分)
+int16_t tileSlot[TileChangeMap::MAX_TILES];
+uint32_t packetSeq = 0;
+uint32_t keySeq = 0;
+uint64_t tileBytesSent = 0;
+uint64_t fullBytesEquivalent = 0;
+
+// 1時間分のフレームを SD の AVI (MJPEG) にためて、1時間ごとに1回でアップロードする
+// false なら従来どおりフレームごとに (タイル差分で) 送る
+const bool upload_segments = true;
+const uint32_t segment_duration = 3600000;   // 1セグメントの長さ (ms)
+const uint32_t segment_max_frames = 256;     // 20 秒間隔で 1 時間 = 180 枚
+const uint32_t segment_playback_fps = 10;    // 再生時のフレームレート
+const char *segment_dir = "/timelapse";     // 閉じたセグメントは送れるまでここに残す
+const char *segment_failed_dir = "/timelapse_failed"; // 何度送っても失敗するセグメントはここに移して後ろを詰まらせない
+const uint8_t segment_max_failures = 3;
+bool sdReady = false;
+File segmentFile;
+FsAviSink segmentSink(segmentFile);
+AviWriter segmentWriter;
+char segmentPath[40];
+uint32_t segmentStart = 0;
+uint32_t segmentCounter = 0;
+uint32_t segmentsUploaded = 0;
+uint32_t segmentFrames = 0; // 閉じたセグメントに入れたフレーム数
+char failingSegment[40] = ""; // 続けて送れていないセグメントと、その回数
+uint8_t segmentFailures = 0;
+char skippedSegment[40] = ""; // 移せなかったときは、この起動の間は送らない
+
+// File::name() はコアのバージョンによってフルパスを返す
+const char *baseName(const char *path)
+{
+    const char *slash = strrchr(path, '/');
+    return slash ? slash + 1 : path;
+}
+
 void setup()
 {
     Serial.begin(115200);
@@ -109,6 +166,38 @@ void setup()
     Firebase.begin(&firebaseConfig, &auth);
     Firebase.reconnectWiFi(true);
 
+    if (upload_segments)
+    {
+        // Firebase のファイルアップロードも同じ SD を使う。既定の VSPI (5, 18, 19, 23) は
+        // M5STACK_PSRAM ではカメラが使っているので、camera_pins.h が SD のピンを決めている機種だけで使う
+#if defined(SD_SCK_GPIO_NUM)
+        sdReady = Firebase.sdBegin(SD_CS_GPIO_NUM, SD_SCK_GPIO_NUM, SD_MISO_GPIO_NUM, SD_MOSI_GPIO_NUM);
+#endif
+        if (!sdReady)
+        {
+            Serial.println("SD card not available, uploading frames individually");
+        }
+        else
+        {
+            // 再起動前に送れなかったセグメント (移したものも) と番号が重ならないようにする
+            const char *dirs[] = {segment_dir, segment_failed_dir};
+            for (const char *path : dirs)
+            {
+                SD.mkdir(path);
+                File dir = SD.open(path);
+                for (File f = dir.openNextFile(); f; f = dir.openNextFile())
+                {
+                    uint32_t n = strtoul(baseName(f.name()), NULL, 10);
+                    if (n >= segmentCounter)
+                    {
+                        segmentCounter = n + 1;
+                    }
+                }
+                dir.close();
+            }
+        }
+    }
+
     Serial.println("Firebase initialized");
 }
 
@@ -137,6 +226,365 @@ bool uploadImageToFirebase(camera_fb_t *fb)
     }
 }
 
+// 1/8 の輝度画像から dHash を計算する。失敗したら false
+bool hashFrame(camera_fb_t *fb, uint64_t *hash)
+{
+    uint16_t w, h;
+    if (!jpegDc.getSize(fb->buf, fb->len, &w, &h))
+    {
+        return false;
+    }
+    size_t size = (size_t)w * h;
+    if (size > thumbGraySize)
+    {
+        free(thumbGray);
+        thumbGray = (uint8_t *)ps_malloc(size);
+        thumbGraySize = thumbGray ? size : 0;
+    }
+    if (!thumbGray || !jpegDc.decode(fb->buf, fb->len, thumbGray, thumbGraySize))
+    {
+        return false;
+    }
+    thumbWidth = w;
+    thumbHeight = h;
+    *hash = PerceptualHash::dHash(thumbGray, w, h);
+    return true;
+}
+
+struct TileDecodeContext
+{
+    camera_fb_t *fb;
+    uint16_t tileSize;
+    uint16_t tilesX;
+};
+
+static size_t readJpeg(void *arg, size_t index, uint8_t *buf, size_t len)
+{
+    camera_fb_t *fb = ((TileDecodeContext *)arg)->fb;
+    if (index + len > fb->len)
+    {
+        len = fb->len - index;
+    }
+    if (buf)
+    {
+        memcpy(buf, fb->buf + index, len);
+    }
+    return len;
+}
+
+// デコードされたブロックのうち、変化したタイルに入るものだけを拾う
+static bool writeTiles(void *arg, uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint8_t *data)
+{
+    if (!data)
+    {
+        return true; // 初期化・終了の呼び出し
+    }
+    TileDecodeContext *ctx = (TileDecodeContext *)arg;
+    uint16_t ts = ctx->tileSize;
+    int16_t slot = tileSlot[(y / ts) * ctx->tilesX + x / ts];
+    if (slot < 0)
+    {
+        return true;
+    }
+    uint8_t *tile = tileRgb + (size_t)slot * ts * ts * 3;
+    uint16_t ox = x % ts;
+    uint16_t oy = y % ts;
+    for (uint16_t row = 0; row < h; row++)
+    {
+        uint8_t *dst = tile + ((size_t)(oy + row) * ts + ox) * 3;
+        for (uint16_t col = 0; col < w; col++)
+        {
+            // fmt2jpg の RGB888 は BGR の順
+            dst[0] = data[2];
+            dst[1] = data[1];
+            dst[2] = data[0];
+            dst += 3;
+            data += 3;
+        }
+    }
+    return true;
+}
+
+// ヘッダ + タイル表 + JPEG を1つのバッファにまとめて送る
+bool uploadTilePacket(const TilePacketHeader &header, const TileEntry *entries, uint8_t **jpegs)
+{
+    size_t total = tilePacketManifestSize(header.count);
+    for (uint16_t i = 0; i < header.count; i++)
+    {
+        total += entries[i].length;
+    }
+    uint8_t *packet = (uint8_t *)ps_malloc(total);
+    if (!packet)
+    {
+        Serial.println("Packet allocation failed");
+        return false;
+    }
+    writeTilePacketManifest(packet, header, entries);
+    uint8_t *p = packet + tilePacketManifestSize(header.count);
+    for (uint16_t i = 0; i < header.count; i++)
+    {
+        memcpy(p, jpegs[i], entries[i].length);
+        p += entries[i].length;
+    }
+
+    char path[40];
+    snprintf(path, sizeof(path), "/deltas/%08lu.tdl", (unsigned long)header.seq);
+    bool ok = Firebase.Storage.upload(&fbdo, STORAGE_BUCKET_ID, packet, total, path, "application/octet-stream");
+    free(packet);
+    if (ok)
+    {
+        tileBytesSent += total;
+    }
+    return ok;
+}
+
+// キーフレームか、変化したタイルだけの差分を送る
+bool uploadTileDelta(camera_fb_t *fb)
+{
+    if (tileMap.tilesX() != (thumbWidth + tile_cells - 1) / tile_cells || tileMap.tilesY() != (thumbHeight + tile_cells - 1) / tile_cells)
+    {
+        if (!tileMap.begin(thumbWidth, thumbHeight, tile_cells))
+        {
+            return false;
+        }
+    }
+    if (!tileRgb)
+    {
+        tileRgb = (uint8_t *)ps_malloc((size_t)max_delta_tiles * tileMap.tileSize() * tileMap.tileSize() * 3);
+        if (!tileRgb)
+        {
+            Serial.println("Tile buffer allocation failed");
+            return false;
+        }
+    }
+
+    size_t nChanged = tileMap.detect(thumbGray);
+    TilePacketHeader header;
+    header.tileSize = tileMap.tileSize();
+    header.seq = packetSeq;
+    header.width = fb->width;
+    header.height = fb->height;
+
+    if (tileMap.keyframeDue() || nChanged > max_delta_tiles)
+    {
+        header.type = TILE_PACKET_KEYFRAME;
+        header.keySeq = packetSeq;
+        header.count = 1;
+        TileEntry entry = {TILE_FULL_FRAME, TILE_FULL_FRAME, (uint32_t)fb->len};
+        uint8_t *jpeg = fb->buf;
+        if (!uploadTilePacket(header, &entry, &jpeg))
+        {
+            return false;
+        }
+        tileMap.commitKeyframe(thumbGray);
+        keySeq = packetSeq++;
+        fullBytesEquivalent += fb->len;
+        Serial.printf("Keyframe %lu sent (%u bytes)\n", (unsigned long)header.seq, fb->len);
+        return true;
+    }
+
+    // 変化したタイルだけをフル解像度でデコードする
+    uint16_t ts = tileMap.tileSize();
+    memset(tileSlot, 0xFF, sizeof(tileSlot));
+    for (size_t i = 0; i < nChanged; i++)
+    {
+        tileSlot[tileMap.changedTile(i)] = (int16_t)i;
+    }
+    TileDecodeContext ctx = {fb, ts, tileMap.tilesX()};
+    if (nChanged && esp_jpg_decode(fb->len, JPG_SCALE_NONE, readJpeg, writeTiles, &ctx) != ESP_OK)
+    {
+        Serial.println("Tile decode failed");
+        return false;
+    }
+
+    TileEntry entries[max_delta_tiles];
+    uint8_t *jpegs[max_delta_tiles];
+    bool ok = true;
+    for (size_t i = 0; i < nChanged; i++)
+    {
+        uint16_t tx = tileMap.changedTile(i) % tileMap.tilesX();
+        uint16_t ty = tileMap.changedTile(i) / tileMap.tilesX();
+        uint16_t tw = min((int)ts, (int)fb->width - tx * ts);
+        uint16_t th = min((int)ts, (int)fb->height - ty * ts);
+        uint8_t *tile = tileRgb + i * ts * ts * 3;
+        // 端のタイルは行を詰める
+        for (uint16_t row = 1; tw < ts && row < th; row++)
+        {
+            memmove(tile + (size_t)row * tw * 3, tile + (size_t)row * ts * 3, (size_t)tw * 3);
+        }
+        size_t len = 0;
+        jpegs[i] = NULL;
+        if (!fmt2jpg(tile, (size_t)tw * th * 3, tw, th, PIXFORMAT_RGB888, tile_jpeg_quality, &jpegs[i], &len))
+        {
+            ok = false;
+            nChanged = i;
+            break;
+        }
+        entries[i].tileX = tx;
+        entries[i].tileY = ty;
+        entries[i].length = (uint32_t)len;
+    }
+
+    if (ok)
+    {
+        header.type = TILE_PACKET_DELTA;
+        header.keySeq = keySeq;
+        header.count = (uint16_t)nChanged;
+        ok = uploadTilePacket(header, entries, jpegs);
+    }
+    for (size_t i = 0; i < nChanged; i++)
+    {
+        free(jpegs[i]);
+    }
+    if (!ok)
+    {
+        return false;
+    }
+    tileMap.commitDelta(thumbGray);
+    packetSeq++;
+    fullBytesEquivalent += fb->len;
+    Serial.printf("Delta %lu sent (%u tiles)\n", (unsigned long)header.seq, (unsigned)nChanged);
+    return true;
+}
+
+// 閉じたセグメントを SD から1回のリクエストで (読みながら) 送る。送れたものは消す
+// 1回に1つだけ送り、残りは次の周期に回す
+bool uploadPendingSegment()
+{
+    if (WiFi.status() != WL_CONNECTED || !Firebase.ready())
+    {
+        return false;
+    }
+    char local[40] = "";
+    File dir = SD.open(segment_dir);
+    for (File f = dir.openNextFile(); f; f = dir.openNextFile())
+    {
+        snprintf(local, sizeof(local), "%s/%s", segment_dir, baseName(f.name()));
+        if ((!segmentWriter.isOpen() || strcmp(local, segmentPath) != 0) && strcmp(local, skippedSegment) != 0)
+        {
+            break;
+        }
+        local[0] = '\0';
+    }
+    dir.close();
+    if (!local[0])
+    {
+        return true;
+    }
+
+    char remote[48];
+    snprintf(remote, sizeof(remote), "/segments%s", local + strlen(segment_dir));
+    Serial.printf("Uploading segment %s...\n", local);
+    if (!Firebase.Storage.upload(&fbdo, STORAGE_BUCKET_ID, local, mem_storage_type_sd, remote, "video/x-msvideo"))
+    {
+        Serial.printf("Segment upload failed: %s\n", fbdo.errorReason().c_str());
+        // ディレクトリの先頭から選ぶので、壊れたファイルなどで失敗し続けると後ろのセグメントが送れない
+        if (strcmp(failingSegment, local) != 0)
+        {
+            snprintf(failingSegment, sizeof(failingSegment), "%s", local);
+            segmentFailures = 0;
+        }
+        if (++segmentFailures >= segment_max_failures)
+        {
+            char failed[56];
+            snprintf(failed, sizeof(failed), "%s%s", segment_failed_dir, local + strlen(segment_dir));
+            Serial.printf("Moving %s aside after %u failures\n", local, (unsigned)segmentFailures);
+            if (!SD.rename(local, failed))
+            {
+                snprintf(skippedSegment, sizeof(skippedSegment), "%s", local);
+            }
+            failingSegment[0] = '\0';
+        }
+        return false;
+    }
+    failingSegment[0] = '\0';
+    SD.remove(local);
+    segmentsUploaded++;
+    return true;
+}
+
+void closeSegment()
+{
+    if (!segmentWriter.isOpen())
+    {
+        return;
+    }
+    uint32_t frames = segmentWriter.frameCount();
+    bool ok = segmentWriter.close();
+    segmentFile.close();
+    if (!ok || !frames)
+    {
+        SD.remove(segmentPath);
+        return;
+    }
+    segmentFrames += frames;
+}
+
+// フレームを今のセグメントに追記する。1時間たったら閉じて送る
+bool appendToSegment(camera_fb_t *fb)
+{
+    if (segmentWriter.isOpen() && (millis() - segmentStart >= segment_duration || segmentWriter.frameCount() >= segment_max_frames))
+    {
+        closeSegment();
+    }
+    if (!segmentWriter.isOpen())
+    {
+        snprintf(segmentPath, sizeof(segmentPath), "%s/%08lu.avi", segment_dir, (unsigned long)segmentCounter++);
+        segmentFile = SD.open(segmentPath, FILE_WRITE);
+        if (!segmentFile)
+        {
+            Serial.println("Failed to open segment file");
+            return false;
+        }
+        segmentWriter.playbackUsPerFrame = 1000000 / segment_playback_fps;
+        if (!segmentWriter.begin(&segmentSink, fb->width, fb->height, segment_max_frames, 32768))
+        {
+            segmentFile.close();
+            return false;
+        }
+        segmentStart = millis();
+    }
+    if (!segmentWriter.writeFrame(fb->buf, fb->len, millis()))
+    {
+        Serial.println("Segment write failed");
+        closeSegment();
+        return false;
+    }
+    fullBytesEquivalent += fb->len;
+    Serial.printf("Frame %u appended to segment\n", (unsigned)segmentWriter.frameCount());
+    return true;
+}
+
+// Firestore の integerValue は 64 ビットの整数を文字列で受け取る (double にすると 2^53 を超えたところで丸まる)
+static void setUint64(FirebaseJson &json, const char *path, uint64_t v)
+{
+    char buf[24];
+    snprintf(buf, sizeof(buf), "%llu", (unsigned long long)v);
+    json.set(path, buf);
+}
+
+// スキップした枚数と節約したバイト数を Firestore に書く
+void sendTelemetry()
+{
+    if (!Firebase.ready())
+    {
+        return;
+    }
+    FirebaseJson content;
+    content.set("fields/uploaded/integerValue", counter + (int)packetSeq);
+    content.set("fields/skipped/integerValue", (int)dedup.skippedFrames());
+    setUint64(content, "fields/bytesSaved/integerValue", dedup.bytesSaved());
+    content.set("fields/lastDistance/integerValue", dedup.lastDistance());
+    setUint64(content, "fields/tileBytesSent/integerValue", tileBytesSent);
+    setUint64(content, "fields/fullBytesEquivalent/integerValue", fullBytesEquivalent);
+    content.set("fields/segmentsUploaded/integerValue", (int)segmentsUploaded);
+    content.set("fields/segmentFrames/integerValue", (int)segmentFrames);
+    if (!Firebase.Firestore.patchDocument(&fbdo, FIREBASE_PROJECT_ID, "", "timelapse/telemetry", content.raw(), ""))
+    {
+        Serial.println("Telemetry update failed");
+    }
+}
+
 void loop()
 {
     static uint32_t lastTime = 0;
@@ -153,7 +601,44 @@ void loop()
             return;
         }
 
-        if (!uploadImageToFirebase(fb))
+        uint64_t hash = 0;
+        bool hashed = hashFrame(fb, &hash);
+        if (hashed && !dedup.shouldUpload(hash, fb->len))
+        {
+            Serial.printf("Unchanged frame skipped (distance %d, skipped %u)\n", dedup.lastDistance(), dedup.skippedFrames());
+            esp_camera_fb_return(fb);
+            return;
+        }
+
+        // 1/8 画像が作れないフレームは従来どおり JPEG のまま送る
+        bool uploaded;
+        if (upload_segments && sdReady)
+        {
+            uploaded = appendToSegment(fb);
+            // 閉じたセグメントがあれば送る (1時間に1回)。テレメトリもそのときだけ
+            uint32_t before = segmentsUploaded;
+            uploadPendingSegment();
+            if (segmentsUploaded != before)
+            {
+                sendTelemetry();
+            }
+        }
+        else
+        {
+            uploaded = hashed ? uploadTileDelta(fb) : uploadImageToFirebase(fb);
+            if (uploaded)
+            {
+                sendTelemetry();
+            }
+        }
+        if (uploaded)
+        {
+            if (hashed)
+            {
+                dedup.markUploaded(hash);
+            }
+        }
+        else
         {
             Serial.println("Retrying upload in next cycle...");
         }
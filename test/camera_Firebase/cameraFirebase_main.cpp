@@ -1,6 +1,8 @@
 #include "esp_camera.h"
 #include <WiFi.h>
 #include <Firebase_ESP_Client.h>
+#include <WiFiClientSecure.h>
+#include "FirebaseLink.h"
 
 // Select camera model
 #define CAMERA_MODEL_M5STACK_PSRAM // M5Stack with PSRAM
@@ -17,10 +19,20 @@ const char *password = "*******"; // Replace with your Wi-Fi password
 #define USER_EMAIL "********"        // Optional user email for authentication
 #define USER_PASSWORD "********"     // Optional user password for authentication
 
-FirebaseData fbdo;
 FirebaseAuth auth;
 FirebaseConfig firebaseConfig;
 
+// アップロードは固定バッファの FirebaseLink で行う (パスも String で組み立てない)。Storage しか使わないので接続は1つ
+WiFiClientSecure storageClient;
+static uint8_t parseArena[512];
+FirebaseLink firebase(storageClient, storageClient, parseArena, sizeof(parseArena));
+static char imagePath[40];
+
+static const char *firebaseToken()
+{
+    return Firebase.getToken();
+}
+
 void startCameraServer();
 
 void setup()
@@ -93,44 +105,21 @@ void setup()
     Firebase.begin(&firebaseConfig, &auth);
     Firebase.reconnectWiFi(true);
 
+    storageClient.setInsecure(); // Firebase_ESP_Client と同じく証明書は検証しない
+    firebase.begin("", STORAGE_BUCKET_ID, firebaseToken);
+
     Serial.println("Firebase initialized");
     
 }
 
-void fcsUploadCallback(FCS_UploadStatusInfo info)
+void uploadImageToFirebase()
 {
-    if (info.status == firebase_fcs_upload_status_init)
-    {
-        Serial.printf("Uploading data to %s\n", info.remoteFileName.c_str());
-    }
-    else if (info.status == firebase_fcs_upload_status_upload)
+    if (!Firebase.ready())
     {
-        Serial.printf("Uploaded %d%s, Elapsed time %d ms\n", (int)info.progress, "%", info.elapsedTime);
-    }
-    else if (info.status == firebase_fcs_upload_status_complete)
-    {
-        Serial.println("Upload completed\n");
-        FileMetaInfo meta = fbdo.metaData();
-        Serial.printf("Name: %s\n", meta.name.c_str());
-        Serial.printf("Bucket: %s\n", meta.bucket.c_str());
-        Serial.printf("contentType: %s\n", meta.contentType.c_str());
-        Serial.printf("Size: %d\n", meta.size);
-        Serial.printf("Generation: %lu\n", meta.generation);
-        Serial.printf("Metageneration: %lu\n", meta.metageneration);
-        Serial.printf("ETag: %s\n", meta.etag.c_str());
-        Serial.printf("CRC32: %s\n", meta.crc32.c_str());
-        Serial.printf("Tokens: %s\n", meta.downloadTokens.c_str());
-        Serial.printf("Download URL: %s\n\n", fbdo.downloadURL().c_str());
-    }
-    else if (info.status == firebase_fcs_upload_status_error)
-    {
-        Serial.printf("Upload failed, %s\n", info.errorMsg.c_str());
+        Serial.println("Firebase is not ready");
+        return;
     }
-}
-
 
-void uploadImageToFirebase()
-{
     camera_fb_t *fb = esp_camera_fb_get();
     if (!fb)
     {
@@ -138,16 +127,18 @@ void uploadImageToFirebase()
         return;
     }
 
-    String path = "/images/" + String(millis()) + ".jpg"; // Unique path for each image
+    // Unique path for each image
+    FirebaseLink::formatName(imagePath, sizeof(imagePath), "/images/", millis(), ".jpg");
 
-    Serial.println("Uploading to Firebase...");
-    if (Firebase.Storage.upload(&fbdo, STORAGE_BUCKET_ID, fb->buf, fb->len, path.c_str(), "image/jpeg", fcsUploadCallback))
+    Serial.printf("Uploading data to %s\n", imagePath);
+    unsigned long start = millis();
+    if (firebase.upload(imagePath, fb->buf, fb->len, "image/jpeg"))
     {
-        Serial.println("Upload successful: " + fbdo.downloadURL());
+        Serial.printf("Upload successful: %u bytes, Elapsed time %lu ms\n", (unsigned)fb->len, millis() - start);
     }
     else
     {
-        Serial.println("Upload failed: " + fbdo.errorReason());
+        Serial.printf("Upload failed: HTTP %d\n", firebase.lastStatus());
     }
 
     esp_camera_fb_return(fb);
@@ -6,8 +6,17 @@
 #include <esp_system.h>
 #include <ArduinoJson.h> // FirebaseJson を扱いやすくするため
 #include <HTTPClient.h>
+#include <WiFiClientSecure.h>
 #include <base64.h>
 #include <time.h>
+#include "FirebaseLink.h"
+
+// 1 にすると、Firestore の slackMessage/slackStatus が書き換わったときに中継 (Cloud Functions など) が
+// MQTT に送る通知で問い合わせる。問い合わせは通知を受けたときと、取りこぼしに備えた長い間隔だけになる
+#define STATUS_RELAY_MQTT 0
+#if STATUS_RELAY_MQTT
+#include <PubSubClient.h>
+#endif
 
 // Select camera model
 #define CAMERA_MODEL_M5STACK_PSRAM // M5Stack with PSRAM
@@ -23,10 +32,72 @@ const char *password = "*******"; // Replace with your Wi-Fi password
 #define USER_EMAIL "********"        // Optional user email for authentication
 #define USER_PASSWORD "********"     // Optional user password for authentication
 
-FirebaseData fbdo;
+#if STATUS_RELAY_MQTT
+#define RELAY_MQTT_SERVER "*******"
+#define RELAY_MQTT_PORT 1883
+#define RELAY_MQTT_TOPIC "cps/slackStatus" // 中継が status を true にしたときに送るトピック (中身は見ない)
+#endif
+
 FirebaseAuth auth;
 FirebaseConfig firebaseConfig;
 
+// 撮影は Firestore の status が true のときだけ。待っている間は問い合わせだけをする
+const unsigned long poll_interval = 5000;         // 問い合わせの間隔 (ms)
+const unsigned long relay_poll_interval = 60000;  // MQTT の通知を使うときの取りこぼし用の問い合わせ (ms)
+const unsigned long rate_report_interval = 3600000; // 問い合わせ数・撮影数をシリアルに出す間隔 (ms)
+unsigned long lastPoll = 0;
+unsigned long lastRateReport = 0;
+uint32_t reportedRequests = 0; // 前回出したときの firebase.requests()
+uint32_t captureCount = 0;
+uint32_t pollCount = 0;
+
+// 5秒ごとの問い合わせを何か月も回すので、Firestore / Storage は固定バッファの FirebaseLink で叩く (ヒープを使わない)
+// Firebase_ESP_Client はトークンの取得・更新だけに使う
+WiFiClientSecure firestoreClient;
+WiFiClientSecure storageClient;
+static uint8_t parseArena[8192]; // レスポンスの JSON はここにパースする (毎回使い回す)
+FirebaseLink firebase(firestoreClient, storageClient, parseArena, sizeof(parseArena));
+// 問い合わせはドキュメント1つの status だけを返させ (mask)、パースでも status の値だけを残す (filter)
+// filter は setup() で一度だけ作る
+JsonDocument statusFilter;
+
+static const char *firebaseToken()
+{
+    return Firebase.getToken();
+}
+
+#if STATUS_RELAY_MQTT
+WiFiClient relayClient;
+PubSubClient relay(relayClient);
+volatile bool relayNotified = false;
+unsigned long lastRelayAttempt = 0;
+
+void relayCallback(char *topic, byte *payload, unsigned int length)
+{
+    relayNotified = true;
+}
+
+// 切れていたら 5 秒ごとに繋ぎ直す。繋がっている間は届いた通知を処理する
+void relayLoop()
+{
+    if (!relay.connected())
+    {
+        if (millis() - lastRelayAttempt < 5000)
+        {
+            return;
+        }
+        lastRelayAttempt = millis();
+        if (!relay.connect("cpsMonitoring") || !relay.subscribe(RELAY_MQTT_TOPIC))
+        {
+            Serial.println("Relay connection failed");
+            return;
+        }
+        relayNotified = true; // 繋がっていない間の通知を取りこぼしたかもしれないので一度聞く
+    }
+    relay.loop();
+}
+#endif
+
 void syncTime()
 {
     configTime(0, 0, "pool.ntp.org", "time.nist.gov");
@@ -41,71 +112,45 @@ void syncTime()
 
 bool getLatestData()
 {
-    if (Firebase.ready())
+    if (!Firebase.ready())
     {
-        String documentPath = "slackMessage";
-
-        Serial.print("Querying Firestore for latest data...");
+        Serial.println("Firebase is not ready");
+        return false;
+    }
 
-        if (Firebase.Firestore.getDocument(&fbdo, FIREBASE_PROJECT_ID, "", documentPath.c_str()))
-        {
-            Serial.println("Query successful!");
-            // Serial.printf("ok\n%s\n\n", fbdo.payload().c_str());
-            // Firebase JSON からドキュメントIDを取得
-            DynamicJsonDocument doc(2048); // 必要に応じてサイズを調整
-            deserializeJson(doc, fbdo.payload().c_str());
-
-            // document.name フィールドの確認
-            if (!doc["documents"].isNull() && doc["documents"].size() > 0)
-            {
-                String documentStatus = doc["documents"][0]["fields"]["status"]["booleanValue"].as<String>();
-                Serial.println("JsonParse successful!");
-                return documentStatus.equals("true");
-            }
-            else
-            {
-                Serial.println("No documents found or documents array is empty!");
-                return false;
-            }
-        }
-        else
-        {
-            Serial.println("Query failed: ");
-            Serial.println(fbdo.errorReason());
-            return false;
-        }
+    Serial.print("Querying Firestore for latest data...");
+    if (!firebase.get("slackMessage/slackStatus", "status", &statusFilter))
+    {
+        Serial.printf("Query failed: HTTP %d\n", firebase.lastStatus());
+        return false;
     }
-    else
+    Serial.printf("Query successful! (%u bytes, parse %u us)\n", (unsigned)firebase.lastBodyBytes(), (unsigned)firebase.lastParseUs());
+
+    JsonVariantConst status = firebase.document()["fields"]["status"]["booleanValue"];
+    if (status.isNull())
     {
-        Serial.println("Firebase is not ready");
+        Serial.println("No status field in slackMessage/slackStatus!");
         return false;
     }
+    Serial.println("JsonParse successful!");
+    return status.as<bool>();
 }
 
 void updateStatus()
 {
-    if (Firebase.ready())
+    if (!Firebase.ready())
     {
-        String collection = "slackMessage";
-        String documentPath = "/slackStatus";
-        documentPath = collection + documentPath;
-        FirebaseJson content;
-
-        content.set("fields/status/booleanValue", false);
+        Serial.println("Firebase is not ready");
+        return;
+    }
 
-        // まずは更新を試みる
-        if (Firebase.Firestore.patchDocument(&fbdo, FIREBASE_PROJECT_ID, "", documentPath.c_str(), content.raw(), ""))
-        {
-            Serial.println("Data updated in Firestore successfully!");
-        }
-        else
-        {
-            Serial.println("Data updated in Firestore Failed");
-        }
+    if (firebase.patchBool("slackMessage/slackStatus", "status", false))
+    {
+        Serial.println("Data updated in Firestore successfully!");
     }
     else
     {
-        Serial.println("Firebase is not ready");
+        Serial.println("Data updated in Firestore Failed");
     }
 }
 
@@ -117,18 +162,15 @@ bool uploadImageToFirebase(camera_fb_t *fb)
         return false;
     }
 
-    char path[32];
-    snprintf(path, sizeof(path), "/images/CPS.jpg");
-
     Serial.println("Uploading image...");
-    if (Firebase.Storage.upload(&fbdo, STORAGE_BUCKET_ID, fb->buf, fb->len, path, "image/jpeg"))
+    if (firebase.upload("/images/CPS.jpg", fb->buf, fb->len, "image/jpeg"))
     {
         Serial.println("Image uploaded successfully");
         return true;
     }
     else
     {
-        Serial.println("Image upload failed");
+        Serial.printf("Image upload failed: HTTP %d\n", firebase.lastStatus());
         return false;
     }
 }
@@ -168,6 +210,9 @@ void setup()
     config.xclk_freq_hz = 20000000;
     config.pixel_format = PIXFORMAT_JPEG;
 
+    // 頼まれてから撮るので、待っている間に溜まった古いフレームではなく最新のフレームを返させる
+    config.grab_mode = CAMERA_GRAB_LATEST;
+
     // Optimize camera settings for stability and quality
     if (psramFound())
     {
@@ -216,7 +261,18 @@ void setup()
     Firebase.begin(&firebaseConfig, &auth);
     Firebase.reconnectWiFi(true);
     syncTime();
+
+    // Firebase_ESP_Client と同じく証明書は検証しない
+    firestoreClient.setInsecure();
+    storageClient.setInsecure();
+    firebase.begin(FIREBASE_PROJECT_ID, STORAGE_BUCKET_ID, firebaseToken);
+    statusFilter["fields"]["status"]["booleanValue"] = true;
     Serial.println("Firebase initialized");
+
+#if STATUS_RELAY_MQTT
+    relay.setServer(RELAY_MQTT_SERVER, RELAY_MQTT_PORT);
+    relay.setCallback(relayCallback);
+#endif
 }
 
 bool reconnectWiFi()
@@ -252,36 +308,70 @@ bool reconnectWiFi()
     }
 }
 
-void loop()
+// status が true になってから撮って送り、status を戻す
+void captureAndUpload()
 {
-    delay(5000);
     camera_fb_t *fb = esp_camera_fb_get();
     if (!fb)
     {
         Serial.println("Camera capture failed");
-        esp_camera_fb_return(fb);
         return;
     }
+    captureCount++;
+    bool uploaded = uploadImageToFirebase(fb);
+    esp_camera_fb_return(fb);
+    if (uploaded)
+    {
+        updateStatus();
+    }
+}
+
+// 1時間あたりの Firestore / Storage への要求数と撮影数
+void reportRates()
+{
+    unsigned long elapsed = millis() - lastRateReport;
+    if (elapsed < rate_report_interval)
+    {
+        return;
+    }
+    uint32_t requests = firebase.requests();
+    float hours = elapsed / 3600000.0f;
+    Serial.printf("{\"requests_per_hour\":%.0f,\"polls_per_hour\":%.0f,\"captures_per_hour\":%.0f,\"reconnects\":%u}\n", (requests - reportedRequests) / hours,
+                  pollCount / hours, captureCount / hours, (unsigned)firebase.reconnects());
+    reportedRequests = requests;
+    pollCount = 0;
+    captureCount = 0;
+    lastRateReport = millis();
+}
+
+void loop()
+{
     // Wi-Fiの接続状態をチェックし、再接続を試みる
-    if (reconnectWiFi())
+    if (!reconnectWiFi())
     {
-        if (!fb)
-        {
-            Serial.println("Camera capture failed");
-            return;
-        }
+        delay(5000);
+        return;
+    }
 
+#if STATUS_RELAY_MQTT
+    relayLoop();
+    bool due = relayNotified || millis() - lastPoll >= relay_poll_interval;
+#else
+    bool due = millis() - lastPoll >= poll_interval;
+#endif
+    if (due)
+    {
+#if STATUS_RELAY_MQTT
+        relayNotified = false;
+#endif
+        lastPoll = millis();
+        pollCount++;
         if (getLatestData())
         {
             Serial.println("============Update Mode=========");
-
-            if (uploadImageToFirebase(fb))
-            {
-                delay(2000);
-                updateStatus();
-            }
-            delay(2000);
+            captureAndUpload();
         }
     }
-    esp_camera_fb_return(fb);
+    reportRates();
+    delay(50);
 }
@@ -0,0 +1,85 @@
+#pragma once
+
+// ホスト用テストで Arduino に依存するライブラリを動かすための最小限の代役
+// (時刻と Print / Stream だけ。Stream::readBytes はタイムアウトつきで read() を繰り返す)
+#include <stddef.h>
+#include <stdint.h>
+#include <chrono>
+#include <thread>
+
+inline unsigned long millis()
+{
+    using namespace std::chrono;
+    return (unsigned long)duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+inline unsigned long micros()
+{
+    using namespace std::chrono;
+    return (unsigned long)duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+inline void delay(unsigned long ms)
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+class Print
+{
+public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t *buf, size_t size)
+    {
+        size_t n = 0;
+        while (size-- && write(*buf++))
+        {
+            n++;
+        }
+        return n;
+    }
+    virtual void flush() {}
+};
+
+class Stream : public Print
+{
+public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+
+    void setTimeout(unsigned long ms) { timeout = ms; }
+
+    virtual size_t readBytes(char *buffer, size_t length)
+    {
+        size_t n = 0;
+        while (n < length)
+        {
+            int c = timedRead();
+            if (c < 0)
+            {
+                break;
+            }
+            buffer[n++] = (char)c;
+        }
+        return n;
+    }
+    size_t readBytes(uint8_t *buffer, size_t length) { return readBytes((char *)buffer, length); }
+
+protected:
+    int timedRead()
+    {
+        unsigned long start = millis();
+        do
+        {
+            int c = read();
+            if (c >= 0)
+            {
+                return c;
+            }
+        } while (millis() - start < timeout);
+        return -1;
+    }
+
+    unsigned long timeout = 1000;
+};
@@ -0,0 +1,18 @@
+#pragma once
+
+// ホスト用テストの Client の代役。テストはこれを継承して、決まった応答を返す接続を作る
+#include "Arduino.h"
+
+class Client : public Stream
+{
+public:
+    virtual int connect(const char *host, uint16_t port) = 0;
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t *buf, size_t size) = 0;
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+    virtual void stop() = 0;
+    virtual uint8_t connected() = 0;
+    operator bool() { return connected(); }
+};
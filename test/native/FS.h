@@ -0,0 +1,145 @@
+#pragma once
+
+// ホスト用テストの fs::FS / fs::File の代役。root の下のホストのファイルを stdio で読み書きする
+// (FrameLog が使う open / mkdir / remove / exists と、ディレクトリの openNextFile だけ)。
+// File は Arduino と同じくコピーできる持ち手で、最後のコピーが消えたときに閉じる
+#include "Arduino.h"
+
+#include <dirent.h>
+#include <memory>
+#include <stdio.h>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace fs
+{
+
+struct FileHandle
+{
+    FILE *file = nullptr;
+    DIR *dir = nullptr;
+    std::string path; // ホストの絶対パス
+    std::string name; // FS の中のパス
+
+    ~FileHandle()
+    {
+        if (file)
+        {
+            fclose(file);
+        }
+        if (dir)
+        {
+            closedir(dir);
+        }
+    }
+};
+
+class File
+{
+public:
+    File() {}
+    explicit File(std::shared_ptr<FileHandle> h) : handle(h) {}
+
+    explicit operator bool() const { return handle && (handle->file || handle->dir); }
+    bool isDirectory() const { return handle && handle->dir; }
+    const char *name() const { return handle ? handle->name.c_str() : ""; }
+
+    size_t read(uint8_t *buf, size_t size) { return handle && handle->file ? fread(buf, 1, size, handle->file) : 0; }
+    size_t write(const uint8_t *buf, size_t size) { return handle && handle->file ? fwrite(buf, 1, size, handle->file) : 0; }
+    bool seek(uint32_t pos) { return handle && handle->file && fseek(handle->file, pos, SEEK_SET) == 0; }
+    size_t position() const { return handle && handle->file ? (size_t)ftell(handle->file) : 0; }
+    void flush()
+    {
+        if (handle && handle->file)
+        {
+            fflush(handle->file);
+        }
+    }
+    size_t size() const
+    {
+        if (!handle || !handle->file)
+        {
+            return 0;
+        }
+        fflush(handle->file);
+        struct stat st;
+        return fstat(fileno(handle->file), &st) == 0 ? (size_t)st.st_size : 0;
+    }
+    void close() { handle.reset(); }
+
+    // ディレクトリの次の項目 ("." で始まるものは飛ばす)。なければ閉じた File
+    File openNextFile()
+    {
+        if (!handle || !handle->dir)
+        {
+            return File();
+        }
+        while (struct dirent *e = readdir(handle->dir))
+        {
+            if (e->d_name[0] == '.')
+            {
+                continue;
+            }
+            auto h = std::make_shared<FileHandle>();
+            h->path = handle->path + "/" + e->d_name;
+            h->name = handle->name + "/" + e->d_name;
+            struct stat st;
+            if (stat(h->path.c_str(), &st) == 0 && S_ISDIR(st.st_mode))
+            {
+                h->dir = opendir(h->path.c_str());
+            }
+            else
+            {
+                h->file = fopen(h->path.c_str(), "rb");
+            }
+            return File(h);
+        }
+        return File();
+    }
+
+private:
+    std::shared_ptr<FileHandle> handle;
+};
+
+class FS
+{
+public:
+    explicit FS(const std::string &rootDir) : root(rootDir) {}
+
+    // mode は "r" / "w" / "a" / "r+" (Arduino と同じ)
+    File open(const char *path, const char *mode = "r")
+    {
+        auto h = std::make_shared<FileHandle>();
+        h->path = root + path;
+        h->name = path;
+        struct stat st;
+        if (stat(h->path.c_str(), &st) == 0 && S_ISDIR(st.st_mode))
+        {
+            h->dir = opendir(h->path.c_str());
+        }
+        else
+        {
+            std::string m = std::string(mode) + "b";
+            h->file = fopen(h->path.c_str(), m.c_str());
+        }
+        return File(h);
+    }
+    bool exists(const char *path)
+    {
+        struct stat st;
+        return stat((root + path).c_str(), &st) == 0;
+    }
+    bool mkdir(const char *path) { return ::mkdir((root + path).c_str(), 0755) == 0; }
+    bool remove(const char *path) { return ::remove((root + path).c_str()) == 0; }
+    bool rename(const char *from, const char *to) { return ::rename((root + from).c_str(), (root + to).c_str()) == 0; }
+
+    const std::string &hostPath() const { return root; }
+
+private:
+    std::string root;
+};
+
+} // namespace fs
+
+using fs::File;
@@ -0,0 +1,99 @@
+#pragma once
+
+// ホスト用テストでヒープからの確保を数える。テストの test_main.cpp でだけ含める
+// (malloc / calloc / realloc と operator new をこの翻訳単位で置き換え、プログラム全体の確保を数える)。
+// malloc を数えられるのは glibc だけ。ほかでは operator new だけを数え、allocCountsMalloc が false になる
+#include <stddef.h>
+#include <stdlib.h>
+#include <new>
+
+static size_t allocCount = 0;
+static bool allocCounting = false;
+
+static inline void allocCounterStart()
+{
+    allocCount = 0;
+    allocCounting = true;
+}
+
+// 数え始めてからの確保の回数
+static inline size_t allocCounterStop()
+{
+    allocCounting = false;
+    return allocCount;
+}
+
+#if defined(__GLIBC__)
+static const bool allocCountsMalloc = true;
+
+extern "C"
+{
+    void *__libc_malloc(size_t n);
+    void *__libc_calloc(size_t n, size_t size);
+    void *__libc_realloc(void *p, size_t n);
+    void __libc_free(void *p);
+
+    void *malloc(size_t n)
+    {
+        allocCount += allocCounting;
+        return __libc_malloc(n);
+    }
+
+    void *calloc(size_t n, size_t size)
+    {
+        allocCount += allocCounting;
+        return __libc_calloc(n, size);
+    }
+
+    void *realloc(void *p, size_t n)
+    {
+        allocCount += allocCounting;
+        return __libc_realloc(p, n);
+    }
+
+    void free(void *p)
+    {
+        __libc_free(p);
+    }
+}
+#else
+static const bool allocCountsMalloc = false;
+#endif
+
+void *operator new(size_t n)
+{
+#if !defined(__GLIBC__)
+    allocCount += allocCounting;
+#endif
+    void *p = malloc(n ? n : 1);
+    if (!p)
+    {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void *operator new[](size_t n)
+{
+    return operator new(n);
+}
+
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void *p, size_t) noexcept
+{
+    free(p);
+}
@@ -0,0 +1,305 @@
+// AviWriter のホスト用テスト (pio test -e native -f test_avi_writer)
+// ファイルに書いた AVI を読み直して RIFF の構造と idx1 の索引を確かめ、書き込みがバッファの大きさ単位だけになっていることと、
+// 書く速さ (ホストのファイル) を測る
+#include <unity.h>
+#include <AviWriter.h>
+
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+// stdio のファイルに書く AviSink。write() の大きさと位置を数える
+class FileAviSink : public AviSink
+{
+public:
+    FILE *file;
+    size_t blockSize;
+    uint32_t pos = 0;
+    uint32_t writes = 0;
+    uint32_t unalignedWrites = 0; // 大きさか位置が blockSize の倍数でない write()
+    uint32_t seeks = 0;
+    size_t failAfter = (size_t)-1; // これより後ろには書けない (SD がいっぱいのときの代わり)
+
+    FileAviSink(FILE *f, size_t block) : file(f), blockSize(block) {}
+
+    size_t write(const uint8_t *data, size_t len) override
+    {
+        writes++;
+        if (len % blockSize || pos % blockSize)
+        {
+            unalignedWrites++;
+        }
+        if (pos + len > failAfter)
+        {
+            return 0;
+        }
+        size_t n = fwrite(data, 1, len, file);
+        pos += n;
+        return n;
+    }
+
+    bool seek(uint32_t p) override
+    {
+        seeks++;
+        pos = p;
+        return fseek(file, p, SEEK_SET) == 0;
+    }
+};
+
+static const size_t BUFFER_BYTES = 16384; // main.cpp の録画と同じ既定の大きさ
+
+static uint32_t rd32(const std::vector<uint8_t> &b, size_t pos)
+{
+    return b[pos] | b[pos + 1] << 8 | b[pos + 2] << 16 | (uint32_t)b[pos + 3] << 24;
+}
+
+static bool fourcc(const std::vector<uint8_t> &b, size_t pos, const char *cc)
+{
+    return pos + 4 <= b.size() && memcmp(&b[pos], cc, 4) == 0;
+}
+
+static std::vector<uint8_t> readAll(FILE *f)
+{
+    fflush(f);
+    fseek(f, 0, SEEK_END);
+    std::vector<uint8_t> b(ftell(f));
+    fseek(f, 0, SEEK_SET);
+    TEST_ASSERT_EQUAL_UINT32(b.size(), fread(b.data(), 1, b.size(), f));
+    return b;
+}
+
+// SOI で始まり EOI で終わる、大きさ len の JPEG らしいもの
+static void makeJpeg(std::vector<uint8_t> &jpg, size_t len, uint32_t seed)
+{
+    jpg.resize(len);
+    for (size_t i = 0; i < len; i++)
+    {
+        jpg[i] = (uint8_t)((seed + i) * 2654435761u >> 24);
+    }
+    jpg[0] = 0xFF;
+    jpg[1] = 0xD8;
+    jpg[len - 2] = 0xFF;
+    jpg[len - 1] = 0xD9;
+}
+
+struct ParsedAvi
+{
+    uint32_t usPerFrame;
+    uint32_t avihFrames;
+    uint32_t strhLength;
+    uint32_t strhScale;
+    uint32_t strhRate;
+    uint32_t width;
+    uint32_t height;
+    uint32_t moviChunks;
+    std::vector<uint32_t> sizes; // idx1 の順
+};
+
+// RIFF → LIST hdrl (avih, LIST strl (strh, strf)) → LIST movi (00dc ...) → idx1 を読み、
+// idx1 の位置が全部 SOI・EOI を持つ 00dc のチャンクを指していることを確かめる
+static ParsedAvi parseAvi(const std::vector<uint8_t> &b)
+{
+    ParsedAvi avi = {};
+    TEST_ASSERT_TRUE(fourcc(b, 0, "RIFF"));
+    TEST_ASSERT_EQUAL_UINT32(b.size() - 8, rd32(b, 4));
+    TEST_ASSERT_TRUE(fourcc(b, 8, "AVI "));
+
+    TEST_ASSERT_TRUE(fourcc(b, 12, "LIST"));
+    size_t hdrlEnd = 20 + rd32(b, 16);
+    TEST_ASSERT_TRUE(fourcc(b, 20, "hdrl"));
+    TEST_ASSERT_TRUE(fourcc(b, 24, "avih"));
+    TEST_ASSERT_EQUAL_UINT32(56, rd32(b, 28));
+    size_t avih = 32;
+    avi.usPerFrame = rd32(b, avih);
+    TEST_ASSERT_EQUAL_UINT32(0x10, rd32(b, avih + 12) & 0x10); // AVIF_HASINDEX
+    avi.avihFrames = rd32(b, avih + 16);
+    TEST_ASSERT_EQUAL_UINT32(1, rd32(b, avih + 24));
+    avi.width = rd32(b, avih + 32);
+    avi.height = rd32(b, avih + 36);
+
+    size_t strl = avih + 56;
+    TEST_ASSERT_TRUE(fourcc(b, strl, "LIST"));
+    TEST_ASSERT_EQUAL_UINT32(hdrlEnd, strl + 8 + rd32(b, strl + 4));
+    TEST_ASSERT_TRUE(fourcc(b, strl + 8, "strl"));
+    size_t strh = strl + 12;
+    TEST_ASSERT_TRUE(fourcc(b, strh, "strh"));
+    TEST_ASSERT_TRUE(fourcc(b, strh + 8, "vids"));
+    TEST_ASSERT_TRUE(fourcc(b, strh + 12, "MJPG"));
+    avi.strhScale = rd32(b, strh + 28);
+    avi.strhRate = rd32(b, strh + 32);
+    avi.strhLength = rd32(b, strh + 40);
+    size_t strf = strh + 8 + rd32(b, strh + 4);
+    TEST_ASSERT_TRUE(fourcc(b, strf, "strf"));
+    TEST_ASSERT_EQUAL_UINT32(hdrlEnd, strf + 8 + rd32(b, strf + 4));
+
+    TEST_ASSERT_TRUE(fourcc(b, hdrlEnd, "LIST"));
+    size_t movi = hdrlEnd + 8; // idx1 の位置はここ ("movi") から数える
+    size_t moviEnd = movi + rd32(b, hdrlEnd + 4);
+    TEST_ASSERT_TRUE(fourcc(b, movi, "movi"));
+    for (size_t p = movi + 4; p < moviEnd;)
+    {
+        TEST_ASSERT_TRUE(fourcc(b, p, "00dc"));
+        uint32_t len = rd32(b, p + 4);
+        p += 8 + len + (len & 1);
+        TEST_ASSERT_LESS_OR_EQUAL(moviEnd, p);
+        avi.moviChunks++;
+    }
+
+    TEST_ASSERT_TRUE(fourcc(b, moviEnd, "idx1"));
+    uint32_t idxBytes = rd32(b, moviEnd + 4);
+    TEST_ASSERT_EQUAL_UINT32(0, idxBytes % 16);
+    TEST_ASSERT_EQUAL_UINT32(b.size(), moviEnd + 8 + idxBytes);
+    for (size_t e = moviEnd + 8; e < moviEnd + 8 + idxBytes; e += 16)
+    {
+        TEST_ASSERT_TRUE(fourcc(b, e, "00dc"));
+        TEST_ASSERT_EQUAL_UINT32(0x10, rd32(b, e + 4)); // AVIIF_KEYFRAME
+        size_t chunk = movi + rd32(b, e + 8);
+        uint32_t len = rd32(b, e + 12);
+        TEST_ASSERT_TRUE(fourcc(b, chunk, "00dc"));
+        TEST_ASSERT_EQUAL_UINT32(len, rd32(b, chunk + 4));
+        TEST_ASSERT_LESS_OR_EQUAL(moviEnd, chunk + 8 + len);
+        TEST_ASSERT_EQUAL_HEX8(0xFF, b[chunk + 8]);
+        TEST_ASSERT_EQUAL_HEX8(0xD8, b[chunk + 9]);
+        TEST_ASSERT_EQUAL_HEX8(0xFF, b[chunk + 8 + len - 2]);
+        TEST_ASSERT_EQUAL_HEX8(0xD9, b[chunk + 8 + len - 1]);
+        avi.sizes.push_back(len);
+    }
+    return avi;
+}
+
+void setUp(void)
+{
+}
+
+void tearDown(void)
+{
+}
+
+void test_writes_valid_avi_with_index(void)
+{
+    FILE *f = tmpfile();
+    FileAviSink sink(f, BUFFER_BYTES);
+    AviWriter writer;
+    TEST_ASSERT_TRUE(writer.begin(&sink, 640, 480, 100, BUFFER_BYTES));
+
+    // 奇数の大きさ (詰め物が入る) と、バッファより大きい (直接書く) フレームを混ぜる
+    std::vector<uint8_t> jpg;
+    std::vector<uint32_t> sizes;
+    for (uint32_t i = 0; i < 60; i++)
+    {
+        size_t len = i % 10 == 9 ? 3 * BUFFER_BYTES + 7 : 2000 + i * 397;
+        makeJpeg(jpg, len, i);
+        TEST_ASSERT_TRUE(writer.writeFrame(jpg.data(), jpg.size(), 1000 + i * 100));
+        sizes.push_back((uint32_t)len);
+    }
+    // 録画中の書き込みは全部バッファの大きさ単位 (SD のクラスタの途中から書かない)
+    TEST_ASSERT_EQUAL_UINT32(0, sink.unalignedWrites);
+    TEST_ASSERT_EQUAL_UINT32(0, sink.seeks);
+    uint32_t writesWhileRecording = sink.writes;
+    TEST_ASSERT_TRUE(writer.close());
+    TEST_ASSERT_FALSE(writer.isOpen());
+
+    // close() は最後の半端と、ヘッダーの書き直し (4 バイトずつ) だけ
+    char msg[96];
+    snprintf(msg, sizeof(msg), "writes while recording %u, unaligned in close() %u", (unsigned)writesWhileRecording, (unsigned)sink.unalignedWrites);
+    TEST_MESSAGE(msg);
+    TEST_ASSERT_LESS_OR_EQUAL(11, sink.unalignedWrites);
+
+    std::vector<uint8_t> b = readAll(f);
+    fclose(f);
+    TEST_ASSERT_EQUAL_UINT32(writer.bytesWritten(), b.size());
+    ParsedAvi avi = parseAvi(b);
+    TEST_ASSERT_EQUAL_UINT32(60, writer.frameCount());
+    TEST_ASSERT_EQUAL_UINT32(writer.frameCount(), avi.avihFrames);
+    TEST_ASSERT_EQUAL_UINT32(writer.frameCount(), avi.strhLength);
+    TEST_ASSERT_EQUAL_UINT32(writer.frameCount(), avi.moviChunks);
+    TEST_ASSERT_EQUAL_UINT32(640, avi.width);
+    TEST_ASSERT_EQUAL_UINT32(480, avi.height);
+    // 撮った間隔 (100 ms) がフレームレートになる
+    TEST_ASSERT_EQUAL_UINT32(100000, avi.usPerFrame);
+    TEST_ASSERT_EQUAL_UINT32(100000, avi.strhScale);
+    TEST_ASSERT_EQUAL_UINT32(1000000, avi.strhRate);
+    TEST_ASSERT_EQUAL_UINT32(sizes.size(), avi.sizes.size());
+    TEST_ASSERT_EQUAL_UINT32_ARRAY(sizes.data(), avi.sizes.data(), sizes.size());
+}
+
+void test_fixed_playback_rate_and_frame_limit(void)
+{
+    // タイムラプスは再生の速さを決めておく。maxFrames を超えたフレームは書かない
+    FILE *f = tmpfile();
+    FileAviSink sink(f, 4096);
+    AviWriter writer;
+    writer.playbackUsPerFrame = 40000;
+    TEST_ASSERT_TRUE(writer.begin(&sink, 320, 240, 3, 4096));
+    std::vector<uint8_t> jpg;
+    for (uint32_t i = 0; i < 3; i++)
+    {
+        makeJpeg(jpg, 1001 + i, i);
+        TEST_ASSERT_TRUE(writer.writeFrame(jpg.data(), jpg.size(), i * 60000));
+    }
+    TEST_ASSERT_FALSE(writer.writeFrame(jpg.data(), jpg.size(), 180000));
+    TEST_ASSERT_TRUE(writer.close());
+
+    std::vector<uint8_t> b = readAll(f);
+    fclose(f);
+    ParsedAvi avi = parseAvi(b);
+    TEST_ASSERT_EQUAL_UINT32(3, avi.avihFrames);
+    TEST_ASSERT_EQUAL_UINT32(40000, avi.usPerFrame);
+}
+
+void test_write_failure_is_reported(void)
+{
+    // 書けなくなったら writeFrame() と close() が false を返す
+    FILE *f = tmpfile();
+    FileAviSink sink(f, 4096);
+    sink.failAfter = 3 * 4096;
+    AviWriter writer;
+    TEST_ASSERT_TRUE(writer.begin(&sink, 320, 240, 100, 4096));
+    std::vector<uint8_t> jpg;
+    makeJpeg(jpg, 3000, 0);
+    bool ok = true;
+    for (int i = 0; i < 20 && ok; i++)
+    {
+        ok = writer.writeFrame(jpg.data(), jpg.size(), i * 100);
+    }
+    TEST_ASSERT_FALSE(ok);
+    TEST_ASSERT_FALSE(writer.close());
+    fclose(f);
+}
+
+// 書く速さの目安 (ホストのファイル)。VGA の JPEG くらいの大きさで 10 秒分
+void test_benchmark(void)
+{
+    FILE *f = tmpfile();
+    FileAviSink sink(f, BUFFER_BYTES);
+    AviWriter writer;
+    const uint32_t frames = 250;
+    TEST_ASSERT_TRUE(writer.begin(&sink, 640, 480, frames, BUFFER_BYTES));
+    std::vector<uint8_t> jpg;
+    makeJpeg(jpg, 48 * 1024 + 123, 1);
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < frames; i++)
+    {
+        TEST_ASSERT_TRUE(writer.writeFrame(jpg.data(), jpg.size(), i * 40));
+    }
+    TEST_ASSERT_TRUE(writer.close());
+    fflush(f);
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    fclose(f);
+    char msg[96];
+    snprintf(msg, sizeof(msg), "%u frames, %u bytes: %.1f MB/s, %u writes", (unsigned)frames, (unsigned)writer.bytesWritten(),
+             (double)writer.bytesWritten() / (us ? us : 1), (unsigned)sink.writes);
+    TEST_MESSAGE(msg);
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_writes_valid_avi_with_index);
+    RUN_TEST(test_fixed_playback_rate_and_frame_limit);
+    RUN_TEST(test_write_failure_is_reported);
+    RUN_TEST(test_benchmark);
+    return UNITY_END();
+}
@@ -0,0 +1,320 @@
+// CaptureScheduler と SchedulerStats のホスト用テスト (pio test -e native -f test_capture_scheduler)
+// 取り出す順番 (優先度 → 締め切り → 来た順)、同じ key のまとめ方、いっぱいのときの追い出し方と、待ち時間の百分位を確かめる
+#include <unity.h>
+#include <CaptureScheduler.h>
+
+#include <algorithm>
+#include <random>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+struct Job
+{
+    uint32_t id;
+};
+
+typedef CaptureScheduler<Job, 8> Scheduler;
+
+// main.cpp の CLASS_*
+enum
+{
+    CLASS_COMMAND,
+    CLASS_RECORD,
+    CLASS_PERIODIC,
+};
+
+static Job job(uint32_t id)
+{
+    Job j = {id};
+    return j;
+}
+
+template <size_t N>
+static uint32_t popId(CaptureScheduler<Job, N> &s, uint32_t nowMs)
+{
+    typename CaptureScheduler<Job, N>::Entry e;
+    TEST_ASSERT_TRUE(s.pop(e, nowMs));
+    return e.job.id;
+}
+
+void setUp(void)
+{
+}
+
+void tearDown(void)
+{
+}
+
+void test_orders_by_priority_deadline_then_arrival(void)
+{
+    static Scheduler s;
+    Scheduler::Entry e;
+    TEST_ASSERT_FALSE(s.pop(e, 0));
+    TEST_ASSERT_NULL(s.peek());
+
+    s.push(job(1), CLASS_PERIODIC, 1, 5000, 0);
+    s.push(job(2), CLASS_RECORD, 2, 9000, 0);
+    s.push(job(3), CLASS_COMMAND, 3, 9000, 0);
+    s.push(job(4), CLASS_RECORD, 2, 3000, 0);
+    s.push(job(5), CLASS_PERIODIC, 1, 5000, 0); // 1 と同じ優先度・締め切りなら来た順
+    s.push(job(6), CLASS_PERIODIC, 1, 4000, 0);
+    TEST_ASSERT_EQUAL_UINT32(6, s.size());
+    TEST_ASSERT_EQUAL_UINT32(3, s.peek()->job.id);
+
+    const uint32_t expected[] = {3, 4, 2, 6, 1, 5};
+    for (uint32_t id : expected)
+    {
+        TEST_ASSERT_EQUAL_UINT32(id, popId(s, 100));
+    }
+    TEST_ASSERT_TRUE(s.empty());
+}
+
+void test_deadlines_compare_across_millis_wrap(void)
+{
+    // millis() が折り返す直前に入れた予定は、折り返した後の締め切りより先
+    static Scheduler s;
+    uint32_t now = 0xfffff000u;
+    s.push(job(1), CLASS_PERIODIC, 1, now + 0x2000, now); // 折り返した後
+    s.push(job(2), CLASS_PERIODIC, 1, now + 0x800, now);  // 折り返す前
+    TEST_ASSERT_EQUAL_UINT32(2, popId(s, now + 10));
+    TEST_ASSERT_EQUAL_UINT32(1, popId(s, now + 20));
+}
+
+// ヒープから取り出す順番が、全部を並べ替えた順番と同じになる
+void test_random_order_matches_sorted_reference(void)
+{
+    struct Ref
+    {
+        uint32_t id;
+        uint8_t priority;
+        uint32_t deadline;
+        uint32_t seq;
+    };
+    static CaptureScheduler<Job, 32> s;
+    std::mt19937 rng(12345);
+    std::vector<Ref> ref;
+    uint32_t seq = 0;
+    for (uint32_t round = 0; round < 2000; round++)
+    {
+        // 入れる方を少し多くして、いっぱいにならない程度に溜める
+        if (ref.size() < 32 && (ref.empty() || rng() % 5 < 3))
+        {
+            Ref r = {round, (uint8_t)(rng() % 4), (uint32_t)(1000 + rng() % 50), seq++};
+            TEST_ASSERT_EQUAL(Scheduler::QUEUED, s.push(job(r.id), CLASS_PERIODIC, r.priority, r.deadline, 0));
+            ref.push_back(r);
+            continue;
+        }
+        auto first = std::min_element(ref.begin(), ref.end(), [](const Ref &a, const Ref &b) {
+            if (a.priority != b.priority)
+            {
+                return a.priority > b.priority;
+            }
+            if (a.deadline != b.deadline)
+            {
+                return a.deadline < b.deadline;
+            }
+            return a.seq < b.seq;
+        });
+        TEST_ASSERT_EQUAL_UINT32(first->id, popId(s, 0));
+        ref.erase(first);
+    }
+    TEST_ASSERT_EQUAL_UINT32(ref.size(), s.size());
+}
+
+void test_same_key_coalesces_into_waiting_entry(void)
+{
+    static Scheduler s;
+    s.push(job(1), CLASS_PERIODIC, 1, 9000, 100, 7);
+    s.push(job(2), CLASS_RECORD, 2, 5000, 100);
+    // 同じ key: 優先度は高い方、締め切りは早い方になり、待ち時間は先に来た方から数える
+    TEST_ASSERT_EQUAL(Scheduler::COALESCED, s.push(job(3), CLASS_PERIODIC, 3, 8000, 400, 7));
+    TEST_ASSERT_EQUAL(Scheduler::COALESCED, s.push(job(4), CLASS_PERIODIC, 1, 9500, 500, 7));
+    TEST_ASSERT_EQUAL_UINT32(2, s.size());
+    TEST_ASSERT_TRUE(s.contains(7));
+
+    Scheduler::Entry e;
+    TEST_ASSERT_TRUE(s.pop(e, 1000));
+    TEST_ASSERT_EQUAL_UINT32(1, e.job.id); // 最初の予定の中身のまま
+    TEST_ASSERT_EQUAL_UINT8(3, e.priority);
+    TEST_ASSERT_EQUAL_UINT32(8000, e.deadlineMs);
+    TEST_ASSERT_EQUAL_UINT32(100, e.enqueuedMs);
+    TEST_ASSERT_EQUAL_UINT16(2, e.merged);
+    TEST_ASSERT_EQUAL_UINT32(900, s.stats.maxMs(CLASS_PERIODIC));
+    TEST_ASSERT_EQUAL_UINT32(2, s.stats.coalescedCount(CLASS_PERIODIC));
+    TEST_ASSERT_FALSE(s.contains(7));
+
+    // 取り出した後の同じ key は新しい予定になる
+    TEST_ASSERT_EQUAL(Scheduler::QUEUED, s.push(job(5), CLASS_PERIODIC, 1, 9000, 1000, 7));
+    TEST_ASSERT_EQUAL_UINT32(2, s.size());
+    TEST_ASSERT_EQUAL_UINT32(2, popId(s, 1000));
+    TEST_ASSERT_EQUAL_UINT32(5, popId(s, 1000));
+}
+
+void test_zero_key_never_coalesces(void)
+{
+    static Scheduler s;
+    for (uint32_t i = 0; i < 3; i++)
+    {
+        TEST_ASSERT_EQUAL(Scheduler::QUEUED, s.push(job(i), CLASS_COMMAND, 3, 1000, 0));
+    }
+    TEST_ASSERT_EQUAL_UINT32(3, s.size());
+    for (uint32_t i = 0; i < 3; i++)
+    {
+        TEST_ASSERT_EQUAL_UINT32(i, popId(s, 0));
+    }
+}
+
+void test_full_queue_evicts_lowest_priority(void)
+{
+    static Scheduler s;
+    // いっぱいにする。周期撮影 (優先度 1) のうち締め切りの一番遅いものが一番後に取り出される
+    for (uint32_t i = 0; i < Scheduler::capacity(); i++)
+    {
+        uint8_t cls = i < 4 ? CLASS_RECORD : CLASS_PERIODIC;
+        s.push(job(i), cls, i < 4 ? 2 : 1, 1000 + (i % 4) * 100, 0);
+    }
+    TEST_ASSERT_EQUAL_UINT32(Scheduler::capacity(), s.size());
+
+    // 同じ優先度で締め切りも遅いものは入れない
+    TEST_ASSERT_EQUAL(Scheduler::REJECTED, s.push(job(100), CLASS_PERIODIC, 1, 2000, 0));
+    TEST_ASSERT_EQUAL_UINT32(1, s.stats.droppedCount(CLASS_PERIODIC));
+
+    // コマンドは周期撮影の 7 番 (締め切り 1300) を追い出して入る
+    TEST_ASSERT_EQUAL(Scheduler::REPLACED, s.push(job(101), CLASS_COMMAND, 3, 5000, 0));
+    TEST_ASSERT_EQUAL_UINT32(2, s.stats.droppedCount(CLASS_PERIODIC));
+    TEST_ASSERT_EQUAL_UINT32(0, s.stats.droppedCount(CLASS_COMMAND));
+    TEST_ASSERT_EQUAL_UINT32(Scheduler::capacity(), s.size());
+
+    // 同じ優先度でも締め切りが早ければ、遅いもの (6 番) を追い出す
+    TEST_ASSERT_EQUAL(Scheduler::REPLACED, s.push(job(102), CLASS_PERIODIC, 1, 900, 0));
+
+    const uint32_t expected[] = {101, 0, 1, 2, 3, 102, 4, 5};
+    for (uint32_t id : expected)
+    {
+        TEST_ASSERT_EQUAL_UINT32(id, popId(s, 0));
+    }
+    TEST_ASSERT_TRUE(s.empty());
+}
+
+void test_full_queue_still_coalesces(void)
+{
+    // いっぱいでも、同じ key の予定があればまとめるだけで誰も追い出さない
+    static Scheduler s;
+    for (uint32_t i = 0; i < Scheduler::capacity(); i++)
+    {
+        s.push(job(i), CLASS_PERIODIC, 1, 1000, 0, i + 1);
+    }
+    TEST_ASSERT_EQUAL(Scheduler::COALESCED, s.push(job(99), CLASS_COMMAND, 3, 500, 0, 5));
+    TEST_ASSERT_EQUAL_UINT32(Scheduler::capacity(), s.size());
+    TEST_ASSERT_EQUAL_UINT32(4, popId(s, 0)); // key 5 は 4 番。優先度が上がって先頭に来る
+}
+
+void test_deadline_misses_are_counted(void)
+{
+    static Scheduler s;
+    s.push(job(1), CLASS_COMMAND, 3, 1000, 0);
+    s.push(job(2), CLASS_COMMAND, 3, 2000, 0);
+    popId(s, 1000); // ちょうどなら間に合っている
+    popId(s, 2001);
+    TEST_ASSERT_EQUAL_UINT32(2, s.stats.servedCount(CLASS_COMMAND));
+    TEST_ASSERT_EQUAL_UINT32(1, s.stats.missedCount(CLASS_COMMAND));
+    TEST_ASSERT_EQUAL_UINT32(2001, s.stats.maxMs(CLASS_COMMAND));
+}
+
+void test_percentiles_answer_bucket_upper_bound(void)
+{
+    static SchedulerStats stats;
+    TEST_ASSERT_EQUAL_UINT32(0, stats.percentileMs(CLASS_RECORD, 50)); // まだ何もない
+
+    // 1..100 ms を1回ずつ。区間は [1], [2,3], [4,7], ... [32,63], [64,127]
+    for (uint32_t ms = 1; ms <= 100; ms++)
+    {
+        stats.served(CLASS_RECORD, ms, false);
+    }
+    TEST_ASSERT_EQUAL_UINT32(1, stats.percentileMs(CLASS_RECORD, 0));
+    TEST_ASSERT_EQUAL_UINT32(15, stats.percentileMs(CLASS_RECORD, 10));
+    TEST_ASSERT_EQUAL_UINT32(63, stats.percentileMs(CLASS_RECORD, 50));
+    TEST_ASSERT_EQUAL_UINT32(100, stats.percentileMs(CLASS_RECORD, 95)); // 上端 127 でなく最大値
+    TEST_ASSERT_EQUAL_UINT32(100, stats.percentileMs(CLASS_RECORD, 100));
+
+    // 0 ms は区間 0、とても長い待ちは最後の区間に入り、最大値で答える
+    stats.served(CLASS_COMMAND, 0, false);
+    TEST_ASSERT_EQUAL_UINT32(0, stats.percentileMs(CLASS_COMMAND, 99));
+    stats.served(CLASS_COMMAND, 1000000, true);
+    TEST_ASSERT_EQUAL_UINT32(0, stats.percentileMs(CLASS_COMMAND, 50));
+    TEST_ASSERT_EQUAL_UINT32(1000000, stats.percentileMs(CLASS_COMMAND, 99));
+
+    // クラスは混ざらない
+    TEST_ASSERT_EQUAL_UINT32(0, stats.servedCount(CLASS_PERIODIC));
+    TEST_ASSERT_EQUAL_UINT32(100, stats.servedCount(CLASS_RECORD));
+}
+
+void test_percentiles_bound_exact_values(void)
+{
+    // 区間の上端で答えるので、本当の百分位以上・その 2 倍未満になる
+    static SchedulerStats stats;
+    std::mt19937 rng(777);
+    std::vector<uint32_t> samples;
+    for (int i = 0; i < 5000; i++)
+    {
+        // 待ち時間らしく、ほとんど短く、ときどき長い
+        uint32_t ms = rng() % 10 ? rng() % 200 : rng() % 20000;
+        samples.push_back(ms);
+        stats.served(CLASS_PERIODIC, ms, false);
+    }
+    std::sort(samples.begin(), samples.end());
+    const uint32_t ps[] = {50, 90, 95, 99};
+    for (uint32_t p : ps)
+    {
+        uint32_t exact = samples[(samples.size() * p + 99) / 100 - 1];
+        uint32_t reported = stats.percentileMs(CLASS_PERIODIC, p);
+        char msg[64];
+        snprintf(msg, sizeof(msg), "p%u: exact %u, reported %u", (unsigned)p, (unsigned)exact, (unsigned)reported);
+        TEST_ASSERT_GREATER_OR_EQUAL_MESSAGE(exact, reported, msg);
+        TEST_ASSERT_LESS_OR_EQUAL_MESSAGE(exact ? 2 * exact - 1 : 0, reported, msg);
+    }
+    TEST_ASSERT_EQUAL_UINT32(samples.back(), stats.maxMs(CLASS_PERIODIC));
+}
+
+void test_format_json_lists_named_classes(void)
+{
+    static SchedulerStats stats;
+    stats.setName(CLASS_COMMAND, "command");
+    stats.setName(CLASS_PERIODIC, "periodic");
+    stats.requested(CLASS_COMMAND);
+    stats.requested(CLASS_COMMAND);
+    stats.coalesced(CLASS_COMMAND);
+    stats.served(CLASS_COMMAND, 40, false);
+    stats.served(CLASS_RECORD, 5, false); // 名前がないので出さない
+
+    char out[512];
+    size_t len = stats.formatJson(out, sizeof(out));
+    TEST_ASSERT_EQUAL_UINT32(strlen(out), len);
+    TEST_ASSERT_EQUAL_STRING("{\"scheduler\":["
+                             "{\"class\":\"command\",\"requested\":2,\"served\":1,\"coalesced\":1,\"dropped\":0,\"missed\":0,\"p50_ms\":40,\"p95_ms\":40,"
+                             "\"p99_ms\":40,\"max_ms\":40},"
+                             "{\"class\":\"periodic\",\"requested\":0,\"served\":0,\"coalesced\":0,\"dropped\":0,\"missed\":0,\"p50_ms\":0,\"p95_ms\":0,"
+                             "\"p99_ms\":0,\"max_ms\":0}]}",
+                             out);
+    // 入りきらなければ 0
+    TEST_ASSERT_EQUAL_UINT32(0, stats.formatJson(out, len));
+    TEST_ASSERT_EQUAL_UINT32(len, stats.formatJson(out, len + 1));
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_orders_by_priority_deadline_then_arrival);
+    RUN_TEST(test_deadlines_compare_across_millis_wrap);
+    RUN_TEST(test_random_order_matches_sorted_reference);
+    RUN_TEST(test_same_key_coalesces_into_waiting_entry);
+    RUN_TEST(test_zero_key_never_coalesces);
+    RUN_TEST(test_full_queue_evicts_lowest_priority);
+    RUN_TEST(test_full_queue_still_coalesces);
+    RUN_TEST(test_deadline_misses_are_counted);
+    RUN_TEST(test_percentiles_answer_bucket_upper_bound);
+    RUN_TEST(test_percentiles_bound_exact_values);
+    RUN_TEST(test_format_json_lists_named_classes);
+    return UNITY_END();
+}
@@ -0,0 +1,294 @@
+// FirebaseLink のホスト用テスト (pio test -e native -f test_firebase_link)
+// 決まった応答を返す Client で、送る要求の形・応答の読み方 (Content-Length / chunked / 途中で切れたもの) と、
+// 温まったあとの問い合わせ・アップロードがヒープを使わないことを確保の回数で確かめる
+#include <unity.h>
+#include <FirebaseLink.h>
+#include <alloc_counter.h>
+
+#include <chrono>
+#include <stdio.h>
+#include <string.h>
+
+// script の応答を順に返す接続 (loop なら最後まで行ったら最初に戻る)。送られた要求は out にためる
+// dropAfter 番目の応答を返し終えたところで接続が切れる
+class FakeClient : public Client
+{
+public:
+    const char *const *script = nullptr;
+    size_t scriptLen = 0;
+    bool loop = false;
+    int dropAfter = -1;
+    int connects = 0;
+    char out[4096];
+    size_t outLen = 0;
+    size_t outTotal = 0;
+
+    void respond(const char *const *responses, size_t n, bool repeat = false)
+    {
+        script = responses;
+        scriptLen = n;
+        loop = repeat;
+        index = 0;
+        pos = 0;
+    }
+    void clearOut()
+    {
+        outLen = 0;
+        out[0] = '\0';
+    }
+
+    int connect(const char *, uint16_t) override
+    {
+        open = true;
+        connects++;
+        return 1;
+    }
+    size_t write(uint8_t c) override { return write(&c, 1); }
+    size_t write(const uint8_t *buf, size_t size) override
+    {
+        // 要求の見出しだけ残す (画像の本文は数えるだけ)
+        size_t k = size < sizeof(out) - 1 - outLen ? size : sizeof(out) - 1 - outLen;
+        memcpy(out + outLen, buf, k);
+        outLen += k;
+        out[outLen] = '\0';
+        outTotal += size;
+        return size;
+    }
+    int available() override { return open && current() ? (int)strlen(current() + pos) : 0; }
+    int read() override
+    {
+        if (!available())
+        {
+            return -1;
+        }
+        int c = (uint8_t)current()[pos++];
+        if (!current()[pos])
+        {
+            if ((int)index == dropAfter)
+            {
+                open = false;
+            }
+            index++;
+            pos = 0;
+            if (loop && index == scriptLen)
+            {
+                index = 0;
+            }
+        }
+        return c;
+    }
+    int peek() override { return available() ? (uint8_t)current()[pos] : -1; }
+    void stop() override { open = false; }
+    uint8_t connected() override { return open; }
+
+private:
+    const char *current() const { return index < scriptLen ? script[index] : nullptr; }
+
+    size_t index = 0;
+    size_t pos = 0;
+    bool open = false;
+};
+
+// Firestore はコレクションの一覧を chunked で返すことがある (チャンクの境目が JSON の途中にある)
+static const char *COLLECTION_CHUNKED = "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nTransfer-Encoding: chunked\r\n\r\n"
+                                        "1a\r\n{\"documents\":[{\"fields\":{\r\n"
+                                        "1d\r\n\"status\":{\"booleanValue\":true\r\n"
+                                        "4\r\n}}}]\r\n"
+                                        "1\r\n}\r\n"
+                                        "0\r\n\r\n";
+// mask を付けても name と時刻は返ってくる
+static const char *DOCUMENT_MASKED = "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nContent-Length: 139\r\n\r\n"
+                                     "{\"name\":\"projects/p/databases/(default)/documents/slackMessage/slackStatus\","
+                                     "\"fields\":{\"status\":{\"booleanValue\":false}},\"updateTime\":\"2024\"}";
+static const char *PATCH_OK = "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\n{}";
+static const char *UPLOAD_OK = "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nContent-Length: 25\r\n\r\n{\"name\":\"images/CPS.jpg\"}";
+static const char *NOT_FOUND = "HTTP/1.1 404 Not Found\r\nContent-Length: 9\r\n\r\nnot found";
+
+static const char *token()
+{
+    return "TOKEN123";
+}
+
+static FakeClient firestore;
+static FakeClient storage;
+// ArduinoJson v7 は変数をプール単位 (64 ビットのホストでは 256 個 x 16 バイト) で確保するので、プール1つと文字列が入る大きさにする
+static uint8_t arenaBuf[16384];
+static FirebaseLink *firebase;
+static uint8_t jpg[20000];
+
+void setUp(void)
+{
+    firestore = FakeClient();
+    storage = FakeClient();
+    firebase = new FirebaseLink(firestore, storage, arenaBuf, sizeof(arenaBuf));
+    firebase->begin("proj", "bucket.appspot.com", token);
+    firebase->timeoutMs = 50;
+}
+
+void tearDown(void)
+{
+    delete firebase;
+}
+
+void test_get_reads_chunked_body(void)
+{
+    firestore.respond(&COLLECTION_CHUNKED, 1);
+    TEST_ASSERT_TRUE(firebase->get("slackMessage"));
+    TEST_ASSERT_EQUAL_INT(200, firebase->lastStatus());
+    TEST_ASSERT_TRUE(firebase->document()["documents"][0]["fields"]["status"]["booleanValue"].as<bool>());
+    TEST_ASSERT_EQUAL_UINT32(0x1a + 0x1d + 4 + 1, firebase->lastBodyBytes());
+    TEST_ASSERT_EQUAL_INT(0, strncmp(firestore.out, "GET /v1/projects/proj/databases/(default)/documents/slackMessage HTTP/1.1\r\n", 75));
+    TEST_ASSERT_NOT_NULL(strstr(firestore.out, "Host: firestore.googleapis.com\r\nAuthorization: Bearer TOKEN123\r\n\r\n"));
+    TEST_ASSERT_TRUE(firestore.connected()); // 本文を読み切ったので張ったまま
+}
+
+void test_get_with_mask_and_filter(void)
+{
+    JsonDocument filter;
+    filter["fields"]["status"]["booleanValue"] = true;
+    firestore.respond(&DOCUMENT_MASKED, 1);
+    TEST_ASSERT_TRUE(firebase->get("slackMessage/slackStatus", "status,other", &filter));
+    TEST_ASSERT_NOT_NULL(strstr(firestore.out, "/documents/slackMessage/slackStatus?mask.fieldPaths=status&mask.fieldPaths=other HTTP/1.1\r\n"));
+    JsonVariantConst status = firebase->document()["fields"]["status"]["booleanValue"];
+    TEST_ASSERT_FALSE(status.isNull());
+    TEST_ASSERT_FALSE(status.as<bool>());
+    TEST_ASSERT_TRUE(firebase->document()["name"].isNull()); // filter にないものは残さない
+    TEST_ASSERT_EQUAL_UINT32(139, firebase->lastBodyBytes());
+}
+
+void test_patch_sends_json_body(void)
+{
+    firestore.respond(&PATCH_OK, 1);
+    TEST_ASSERT_TRUE(firebase->patchBool("slackMessage/slackStatus", "status", false));
+    TEST_ASSERT_EQUAL_INT(0, strncmp(firestore.out, "PATCH /v1/projects/proj/databases/(default)/documents/slackMessage/slackStatus HTTP/1.1\r\n", 89));
+    const char *body = "{\"fields\":{\"status\":{\"booleanValue\":false}}}";
+    char head[64];
+    snprintf(head, sizeof(head), "Content-Length: %u\r\n\r\n", (unsigned)strlen(body));
+    const char *p = strstr(firestore.out, head);
+    TEST_ASSERT_NOT_NULL(p);
+    TEST_ASSERT_EQUAL_STRING(body, p + strlen(head));
+}
+
+void test_upload_escapes_name_and_streams_data(void)
+{
+    storage.respond(&UPLOAD_OK, 1);
+    TEST_ASSERT_TRUE(firebase->upload("/images/CPS 1.jpg", jpg, sizeof(jpg), "image/jpeg"));
+    TEST_ASSERT_NOT_NULL(strstr(storage.out, "POST /v0/b/bucket.appspot.com/o?uploadType=media&name=images%2FCPS%201.jpg HTTP/1.1\r\n"));
+    TEST_ASSERT_NOT_NULL(strstr(storage.out, "Authorization: Firebase TOKEN123\r\nContent-Type: image/jpeg\r\nContent-Length: 20000\r\n\r\n"));
+    const char *body = strstr(storage.out, "\r\n\r\n") + 4;
+    TEST_ASSERT_EQUAL_UINT32(sizeof(jpg), storage.outTotal - (body - storage.out));
+    TEST_ASSERT_EQUAL_INT(0, firestore.connects); // Storage は別の接続
+}
+
+void test_error_status_reconnects(void)
+{
+    // 失敗した要求のあとは接続を張り直す。エラーの本文は読み捨てて、次の応答と混ざらない
+    static const char *responses[] = {NOT_FOUND, PATCH_OK};
+    firestore.respond(responses, 2);
+    TEST_ASSERT_FALSE(firebase->get("missing"));
+    TEST_ASSERT_EQUAL_INT(404, firebase->lastStatus());
+    TEST_ASSERT_EQUAL_UINT32(9, firebase->lastBodyBytes());
+    TEST_ASSERT_TRUE(firebase->patchBool("a/b", "status", true));
+    TEST_ASSERT_EQUAL_INT(200, firebase->lastStatus());
+    TEST_ASSERT_EQUAL_INT(2, firestore.connects);
+}
+
+void test_truncated_body_reconnects(void)
+{
+    // Content-Length より短いところで応答が尽きると、次の要求はつなぎ直す (残りを次の応答として読まない)
+    static const char *responses[] = {"HTTP/1.1 200 OK\r\nContent-Length: 50\r\n\r\n{\"fields\":", PATCH_OK};
+    firestore.respond(responses, 2);
+    firestore.dropAfter = 0;
+    TEST_ASSERT_FALSE(firebase->get("slackMessage/slackStatus"));
+    TEST_ASSERT_FALSE(firestore.connected());
+    TEST_ASSERT_TRUE(firebase->patchBool("slackMessage/slackStatus", "status", false));
+    TEST_ASSERT_EQUAL_INT(2, firestore.connects);
+    TEST_ASSERT_EQUAL_UINT32(2, firebase->reconnects());
+}
+
+void test_small_arena_fails_without_heap(void)
+{
+    static uint8_t tiny[64];
+    FirebaseLink small(firestore, storage, tiny, sizeof(tiny));
+    small.begin("proj", "bucket", token);
+    small.timeoutMs = 50;
+    firestore.respond(&COLLECTION_CHUNKED, 1);
+    TEST_ASSERT_FALSE(small.get("slackMessage"));
+    TEST_ASSERT_GREATER_THAN_UINT32(0, small.parseArena().failures());
+}
+
+// cpsMonitoring の周期 (状態の問い合わせ・画像のアップロード・状態を戻す) を 1000 回
+void test_steady_state_makes_no_heap_allocations(void)
+{
+    if (!allocCountsMalloc)
+    {
+        TEST_IGNORE_MESSAGE("malloc is only counted with glibc");
+    }
+    JsonDocument filter;
+    filter["fields"]["status"]["booleanValue"] = true;
+    static const char *fsResponses[] = {DOCUMENT_MASKED, PATCH_OK};
+    firestore.respond(fsResponses, 2, true);
+    storage.respond(&UPLOAD_OK, 1, true);
+
+    const int cycles = 1000;
+    char name[40];
+    for (int i = 0; i < cycles; i++)
+    {
+        if (i == 1)
+        {
+            allocCounterStart(); // 1 回目は接続とウォームアップ
+        }
+        firestore.clearOut();
+        storage.clearOut();
+        TEST_ASSERT_TRUE(firebase->get("slackMessage/slackStatus", "status", &filter));
+        TEST_ASSERT_FALSE(firebase->document()["fields"]["status"]["booleanValue"].isNull());
+        TEST_ASSERT_TRUE(FirebaseLink::formatName(name, sizeof(name), "/images/", 123456u + i, ".jpg"));
+        TEST_ASSERT_TRUE(firebase->upload(name, jpg, sizeof(jpg), "image/jpeg"));
+        TEST_ASSERT_TRUE(firebase->patchBool("slackMessage/slackStatus", "status", false));
+    }
+    size_t allocs = allocCounterStop();
+
+    char msg[128];
+    snprintf(msg, sizeof(msg), "%d cycles: %u allocations, %u requests, arena high water %u bytes", cycles, (unsigned)allocs, (unsigned)firebase->requests(),
+             (unsigned)firebase->parseArena().highWater());
+    TEST_MESSAGE(msg);
+    TEST_ASSERT_EQUAL_UINT32(0, allocs);
+    TEST_ASSERT_EQUAL_INT(1, firestore.connects);
+    TEST_ASSERT_EQUAL_INT(1, storage.connects);
+    TEST_ASSERT_EQUAL_UINT32(3 * cycles, firebase->requests());
+    TEST_ASSERT_EQUAL_UINT32(0, firebase->parseArena().failures());
+}
+
+// 問い合わせ 1 回 (要求を組み立て、応答を読み、パースする) の時間の目安 (ホスト)
+void test_benchmark(void)
+{
+    JsonDocument filter;
+    filter["fields"]["status"]["booleanValue"] = true;
+    firestore.respond(&DOCUMENT_MASKED, 1, true);
+    const int runs = 10000;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < runs; i++)
+    {
+        firestore.clearOut();
+        firebase->get("slackMessage/slackStatus", "status", &filter);
+    }
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    char msg[64];
+    snprintf(msg, sizeof(msg), "masked get: %.2f us", (double)us / runs);
+    TEST_MESSAGE(msg);
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_get_reads_chunked_body);
+    RUN_TEST(test_get_with_mask_and_filter);
+    RUN_TEST(test_patch_sends_json_body);
+    RUN_TEST(test_upload_escapes_name_and_streams_data);
+    RUN_TEST(test_error_status_reconnects);
+    RUN_TEST(test_truncated_body_reconnects);
+    RUN_TEST(test_small_arena_fails_without_heap);
+    RUN_TEST(test_steady_state_makes_no_heap_allocations);
+    RUN_TEST(test_benchmark);
+    return UNITY_END();
+}
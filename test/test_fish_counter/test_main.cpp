@@ -0,0 +1,198 @@
+// FishCounter のホスト用テスト (pio test -e native -f test_fish_counter)
+// 固定の乱数で作る合成フレーム (1/8 に縮小した VGA = 80x60 の背景に暗い楕円の魚) を使う
+#include <unity.h>
+#include <FishCounter.h>
+
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const uint16_t W = 80;
+static const uint16_t H = 60;
+
+static uint8_t frame[256 * 192];
+static uint32_t rng;
+
+static uint32_t nextRandom()
+{
+    rng = rng * 1664525u + 1013904223u;
+    return rng >> 16;
+}
+
+// 横方向に明るさが変わる水槽の背景と、±noise のセンサーノイズ
+static void drawBackground(uint8_t *img, uint16_t w, uint16_t h, int noise, int offset = 0)
+{
+    for (uint16_t y = 0; y < h; y++)
+    {
+        for (uint16_t x = 0; x < w; x++)
+        {
+            int v = 120 + x * 40 / w + offset;
+            if (noise)
+            {
+                v += (int)(nextRandom() % (2 * noise + 1)) - noise;
+            }
+            img[(size_t)y * w + x] = (uint8_t)(v < 0 ? 0 : v > 255 ? 255 : v);
+        }
+    }
+}
+
+// (cx, cy) を中心に半径 rx, ry の楕円を value で塗る。塗った画素数を返す
+static uint32_t drawFish(uint8_t *img, uint16_t w, uint16_t h, int cx, int cy, int rx, int ry, uint8_t value = 40)
+{
+    uint32_t area = 0;
+    for (int y = cy - ry; y <= cy + ry; y++)
+    {
+        for (int x = cx - rx; x <= cx + rx; x++)
+        {
+            if (x < 0 || y < 0 || x >= w || y >= h)
+            {
+                continue;
+            }
+            int dx = x - cx, dy = y - cy;
+            if (dx * dx * ry * ry + dy * dy * rx * rx <= rx * rx * ry * ry)
+            {
+                img[(size_t)y * w + x] = value;
+                area++;
+            }
+        }
+    }
+    return area;
+}
+
+static void fillRect(uint8_t *img, uint16_t w, int x0, int y0, int x1, int y1, uint8_t value)
+{
+    for (int y = y0; y <= y1; y++)
+    {
+        memset(img + (size_t)y * w + x0, value, x1 - x0 + 1);
+    }
+}
+
+static FishCounter counter;
+
+void setUp(void)
+{
+    rng = 12345;
+    TEST_ASSERT_TRUE(counter.begin(W, H));
+    drawBackground(frame, W, H, 4);
+    TEST_ASSERT_EQUAL_INT(0, counter.process(frame)); // 最初のフレームは背景になる
+}
+
+void tearDown(void)
+{
+    counter.end();
+}
+
+void test_empty_scene_counts_zero(void)
+{
+    for (int i = 0; i < 10; i++)
+    {
+        drawBackground(frame, W, H, 4);
+        TEST_ASSERT_EQUAL_INT(0, counter.process(frame));
+    }
+}
+
+void test_counts_separate_fish_with_centroids(void)
+{
+    drawBackground(frame, W, H, 4);
+    drawFish(frame, W, H, 15, 15, 5, 3);
+    drawFish(frame, W, H, 50, 20, 6, 3);
+    uint32_t area = drawFish(frame, W, H, 40, 45, 4, 4);
+    TEST_ASSERT_EQUAL_INT(3, counter.process(frame));
+
+    // 魚の順はラベルの順 (上から) なので、3匹目は一番下の魚
+    const FishBlob &b = counter.blob(2);
+    TEST_ASSERT_INT_WITHIN(1, 40, b.cx);
+    TEST_ASSERT_INT_WITHIN(1, 45, b.cy);
+    TEST_ASSERT_UINT32_WITHIN(area / 4, area, b.area);
+    TEST_ASSERT_TRUE(b.minX >= 35 && b.maxX <= 45 && b.minY >= 40 && b.maxY <= 50);
+}
+
+void test_isolated_pixels_are_removed_by_opening(void)
+{
+    drawBackground(frame, W, H, 4);
+    for (int i = 0; i < 40; i++)
+    {
+        frame[(nextRandom() % H) * W + nextRandom() % W] = 0;
+    }
+    TEST_ASSERT_EQUAL_INT(0, counter.process(frame));
+}
+
+void test_u_shape_is_one_blob(void)
+{
+    // 2本の腕は下の行で初めてつながる。ラベルの統合で1匹になる
+    drawBackground(frame, W, H, 4);
+    fillRect(frame, W, 20, 10, 24, 35, 30);
+    fillRect(frame, W, 40, 10, 44, 35, 30);
+    fillRect(frame, W, 20, 31, 44, 35, 30);
+    TEST_ASSERT_EQUAL_INT(1, counter.process(frame));
+    TEST_ASSERT_EQUAL_UINT16(20, counter.blob(0).minX);
+    TEST_ASSERT_EQUAL_UINT16(44, counter.blob(0).maxX);
+}
+
+void test_lighting_change_is_not_counted(void)
+{
+    // 照明が変わると画面全体が前景になるが、maxArea を超えるので魚として数えない
+    drawBackground(frame, W, H, 4, 60);
+    TEST_ASSERT_EQUAL_INT(0, counter.process(frame));
+}
+
+void test_background_follows_slow_drift(void)
+{
+    // 2フレームに 1 ずつ明るくなっても、背景の遅れ (変化の速さ x 2^learnShift) がしきい値に届かない
+    for (int i = 1; i <= 80; i++)
+    {
+        drawBackground(frame, W, H, 2, i / 2);
+        TEST_ASSERT_EQUAL_INT(0, counter.process(frame));
+    }
+}
+
+void test_moving_fish_is_tracked_across_frames(void)
+{
+    for (int i = 0; i < 20; i++)
+    {
+        drawBackground(frame, W, H, 4);
+        drawFish(frame, W, H, 10 + i * 3, 30, 5, 3);
+        TEST_ASSERT_EQUAL_INT(1, counter.process(frame));
+        TEST_ASSERT_INT_WITHIN(1, 10 + i * 3, counter.blob(0).cx);
+    }
+}
+
+// 処理時間の目安 (ホスト)。80x60 と 256x192 (QXGA の 1/8) で測る
+void test_benchmark(void)
+{
+    static const uint16_t sizes[][2] = {{80, 60}, {256, 192}};
+    for (size_t s = 0; s < 2; s++)
+    {
+        uint16_t w = sizes[s][0], h = sizes[s][1];
+        FishCounter fc;
+        TEST_ASSERT_TRUE(fc.begin(w, h));
+        drawBackground(frame, w, h, 4);
+        fc.process(frame);
+        const int frames = 200;
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < frames; i++)
+        {
+            drawFish(frame, w, h, (i * 7) % w, h / 2, 5, 3);
+            fc.process(frame);
+        }
+        auto us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+        char msg[64];
+        snprintf(msg, sizeof(msg), "%ux%u: %.1f us/frame", w, h, (double)us / frames);
+        TEST_MESSAGE(msg);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_empty_scene_counts_zero);
+    RUN_TEST(test_counts_separate_fish_with_centroids);
+    RUN_TEST(test_isolated_pixels_are_removed_by_opening);
+    RUN_TEST(test_u_shape_is_one_blob);
+    RUN_TEST(test_lighting_change_is_not_counted);
+    RUN_TEST(test_background_follows_slow_drift);
+    RUN_TEST(test_moving_fish_is_tracked_across_frames);
+    RUN_TEST(test_benchmark);
+    return UNITY_END();
+}
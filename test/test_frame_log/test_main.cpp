@@ -0,0 +1,289 @@
+// FrameLog のホスト用テスト (pio test -e native -f test_frame_log)
+// 一時ディレクトリの上の fs::FS の代役 (test/native/FS.h) でセグメントを切り替えながら書き、
+// 書きかけの最後のレコードが起動時に捨てられること、時刻での検索が閉じたセグメントと書いているセグメントの両方で効くことを確かめる
+#include <unity.h>
+#include <FrameLog.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+static const char *LOG_DIR = "/framelog";
+static const uint64_t BASE_MS = 1700000000000ull; // 時刻は UNIX 時間の ms
+static const uint32_t FRAME_INTERVAL = 1000;
+
+static std::string root;
+static fs::FS *disk;
+static FrameLog *frameLog;
+
+// i 番目のフレーム。大きさを変えて、4 バイト境界への詰め物が入るものも混ぜる
+static std::vector<uint8_t> frame(uint32_t i)
+{
+    std::vector<uint8_t> jpg(300 + (i * 37) % 500);
+    for (size_t k = 0; k < jpg.size(); k++)
+    {
+        jpg[k] = (uint8_t)(i * 31 + k);
+    }
+    jpg[0] = 0xFF;
+    jpg[1] = 0xD8;
+    return jpg;
+}
+
+static uint64_t frameMs(uint32_t i)
+{
+    return BASE_MS + (uint64_t)i * FRAME_INTERVAL;
+}
+
+static void startLog()
+{
+    frameLog = new FrameLog();
+    frameLog->segmentBytes = 4096; // 1つのセグメントに 6〜10 フレーム
+    frameLog->indexIntervalMs = 2000;
+    TEST_ASSERT_TRUE(frameLog->begin(*disk, LOG_DIR));
+}
+
+static void appendFrames(uint32_t from, uint32_t to)
+{
+    for (uint32_t i = from; i < to; i++)
+    {
+        std::vector<uint8_t> jpg = frame(i);
+        TEST_ASSERT_TRUE(frameLog->append(jpg.data(), jpg.size(), frameMs(i)));
+    }
+}
+
+// FrameLog と同じ名前 ("<dir>/<n>.<ext>")
+static std::string segmentName(uint32_t number, const char *ext)
+{
+    char name[48];
+    snprintf(name, sizeof(name), "%s/%08lu.%s", LOG_DIR, (unsigned long)number, ext);
+    return name;
+}
+
+static std::string segmentHostPath(uint32_t number)
+{
+    return disk->hostPath() + segmentName(number, "seg");
+}
+
+// 読んだ JPEG が i 番目のフレームと同じか
+static void checkRecord(const FrameLogRecord &rec, uint32_t i)
+{
+    std::vector<uint8_t> jpg = frame(i);
+    TEST_ASSERT_EQUAL_UINT64(frameMs(i), rec.timestampMs);
+    TEST_ASSERT_EQUAL_UINT32(jpg.size(), rec.length);
+    TEST_ASSERT_TRUE(frameLog->verify(rec));
+    File f = frameLog->open(rec);
+    TEST_ASSERT_TRUE((bool)f);
+    std::vector<uint8_t> got(rec.length);
+    TEST_ASSERT_EQUAL_UINT32(rec.length, f.read(got.data(), got.size()));
+    TEST_ASSERT_EQUAL_MEMORY(jpg.data(), got.data(), jpg.size());
+}
+
+static void checkAll(uint32_t first, uint32_t count)
+{
+    std::vector<FrameLogRecord> recs(count + 8);
+    size_t n = frameLog->list(0, UINT64_MAX, recs.data(), recs.size());
+    TEST_ASSERT_EQUAL_UINT32(count, n);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        checkRecord(recs[i], first + i);
+    }
+}
+
+void setUp(void)
+{
+    char tmpl[] = "/tmp/framelog_XXXXXX";
+    TEST_ASSERT_NOT_NULL(mkdtemp(tmpl));
+    root = tmpl;
+    disk = new fs::FS(root);
+    frameLog = nullptr;
+}
+
+void tearDown(void)
+{
+    delete frameLog;
+    delete disk;
+    std::string cmd = "rm -rf " + root;
+    TEST_ASSERT_EQUAL_INT(0, system(cmd.c_str()));
+}
+
+void test_rolls_segments_and_lists_everything(void)
+{
+    startLog();
+    appendFrames(0, 60);
+    TEST_ASSERT_GREATER_THAN(5, frameLog->segmentCount());
+    TEST_ASSERT_EQUAL_UINT64(frameMs(0), frameLog->firstTimestamp());
+    TEST_ASSERT_EQUAL_UINT64(frameMs(59), frameLog->lastTimestamp());
+    checkAll(0, 60);
+
+    // 範囲の途中から途中まで (閉じたセグメントをまたいで書いているセグメントまで)
+    FrameLogRecord recs[64];
+    size_t n = frameLog->list(frameMs(13), frameMs(55) - 1, recs, 64);
+    TEST_ASSERT_EQUAL_UINT32(42, n);
+    TEST_ASSERT_EQUAL_UINT64(frameMs(13), recs[0].timestampMs);
+    TEST_ASSERT_EQUAL_UINT64(frameMs(54), recs[n - 1].timestampMs);
+    // max で打ち切る
+    TEST_ASSERT_EQUAL_UINT32(5, frameLog->list(0, UINT64_MAX, recs, 5));
+    TEST_ASSERT_EQUAL_UINT64(frameMs(4), recs[4].timestampMs);
+}
+
+void test_find_at_uses_closed_and_tail_segments(void)
+{
+    startLog();
+    appendFrames(0, 60);
+    FrameLogRecord rec;
+    for (uint32_t i = 0; i < 60; i++)
+    {
+        // ちょうどの時刻と、前のフレームとの間の時刻
+        TEST_ASSERT_TRUE(frameLog->findAt(frameMs(i), &rec));
+        checkRecord(rec, i);
+        TEST_ASSERT_TRUE(frameLog->findAt(frameMs(i) - FRAME_INTERVAL / 2, &rec));
+        TEST_ASSERT_EQUAL_UINT64(frameMs(i), rec.timestampMs);
+    }
+    TEST_ASSERT_TRUE(frameLog->findAt(0, &rec));
+    TEST_ASSERT_EQUAL_UINT64(frameMs(0), rec.timestampMs);
+    TEST_ASSERT_FALSE(frameLog->findAt(frameMs(59) + 1, &rec));
+}
+
+void test_reopen_keeps_closed_segment_index(void)
+{
+    // 起動し直しても閉じたセグメントは .idx の見出しだけで時刻がわかる
+    startLog();
+    appendFrames(0, 40);
+    size_t segments = frameLog->segmentCount();
+    delete frameLog;
+
+    startLog();
+    TEST_ASSERT_EQUAL_UINT32(segments, frameLog->segmentCount());
+    TEST_ASSERT_EQUAL_UINT32(0, frameLog->recoveredBytes());
+    TEST_ASSERT_EQUAL_UINT64(frameMs(0), frameLog->firstTimestamp());
+    TEST_ASSERT_EQUAL_UINT64(frameMs(39), frameLog->lastTimestamp());
+    appendFrames(40, 50);
+    checkAll(0, 50);
+}
+
+void test_torn_tail_record_is_discarded(void)
+{
+    startLog();
+    appendFrames(0, 30);
+    FrameLogRecord last;
+    TEST_ASSERT_TRUE(frameLog->findAt(frameMs(29), &last));
+    delete frameLog;
+
+    // 電源が落ちて、次のレコードの見出しと JPEG の途中までだけが書けていた
+    std::vector<uint8_t> jpg = frame(30);
+    uint8_t h[20] = {'F', 'R', 'E', 'C'};
+    uint64_t ts = frameMs(30);
+    uint32_t len = (uint32_t)jpg.size();
+    uint32_t crc = FrameLog::crc32(jpg.data(), jpg.size());
+    for (int k = 0; k < 8; k++)
+    {
+        h[4 + k] = (uint8_t)(ts >> (8 * k));
+    }
+    for (int k = 0; k < 4; k++)
+    {
+        h[12 + k] = (uint8_t)(len >> (8 * k));
+        h[16 + k] = (uint8_t)(crc >> (8 * k));
+    }
+    FILE *f = fopen(segmentHostPath(last.segment).c_str(), "ab");
+    TEST_ASSERT_NOT_NULL(f);
+    fwrite(h, 1, sizeof(h), f);
+    fwrite(jpg.data(), 1, jpg.size() / 2, f);
+    fclose(f);
+    uint32_t torn = sizeof(h) + (uint32_t)jpg.size() / 2;
+
+    startLog();
+    TEST_ASSERT_EQUAL_UINT32(torn, frameLog->recoveredBytes());
+    TEST_ASSERT_EQUAL_UINT64(frameMs(29), frameLog->lastTimestamp());
+    checkAll(0, 30);
+
+    // 書きかけの所から書き続ける (後ろに残ったごみは上書きされる)
+    appendFrames(30, 45);
+    checkAll(0, 45);
+    delete frameLog;
+    startLog();
+    TEST_ASSERT_EQUAL_UINT32(0, frameLog->recoveredBytes());
+    checkAll(0, 45);
+}
+
+void test_corrupt_tail_record_is_discarded(void)
+{
+    // 見出しは全部書けていても、中身が CRC と合わないレコードから後ろは捨てる
+    startLog();
+    appendFrames(0, 20);
+    FrameLogRecord last;
+    TEST_ASSERT_TRUE(frameLog->findAt(frameMs(19), &last));
+    delete frameLog;
+
+    FILE *f = fopen(segmentHostPath(last.segment).c_str(), "r+b");
+    TEST_ASSERT_NOT_NULL(f);
+    fseek(f, last.offset + 10, SEEK_SET);
+    fputc(0x55 ^ frame(19)[10], f);
+    fclose(f);
+
+    startLog();
+    TEST_ASSERT_EQUAL_UINT32(20 + ((last.length + 3) & ~3u), frameLog->recoveredBytes());
+    TEST_ASSERT_EQUAL_UINT64(frameMs(18), frameLog->lastTimestamp());
+    checkAll(0, 19);
+}
+
+void test_missing_index_falls_back_to_record_headers(void)
+{
+    startLog();
+    appendFrames(0, 40);
+    delete frameLog;
+    // 閉じたセグメントの索引を消しても、見出しをたどって検索できる
+    TEST_ASSERT_TRUE(disk->remove(segmentName(1, "idx").c_str()));
+
+    startLog();
+    FrameLogRecord rec;
+    for (uint32_t i = 0; i < 40; i++)
+    {
+        TEST_ASSERT_TRUE(frameLog->findAt(frameMs(i), &rec));
+        checkRecord(rec, i);
+    }
+}
+
+void test_oldest_segments_are_dropped(void)
+{
+    startLog();
+    frameLog->maxSegments = 3;
+    appendFrames(0, 60);
+    TEST_ASSERT_EQUAL_UINT32(3, frameLog->segmentCount());
+    uint64_t first = frameLog->firstTimestamp();
+    TEST_ASSERT_GREATER_THAN(frameMs(30), first);
+
+    FrameLogRecord rec;
+    TEST_ASSERT_TRUE(frameLog->findAt(0, &rec));
+    TEST_ASSERT_EQUAL_UINT64(first, rec.timestampMs);
+    uint32_t firstFrame = (uint32_t)((first - BASE_MS) / FRAME_INTERVAL);
+    checkAll(firstFrame, 60 - firstFrame);
+    TEST_ASSERT_FALSE(disk->exists(segmentName(0, "seg").c_str()));
+    TEST_ASSERT_FALSE(disk->exists(segmentName(0, "idx").c_str()));
+}
+
+void test_zero_max_segments_keeps_the_tail(void)
+{
+    // 0 を設定しても止まらず、書いているセグメントだけを残す
+    startLog();
+    frameLog->maxSegments = 0;
+    appendFrames(0, 30);
+    TEST_ASSERT_EQUAL_UINT32(1, frameLog->segmentCount());
+    FrameLogRecord rec;
+    TEST_ASSERT_TRUE(frameLog->findAt(frameMs(29), &rec));
+    checkRecord(rec, 29);
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_rolls_segments_and_lists_everything);
+    RUN_TEST(test_find_at_uses_closed_and_tail_segments);
+    RUN_TEST(test_reopen_keeps_closed_segment_index);
+    RUN_TEST(test_torn_tail_record_is_discarded);
+    RUN_TEST(test_corrupt_tail_record_is_discarded);
+    RUN_TEST(test_missing_index_falls_back_to_record_headers);
+    RUN_TEST(test_oldest_segments_are_dropped);
+    RUN_TEST(test_zero_max_segments_keeps_the_tail);
+    return UNITY_END();
+}
@@ -0,0 +1,151 @@
+#pragma once
+
+// JpegDc のテスト用の JPEG と、その 8x8 ブロックごとの平均
+// libjpeg で作った合成画像 (横のグラデーションの水槽に暗い魚と明るい石) を libjpeg で全部デコードし、
+// 出力の YCbCr をブロックごとに平均した。欠けたブロックは端の画素を繰り返して埋め (エンコーダと同じ)、
+// 色差は色差のブロック (4:2:2 では輝度のブロック2つ分) で平均する
+#include <stdint.h>
+
+// 64x48 YCbCr 4:2:2, restart interval 2, 1164 bytes
+static const uint16_t color_width = 64, color_height = 48;
+static const uint8_t color_jpg[] = {
+    0xff, 0xd8, 0xff, 0xe0, 0x00, 0x10, 0x4a, 0x46, 0x49, 0x46, 0x00, 0x01, 0x01, 0x00, 0x00, 0x01,
+    0x00, 0x01, 0x00, 0x00, 0xff, 0xdb, 0x00, 0x43, 0x00, 0x05, 0x03, 0x04, 0x04, 0x04, 0x03, 0x05,
+    0x04, 0x04, 0x04, 0x05, 0x05, 0x05, 0x06, 0x07, 0x0c, 0x08, 0x07, 0x07, 0x07, 0x07, 0x0f, 0x0b,
+    0x0b, 0x09, 0x0c, 0x11, 0x0f, 0x12, 0x12, 0x11, 0x0f, 0x11, 0x11, 0x13, 0x16, 0x1c, 0x17, 0x13,
+    0x14, 0x1a, 0x15, 0x11, 0x11, 0x18, 0x21, 0x18, 0x1a, 0x1d, 0x1d, 0x1f, 0x1f, 0x1f, 0x13, 0x17,
+    0x22, 0x24, 0x22, 0x1e, 0x24, 0x1c, 0x1e, 0x1f, 0x1e, 0xff, 0xdb, 0x00, 0x43, 0x01, 0x05, 0x05,
+    0x05, 0x07, 0x06, 0x07, 0x0e, 0x08, 0x08, 0x0e, 0x1e, 0x14, 0x11, 0x14, 0x1e, 0x1e, 0x1e, 0x1e,
+    0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e,
+    0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e,
+    0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0xff, 0xc0,
+    0x00, 0x11, 0x08, 0x00, 0x30, 0x00, 0x40, 0x03, 0x01, 0x21, 0x00, 0x02, 0x11, 0x01, 0x03, 0x11,
+    0x01, 0xff, 0xc4, 0x00, 0x1f, 0x00, 0x00, 0x01, 0x05, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09,
+    0x0a, 0x0b, 0xff, 0xc4, 0x00, 0xb5, 0x10, 0x00, 0x02, 0x01, 0x03, 0x03, 0x02, 0x04, 0x03, 0x05,
+    0x05, 0x04, 0x04, 0x00, 0x00, 0x01, 0x7d, 0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21,
+    0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07, 0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08, 0x23,
+    0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0, 0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16, 0x17,
+    0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28, 0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a,
+    0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a,
+    0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a,
+    0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99,
+    0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7,
+    0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5,
+    0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf1,
+    0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa, 0xff, 0xc4, 0x00, 0x1f, 0x01, 0x00, 0x03,
+    0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01,
+    0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0xff, 0xc4, 0x00, 0xb5, 0x11, 0x00,
+    0x02, 0x01, 0x02, 0x04, 0x04, 0x03, 0x04, 0x07, 0x05, 0x04, 0x04, 0x00, 0x01, 0x02, 0x77, 0x00,
+    0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71, 0x13,
+    0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91, 0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0, 0x15,
+    0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26, 0x27,
+    0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+    0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+    0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88,
+    0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6,
+    0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4,
+    0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe2,
+    0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9,
+    0xfa, 0xff, 0xdd, 0x00, 0x04, 0x00, 0x02, 0xff, 0xda, 0x00, 0x0c, 0x03, 0x01, 0x00, 0x02, 0x11,
+    0x03, 0x11, 0x00, 0x3f, 0x00, 0xe2, 0x63, 0x8e, 0xac, 0x47, 0x1d, 0x7d, 0x9d, 0x79, 0x1e, 0x56,
+    0x16, 0x45, 0x88, 0xe3, 0xab, 0x11, 0xc7, 0x5e, 0x3d, 0x79, 0x1f, 0x45, 0x85, 0x91, 0xff, 0xd0,
+    0xc9, 0x8e, 0x3a, 0xb1, 0x1c, 0x75, 0x75, 0xe4, 0x7d, 0x7e, 0x16, 0x45, 0x88, 0xe3, 0xab, 0x31,
+    0xc7, 0x5e, 0x45, 0x79, 0x1f, 0x47, 0x85, 0x91, 0xff, 0xd1, 0xe5, 0x23, 0x8e, 0xac, 0x47, 0x1d,
+    0x7d, 0x65, 0x79, 0x1e, 0x16, 0x16, 0x45, 0x88, 0xe3, 0xab, 0x11, 0xc7, 0x5e, 0x3d, 0x79, 0x1f,
+    0x45, 0x85, 0x91, 0xff, 0xd2, 0xa9, 0x1c, 0x75, 0x66, 0x38, 0xea, 0x2b, 0xc8, 0xfa, 0x7c, 0x2c,
+    0x8b, 0x11, 0xc7, 0x56, 0x23, 0x8e, 0xbc, 0x7a, 0xf2, 0x3e, 0x8b, 0x0b, 0x23, 0xff, 0xd3, 0xe7,
+    0xe3, 0x8e, 0x9d, 0x74, 0xb7, 0x09, 0x65, 0x3b, 0xda, 0x46, 0xb2, 0x5c, 0x08, 0xd8, 0xc4, 0x8d,
+    0xd1, 0x9f, 0x1c, 0x03, 0xc8, 0xef, 0x8e, 0xf5, 0xf4, 0xb5, 0xe4, 0xec, 0xec, 0x7c, 0xde, 0x16,
+    0x5b, 0x1e, 0x76, 0x35, 0x6f, 0x88, 0x3d, 0xa0, 0xd4, 0x7f, 0xf0, 0x5c, 0x3f, 0xf8, 0x8a, 0xf4,
+    0x9f, 0x0b, 0x36, 0xa3, 0x3e, 0x85, 0x69, 0x2e, 0xad, 0x17, 0x95, 0x78, 0xc9, 0x99, 0x17, 0x6e,
+    0xd3, 0xd4, 0xe0, 0x91, 0xd8, 0x91, 0x82, 0x47, 0x62, 0x7a, 0x0e, 0x95, 0xe0, 0xb9, 0xd4, 0x7f,
+    0x19, 0xf4, 0x58, 0x79, 0x59, 0xe8, 0x7f, 0xff, 0xd4, 0x58, 0xe3, 0xab, 0x11, 0xc7, 0x5c, 0xb5,
+    0xe4, 0x7b, 0xf8, 0x59, 0x16, 0x23, 0x8e, 0xac, 0x47, 0x1d, 0x79, 0x15, 0xe4, 0x7d, 0x16, 0x16,
+    0x47, 0xff, 0xd5, 0xcb, 0x8e, 0x3a, 0xb1, 0x1c, 0x75, 0xef, 0xd7, 0x91, 0xf2, 0x58, 0x59, 0x16,
+    0x23, 0x8e, 0xac, 0x47, 0x1d, 0x79, 0x15, 0xe4, 0x7d, 0x16, 0x16, 0x47, 0xff, 0xd6, 0xd0, 0xb3,
+    0xb5, 0x92, 0xe2, 0xe2, 0x3b, 0x78, 0x57, 0x74, 0x92, 0x38, 0x44, 0x19, 0xc6, 0x49, 0x38, 0x03,
+    0x9a, 0xed, 0xed, 0x7e, 0x1f, 0x4b, 0xe4, 0xa9, 0xb8, 0xd4, 0xe3, 0x49, 0x3b, 0xaa, 0x42, 0x59,
+    0x47, 0xe2, 0x48, 0xfe, 0x55, 0xc1, 0x55, 0xdd, 0x9e, 0x9d, 0x2a, 0xdc, 0x89, 0x33, 0x23, 0x5d,
+    0xd0, 0x6e, 0x74, 0x6b, 0x84, 0x49, 0x9d, 0x24, 0x8e, 0x4c, 0x98, 0xdd, 0x7b, 0x80, 0x7b, 0x8e,
+    0xc7, 0x91, 0xf9, 0xf5, 0x35, 0x4e, 0x38, 0xeb, 0xc8, 0xc4, 0x68, 0xec, 0x7d, 0x26, 0x06, 0xaa,
+    0x9c, 0x54, 0x91, 0xff, 0xd7, 0xad, 0x1c, 0x75, 0x62, 0x38, 0xeb, 0xd9, 0xaf, 0x23, 0xe2, 0xb0,
+    0xb2, 0x2c, 0x47, 0x1d, 0x58, 0x8e, 0x3a, 0xf2, 0x2b, 0xc8, 0xfa, 0x2c, 0x2c, 0x8f, 0xff, 0xd0,
+    0xec, 0x3c, 0x0b, 0xb2, 0x2f, 0x14, 0x59, 0x33, 0xb2, 0xa8, 0xcb, 0x00, 0x49, 0xc7, 0x25, 0x18,
+    0x01, 0xf8, 0x93, 0x5e, 0xab, 0x5e, 0x6c, 0x9d, 0xd9, 0xd3, 0x07, 0x74, 0x73, 0x7f, 0x10, 0x0a,
+    0x9d, 0x2a, 0x08, 0xcb, 0x0d, 0xc6, 0x70, 0x42, 0xe7, 0x92, 0x02, 0xb6, 0x4f, 0xea, 0x3f, 0x3a,
+    0xe3, 0xa3, 0x8e, 0xbc, 0x9c, 0x6c, 0xbd, 0xf3, 0xe8, 0x32, 0xc7, 0x68, 0x1f, 0xff, 0xd1, 0x74,
+    0x71, 0xd5, 0x88, 0xe3, 0xaf, 0x4e, 0xbc, 0x8f, 0x82, 0xc2, 0xc8, 0xb1, 0x1c, 0x75, 0x62, 0x38,
+    0xeb, 0xc7, 0xaf, 0x23, 0xe8, 0xb0, 0xb2, 0x3f, 0xff, 0xd2, 0xe9, 0x20, 0x0f, 0x1b, 0xac, 0x91,
+    0xb3, 0x2b, 0xa9, 0x05, 0x59, 0x4e, 0x08, 0x23, 0xb8, 0xae, 0x9e, 0xdb, 0xc5, 0x5a, 0xb2, 0x44,
+    0x11, 0xd6, 0xde, 0x56, 0x1f, 0xc6, 0xe8, 0x41, 0x3f, 0x91, 0x03, 0xf4, 0xaf, 0x16, 0xa5, 0x57,
+    0x17, 0xa1, 0xb6, 0x1d, 0xa6, 0xac, 0x52, 0xbf, 0xbd, 0xbb, 0xd4, 0x66, 0x12, 0xdd, 0x49, 0xbb,
+    0x6e, 0x76, 0xa8, 0x18, 0x55, 0x04, 0xf4, 0x03, 0xfc, 0x9e, 0x05, 0x32, 0x38, 0xeb, 0xc6, 0xc4,
+    0x4d, 0xc9, 0xb6, 0xcf, 0xa2, 0xc2, 0x35, 0x14, 0x92, 0x3f, 0xff, 0xd9,
+};
+// 8x8 ブロックごとの平均 (y)
+static const uint8_t color_y[] = {
+     94,  99, 104, 109, 114, 119, 124, 130,
+    101, 106, 111, 116, 121, 127, 132, 137,
+    108, 109,  67, 112, 129, 134, 139, 144,
+    116, 121, 126, 131, 138, 172, 158, 151,
+    122, 127, 132, 137, 158, 211, 189, 158,
+    129, 134, 139, 144, 151, 175, 167, 165,
+};
+// 8x8 ブロックごとの平均 (cb)
+static const uint8_t color_cb[] = {
+    160, 160, 145, 145, 130, 130, 116, 116,
+    155, 155, 141, 141, 126, 126, 111, 111,
+    151, 151, 132, 132, 122, 122, 107, 107,
+    147, 147, 133, 133, 119, 119, 104, 104,
+    144, 144, 129, 129, 117, 117, 103, 103,
+    140, 140, 125, 125, 112, 112,  96,  96,
+};
+// 8x8 ブロックごとの平均 (cr)
+static const uint8_t color_cr[] = {
+    115, 115, 136, 136, 157, 157, 179, 179,
+    110, 110, 131, 131, 152, 152, 174, 174,
+    106, 106, 127, 127, 147, 147, 169, 169,
+    100, 100, 121, 121, 140, 140, 162, 162,
+     95,  95, 116, 116, 134, 134, 154, 154,
+     90,  90, 111, 111, 132, 132, 153, 153,
+};
+// 40x20 grayscale, 457 bytes
+static const uint16_t gray_width = 40, gray_height = 20;
+static const uint8_t gray_jpg[] = {
+    0xff, 0xd8, 0xff, 0xe0, 0x00, 0x10, 0x4a, 0x46, 0x49, 0x46, 0x00, 0x01, 0x01, 0x00, 0x00, 0x01,
+    0x00, 0x01, 0x00, 0x00, 0xff, 0xdb, 0x00, 0x43, 0x00, 0x03, 0x02, 0x02, 0x03, 0x02, 0x02, 0x03,
+    0x03, 0x03, 0x03, 0x04, 0x03, 0x03, 0x04, 0x05, 0x08, 0x05, 0x05, 0x04, 0x04, 0x05, 0x0a, 0x07,
+    0x07, 0x06, 0x08, 0x0c, 0x0a, 0x0c, 0x0c, 0x0b, 0x0a, 0x0b, 0x0b, 0x0d, 0x0e, 0x12, 0x10, 0x0d,
+    0x0e, 0x11, 0x0e, 0x0b, 0x0b, 0x10, 0x16, 0x10, 0x11, 0x13, 0x14, 0x15, 0x15, 0x15, 0x0c, 0x0f,
+    0x17, 0x18, 0x16, 0x14, 0x18, 0x12, 0x14, 0x15, 0x14, 0xff, 0xc0, 0x00, 0x0b, 0x08, 0x00, 0x14,
+    0x00, 0x28, 0x01, 0x01, 0x11, 0x00, 0xff, 0xc4, 0x00, 0x1f, 0x00, 0x00, 0x01, 0x05, 0x01, 0x01,
+    0x01, 0x01, 0x01, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x02, 0x03, 0x04,
+    0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0xff, 0xc4, 0x00, 0xb5, 0x10, 0x00, 0x02, 0x01, 0x03,
+    0x03, 0x02, 0x04, 0x03, 0x05, 0x05, 0x04, 0x04, 0x00, 0x00, 0x01, 0x7d, 0x01, 0x02, 0x03, 0x00,
+    0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07, 0x22, 0x71, 0x14, 0x32,
+    0x81, 0x91, 0xa1, 0x08, 0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0, 0x24, 0x33, 0x62, 0x72,
+    0x82, 0x09, 0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28, 0x29, 0x2a, 0x34, 0x35,
+    0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49, 0x4a, 0x53, 0x54, 0x55,
+    0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a, 0x73, 0x74, 0x75,
+    0x76, 0x77, 0x78, 0x79, 0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89, 0x8a, 0x92, 0x93, 0x94,
+    0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2,
+    0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9,
+    0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2, 0xe3, 0xe4, 0xe5, 0xe6,
+    0xe7, 0xe8, 0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa, 0xff, 0xda,
+    0x00, 0x08, 0x01, 0x01, 0x00, 0x00, 0x3f, 0x00, 0xf2, 0x48, 0x6d, 0xfd, 0xaa, 0xec, 0x36, 0xfe,
+    0xd5, 0x7a, 0x1b, 0x7f, 0x6a, 0xbb, 0x0d, 0xbf, 0xb5, 0x5e, 0x86, 0xdf, 0xda, 0xb9, 0xc8, 0x6d,
+    0xfd, 0xaa, 0xec, 0x36, 0xfe, 0xd5, 0x7a, 0x1b, 0x7f, 0x6a, 0xbb, 0x0d, 0xbf, 0xb5, 0x5e, 0x86,
+    0xdf, 0xda, 0xb9, 0x88, 0x50, 0x71, 0xc5, 0x33, 0x5d, 0xbd, 0x7d, 0x23, 0xc3, 0xfa, 0x9d, 0xf4,
+    0x2a, 0xad, 0x35, 0xad, 0xac, 0xb3, 0xa2, 0xb8, 0x25, 0x4b, 0x2a, 0x16, 0x19, 0xc6, 0x38, 0xc8,
+    0xaf, 0x9e, 0xc7, 0xc6, 0x6f, 0x18, 0xaf, 0x4d, 0x63, 0xff, 0x00, 0x25, 0x61, 0xff, 0x00, 0xe2,
+    0x2b, 0xe8, 0x9f, 0x85, 0xda, 0xe5, 0xd7, 0x8a, 0x3c, 0x0f, 0xa5, 0xea, 0x57, 0xc5, 0x1a, 0xee,
+    0x65, 0x75, 0x91, 0x91, 0x76, 0x86, 0x2b, 0x23, 0x26, 0x71, 0xea, 0x42, 0x82, 0x71, 0xc6, 0x49,
+    0xc0, 0x1d, 0x2b, 0xb5, 0x85, 0x05, 0x7f, 0xff, 0xd9,
+};
+// 8x8 ブロックごとの平均 (y)
+static const uint8_t gray_y[] = {
+     94,  99, 104, 109, 114,
+    101, 106, 111, 116, 121,
+    107, 106,  56, 107, 127,
+};
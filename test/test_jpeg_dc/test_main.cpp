@@ -0,0 +1,123 @@
+// JpegDcDecoder のホスト用テスト (pio test -e native -f test_jpeg_dc)
+// DC 係数だけで作った 1/8 の画像が、全部デコードした画像の 8x8 ブロックの平均と合うかを fixtures.h で確かめる
+#include <unity.h>
+#include <JpegDc.h>
+
+#include "fixtures.h"
+
+#include <chrono>
+#include <stdio.h>
+#include <string.h>
+
+// DC の量子化と、全部デコードしたときの丸め・飽和の分だけずれてよい
+static const int LUMA_TOLERANCE = 2;
+static const int CHROMA_TOLERANCE = 3;
+
+static JpegDcDecoder decoder;
+static uint8_t y[64], cb[64], cr[64];
+
+void setUp(void)
+{
+    memset(y, 0, sizeof(y));
+    memset(cb, 0, sizeof(cb));
+    memset(cr, 0, sizeof(cr));
+}
+
+void tearDown(void)
+{
+}
+
+static void assertWithin(int tolerance, const uint8_t *expected, const uint8_t *actual, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        char msg[32];
+        snprintf(msg, sizeof(msg), "block %u", (unsigned)i);
+        TEST_ASSERT_INT_WITHIN_MESSAGE(tolerance, expected[i], actual[i], msg);
+    }
+}
+
+void test_size_is_one_eighth(void)
+{
+    uint16_t w, h;
+    TEST_ASSERT_TRUE(decoder.getSize(color_jpg, sizeof(color_jpg), &w, &h));
+    TEST_ASSERT_EQUAL_UINT16(8, w);
+    TEST_ASSERT_EQUAL_UINT16(6, h);
+    TEST_ASSERT_EQUAL_UINT16(color_width, decoder.imageWidth());
+    TEST_ASSERT_EQUAL_UINT16(color_height, decoder.imageHeight());
+
+    // 高さ 20 は 8 で割り切れないので、下の欠けたブロックも1画素になる
+    TEST_ASSERT_TRUE(decoder.getSize(gray_jpg, sizeof(gray_jpg), &w, &h));
+    TEST_ASSERT_EQUAL_UINT16(5, w);
+    TEST_ASSERT_EQUAL_UINT16(3, h);
+}
+
+void test_color_block_means(void)
+{
+    TEST_ASSERT_TRUE(decoder.decode(color_jpg, sizeof(color_jpg), y, sizeof(color_y), cb, cr));
+    assertWithin(LUMA_TOLERANCE, color_y, y, sizeof(color_y));
+    assertWithin(CHROMA_TOLERANCE, color_cb, cb, sizeof(color_cb));
+    assertWithin(CHROMA_TOLERANCE, color_cr, cr, sizeof(color_cr));
+}
+
+void test_luma_only(void)
+{
+    TEST_ASSERT_TRUE(decoder.decode(color_jpg, sizeof(color_jpg), y, sizeof(color_y)));
+    assertWithin(LUMA_TOLERANCE, color_y, y, sizeof(color_y));
+}
+
+void test_grayscale_block_means(void)
+{
+    TEST_ASSERT_TRUE(decoder.decode(gray_jpg, sizeof(gray_jpg), y, sizeof(gray_y), cb, cr));
+    assertWithin(LUMA_TOLERANCE, gray_y, y, sizeof(gray_y));
+    for (size_t i = 0; i < sizeof(gray_y); i++)
+    {
+        TEST_ASSERT_EQUAL_UINT8(128, cb[i]);
+        TEST_ASSERT_EQUAL_UINT8(128, cr[i]);
+    }
+}
+
+void test_rejects_small_output(void)
+{
+    TEST_ASSERT_FALSE(decoder.decode(color_jpg, sizeof(color_jpg), y, sizeof(color_y) - 1));
+}
+
+void test_rejects_truncated_and_garbage(void)
+{
+    // どこで切れても読み越さずに失敗する (ヘッダの途中で切れたもの・スキャンの途中で切れたもの)
+    for (size_t len = 0; len < sizeof(color_jpg); len += 37)
+    {
+        decoder.decode(color_jpg, len, y, sizeof(y));
+    }
+    TEST_ASSERT_FALSE(decoder.decode(color_jpg, 100, y, sizeof(y)));
+    static const uint8_t garbage[] = {0x00, 0x11, 0x22, 0x33, 0xff, 0xd9};
+    TEST_ASSERT_FALSE(decoder.decode(garbage, sizeof(garbage), y, sizeof(y)));
+}
+
+// 処理時間の目安 (ホスト)
+void test_benchmark(void)
+{
+    const int runs = 5000;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < runs; i++)
+    {
+        decoder.decode(color_jpg, sizeof(color_jpg), y, sizeof(y), cb, cr);
+    }
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    char msg[80];
+    snprintf(msg, sizeof(msg), "%ux%u (%u bytes): %.2f us/frame", color_width, color_height, (unsigned)sizeof(color_jpg), (double)us / runs);
+    TEST_MESSAGE(msg);
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_size_is_one_eighth);
+    RUN_TEST(test_color_block_means);
+    RUN_TEST(test_luma_only);
+    RUN_TEST(test_grayscale_block_means);
+    RUN_TEST(test_rejects_small_output);
+    RUN_TEST(test_rejects_truncated_and_garbage);
+    RUN_TEST(test_benchmark);
+    return UNITY_END();
+}
@@ -0,0 +1,171 @@
+// JpegQualityController のホスト用テスト (pio test -e native -f test_jpeg_quality_controller)
+// カメラの代わりに「JPEG の大きさ = 場面の複雑さ x 画素数 / 品質」の模型を使い、
+// 場面の複雑さは水槽で撮った一日の推移を模したトレース (落ち着いた昼・給餌で濁る・夜) で与える
+#include <unity.h>
+#include <JpegQualityController.h>
+
+#include <stdio.h>
+
+static const int ladder[] = {0, 1, 2, 3, 4}; // VGA, SVGA, XGA, UXGA, QXGA の代わり
+static const uint32_t ladderPixels[] = {640 * 480, 800 * 600, 1024 * 768, 1600 * 1200, 2048 * 1536};
+static const size_t LADDER_LEN = sizeof(ladder) / sizeof(ladder[0]);
+static const uint32_t TARGET = 120000;
+
+// 場面の複雑さ (1.0 が平常)。区間ごとに (フレーム数, 複雑さ)
+struct Segment
+{
+    int frames;
+    float complexity;
+};
+static const Segment dayTrace[] = {
+    {120, 1.0f}, // 昼の落ち着いた水槽
+    {40, 1.8f},  // 給餌で泡と濁り
+    {80, 1.2f},  // 濁りが引いていく
+    {120, 0.5f}, // 夜 (暗くてノイズは少ない)
+    {60, 1.0f},
+};
+
+static uint32_t rng;
+
+static float noise()
+{
+    rng = rng * 1664525u + 1013904223u;
+    return 0.95f + (rng >> 16) % 1001 / 10000.0f; // ±5%
+}
+
+static size_t frameBytes(const JpegQualityController &c, float complexity)
+{
+    return (size_t)(complexity * ladderPixels[c.frameSize()] * 1.2f / c.quality() * noise());
+}
+
+static JpegQualityController controller;
+
+void setUp(void)
+{
+    rng = 1;
+    controller = JpegQualityController();
+    controller.begin(10, 4, ladder, LADDER_LEN); // setup() と同じ QXGA・品質 10 から
+    controller.setTargetBytes(TARGET);
+}
+
+void tearDown(void)
+{
+}
+
+// complexity の場面を frames 枚撮り、最後の tail 枚の平均の大きさと設定を変えた回数を返す
+static void run(float complexity, int frames, int tail, uint32_t *avgBytes, int *changes)
+{
+    uint64_t sum = 0;
+    *changes = 0;
+    for (int i = 0; i < frames; i++)
+    {
+        size_t bytes = frameBytes(controller, complexity);
+        bool changed = controller.observe(bytes, i * 5000);
+        if (i >= frames - tail)
+        {
+            sum += bytes;
+            *changes += changed;
+        }
+    }
+    *avgBytes = (uint32_t)(sum / tail);
+}
+
+void test_converges_from_setup_defaults(void)
+{
+    uint32_t avg;
+    int changes;
+    run(1.0f, 60, 30, &avg, &changes);
+    TEST_ASSERT_UINT32_WITHIN(TARGET / 5, TARGET, avg);
+    TEST_ASSERT_LESS_OR_EQUAL(1, changes); // 落ち着いたら揺れない
+    TEST_ASSERT_EQUAL_INT(4, controller.frameSize());
+}
+
+void test_no_change_inside_hysteresis_band(void)
+{
+    // 目標の ±15% に収まる大きさだけなら一度も変えない
+    for (int i = 0; i < 100; i++)
+    {
+        size_t bytes = TARGET * (90 + i % 21) / 100;
+        TEST_ASSERT_FALSE(controller.observe(bytes, i * 5000));
+    }
+    TEST_ASSERT_EQUAL_INT(10, controller.quality());
+}
+
+void test_steps_down_when_quality_is_exhausted(void)
+{
+    // 最低画質でも目標の倍を超える場面では解像度を下げる
+    uint32_t avg;
+    int changes;
+    run(6.0f, 120, 30, &avg, &changes);
+    TEST_ASSERT_LESS_THAN(4, controller.frameSize());
+    TEST_ASSERT_UINT32_WITHIN(TARGET / 4, TARGET, avg);
+}
+
+void test_steps_up_when_there_is_headroom(void)
+{
+    controller.begin(20, 0, ladder, LADDER_LEN); // VGA から
+    uint32_t avg;
+    int changes;
+    run(1.0f, 120, 30, &avg, &changes);
+    TEST_ASSERT_GREATER_THAN(0, controller.frameSize());
+    TEST_ASSERT_UINT32_WITHIN(TARGET / 4, TARGET, avg);
+}
+
+void test_tracks_day_trace(void)
+{
+    // 区間が変わってから settle 枚たったあとは目標の ±25% に入り、区間の終わりまで揺れない
+    const int settle = 20;
+    int frame = 0;
+    char msg[96];
+    for (size_t s = 0; s < sizeof(dayTrace) / sizeof(dayTrace[0]); s++)
+    {
+        uint64_t sum = 0;
+        int n = 0, changes = 0;
+        for (int i = 0; i < dayTrace[s].frames; i++, frame++)
+        {
+            size_t bytes = frameBytes(controller, dayTrace[s].complexity);
+            bool changed = controller.observe(bytes, frame * 5000);
+            if (i >= settle)
+            {
+                sum += bytes;
+                n++;
+                changes += changed;
+            }
+        }
+        uint32_t avg = (uint32_t)(sum / n);
+        snprintf(msg, sizeof(msg), "segment %u: avg %u, q %d, size %d, changes %d", (unsigned)s, (unsigned)avg, controller.quality(), controller.frameSize(),
+                 changes);
+        TEST_MESSAGE(msg);
+        TEST_ASSERT_UINT32_WITHIN_MESSAGE(TARGET / 4, TARGET, avg, msg);
+        TEST_ASSERT_LESS_OR_EQUAL_MESSAGE(3, changes, msg);
+    }
+}
+
+void test_hourly_budget_is_not_exceeded(void)
+{
+    // 5秒に1枚 (720 枚/時) で 1 時間 60 MB。途中で場面が重くなっても使い切らない
+    const uint32_t budget = 60u * 1000 * 1000, perHour = 720;
+    controller.setHourlyBudget(budget, perHour);
+    uint64_t spent = 0;
+    for (uint32_t i = 0; i < perHour; i++)
+    {
+        float complexity = i < perHour / 2 ? 1.0f : 1.6f;
+        size_t bytes = frameBytes(controller, complexity);
+        controller.observe(bytes, 1 + i * 5000);
+        spent += bytes;
+    }
+    TEST_ASSERT_LESS_OR_EQUAL_UINT32(budget + budget / 20, (uint32_t)spent);
+    TEST_ASSERT_GREATER_OR_EQUAL_UINT32(budget * 7 / 10, (uint32_t)spent); // 予算を余らせすぎない
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_converges_from_setup_defaults);
+    RUN_TEST(test_no_change_inside_hysteresis_band);
+    RUN_TEST(test_steps_down_when_quality_is_exhausted);
+    RUN_TEST(test_steps_up_when_there_is_headroom);
+    RUN_TEST(test_tracks_day_trace);
+    RUN_TEST(test_hourly_budget_is_not_exceeded);
+    return UNITY_END();
+}
@@ -0,0 +1,215 @@
+// PreTriggerBuffer のホスト用テスト (pio test -e native -f test_pre_trigger_buffer)
+// 領域の末尾で先頭に戻るときの追い出し方、クリップのフレームが上書きされず新しいほうが落ちること、
+// クリップの途中のトリガーで終わりが延びることを確かめ、push 1回の時間を測る
+#include <unity.h>
+#include <PreTriggerBuffer.h>
+
+#include <chrono>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+static PreTriggerBuffer *buffer;
+
+// i 番目のフレーム (中身で見分けられるように i で埋める)
+static std::vector<uint8_t> frame(uint32_t i, size_t len)
+{
+    std::vector<uint8_t> jpg(len, (uint8_t)i);
+    jpg[0] = 0xFF;
+    jpg[1] = 0xD8;
+    return jpg;
+}
+
+static bool push(uint32_t i, size_t len, uint32_t timestampMs)
+{
+    std::vector<uint8_t> jpg = frame(i, len);
+    return buffer->push(jpg.data(), jpg.size(), timestampMs);
+}
+
+static void checkFrame(const PreTriggerBuffer::Frame &f, uint32_t i, size_t len)
+{
+    std::vector<uint8_t> jpg = frame(i, len);
+    TEST_ASSERT_EQUAL_UINT32(len, f.len);
+    TEST_ASSERT_EQUAL_MEMORY(jpg.data(), buffer->frameData(f), len);
+}
+
+void setUp(void)
+{
+    buffer = new PreTriggerBuffer();
+    TEST_ASSERT_TRUE(buffer->begin(10000));
+}
+
+void tearDown(void)
+{
+    delete buffer;
+}
+
+void test_wraps_to_the_start_of_the_arena(void)
+{
+    // 3000 バイトのフレームは 3 つで 9000。4 つ目は末尾の 1000 バイトに入らないので先頭に戻り、いちばん古いものを捨てる
+    for (uint32_t i = 0; i < 3; i++)
+    {
+        TEST_ASSERT_TRUE(push(i, 3000, i * 100));
+    }
+    TEST_ASSERT_EQUAL_UINT32(3, buffer->frameCount());
+    TEST_ASSERT_EQUAL_UINT32(9000, buffer->liveBytes());
+
+    TEST_ASSERT_TRUE(push(3, 3000, 300));
+    TEST_ASSERT_EQUAL_UINT32(3, buffer->frameCount());
+    TEST_ASSERT_EQUAL_UINT32(9000, buffer->liveBytes());
+    TEST_ASSERT_EQUAL_UINT32(200, buffer->spanMs()); // 100〜300
+
+    // 先頭に戻ったあとは、書く範囲に重なるものだけを古い順に捨てる
+    TEST_ASSERT_TRUE(push(4, 5000, 400)); // 3000〜8000 (1 と 2 を捨てる)
+    TEST_ASSERT_EQUAL_UINT32(2, buffer->frameCount());
+    TEST_ASSERT_EQUAL_UINT32(8000, buffer->liveBytes());
+    TEST_ASSERT_TRUE(push(5, 1500, 500)); // 8000〜9500 (空いている)
+    TEST_ASSERT_EQUAL_UINT32(3, buffer->frameCount());
+    TEST_ASSERT_TRUE(push(6, 1000, 600)); // 末尾に入らないので 0〜1000 (3 を捨てる)
+    TEST_ASSERT_EQUAL_UINT32(3, buffer->frameCount());
+    TEST_ASSERT_EQUAL_UINT32(7500, buffer->liveBytes());
+    TEST_ASSERT_EQUAL_UINT32(0, buffer->dropped());
+
+    // 残っているのは 4, 5, 6 で、領域の中の位置が折り返していても時刻の順に読め、中身は壊れていない
+    buffer->trigger(600, 1000, 0);
+    TEST_ASSERT_EQUAL_UINT32(3, buffer->clipFrameCount());
+    checkFrame(buffer->clipFrame(0), 4, 5000);
+    checkFrame(buffer->clipFrame(1), 5, 1500);
+    checkFrame(buffer->clipFrame(2), 6, 1000);
+    TEST_ASSERT_EQUAL_UINT32(3000, buffer->clipFrame(0).offset);
+    TEST_ASSERT_EQUAL_UINT32(8000, buffer->clipFrame(1).offset);
+    TEST_ASSERT_EQUAL_UINT32(0, buffer->clipFrame(2).offset);
+    TEST_ASSERT_EQUAL_UINT32(7500, buffer->clipBytes());
+}
+
+void test_old_frames_age_out(void)
+{
+    buffer->maxAgeMs = 1000;
+    for (uint32_t i = 0; i < 20; i++)
+    {
+        TEST_ASSERT_TRUE(push(i, 100, i * 200));
+    }
+    // 3800 の時点で 2800 より古いものは捨てている
+    TEST_ASSERT_EQUAL_UINT32(6, buffer->frameCount());
+    TEST_ASSERT_EQUAL_UINT32(1000, buffer->spanMs());
+}
+
+void test_clip_frames_are_pinned(void)
+{
+    buffer->maxAgeMs = 100000;
+    for (uint32_t i = 0; i < 5; i++)
+    {
+        TEST_ASSERT_TRUE(push(i, 1000, i * 100));
+    }
+    // 200 から後ろ (2, 3, 4 と、これから来るもの) がクリップ
+    buffer->trigger(400, 200, 10000);
+    TEST_ASSERT_TRUE(buffer->clipPending());
+    TEST_ASSERT_EQUAL_UINT32(3, buffer->clipFrameCount());
+
+    // 先頭に戻ったとき 0, 1 は捨てられるが、2 に重なるところで止まり、新しいほうを落とす
+    for (uint32_t i = 5; i < 10; i++)
+    {
+        TEST_ASSERT_TRUE(push(i, 1000, i * 100));
+    }
+    TEST_ASSERT_EQUAL_UINT32(0, buffer->dropped());
+    TEST_ASSERT_TRUE(push(10, 1000, 1000));
+    TEST_ASSERT_TRUE(push(11, 1000, 1100));
+    TEST_ASSERT_EQUAL_UINT32(0, buffer->dropped());
+    TEST_ASSERT_FALSE(push(12, 1000, 1200));
+    TEST_ASSERT_EQUAL_UINT32(1, buffer->dropped());
+    TEST_ASSERT_FALSE(push(13, 1000, 1300));
+    TEST_ASSERT_EQUAL_UINT32(2, buffer->dropped());
+
+    // クリップは 2〜11 がそろったまま
+    TEST_ASSERT_EQUAL_UINT32(10, buffer->clipFrameCount());
+    for (uint32_t i = 0; i < 10; i++)
+    {
+        checkFrame(buffer->clipFrame(i), i + 2, 1000);
+        TEST_ASSERT_EQUAL_UINT32((i + 2) * 100, buffer->clipFrame(i).timestampMs);
+    }
+
+    // release() すればまた古いものから上書きする
+    buffer->release();
+    TEST_ASSERT_EQUAL_UINT32(0, buffer->clipFrameCount());
+    TEST_ASSERT_TRUE(push(14, 1000, 1400));
+    TEST_ASSERT_EQUAL_UINT32(2, buffer->dropped());
+}
+
+void test_frame_larger_than_arena_is_dropped(void)
+{
+    TEST_ASSERT_FALSE(push(0, 10001, 0));
+    TEST_ASSERT_FALSE(buffer->push(nullptr, 0, 0));
+    TEST_ASSERT_EQUAL_UINT32(2, buffer->dropped());
+    TEST_ASSERT_TRUE(push(1, 10000, 0)); // ちょうどなら入る
+    TEST_ASSERT_EQUAL_UINT32(1, buffer->frameCount());
+}
+
+void test_retrigger_extends_the_clip(void)
+{
+    buffer->maxAgeMs = 100000;
+    buffer->trigger(1000, 500, 1000);
+    TEST_ASSERT_FALSE(buffer->clipComplete(1999));
+    TEST_ASSERT_TRUE(buffer->clipComplete(2000));
+
+    // 途中のトリガーで終わりが 1500 + 1000 に延びる
+    buffer->trigger(1500, 500, 1000);
+    TEST_ASSERT_FALSE(buffer->clipComplete(2000));
+    TEST_ASSERT_TRUE(buffer->clipComplete(2500));
+    // 今の終わりより前に終わるトリガーでは縮まない
+    buffer->trigger(1600, 500, 100);
+    TEST_ASSERT_FALSE(buffer->clipComplete(2499));
+
+    // 延びたぶんのフレームもクリップに入る
+    for (uint32_t i = 0; i < 30; i++)
+    {
+        TEST_ASSERT_TRUE(push(i, 100, 1000 + i * 100));
+    }
+    TEST_ASSERT_EQUAL_UINT32(16, buffer->clipFrameCount()); // 1000〜2500
+    TEST_ASSERT_EQUAL_UINT32(2500, buffer->clipFrame(15).timestampMs);
+}
+
+void test_retrigger_across_millis_wrap(void)
+{
+    // millis() が 32 ビットで一周しても終わりの比較は狂わない
+    buffer->trigger(0xFFFFFF00u, 0, 0x80);
+    TEST_ASSERT_FALSE(buffer->clipComplete(0xFFFFFF7Fu));
+    buffer->trigger(0xFFFFFFF0u, 0, 0x100);
+    TEST_ASSERT_FALSE(buffer->clipComplete(0xFFFFFF80u));
+    TEST_ASSERT_FALSE(buffer->clipComplete(0xEFu));
+    TEST_ASSERT_TRUE(buffer->clipComplete(0xF0u));
+}
+
+// 640x480 の JPEG 程度 (20〜40KB) を 2MB の領域に詰め続けたときの push 1回の時間 (ホスト)
+void test_benchmark(void)
+{
+    PreTriggerBuffer big;
+    TEST_ASSERT_TRUE(big.begin(2 * 1024 * 1024));
+    big.maxAgeMs = 10000;
+    std::vector<uint8_t> jpg(40000, 0x55);
+    const uint32_t runs = 20000;
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < runs; i++)
+    {
+        big.push(jpg.data(), 20000 + (i * 7919) % 20000, i * 100);
+    }
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    TEST_ASSERT_EQUAL_UINT32(0, big.dropped());
+
+    char msg[96];
+    snprintf(msg, sizeof(msg), "push: %.2f us (%u frames, %u bytes live)", (double)ns / runs / 1000.0, (unsigned)big.frameCount(),
+             (unsigned)big.liveBytes());
+    TEST_MESSAGE(msg);
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_wraps_to_the_start_of_the_arena);
+    RUN_TEST(test_old_frames_age_out);
+    RUN_TEST(test_clip_frames_are_pinned);
+    RUN_TEST(test_frame_larger_than_arena_is_dropped);
+    RUN_TEST(test_retrigger_extends_the_clip);
+    RUN_TEST(test_retrigger_across_millis_wrap);
+    RUN_TEST(test_benchmark);
+    return UNITY_END();
+}
@@ -0,0 +1,226 @@
+// SpscRing と FrameDescriptor の参照カウントのホスト用テスト (pio test -e native -f test_spsc_ring)
+// 書き手と読み手を別のスレッドで回して、順番が入れ替わったり書きかけの要素を読んだりしないことと、1要素あたりの時間を確かめる
+#include <unity.h>
+#include <FrameRing.h>
+
+#include <chrono>
+#include <stdio.h>
+#include <thread>
+
+// 要素の中身が全部書かれてから見えているかを確かめるため、seq から決まる値で埋める
+struct Item
+{
+    uint32_t seq;
+    uint32_t words[7];
+};
+
+static void fill(Item &item, uint32_t seq)
+{
+    item.seq = seq;
+    for (uint32_t i = 0; i < 7; i++)
+    {
+        item.words[i] = seq * 2654435761u + i;
+    }
+}
+
+static bool intact(const Item &item)
+{
+    for (uint32_t i = 0; i < 7; i++)
+    {
+        if (item.words[i] != item.seq * 2654435761u + i)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+void setUp(void)
+{
+}
+
+void tearDown(void)
+{
+}
+
+void test_fill_and_drain_in_order(void)
+{
+    static SpscRing<uint32_t, 8> ring;
+    TEST_ASSERT_EQUAL_UINT32(8, ring.capacity());
+    TEST_ASSERT_TRUE(ring.empty());
+    uint32_t v = 0;
+    TEST_ASSERT_FALSE(ring.pop(v));
+    // 何周もして添字の折り返しを通る
+    for (uint32_t round = 0; round < 100; round++)
+    {
+        for (uint32_t i = 0; i < 8; i++)
+        {
+            TEST_ASSERT_TRUE(ring.push(round * 8 + i));
+        }
+        TEST_ASSERT_FALSE(ring.push(0xffffffff)); // いっぱい
+        TEST_ASSERT_EQUAL_UINT32(8, ring.size());
+        for (uint32_t i = 0; i < 8; i++)
+        {
+            TEST_ASSERT_TRUE(ring.pop(v));
+            TEST_ASSERT_EQUAL_UINT32(round * 8 + i, v);
+        }
+        TEST_ASSERT_FALSE(ring.pop(v));
+    }
+}
+
+void test_front_is_stable_until_pop_front(void)
+{
+    static SpscRing<Item, 4> ring;
+    Item item;
+    fill(item, 1);
+    TEST_ASSERT_TRUE(ring.push(item));
+    const Item *f = ring.front();
+    TEST_ASSERT_NOT_NULL(f);
+    // 先頭を見ている間に書き手が残りを埋めても、先頭の枠には書かない
+    for (uint32_t seq = 2; seq <= 4; seq++)
+    {
+        fill(item, seq);
+        TEST_ASSERT_TRUE(ring.push(item));
+    }
+    fill(item, 5);
+    TEST_ASSERT_FALSE(ring.push(item));
+    TEST_ASSERT_EQUAL_UINT32(1, f->seq);
+    TEST_ASSERT_TRUE(intact(*f));
+    ring.popFront();
+    TEST_ASSERT_TRUE(ring.push(item));
+    TEST_ASSERT_EQUAL_UINT32(2, ring.front()->seq);
+}
+
+// 書き手と読み手を別のスレッドで回す。読み手は seq が 1 ずつ増え、中身が揃っていることを確かめる
+template <size_t N>
+static void stress(uint32_t count, uint32_t *errors, double *nsPerItem)
+{
+    static SpscRing<Item, N> ring;
+    uint32_t bad = 0;
+    auto start = std::chrono::steady_clock::now();
+    std::thread producer([&] {
+        Item item;
+        for (uint32_t seq = 0; seq < count; seq++)
+        {
+            fill(item, seq);
+            while (!ring.push(item))
+            {
+                std::this_thread::yield();
+            }
+        }
+    });
+    std::thread consumer([&] {
+        Item item;
+        for (uint32_t expected = 0; expected < count; expected++)
+        {
+            while (!ring.pop(item))
+            {
+                std::this_thread::yield();
+            }
+            bad += item.seq != expected || !intact(item);
+        }
+    });
+    producer.join();
+    consumer.join();
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    *errors = bad;
+    *nsPerItem = (double)ns / count;
+}
+
+void test_two_thread_stress(void)
+{
+    uint32_t errors;
+    double ns;
+    // 小さいリングは満杯・空の境目を何度も通る
+    stress<2>(200000, &errors, &ns);
+    TEST_ASSERT_EQUAL_UINT32(0, errors);
+    stress<8>(500000, &errors, &ns);
+    TEST_ASSERT_EQUAL_UINT32(0, errors);
+}
+
+void test_shared_frame_is_released_once(void)
+{
+    // 3 つの受け手に配ったフレームは、最後に手放した1つだけが返す
+    const int rounds = 20000;
+    const int readers = 3;
+    std::atomic<uint32_t> refs{0};
+    std::atomic<int> returned{0};
+    static SpscRing<FrameDescriptor, 4> rings[readers];
+    std::thread consumers[readers];
+    for (int r = 0; r < readers; r++)
+    {
+        consumers[r] = std::thread([&, r] {
+            FrameDescriptor f;
+            for (int i = 0; i < rounds; i++)
+            {
+                while (!rings[r].pop(f))
+                {
+                    std::this_thread::yield();
+                }
+                if (frameRelease(f))
+                {
+                    returned++;
+                }
+            }
+        });
+    }
+    for (int i = 0; i < rounds; i++)
+    {
+        // 前のフレームが返るまで次を配らない (カメラのフレームバッファが1つのときと同じ)
+        while (returned.load() != i)
+        {
+            std::this_thread::yield();
+        }
+        FrameDescriptor f = {nullptr, 0, (uint32_t)i, 0, nullptr, &refs};
+        refs.store(0);
+        frameRetain(f, readers);
+        for (int r = 0; r < readers; r++)
+        {
+            while (!rings[r].push(f))
+            {
+                std::this_thread::yield();
+            }
+        }
+    }
+    for (int r = 0; r < readers; r++)
+    {
+        consumers[r].join();
+    }
+    TEST_ASSERT_EQUAL_INT(rounds, returned.load());
+    TEST_ASSERT_EQUAL_UINT32(0, refs.load());
+}
+
+// 1要素あたりの時間の目安 (ホスト)。同じスレッドでの push + pop と、2つのスレッドの間の受け渡し
+void test_benchmark(void)
+{
+    static SpscRing<FrameDescriptor, 8> ring;
+    FrameDescriptor f = {nullptr, 0, 0, 0, nullptr, nullptr};
+    const uint32_t runs = 10000000;
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < runs; i++)
+    {
+        f.seq = i;
+        ring.push(f);
+        ring.pop(f);
+    }
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    TEST_ASSERT_EQUAL_UINT32(runs - 1, f.seq);
+
+    uint32_t errors;
+    double crossNs;
+    stress<8>(1000000, &errors, &crossNs);
+    char msg[96];
+    snprintf(msg, sizeof(msg), "push + pop: %.2f ns, across threads: %.1f ns/item (%.1f M items/s)", (double)ns / runs, crossNs, 1000.0 / crossNs);
+    TEST_MESSAGE(msg);
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_fill_and_drain_in_order);
+    RUN_TEST(test_front_is_stable_until_pop_front);
+    RUN_TEST(test_two_thread_stress);
+    RUN_TEST(test_shared_frame_is_released_once);
+    RUN_TEST(test_benchmark);
+    return UNITY_END();
+}
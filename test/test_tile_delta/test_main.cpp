@@ -0,0 +1,213 @@
+// TileDelta のパケットのホスト用テスト (pio test -e native -f test_tile_delta)
+// writeTilePacketManifest で書いたヘッダとタイル表を readTilePacketHeader / readTilePacketEntries で読み戻し、
+// 途中で切れたパケットや壊れたパケットを受け付けないことを確かめる
+#include <unity.h>
+#include <TileDelta.h>
+
+#include <string.h>
+#include <vector>
+
+// ヘッダ + タイル表 + 本文 (タイルごとに i で埋めたもの) のパケットを作る
+static std::vector<uint8_t> buildPacket(const TilePacketHeader &header, const TileEntry *entries)
+{
+    std::vector<uint8_t> buf(tilePacketManifestSize(header.count));
+    writeTilePacketManifest(buf.data(), header, entries);
+    for (uint16_t i = 0; i < header.count; i++)
+    {
+        buf.insert(buf.end(), entries[i].length, (uint8_t)i);
+    }
+    return buf;
+}
+
+static TilePacketHeader deltaHeader(uint16_t count)
+{
+    TilePacketHeader h = {};
+    h.type = TILE_PACKET_DELTA;
+    h.tileSize = 64;
+    h.seq = 0x01020304;
+    h.keySeq = 0x01020300;
+    h.width = 800;
+    h.height = 600;
+    h.count = count;
+    return h;
+}
+
+void setUp(void)
+{
+}
+
+void tearDown(void)
+{
+}
+
+void test_delta_round_trip(void)
+{
+    const TileEntry entries[] = {{0, 0, 1200}, {12, 9, 0x345}, {3, 4, 1}};
+    TilePacketHeader h = deltaHeader(3);
+    std::vector<uint8_t> buf = buildPacket(h, entries);
+    TEST_ASSERT_EQUAL_UINT32(TILE_PACKET_HEADER_SIZE + 3 * TILE_ENTRY_SIZE + 1200 + 0x345 + 1, buf.size());
+    TEST_ASSERT_EQUAL_MEMORY("TDL1", buf.data(), 4);
+
+    TilePacketHeader r;
+    TEST_ASSERT_TRUE(readTilePacketHeader(buf.data(), buf.size(), &r));
+    TEST_ASSERT_EQUAL_UINT8(TILE_PACKET_DELTA, r.type);
+    TEST_ASSERT_EQUAL_UINT16(64, r.tileSize);
+    TEST_ASSERT_EQUAL_UINT32(0x01020304, r.seq);
+    TEST_ASSERT_EQUAL_UINT32(0x01020300, r.keySeq);
+    TEST_ASSERT_EQUAL_UINT16(800, r.width);
+    TEST_ASSERT_EQUAL_UINT16(600, r.height);
+    TEST_ASSERT_EQUAL_UINT16(3, r.count);
+
+    TileEntry out[3];
+    const uint8_t *payload = nullptr;
+    TEST_ASSERT_TRUE(readTilePacketEntries(buf.data(), buf.size(), r, out, &payload));
+    TEST_ASSERT_EQUAL_PTR(buf.data() + tilePacketManifestSize(3), payload);
+    for (int i = 0; i < 3; i++)
+    {
+        TEST_ASSERT_EQUAL_UINT16(entries[i].tileX, out[i].tileX);
+        TEST_ASSERT_EQUAL_UINT16(entries[i].tileY, out[i].tileY);
+        TEST_ASSERT_EQUAL_UINT32(entries[i].length, out[i].length);
+    }
+    // 本文はタイル表の順に並ぶ
+    TEST_ASSERT_EQUAL_UINT8(0, payload[1199]);
+    TEST_ASSERT_EQUAL_UINT8(1, payload[1200]);
+    TEST_ASSERT_EQUAL_UINT8(2, payload[1200 + 0x345]);
+}
+
+void test_keyframe_round_trip(void)
+{
+    TilePacketHeader h = deltaHeader(1);
+    h.type = TILE_PACKET_KEYFRAME;
+    h.keySeq = h.seq;
+    const TileEntry entry = {TILE_FULL_FRAME, TILE_FULL_FRAME, 5000};
+    std::vector<uint8_t> buf = buildPacket(h, &entry);
+
+    TilePacketHeader r;
+    TileEntry out;
+    const uint8_t *payload = nullptr;
+    TEST_ASSERT_TRUE(readTilePacketHeader(buf.data(), buf.size(), &r));
+    TEST_ASSERT_EQUAL_UINT8(TILE_PACKET_KEYFRAME, r.type);
+    TEST_ASSERT_TRUE(readTilePacketEntries(buf.data(), buf.size(), r, &out, &payload));
+    TEST_ASSERT_EQUAL_UINT16(TILE_FULL_FRAME, out.tileX);
+    TEST_ASSERT_EQUAL_UINT16(TILE_FULL_FRAME, out.tileY);
+    TEST_ASSERT_EQUAL_UINT32(5000, out.length);
+}
+
+void test_empty_delta_has_no_payload(void)
+{
+    // 何も変わらなかったフレームはタイル表が空のパケットになる
+    TilePacketHeader h = deltaHeader(0);
+    std::vector<uint8_t> buf = buildPacket(h, nullptr);
+    TEST_ASSERT_EQUAL_UINT32(TILE_PACKET_HEADER_SIZE, buf.size());
+    TilePacketHeader r;
+    const uint8_t *payload = nullptr;
+    TEST_ASSERT_TRUE(readTilePacketHeader(buf.data(), buf.size(), &r));
+    TEST_ASSERT_TRUE(readTilePacketEntries(buf.data(), buf.size(), r, nullptr, &payload));
+    TEST_ASSERT_EQUAL_PTR(buf.data() + buf.size(), payload);
+}
+
+void test_truncated_packets_are_rejected(void)
+{
+    // どこで切れても、ヘッダかタイル表か本文のどれかで受け付けない
+    const TileEntry entries[] = {{1, 1, 300}, {2, 1, 301}};
+    TilePacketHeader h = deltaHeader(2);
+    std::vector<uint8_t> buf = buildPacket(h, entries);
+    size_t manifest = tilePacketManifestSize(2);
+    for (size_t len = 0; len < buf.size(); len++)
+    {
+        TilePacketHeader r;
+        TileEntry out[2];
+        const uint8_t *payload = nullptr;
+        bool header = readTilePacketHeader(buf.data(), len, &r);
+        TEST_ASSERT_EQUAL(len >= manifest, header);
+        if (header)
+        {
+            TEST_ASSERT_FALSE(readTilePacketEntries(buf.data(), len, r, out, &payload));
+            TEST_ASSERT_NULL(payload);
+        }
+    }
+    // ヘッダだけ読めても、本当の長さより短いと言われたらタイル表も読まない
+    TilePacketHeader r;
+    TileEntry out[2];
+    const uint8_t *payload = nullptr;
+    TEST_ASSERT_TRUE(readTilePacketHeader(buf.data(), buf.size(), &r));
+    TEST_ASSERT_FALSE(readTilePacketEntries(buf.data(), manifest - 1, r, out, &payload));
+}
+
+void test_corrupt_headers_are_rejected(void)
+{
+    const TileEntry entries[] = {{0, 0, 10}};
+    TilePacketHeader h = deltaHeader(1);
+    TilePacketHeader r;
+
+    std::vector<uint8_t> buf = buildPacket(h, entries);
+    buf[3] = '2'; // 知らない版
+    TEST_ASSERT_FALSE(readTilePacketHeader(buf.data(), buf.size(), &r));
+
+    buf = buildPacket(h, entries);
+    buf[4] = 'X'; // 知らない種類
+    TEST_ASSERT_FALSE(readTilePacketHeader(buf.data(), buf.size(), &r));
+
+    // count が大きすぎてタイル表がパケットに入りきらない
+    buf = buildPacket(h, entries);
+    buf[20] = 0xFF;
+    buf[21] = 0xFF;
+    TEST_ASSERT_FALSE(readTilePacketHeader(buf.data(), buf.size(), &r));
+}
+
+void test_huge_lengths_do_not_wrap(void)
+{
+    // length の合計が 32 ビットを超えるタイル表は、折り返して短く見えても受け付けない
+    const TileEntry entries[] = {{0, 0, 0xFFFFFFF0u}, {1, 0, 0x20}};
+    TilePacketHeader h = deltaHeader(2);
+    std::vector<uint8_t> buf(tilePacketManifestSize(2) + 0x20);
+    writeTilePacketManifest(buf.data(), h, entries);
+    TilePacketHeader r;
+    TileEntry out[2];
+    const uint8_t *payload = nullptr;
+    TEST_ASSERT_TRUE(readTilePacketHeader(buf.data(), buf.size(), &r));
+    TEST_ASSERT_FALSE(readTilePacketEntries(buf.data(), buf.size(), r, out, &payload));
+}
+
+void test_change_map_marks_changed_tiles(void)
+{
+    // 1/8 の 80x60 を 8 画素のタイル (フル解像度で 64 px) に分けると 10x8
+    static TileChangeMap map;
+    TEST_ASSERT_TRUE(map.begin(80, 60, 8));
+    TEST_ASSERT_EQUAL_UINT16(10, map.tilesX());
+    TEST_ASSERT_EQUAL_UINT16(8, map.tilesY());
+    TEST_ASSERT_EQUAL_UINT16(64, map.tileSize());
+
+    static uint8_t thumb[80 * 60];
+    memset(thumb, 100, sizeof(thumb));
+    TEST_ASSERT_TRUE(map.keyframeDue()); // 基準がない
+    map.commitKeyframe(thumb);
+    TEST_ASSERT_EQUAL_UINT32(0, map.detect(thumb));
+
+    // タイル (3, 2) と、端で半分しかないタイル (9, 7) の中を変える
+    for (int y = 16; y < 20; y++)
+    {
+        thumb[y * 80 + 26] = 200;
+    }
+    thumb[59 * 80 + 79] = 0;
+    thumb[58 * 80 + 78] = 0;
+    TEST_ASSERT_EQUAL_UINT32(2, map.detect(thumb));
+    TEST_ASSERT_EQUAL_UINT16(2 * 10 + 3, map.changedTile(0));
+    TEST_ASSERT_EQUAL_UINT16(7 * 10 + 9, map.changedTile(1));
+    TEST_ASSERT_FALSE(map.keyframeDue());
+    map.commitDelta(thumb);
+    TEST_ASSERT_EQUAL_UINT32(0, map.detect(thumb));
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_delta_round_trip);
+    RUN_TEST(test_keyframe_round_trip);
+    RUN_TEST(test_empty_delta_has_no_payload);
+    RUN_TEST(test_truncated_packets_are_rejected);
+    RUN_TEST(test_corrupt_headers_are_rejected);
+    RUN_TEST(test_huge_lengths_do_not_wrap);
+    RUN_TEST(test_change_map_marks_changed_tiles);
+    return UNITY_END();
+}
@@ -0,0 +1,210 @@
+// UplinkEstimator のホスト用テスト (pio test -e native -f test_uplink_estimator)
+// 回線の帯域のトレース (良い → 弱くなる → 切れる → 戻る) の上で main.cpp の送り方を真似て、
+// 推定が回線に追いつくか・締め切りを守れるかを確かめる
+#include <unity.h>
+#include <UplinkEstimator.h>
+
+#include <stdio.h>
+
+static const uint32_t UPLOAD_DEADLINE = 8000;   // main.cpp の upload_deadline
+static const uint32_t HTTP_TIMEOUT = 5000;      // HTTPClient の既定のタイムアウト
+static const uint32_t TARGET_BYTES = 120000;    // main.cpp の jpeg_target_bytes
+static const uint32_t THUMB_BYTES = 5000;       // 1/8 のサムネイル
+static const uint32_t CAPTURE_INTERVAL = 15000; // 撮影の間隔 (ms)
+static const uint32_t DEFERRED_RETRY = 60000;   // main.cpp の deferred_retry_interval
+static const uint32_t SETTLE_CAPTURES = 5;      // 回線が変わってから推定が追いつくまでの撮影の数
+
+struct LinkSegment
+{
+    uint32_t minutes;
+    uint32_t bytesPerSecond; // 0 なら切れている
+    uint32_t latencyMs;
+};
+
+static const LinkSegment trace[] = {
+    {10, 120000, 250}, // 電波の良い昼
+    {10, 30000, 400},  // 混雑
+    {10, 8000, 800},   // 電波が弱い
+    {5, 0, 0},         // 圏外
+    {10, 60000, 300},  // 戻る
+};
+
+// 送った結果。圏外なら HTTP_TIMEOUT 待って失敗する。遅い回線でも届きはする (本文を送っている間はタイムアウトしない)
+static bool send(const LinkSegment &link, uint32_t bytes, uint32_t *elapsedMs)
+{
+    if (!link.bytesPerSecond)
+    {
+        *elapsedMs = HTTP_TIMEOUT;
+        return false;
+    }
+    *elapsedMs = link.latencyMs + (uint32_t)((uint64_t)bytes * 1000 / link.bytesPerSecond);
+    return true;
+}
+
+static void record(UplinkEstimator &uplink, bool ok, uint32_t bytes, uint32_t elapsedMs)
+{
+    if (ok)
+    {
+        uplink.recordUpload(bytes, elapsedMs);
+    }
+    else
+    {
+        uplink.recordFailure(elapsedMs);
+    }
+}
+
+void setUp(void)
+{
+}
+
+void tearDown(void)
+{
+}
+
+void test_large_uploads_converge_to_link_rate(void)
+{
+    UplinkEstimator uplink;
+    LinkSegment link = {0, 30000, 400};
+    for (int i = 0; i < 20; i++)
+    {
+        uint32_t ms;
+        bool ok = send(link, 100000, &ms);
+        record(uplink, ok, 100000, ms);
+    }
+    TEST_ASSERT_UINT32_WITHIN(30000 / 5, 30000, uplink.bytesPerSecond());
+}
+
+void test_failures_make_a_dead_link_poor(void)
+{
+    // 良い推定から始めても、送れない送信が続けば回線不良とみなす
+    UplinkEstimator uplink(120000, 250);
+    TEST_ASSERT_FALSE(uplink.linkPoor(UPLOAD_DEADLINE));
+    uplink.recordFailure(HTTP_TIMEOUT);
+    TEST_ASSERT_FALSE(uplink.linkPoor(UPLOAD_DEADLINE)); // 1回だけなら様子を見る
+    uplink.recordFailure(HTTP_TIMEOUT);
+    TEST_ASSERT_TRUE(uplink.linkPoor(UPLOAD_DEADLINE));
+    TEST_ASSERT_EQUAL_UINT32(2, uplink.failures());
+    TEST_ASSERT_LESS_THAN_UINT32(120000 / 3, uplink.bytesPerSecond());
+
+    // 続けて失敗しても下限より下がらない
+    for (int i = 0; i < 100; i++)
+    {
+        uplink.recordFailure(HTTP_TIMEOUT);
+    }
+    TEST_ASSERT_EQUAL_UINT32(uplink.minBytesPerSecond, uplink.bytesPerSecond());
+}
+
+void test_thumbnails_alone_recover_after_outage(void)
+{
+    // 切れたあとはサムネイルしか送らないが、それだけで回線が戻ったことがわかる
+    UplinkEstimator uplink;
+    for (int i = 0; i < 10; i++)
+    {
+        uplink.recordFailure(HTTP_TIMEOUT);
+    }
+    TEST_ASSERT_TRUE(uplink.linkPoor(UPLOAD_DEADLINE));
+    LinkSegment link = {0, 60000, 300};
+    int uploads = 0;
+    while (uplink.linkPoor(UPLOAD_DEADLINE) && uploads < 50)
+    {
+        uint32_t ms;
+        bool ok = send(link, THUMB_BYTES, &ms);
+        record(uplink, ok, THUMB_BYTES, ms);
+        uploads++;
+    }
+    TEST_ASSERT_LESS_OR_EQUAL(10, uploads);
+}
+
+// main.cpp の送り方: サムネイルは毎回送り、回線が良ければフル解像度 (目標は締め切り内に送れる量まで) も送る。
+// 悪ければフル解像度は後回しにして、DEFERRED_RETRY ごとに試しに送る
+void test_bandwidth_trace(void)
+{
+    UplinkEstimator uplink;
+    uint32_t now = 0;
+    uint32_t lastProbe = 0;
+    char msg[160];
+    for (size_t s = 0; s < sizeof(trace) / sizeof(trace[0]); s++)
+    {
+        const LinkSegment &link = trace[s];
+        uint32_t end = now + link.minutes * 60000;
+        uint32_t fulls = 0, probes = 0, late = 0, failed = 0, poor = 0, captures = 0;
+        uint32_t firstPoor = 0, firstGood = 0;
+        for (; now < end; now += CAPTURE_INTERVAL)
+        {
+            captures++;
+            uint32_t ms;
+            bool ok = send(link, THUMB_BYTES, &ms);
+            record(uplink, ok, THUMB_BYTES, ms);
+
+            bool isPoor = uplink.linkPoor(UPLOAD_DEADLINE);
+            poor += isPoor;
+            if (isPoor && !firstPoor)
+            {
+                firstPoor = captures;
+            }
+            if (!isPoor && !firstGood)
+            {
+                firstGood = captures;
+            }
+            uint32_t full = 0;
+            bool probe = false;
+            if (!isPoor)
+            {
+                uint32_t budget = uplink.byteBudget(UPLOAD_DEADLINE);
+                full = budget < TARGET_BYTES ? budget : TARGET_BYTES;
+            }
+            else if (now - lastProbe >= DEFERRED_RETRY)
+            {
+                lastProbe = now;
+                full = TARGET_BYTES / 2;
+                probe = true;
+            }
+            if (full)
+            {
+                ok = send(link, full, &ms);
+                record(uplink, ok, full, ms);
+                // 試しの送信は遅れて当然なので、回線が良いと判断して送った分だけ数える。
+                // 回線が変わった直後の数回は推定が追いついていないので、遅れ・失敗には数えない
+                probes += probe;
+                fulls += !probe;
+                if (!probe && captures > SETTLE_CAPTURES)
+                {
+                    failed += !ok;
+                    late += ok && ms > UPLOAD_DEADLINE + UPLOAD_DEADLINE / 10; // 締め切りちょうどを狙うので 1 割までは許す
+                }
+            }
+        }
+        snprintf(msg, sizeof(msg), "segment %u (%u B/s): estimate %u B/s, latency %u ms, poor %u/%u, fulls %u, probes %u, late %u, failed %u",
+                 (unsigned)s, (unsigned)link.bytesPerSecond, (unsigned)uplink.bytesPerSecond(), (unsigned)uplink.latencyMs(), (unsigned)poor,
+                 (unsigned)captures, (unsigned)fulls, (unsigned)probes, (unsigned)late, (unsigned)failed);
+        TEST_MESSAGE(msg);
+
+        if (!link.bytesPerSecond)
+        {
+            // 圏外に気づくのは最初の数回のうち。気づいたあとは試しの送信しかしない
+            TEST_ASSERT_TRUE_MESSAGE(firstPoor && firstPoor <= 2, msg);
+            TEST_ASSERT_LESS_OR_EQUAL_MESSAGE(2, fulls, msg);
+            TEST_ASSERT_LESS_OR_EQUAL_MESSAGE(link.minutes * 60000 / DEFERRED_RETRY + 1, probes, msg);
+        }
+        else
+        {
+            // 回線がある間は、送ったフル解像度の大半が締め切りに間に合う
+            TEST_ASSERT_LESS_OR_EQUAL_MESSAGE(fulls / 10 + 1, late + failed, msg);
+        }
+        if (link.bytesPerSecond >= 30000)
+        {
+            // 十分な回線なら (戻ったあとも) すぐフル解像度を送れるようになる
+            TEST_ASSERT_TRUE_MESSAGE(firstGood && firstGood <= 10, msg);
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_large_uploads_converge_to_link_rate);
+    RUN_TEST(test_failures_make_a_dead_link_poor);
+    RUN_TEST(test_thumbnails_alone_recover_after_outage);
+    RUN_TEST(test_bandwidth_trace);
+    return UNITY_END();
+}
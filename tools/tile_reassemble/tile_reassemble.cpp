@@ -0,0 +1,215 @@
+// タイル差分パケット (.tdl) からフレームを復元するホスト用ツール
+//
+// ビルド:
+//   g++ -O2 -I../../lib/TileDelta tile_reassemble.cpp ../../lib/TileDelta/TileDelta.cpp -ljpeg -o tile_reassemble
+// 使い方:
+//   ./tile_reassemble <出力ディレクトリ> deltas/00000000.tdl deltas/00000001.tdl ...
+// パケットは seq の順に渡す。途中が欠けた場合は次のキーフレームまで出力しない
+
+#include <TileDelta.h>
+
+#include <csetjmp>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <jpeglib.h>
+
+static bool readFile(const char *path, std::vector<uint8_t> &out)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f)
+    {
+        return false;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    out.resize(size > 0 ? size : 0);
+    bool ok = size > 0 && fread(out.data(), 1, out.size(), f) == out.size();
+    fclose(f);
+    return ok;
+}
+
+// libjpeg の既定の error_exit は exit() するので、壊れた1枚でツール全体が止まる。
+// 呼んだ関数へ longjmp で戻し、そこで cinfo を片付けて false を返す
+struct JpegError
+{
+    jpeg_error_mgr mgr;
+    jmp_buf jump;
+};
+
+static void jpegErrorExit(j_common_ptr cinfo)
+{
+    JpegError *err = (JpegError *)cinfo->err;
+    char msg[JMSG_LENGTH_MAX];
+    err->mgr.format_message(cinfo, msg);
+    fprintf(stderr, "libjpeg: %s\n", msg);
+    longjmp(err->jump, 1);
+}
+
+static jpeg_error_mgr *jpegErrors(JpegError &err)
+{
+    jpeg_std_error(&err.mgr);
+    err.mgr.error_exit = jpegErrorExit;
+    return &err.mgr;
+}
+
+// JPEG を RGB にデコードする
+static bool decodeJpeg(const uint8_t *data, size_t len, std::vector<uint8_t> &rgb, int &width, int &height)
+{
+    jpeg_decompress_struct cinfo;
+    JpegError jerr;
+    cinfo.err = jpegErrors(jerr);
+    if (setjmp(jerr.jump))
+    {
+        jpeg_destroy_decompress(&cinfo);
+        return false;
+    }
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, data, len);
+    if (jpeg_read_header(&cinfo, TRUE) != JPEG_HEADER_OK)
+    {
+        jpeg_destroy_decompress(&cinfo);
+        return false;
+    }
+    cinfo.out_color_space = JCS_RGB;
+    jpeg_start_decompress(&cinfo);
+    width = cinfo.output_width;
+    height = cinfo.output_height;
+    rgb.resize((size_t)width * height * 3);
+    while (cinfo.output_scanline < cinfo.output_height)
+    {
+        JSAMPROW row = &rgb[(size_t)cinfo.output_scanline * width * 3];
+        jpeg_read_scanlines(&cinfo, &row, 1);
+    }
+    jpeg_finish_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+    return true;
+}
+
+static bool writeJpeg(const std::string &path, const std::vector<uint8_t> &rgb, int width, int height)
+{
+    FILE *f = fopen(path.c_str(), "wb");
+    if (!f)
+    {
+        return false;
+    }
+    jpeg_compress_struct cinfo;
+    JpegError jerr;
+    cinfo.err = jpegErrors(jerr);
+    if (setjmp(jerr.jump))
+    {
+        jpeg_destroy_compress(&cinfo);
+        fclose(f);
+        return false;
+    }
+    jpeg_create_compress(&cinfo);
+    jpeg_stdio_dest(&cinfo, f);
+    cinfo.image_width = width;
+    cinfo.image_height = height;
+    cinfo.input_components = 3;
+    cinfo.in_color_space = JCS_RGB;
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, 90, TRUE);
+    jpeg_start_compress(&cinfo, TRUE);
+    while (cinfo.next_scanline < cinfo.image_height)
+    {
+        JSAMPROW row = const_cast<uint8_t *>(&rgb[(size_t)cinfo.next_scanline * width * 3]);
+        jpeg_write_scanlines(&cinfo, &row, 1);
+    }
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+    fclose(f);
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 3)
+    {
+        fprintf(stderr, "usage: %s <output dir> <packet.tdl>...\n", argv[0]);
+        return 2;
+    }
+    std::string outDir = argv[1];
+
+    std::vector<uint8_t> canvas;
+    int canvasW = 0;
+    int canvasH = 0;
+    bool valid = false;
+    uint32_t lastSeq = 0;
+    int written = 0;
+
+    for (int a = 2; a < argc; a++)
+    {
+        std::vector<uint8_t> buf;
+        TilePacketHeader header;
+        if (!readFile(argv[a], buf) || !readTilePacketHeader(buf.data(), buf.size(), &header))
+        {
+            fprintf(stderr, "%s: not a tile packet\n", argv[a]);
+            continue;
+        }
+        std::vector<TileEntry> entries(header.count);
+        const uint8_t *payload = nullptr;
+        if (!readTilePacketEntries(buf.data(), buf.size(), header, entries.data(), &payload))
+        {
+            fprintf(stderr, "%s: truncated packet\n", argv[a]);
+            continue;
+        }
+
+        if (header.type == TILE_PACKET_KEYFRAME)
+        {
+            if (header.count != 1 || !decodeJpeg(payload, entries[0].length, canvas, canvasW, canvasH))
+            {
+                fprintf(stderr, "%s: bad keyframe\n", argv[a]);
+                valid = false;
+                continue;
+            }
+            valid = true;
+        }
+        else
+        {
+            if (!valid || header.seq != lastSeq + 1)
+            {
+                fprintf(stderr, "%s: seq %u has no base frame, waiting for keyframe\n", argv[a], header.seq);
+                valid = false;
+                continue;
+            }
+            const uint8_t *p = payload;
+            for (const TileEntry &e : entries)
+            {
+                std::vector<uint8_t> tile;
+                int tw = 0;
+                int th = 0;
+                if (!decodeJpeg(p, e.length, tile, tw, th))
+                {
+                    fprintf(stderr, "%s: bad tile %u,%u\n", argv[a], e.tileX, e.tileY);
+                    p += e.length;
+                    continue;
+                }
+                int x0 = e.tileX * header.tileSize;
+                int y0 = e.tileY * header.tileSize;
+                for (int y = 0; y < th && y0 + y < canvasH; y++)
+                {
+                    int w = x0 + tw <= canvasW ? tw : canvasW - x0;
+                    if (w > 0)
+                    {
+                        memcpy(&canvas[((size_t)(y0 + y) * canvasW + x0) * 3], &tile[(size_t)y * tw * 3], (size_t)w * 3);
+                    }
+                }
+                p += e.length;
+            }
+        }
+        lastSeq = header.seq;
+
+        char name[32];
+        snprintf(name, sizeof(name), "/%08u.jpg", header.seq);
+        if (writeJpeg(outDir + name, canvas, canvasW, canvasH))
+        {
+            written++;
+        }
+    }
+    printf("%d frames written\n", written);
+    return 0;
+}